@@ -8,9 +8,14 @@
 
 #include "w25q_mem.h"
 
+extern QSPI_HandleTypeDef hqspi;	// CubeMX QSPI handle
+
+// chip on QSPI, size in Mbits
+static W25Q_Device flash = W25Q_DEVICE_QSPI(&hqspi, MEM_FLASH_SIZE);
+
 void main(void) {
-	W25Q_Init();		 // init the chip
-	W25Q_EraseSector(0); // erase 4K sector - required before recording
+	W25Q_Init(&flash);		 // init the chip
+	W25Q_EraseSector(&flash, 0); // erase 4K sector - required before recording
 
 	// make test data
 	u8_t byte = 0x65;
@@ -18,9 +23,9 @@ void main(void) {
 	u8_t in_page_shift = 0;
 	u8_t page_number = 0;
 	// write data
-	W25Q_ProgramByte(byte, in_page_shift, page_number);
+	W25Q_ProgramByte(&flash, byte, in_page_shift, page_number);
 	// read data
-	W25Q_ReadByte(&byte_read, in_page_shift, page_number);
+	W25Q_ReadByte(&flash, &byte_read, in_page_shift, page_number);
 
 	// make example structure
 	struct STR {
@@ -42,11 +47,11 @@ void main(void) {
 	u16_t len = sizeof(_str);	// length of structure in bytes
 
 	// program structure
-	W25Q_ProgramData((u8_t*) &_str, len, ++in_page_shift, page_number);
+	W25Q_ProgramData(&flash, (u8_t*) &_str, len, ++in_page_shift, page_number);
 	// read structure to another instance
-	W25Q_ReadData((u8_t*) &_str2, len, in_page_shift, page_number);
+	W25Q_ReadData(&flash, (u8_t*) &_str2, len, in_page_shift, page_number);
 
-	W25Q_Sleep();	// go to sleep
+	W25Q_Sleep(&flash);	// go to sleep
 
 	__NOP();	// place for breakpoint
 
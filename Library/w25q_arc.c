@@ -0,0 +1,207 @@
+/**
+ *******************************************
+ * @file    w25q_arc.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Read-only asset archive for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Layout: 32-byte header, directory of slots + probe - 1 entries,
+ * payloads aligned to 1 << alignShift. Entry of name is in probe
+ * window from slot hash & (slots - 1) (linear probing, no wrap),
+ * builder picks seed and slots to keep it there. So lookup is one
+ * read of the window, unused slots stay erased (0xFF)
+ */
+
+#include "w25q_arc.h"
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @addtogroup W25Q_Arc
+ * @{
+ */
+
+/// Archive header (as stored in chip)
+typedef struct{
+	u32_t magic;		///< W25Q_ARC_MAGIC
+	u8_t version;		///< W25Q_ARC_VERSION
+	u8_t alignShift;	///< Payload alignment, log2
+	u8_t probe;			///< Probe window
+	u8_t reserved;		///< 0xFF
+	u32_t count;		///< Entries
+	u32_t slots;		///< Hash slots (power of 2)
+	u32_t seed;			///< Hash seed
+	u32_t size;			///< Archive size
+	u32_t dirCrc;		///< CRC-32 of directory
+	u32_t crc;			///< CRC-32 of fields above
+}arc_hdr;
+
+/**
+ * @brief W25Q Archive mount
+ * Check header and directory CRC
+ *
+ * @param[out] arc Archive
+ * @param[in] dev Device (initialized)
+ * @param[in] base Archive address in chip
+ * @param[in] map Chip's address 0 in memory-mapped window (NULL - not used)
+ * @return W25Q_STATE enum (W25Q_CHIP_ERR - no valid archive)
+ */
+W25Q_STATE W25Q_ArcMount(W25Q_ARC *arc, W25Q_Device *dev, u32_t base, const u8_t *map) {
+	memset(arc, 0, sizeof(W25Q_ARC));
+	if (base >= dev->size || dev->size - base < W25Q_ARC_HDR_SIZE)
+		return W25Q_PARAM_ERR;
+
+	arc_hdr hdr;
+	W25Q_STATE state = W25Q_ReadRaw(dev, (u8_t*) &hdr, sizeof(arc_hdr), base);
+	if (state != W25Q_OK)
+		return state;
+	if (hdr.magic != W25Q_ARC_MAGIC || hdr.version != W25Q_ARC_VERSION
+			|| hdr.crc != W25Q_CalcCRC(0, &hdr, sizeof(arc_hdr) - 4))
+		return W25Q_CHIP_ERR;
+	// size and slots are checked before directory size can wrap
+	if (!hdr.slots || (hdr.slots & (hdr.slots - 1U)) || !hdr.probe
+			|| hdr.probe > W25Q_ARC_PROBE_MAX || hdr.size > dev->size - base
+			|| hdr.size < W25Q_ARC_HDR_SIZE || hdr.slots > hdr.size / sizeof(W25Q_ARC_ENTRY)
+			|| (hdr.slots + hdr.probe - 1U) * sizeof(W25Q_ARC_ENTRY) > hdr.size - W25Q_ARC_HDR_SIZE)
+		return W25Q_CHIP_ERR;
+
+	u32_t crc;
+	state = W25Q_Checksum(dev, &crc, (hdr.slots + hdr.probe - 1U) * sizeof(W25Q_ARC_ENTRY),
+			base + W25Q_ARC_HDR_SIZE, W25Q_CRC32);
+	if (state != W25Q_OK)
+		return state;
+	if (crc != hdr.dirCrc)
+		return W25Q_CHIP_ERR;
+
+	arc->dev = dev;
+	arc->base = base;
+	arc->map = map;
+	arc->count = hdr.count;
+	arc->slots = hdr.slots;
+	arc->seed = hdr.seed;
+	arc->size = hdr.size;
+	arc->probe = hdr.probe;
+	arc->alignShift = hdr.alignShift;
+	return W25Q_OK;
+}
+
+/**
+ * @brief W25Q Archive find
+ * Read probe window of name's slot and match both hashes
+ *
+ * @param[in] arc Archive
+ * @param[in] name Entry name (path with '/', as given to builder)
+ * @param[out] entry Directory entry
+ * @return W25Q_STATE enum (W25Q_PARAM_ERR - no such entry)
+ */
+W25Q_STATE W25Q_ArcFind(W25Q_ARC *arc, const char *name, W25Q_ARC_ENTRY *entry) {
+	if (!arc->dev)
+		return W25Q_PARAM_ERR;
+
+	W25Q_ARC_ENTRY win[W25Q_ARC_PROBE_MAX];
+	u32_t check;
+	u32_t hash = W25Q_ArcHash(name, arc->seed, &check);
+	u32_t slot = hash & (arc->slots - 1U);
+	W25Q_STATE state = W25Q_ReadRaw(arc->dev, (u8_t*) win, arc->probe * sizeof(W25Q_ARC_ENTRY),
+			arc->base + W25Q_ARC_HDR_SIZE + slot * sizeof(W25Q_ARC_ENTRY));
+	if (state != W25Q_OK)
+		return state;
+
+	for (u8_t i = 0; i < arc->probe; i++) {
+		if (win[i].hash == 0xFFFFFFFFU)
+			break;	// chain ends at empty slot
+		if (win[i].hash != hash || win[i].check != check)
+			continue;
+		if (win[i].offset > arc->size || win[i].size > arc->size - win[i].offset)
+			return W25Q_CHIP_ERR;
+		*entry = win[i];
+		return W25Q_OK;
+	}
+	return W25Q_PARAM_ERR;
+}
+
+/**
+ * @brief W25Q Archive read
+ * Read part of entry's payload by one long read
+ *
+ * @param[in] arc Archive
+ * @param[in] entry Directory entry
+ * @param[out] buf Pointer to data
+ * @param[in] offset Offset in payload
+ * @param[in] len Length of data
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_ArcRead(W25Q_ARC *arc, const W25Q_ARC_ENTRY *entry, u8_t *buf,
+		u32_t offset, u32_t len) {
+	if (!arc->dev || offset > entry->size || len > entry->size - offset)
+		return W25Q_PARAM_ERR;
+	if (!len)
+		return W25Q_OK;
+	return W25Q_ReadBulk(arc->dev, buf, len, arc->base + entry->offset + offset);
+}
+
+/**
+ * @brief W25Q Archive verify
+ * Compare CRC-32 of payload in chip with entry's one
+ *
+ * @param[in] arc Archive
+ * @param[in] entry Directory entry
+ * @return W25Q_STATE enum (W25Q_OK also if entry has no CRC)
+ */
+W25Q_STATE W25Q_ArcVerify(W25Q_ARC *arc, const W25Q_ARC_ENTRY *entry) {
+	if (!arc->dev)
+		return W25Q_PARAM_ERR;
+	if (!(entry->flags & W25Q_ARC_CRC) || !entry->size)
+		return W25Q_OK;
+
+	u32_t crc;
+	W25Q_STATE state = W25Q_Checksum(arc->dev, &crc, entry->size,
+			arc->base + entry->offset, W25Q_CRC32);
+	if (state != W25Q_OK)
+		return state;
+	return crc == entry->crc ? W25Q_OK : W25Q_VERIFY_ERR;
+}
+
+/**
+ * @brief W25Q Archive pointer
+ * Payload address in memory-mapped window, usable in place
+ *
+ * @note Valid only while QSPI is in memory-mapped mode
+ * @param[in] arc Archive
+ * @param[in] entry Directory entry
+ * @return Pointer to payload (NULL if archive is mounted without map)
+ */
+const void* W25Q_ArcPtr(W25Q_ARC *arc, const W25Q_ARC_ENTRY *entry) {
+	if (!arc->map)
+		return NULL;
+	return arc->map + arc->base + entry->offset;
+}
+
+/**
+ * @brief W25Q Archive hash
+ * FNV-1a from seed, second hash (djb2 from seed) tells names
+ * with same slot hash apart, builder makes pairs unique
+ *
+ * @param[in] name Entry name
+ * @param[in] seed Archive's seed
+ * @param[out] check Second hash
+ * @return Slot hash
+ */
+u32_t W25Q_ArcHash(const char *name, u32_t seed, u32_t *check) {
+	u32_t h = 2166136261U ^ seed;
+	u32_t c = 5381U ^ seed;
+	for (const u8_t *p = (const u8_t*) name; *p; p++) {
+		h = (h ^ *p) * 16777619U;
+		c = c * 33U + *p;
+	}
+	*check = c;
+	return h;
+}
+
+/// @}
+
+/// @}
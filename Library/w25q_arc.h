@@ -0,0 +1,98 @@
+/**
+ *******************************************
+ * @file    w25q_arc.h
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Read-only asset archive for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Archive is made by Tools/w25q_arc.py and programmed to chip:
+ * @code
+ * static W25Q_ARC arc;
+ * W25Q_ARC_ENTRY font;
+ * W25Q_ArcMount(&arc, &flash, 0x100000, NULL);	// (u8_t*) 0x90000000 if memory-mapped
+ * if (W25Q_ArcFind(&arc, "fonts/mono16.bin", &font) == W25Q_OK)
+ *     W25Q_ArcRead(&arc, &font, buf, 0, font.size);	// or W25Q_ArcPtr(&arc, &font)
+ * @endcode
+ */
+
+#ifndef W25Q_QSPI_W25Q_ARC_H_
+#define W25Q_QSPI_W25Q_ARC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "w25q_mem.h"
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @defgroup W25Q_Arc W25Q Asset Archive
+ * @brief Hashed directory, one read per lookup, aligned payloads
+ * @{
+ */
+
+#ifndef W25Q_ARC_PROBE_MAX
+/// Max probe window of archive directory (24 bytes of stack each)
+#define W25Q_ARC_PROBE_MAX 8U
+#endif
+
+#define W25Q_ARC_MAGIC 0x43524157U	///< Archive header magic ("WARC")
+#define W25Q_ARC_VERSION 1U			///< Archive format version
+#define W25Q_ARC_HDR_SIZE 32U		///< Header size, directory follows it
+#define W25Q_ARC_CRC 0x01U			///< Entry flag: crc is valid
+
+/**
+ * @struct W25Q_ARC_ENTRY
+ * @brief  W25Q Archive directory entry (as stored in chip)
+ * @{
+ */
+typedef struct{
+	u32_t hash;		///< Name hash (0xFFFFFFFF - empty slot)
+	u32_t check;	///< Second name hash
+	u32_t offset;	///< Payload offset from archive start (aligned)
+	u32_t size;		///< Payload size
+	u32_t crc;		///< CRC-32 of payload (if W25Q_ARC_CRC)
+	u32_t flags;	///< W25Q_ARC_CRC
+}W25Q_ARC_ENTRY;
+/** @} */
+
+/**
+ * @struct W25Q_ARC
+ * @brief  W25Q Mounted archive
+ * @{
+ */
+typedef struct{
+	W25Q_Device *dev;	///< Device
+	u32_t base;			///< Archive address in chip
+	const u8_t *map;	///< Chip's address 0 in memory-mapped window (NULL - not mapped)
+	u32_t count;		///< Entries
+	u32_t slots;		///< Hash slots (power of 2)
+	u32_t seed;			///< Hash seed
+	u32_t size;			///< Archive size
+	u8_t probe;			///< Probe window (directory has slots + probe - 1 entries)
+	u8_t alignShift;	///< Payload alignment, log2
+}W25Q_ARC;
+/** @} */
+
+W25Q_STATE W25Q_ArcMount(W25Q_ARC *arc, W25Q_Device *dev, u32_t base, const u8_t *map); ///< Check archive header and directory
+W25Q_STATE W25Q_ArcFind(W25Q_ARC *arc, const char *name, W25Q_ARC_ENTRY *entry);	///< Find entry by one directory read
+W25Q_STATE W25Q_ArcRead(W25Q_ARC *arc, const W25Q_ARC_ENTRY *entry, u8_t *buf,
+		u32_t offset, u32_t len);										///< Read part of payload
+W25Q_STATE W25Q_ArcVerify(W25Q_ARC *arc, const W25Q_ARC_ENTRY *entry);	///< Check payload CRC
+const void* W25Q_ArcPtr(W25Q_ARC *arc, const W25Q_ARC_ENTRY *entry);	///< Payload in memory-mapped window
+u32_t W25Q_ArcHash(const char *name, u32_t seed, u32_t *check);			///< Name hashes
+
+/// @}
+
+/// @}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* W25Q_QSPI_W25Q_ARC_H_ */
@@ -0,0 +1,379 @@
+/**
+ *******************************************
+ * @file    w25q_blk.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   512-byte block device for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Writes go to cache lines of whole erase sectors, so host's
+ * 512-byte writes of one sector cost one erase and program together.
+ * Line is written to chip when evicted (LRU), by W25Q_BlkSync or
+ * by W25Q_BlkTask after flushMs without writes. Flush compares new
+ * data with the chip: unchanged LBAs are dropped, erase is skipped
+ * if new data only clears bits, chip is read only for LBAs not in
+ * cache and only if erase is needed. Reads take cached LBAs from
+ * the line, others by one long read per run
+ */
+
+#include "w25q_blk.h"
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @addtogroup W25Q_Blk
+ * @{
+ */
+
+/**
+ * @addtogroup W25Q_Blk_Private
+ * @brief Private methods
+ * @{
+ */
+static inline u32_t line_addr(W25Q_BLK *blk, u32_t sector);		///< Chip address of area's sector
+static W25Q_BLK_LINE* line_find(W25Q_BLK *blk, u32_t sector);		///< Line of sector or NULL
+static W25Q_STATE line_get(W25Q_BLK *blk, W25Q_BLK_LINE **line, u32_t sector); ///< Line for writing sector
+static W25Q_STATE line_compare(W25Q_BLK *blk, W25Q_BLK_LINE *line, bool *erase); ///< Drop unchanged LBAs, check if erase is needed
+static W25Q_STATE line_flush(W25Q_BLK *blk, W25Q_BLK_LINE *line);	///< Write line to chip
+/// @}
+
+/**
+ * @brief W25Q Block device init
+ * Block device of 512-byte LBAs on chip's area
+ *
+ * @param[out] blk Block device
+ * @param[in] dev Device (initialized)
+ * @param[in] base First sector of area
+ * @param[in] sectors Sectors of area (0 - till the end of chip)
+ * @return W25Q_STATE enum (W25Q_PARAM_ERR - also sector over W25Q_BLK_SECTOR)
+ */
+W25Q_STATE W25Q_BlkInit(W25Q_BLK *blk, W25Q_Device *dev, u32_t base, u32_t sectors) {
+	u32_t total = dev->size / dev->sectorSize;
+	if (!sectors && base < total)
+		sectors = total - base;
+	if (dev->sectorSize > W25Q_BLK_SECTOR || dev->sectorSize / W25Q_BLK_SIZE > 32U
+			|| !sectors || base >= total || sectors > total - base)
+		return W25Q_PARAM_ERR;
+
+	memset(blk, 0, sizeof(W25Q_BLK));
+	blk->dev = dev;
+	blk->base = base;
+	blk->perLine = dev->sectorSize / W25Q_BLK_SIZE;
+	blk->count = sectors * blk->perLine;
+	blk->flushMs = W25Q_BLK_FLUSH_MS;
+	for (u8_t i = 0; i < W25Q_BLK_LINES; i++)
+		blk->line[i].sector = W25Q_BLK_NONE;
+	return W25Q_OK;
+}
+
+/**
+ * @brief W25Q Block device read
+ * Cached LBAs are copied from the line, runs of others
+ * are read by one long read
+ *
+ * @param[in] blk Block device
+ * @param[out] buf Pointer to data (count * 512 bytes)
+ * @param[in] lba First LBA
+ * @param[in] count LBAs count
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_BlkRead(W25Q_BLK *blk, u8_t *buf, u32_t lba, u32_t count) {
+	if (!count || lba >= blk->count || count > blk->count - lba)
+		return W25Q_PARAM_ERR;
+
+	W25Q_Device *dev = blk->dev;
+	W25Q_Lock(dev);
+	W25Q_STATE state = W25Q_OK;
+	u32_t run = 0;		// LBAs to read from chip before current one
+	for (u32_t i = 0; i <= count && state == W25Q_OK; i++) {
+		W25Q_BLK_LINE *line = NULL;
+		u32_t bit = 0;
+		if (i < count) {
+			line = line_find(blk, (lba + i) / blk->perLine);
+			bit = 1UL << ((lba + i) % blk->perLine);
+			if (line && !(line->valid & bit))
+				line = NULL;
+			if (!line) {
+				run++;
+				continue;
+			}
+		}
+		// run of uncached LBAs ends here
+		if (run) {
+			u32_t first = lba + i - run;
+			state = W25Q_ReadBulk(dev, buf + (i - run) * W25Q_BLK_SIZE, run * W25Q_BLK_SIZE,
+					line_addr(blk, first / blk->perLine) + first % blk->perLine * W25Q_BLK_SIZE);
+			run = 0;
+		}
+		if (line) {
+			memcpy(buf + i * W25Q_BLK_SIZE,
+					line->data + (lba + i) % blk->perLine * W25Q_BLK_SIZE, W25Q_BLK_SIZE);
+			line->lastUse = w25q_os_tick();
+			blk->hits++;
+		}
+	}
+	W25Q_Unlock(dev);
+	return state;
+}
+
+/**
+ * @brief W25Q Block device write
+ * Copy LBAs to cache lines, evicted lines are written to chip
+ *
+ * @param[in] blk Block device
+ * @param[in] buf Pointer to data (count * 512 bytes)
+ * @param[in] lba First LBA
+ * @param[in] count LBAs count
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_BlkWrite(W25Q_BLK *blk, const u8_t *buf, u32_t lba, u32_t count) {
+	if (!count || lba >= blk->count || count > blk->count - lba)
+		return W25Q_PARAM_ERR;
+
+	W25Q_Lock(blk->dev);
+	W25Q_STATE state = W25Q_OK;
+	while (count && state == W25Q_OK) {
+		W25Q_BLK_LINE *line;
+		state = line_get(blk, &line, lba / blk->perLine);
+		if (state != W25Q_OK)
+			break;
+
+		// LBAs of this line
+		u32_t idx = lba % blk->perLine;
+		u32_t n = blk->perLine - idx;
+		if (n > count)
+			n = count;
+		u32_t mask = (n == 32U ? 0xFFFFFFFFU : (1UL << n) - 1U) << idx;
+		for (u32_t m = line->dirty & mask; m; m &= m - 1U)
+			blk->hits++;	// rewritten before flush
+		memcpy(line->data + idx * W25Q_BLK_SIZE, buf, n * W25Q_BLK_SIZE);
+		line->valid |= mask;
+		line->dirty |= mask;
+		line->lastWrite = line->lastUse = w25q_os_tick();
+
+		buf += n * W25Q_BLK_SIZE;
+		lba += n;
+		count -= n;
+	}
+	W25Q_Unlock(blk->dev);
+	return state;
+}
+
+/**
+ * @brief W25Q Block device sync
+ * Write all dirty lines to chip (FatFs CTRL_SYNC, MSC eject)
+ *
+ * @param[in] blk Block device
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_BlkSync(W25Q_BLK *blk) {
+	W25Q_Lock(blk->dev);
+	W25Q_STATE state = W25Q_OK;
+	for (u8_t i = 0; i < W25Q_BLK_LINES && state == W25Q_OK; i++)
+		state = line_flush(blk, &blk->line[i]);
+	W25Q_Unlock(blk->dev);
+	return state;
+}
+
+/**
+ * @brief W25Q Block device task
+ * Write lines without writes for flushMs
+ *
+ * @note Call it periodically (idle hook, timer task, main loop).
+ * Bare-metal: from the same context as read/write calls
+ * @param[in] blk Block device
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_BlkTask(W25Q_BLK *blk) {
+	W25Q_STATE state = W25Q_OK;
+	W25Q_Lock(blk->dev);
+	for (u8_t i = 0; i < W25Q_BLK_LINES && state == W25Q_OK; i++) {
+		W25Q_BLK_LINE *line = &blk->line[i];
+		if (line->dirty && w25q_os_tick() - line->lastWrite >= blk->flushMs)
+			state = line_flush(blk, line);
+	}
+	W25Q_Unlock(blk->dev);
+	return state;
+}
+
+/// @}
+
+/**
+ * @addtogroup W25Q_Blk_Private
+ * @{
+ */
+
+/**
+ * @brief Line address
+ *
+ * @param[in] blk Block device
+ * @param[in] sector Sector of area
+ * @return Byte address in chip
+ */
+u32_t line_addr(W25Q_BLK *blk, u32_t sector) {
+	return (blk->base + sector) * blk->dev->sectorSize;
+}
+
+/**
+ * @brief Line find
+ *
+ * @param[in] blk Block device
+ * @param[in] sector Sector of area
+ * @return Line of sector or NULL if not cached
+ */
+W25Q_BLK_LINE* line_find(W25Q_BLK *blk, u32_t sector) {
+	for (u8_t i = 0; i < W25Q_BLK_LINES; i++)
+		if (blk->line[i].sector == sector)
+			return &blk->line[i];
+	return NULL;
+}
+
+/**
+ * @brief Line get
+ * Line of sector, free one or least recently used one (written to chip)
+ *
+ * @param[in] blk Block device
+ * @param[out] line Line for sector
+ * @param[in] sector Sector of area
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE line_get(W25Q_BLK *blk, W25Q_BLK_LINE **line, u32_t sector) {
+	*line = line_find(blk, sector);
+	if (*line)
+		return W25Q_OK;
+
+	u32_t now = w25q_os_tick();
+	W25Q_BLK_LINE *lru = &blk->line[0];
+	for (u8_t i = 0; i < W25Q_BLK_LINES; i++) {
+		W25Q_BLK_LINE *l = &blk->line[i];
+		if (l->sector == W25Q_BLK_NONE) {
+			lru = l;
+			break;
+		}
+		if (now - l->lastUse > now - lru->lastUse)
+			lru = l;
+	}
+
+	W25Q_STATE state = line_flush(blk, lru);
+	if (state != W25Q_OK)
+		return state;
+	lru->sector = sector;
+	lru->valid = 0;
+	*line = lru;
+	return W25Q_OK;
+}
+
+/**
+ * @brief Line compare
+ * Compare dirty LBAs with chip by pages: equal ones stop being
+ * dirty, erase is needed if any bit goes 0->1
+ *
+ * @param[in] blk Block device
+ * @param[in,out] line Line (dirty mask is updated)
+ * @param[out] erase 1-sector must be erased/0-program is enough
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE line_compare(W25Q_BLK *blk, W25Q_BLK_LINE *line, bool *erase) {
+	u32_t old[MEM_PAGE_SIZE / 4U];
+	u32_t addr = line_addr(blk, line->sector);
+	*erase = 0;
+
+	for (u8_t i = 0; i < blk->perLine; i++) {
+		if (!(line->dirty & (1UL << i)))
+			continue;
+		bool same = 1;
+		for (u32_t off = i * W25Q_BLK_SIZE; off < (i + 1U) * W25Q_BLK_SIZE; off += sizeof(old)) {
+			W25Q_STATE state = W25Q_ReadRaw(blk->dev, (u8_t*) old, sizeof(old), addr + off);
+			if (state != W25Q_OK)
+				return state;
+			const u8_t *cur = line->data + off;
+			for (u32_t w = 0; w < sizeof(old) / 4U; w++) {
+				u32_t n;
+				memcpy(&n, cur + w * 4U, 4);
+				if (n != old[w])
+					same = 0;
+				if (n & ~old[w]) {
+					*erase = 1;
+					return W25Q_OK;
+				}
+			}
+		}
+		if (same)
+			line->dirty &= ~(1UL << i);
+	}
+	return W25Q_OK;
+}
+
+/**
+ * @brief Line flush
+ * Write dirty LBAs of line to chip, erase sector only if needed
+ *
+ * @note Line stays in cache with valid data
+ * @param[in] blk Block device
+ * @param[in,out] line Line
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE line_flush(W25Q_BLK *blk, W25Q_BLK_LINE *line) {
+	if (line->sector == W25Q_BLK_NONE || !line->dirty)
+		return W25Q_OK;
+
+	W25Q_Device *dev = blk->dev;
+	u32_t addr = line_addr(blk, line->sector);
+	u32_t all = blk->perLine == 32U ? 0xFFFFFFFFU : (1UL << blk->perLine) - 1U;
+	bool erase;
+	W25Q_STATE state = line_compare(blk, line, &erase);
+	if (state != W25Q_OK)
+		return state;
+
+	if (erase) {
+		// rest of sector is needed in line before erase
+		for (u8_t i = 0; i < blk->perLine && state == W25Q_OK; i++) {
+			if (line->valid & (1UL << i))
+				continue;
+			u8_t n = 1;
+			while (i + n < blk->perLine && !(line->valid & (1UL << (i + n))))
+				n++;
+			state = W25Q_ReadBulk(dev, line->data + i * W25Q_BLK_SIZE,
+					n * W25Q_BLK_SIZE, addr + i * W25Q_BLK_SIZE);
+			i += n - 1U;
+		}
+		if (state != W25Q_OK)
+			return state;
+		line->valid = all;
+
+		state = W25Q_EraseSector(dev, addr / dev->sectorSize);
+		if (state == W25Q_OK)
+			state = W25Q_ProgramBulk(dev, line->data, dev->sectorSize, addr, 0);
+		if (state != W25Q_OK)
+			return state;
+		blk->erases++;
+	} else {
+		// only 1->0 bits: program changed runs over old data
+		for (u8_t i = 0; i < blk->perLine && state == W25Q_OK; i++) {
+			if (!(line->dirty & (1UL << i)))
+				continue;
+			u8_t n = 1;
+			while (i + n < blk->perLine && (line->dirty & (1UL << (i + n))))
+				n++;
+			state = W25Q_ProgramBulk(dev, line->data + i * W25Q_BLK_SIZE,
+					n * W25Q_BLK_SIZE, addr + i * W25Q_BLK_SIZE, 0);
+			i += n - 1U;
+		}
+		if (state != W25Q_OK)
+			return state;
+		blk->erasesSkipped++;
+	}
+
+	line->dirty = 0;
+	blk->flushes++;
+	return W25Q_OK;
+}
+
+/// @}
+
+/// @}
+
+/// @}
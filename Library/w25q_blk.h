@@ -0,0 +1,104 @@
+/**
+ *******************************************
+ * @file    w25q_blk.h
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   512-byte block device for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note For FatFs (diskio.c) and USB MSC (usbd_storage_if.c):
+ * @code
+ * static W25Q_BLK blk;
+ * W25Q_BlkInit(&blk, &flash, 0, 0);			// whole chip
+ * // disk_read/STORAGE_Read_FS:  W25Q_BlkRead(&blk, buf, lba, count)
+ * // disk_write/STORAGE_Write_FS: W25Q_BlkWrite(&blk, buf, lba, count)
+ * // CTRL_SYNC: W25Q_BlkSync(&blk), timer or idle task: W25Q_BlkTask(&blk)
+ * @endcode
+ * Dual-flash (8K sectors) needs -DW25Q_BLK_SECTOR=8192
+ */
+
+#ifndef W25Q_QSPI_W25Q_BLK_H_
+#define W25Q_QSPI_W25Q_BLK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "w25q_mem.h"
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @defgroup W25Q_Blk W25Q Block Device
+ * @brief 512-byte LBAs with write-back cache of erase sectors
+ * @{
+ */
+
+#ifndef W25Q_BLK_LINES
+/// Cache lines, one erase sector each (W25Q_BLK_SECTOR bytes of RAM each)
+#define W25Q_BLK_LINES 2U
+#endif
+#ifndef W25Q_BLK_SECTOR
+/// Cache line size: chip's erase sector, set 8192 for dual-flash (default fits 4K only)
+#define W25Q_BLK_SECTOR (MEM_SECTOR_SIZE * 1024U)
+#endif
+#ifndef W25Q_BLK_FLUSH_MS
+/// Dirty line is written by W25Q_BlkTask after this time without writes, ms
+#define W25Q_BLK_FLUSH_MS 500U
+#endif
+
+#define W25Q_BLK_SIZE 512U		///< Logical block size
+#define W25Q_BLK_NONE 0xFFFFFFFFU	///< Free cache line
+
+/**
+ * @struct W25Q_BLK_LINE
+ * @brief  W25Q Block device cache line
+ * @{
+ */
+typedef struct{
+	u32_t sector;		///< Sector of area in line (W25Q_BLK_NONE - free)
+	u32_t valid;		///< LBAs of line with data in buffer (bit mask)
+	u32_t dirty;		///< LBAs of line not written to chip (bit mask)
+	u32_t lastWrite;	///< Tick of last write to line
+	u32_t lastUse;		///< Tick of last access (eviction)
+	u8_t data[W25Q_BLK_SECTOR];	///< Sector data
+}W25Q_BLK_LINE;
+/** @} */
+
+/**
+ * @struct W25Q_BLK
+ * @brief  W25Q Block device
+ * @{
+ */
+typedef struct{
+	W25Q_Device *dev;		///< Device
+	u32_t base;				///< First sector of area
+	u32_t count;			///< LBAs in area
+	u8_t perLine;			///< LBAs per erase sector
+	u32_t flushMs;			///< Write-back delay (W25Q_BLK_FLUSH_MS)
+	u32_t hits;				///< LBAs read from cache or rewritten before flush
+	u32_t flushes;			///< Lines written to chip
+	u32_t erases;			///< Sector erases done by flushes
+	u32_t erasesSkipped;	///< Flushes without erase (only 1->0 bits or no change)
+	W25Q_BLK_LINE line[W25Q_BLK_LINES];	///< Cache lines
+}W25Q_BLK;
+/** @} */
+
+W25Q_STATE W25Q_BlkInit(W25Q_BLK *blk, W25Q_Device *dev, u32_t base, u32_t sectors); ///< Block device on chip's area
+W25Q_STATE W25Q_BlkRead(W25Q_BLK *blk, u8_t *buf, u32_t lba, u32_t count);			///< Read LBAs
+W25Q_STATE W25Q_BlkWrite(W25Q_BLK *blk, const u8_t *buf, u32_t lba, u32_t count);	///< Write LBAs to cache
+W25Q_STATE W25Q_BlkSync(W25Q_BLK *blk);		///< Write all dirty lines to chip
+W25Q_STATE W25Q_BlkTask(W25Q_BLK *blk);		///< Write lines idle for flushMs (call periodically)
+
+/// @}
+
+/// @}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* W25Q_QSPI_W25Q_BLK_H_ */
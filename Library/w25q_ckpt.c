@@ -0,0 +1,170 @@
+/**
+ *******************************************
+ * @file    w25q_ckpt.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Metadata checkpoints for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Slot: page 0 - header, next pages - state. Header is programmed
+ * after the state, so slot with valid header has full state.
+ * Save goes to older slot, newest one stays till the end.
+ * Mount reads two headers and one state - flat boot time
+ */
+
+#include "w25q_ckpt.h"
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @addtogroup W25Q_Ckpt
+ * @{
+ */
+
+/// Slot header
+typedef struct{
+	u32_t magic;		///< W25Q_CKPT_MAGIC
+	u32_t seq;			///< Sequence of checkpoint
+	u32_t len;			///< State length
+	u32_t logPos;		///< Log position at checkpoint
+	u32_t stateCrc;		///< CRC-32 of state
+	u32_t crc;			///< CRC-32 of fields above
+}ckpt_hdr;
+
+/**
+ * @brief Slot address
+ *
+ * @param[in] ck Region state
+ * @param[in] slot Slot
+ * @return Byte address in chip
+ */
+static inline u32_t slot_addr(W25Q_CKPT *ck, u8_t slot) {
+	return (ck->cfg.base + slot * ck->cfg.slotSectors) * ck->dev->sectorSize;
+}
+
+/**
+ * @brief W25Q Checkpoint mount
+ * Load state of newest valid checkpoint, older slot is the fallback
+ *
+ * @param[out] ck Region state
+ * @param[in] dev Device (initialized)
+ * @param[in] cfg Region
+ * @param[out] state Buffer for state
+ * @param[in,out] len Buffer size / state length
+ * @param[out] logPos Log position to replay from
+ * @return W25Q_STATE enum (W25Q_CHIP_ERR - no checkpoint, rebuild state)
+ */
+W25Q_STATE W25Q_CkptMount(W25Q_CKPT *ck, W25Q_Device *dev, const W25Q_CKPT_CFG *cfg,
+		void *state, u32_t *len, u32_t *logPos) {
+	memset(ck, 0, sizeof(W25Q_CKPT));
+	ck->dev = dev;
+	ck->cfg = *cfg;
+	if (!cfg->slotSectors
+			|| cfg->base + 2U * cfg->slotSectors > dev->size / dev->sectorSize)
+		return W25Q_PARAM_ERR;
+
+	ckpt_hdr hdr[2];
+	bool valid[2];
+	for (u8_t s = 0; s < 2; s++) {
+		W25Q_STATE st = W25Q_ReadRaw(dev, (u8_t*) &hdr[s], sizeof(ckpt_hdr), slot_addr(ck, s));
+		if (st != W25Q_OK)
+			return st;
+		valid[s] = hdr[s].magic == W25Q_CKPT_MAGIC
+				&& hdr[s].crc == W25Q_CalcCRC(0, &hdr[s], sizeof(ckpt_hdr) - 4)
+				&& hdr[s].len <= W25Q_CkptCapacity(ck);
+	}
+
+	// newer first, older if newer's state is damaged
+	u8_t first = valid[1] && (!valid[0] || hdr[1].seq > hdr[0].seq);
+	for (u8_t i = 0; i < 2; i++) {
+		u8_t s = first ^ i;
+		if (!valid[s])
+			continue;
+		if (hdr[s].len > *len)
+			return W25Q_PARAM_ERR;
+		if (hdr[s].len) {
+			W25Q_STATE st = W25Q_ReadBulk(dev, state, hdr[s].len,
+					slot_addr(ck, s) + dev->pageSize);
+			if (st != W25Q_OK)
+				return st;
+		}
+		if (W25Q_CalcCRC(0, state, hdr[s].len) != hdr[s].stateCrc)
+			continue;
+
+		ck->seq = hdr[s].seq;
+		ck->slot = s;
+		ck->logPos = hdr[s].logPos;
+		*len = hdr[s].len;
+		*logPos = hdr[s].logPos;
+		return W25Q_OK;
+	}
+	return W25Q_CHIP_ERR;
+}
+
+/**
+ * @brief W25Q Checkpoint save
+ * Erase older slot, program state, then header
+ *
+ * @note Power loss at any point leaves previous checkpoint
+ * @param[in,out] ck Region state
+ * @param[in] state State
+ * @param[in] len State length
+ * @param[in] logPos Log position: records after it aren't in state
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_CkptSave(W25Q_CKPT *ck, const void *state, u32_t len, u32_t logPos) {
+	W25Q_Device *dev = ck->dev;
+	if (!dev || len > W25Q_CkptCapacity(ck))
+		return W25Q_PARAM_ERR;
+
+	u8_t slot = ck->seq ? ck->slot ^ 1 : 0;
+	W25Q_STATE st = W25Q_OK;
+	u32_t first = ck->cfg.base + slot * ck->cfg.slotSectors;
+	for (u16_t i = 0; i < ck->cfg.slotSectors && st == W25Q_OK; i++)
+		st = W25Q_EraseSector(dev, first + i);
+	if (st == W25Q_OK && len)
+		st = W25Q_ProgramBulk(dev, (u8_t*) state, len, slot_addr(ck, slot) + dev->pageSize, 0);
+	if (st != W25Q_OK)
+		return st;
+
+	ckpt_hdr hdr = { W25Q_CKPT_MAGIC, ck->seq + 1, len, logPos,
+			W25Q_CalcCRC(0, state, len), 0 };
+	hdr.crc = W25Q_CalcCRC(0, &hdr, sizeof(hdr) - 4);
+	st = W25Q_ProgramRaw(dev, (u8_t*) &hdr, sizeof(hdr), slot_addr(ck, slot));
+	if (st != W25Q_OK)
+		return st;
+
+	ck->seq++;
+	ck->slot = slot;
+	ck->logPos = logPos;
+	return W25Q_OK;
+}
+
+/**
+ * @brief W25Q Checkpoint due
+ * Log has grown by interval since newest checkpoint
+ *
+ * @param[in] ck Region state
+ * @param[in] logPos Current log position
+ * @return 1-save checkpoint/0-not yet
+ */
+bool W25Q_CkptDue(W25Q_CKPT *ck, u32_t logPos) {
+	return !ck->seq || logPos - ck->logPos >= ck->cfg.interval;
+}
+
+/**
+ * @brief W25Q Checkpoint capacity
+ *
+ * @param[in] ck Region state
+ * @return Max state length in bytes
+ */
+u32_t W25Q_CkptCapacity(W25Q_CKPT *ck) {
+	return ck->cfg.slotSectors * ck->dev->sectorSize - ck->dev->pageSize;
+}
+
+/// @}
+
+/// @}
@@ -0,0 +1,77 @@
+/**
+ *******************************************
+ * @file    w25q_ckpt.h
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Metadata checkpoints for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Structure over the driver (KV, log, FTL) saves its RAM index
+ * with position of its log from time to time. Boot loads newest
+ * checkpoint by one read and replays only log written after it
+ */
+
+#ifndef W25Q_QSPI_W25Q_CKPT_H_
+#define W25Q_QSPI_W25Q_CKPT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "w25q_mem.h"
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @defgroup W25Q_Ckpt W25Q Checkpoints
+ * @brief Ping-pong snapshots of RAM state with log position
+ * @{
+ */
+
+#define W25Q_CKPT_MAGIC 0x50435457U	///< Checkpoint header magic ("WTCP")
+
+/**
+ * @struct W25Q_CKPT_CFG
+ * @brief  W25Q Checkpoint region
+ * Two slots of slotSectors sectors from base
+ * @{
+ */
+typedef struct{
+	u32_t base;			///< First sector of region
+	u16_t slotSectors;	///< Sectors of one slot (first page - header)
+	u32_t interval;		///< Log growth between checkpoints (W25Q_CkptDue)
+}W25Q_CKPT_CFG;
+/** @} */
+
+/**
+ * @struct W25Q_CKPT
+ * @brief  W25Q Checkpoint region state
+ * @{
+ */
+typedef struct{
+	W25Q_Device *dev;	///< Device
+	W25Q_CKPT_CFG cfg;	///< Region
+	u32_t seq;			///< Sequence of newest checkpoint (0 - none)
+	u8_t slot;			///< Slot of newest checkpoint
+	u32_t logPos;		///< Log position of newest checkpoint
+}W25Q_CKPT;
+/** @} */
+
+W25Q_STATE W25Q_CkptMount(W25Q_CKPT *ck, W25Q_Device *dev, const W25Q_CKPT_CFG *cfg,
+		void *state, u32_t *len, u32_t *logPos);	///< Load newest checkpoint
+W25Q_STATE W25Q_CkptSave(W25Q_CKPT *ck, const void *state, u32_t len, u32_t logPos); ///< Save checkpoint to older slot
+bool W25Q_CkptDue(W25Q_CKPT *ck, u32_t logPos);	///< Check if log grew by interval
+u32_t W25Q_CkptCapacity(W25Q_CKPT *ck);			///< Max state length
+
+/// @}
+
+/// @}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* W25Q_QSPI_W25Q_CKPT_H_ */
@@ -0,0 +1,276 @@
+/**
+ *******************************************
+ * @file    w25q_cnt.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Erase-free counters for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Sector: 16-byte header {magic, seq, base, crc}, then bitmap.
+ * Bits are cleared from bit 7 of the first byte on, so bitmap is
+ * 0x00 bytes, one partial byte, 0xFF bytes: value is base + cleared
+ * bits, mount finds them by binary search of single bytes.
+ * Rollover erases the other sector and programs its header with
+ * seq + 1 and current value as base. Torn rollover leaves no valid
+ * header there (CRC), old sector stays current and rollover is
+ * repeated by next increment. Counter is used by one task
+ */
+
+#include "w25q_cnt.h"
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @addtogroup W25Q_Cnt
+ * @{
+ */
+
+/// Sector header (as stored in chip)
+typedef struct{
+	u32_t magic;	///< W25Q_CNT_MAGIC
+	u32_t seq;		///< Generation (bigger is newer, with wrap)
+	u32_t base;		///< Value at start of sector
+	u32_t crc;		///< CRC-32 of fields above
+}cnt_hdr;
+
+#define CNT_CHUNK 32U	///< Bitmap bytes programmed per call
+
+/**
+ * @addtogroup W25Q_Cnt_Private
+ * @brief Private methods
+ * @{
+ */
+static inline u32_t sector_addr(W25Q_CNT *cnt, u8_t i);	///< Chip address of counter's sector
+static inline u32_t bits_max(W25Q_CNT *cnt);				///< Bits of sector's bitmap
+static W25Q_STATE bits_find(W25Q_CNT *cnt);				///< Count cleared bits of current sector
+static W25Q_STATE cnt_roll(W25Q_CNT *cnt, u32_t value);	///< Start other sector with value
+/// @}
+
+/**
+ * @brief W25Q Counter mount
+ * Take newer valid sector and count its cleared bits
+ *
+ * @note Counter without valid sectors is started with 0
+ * @param[out] cnt Counter
+ * @param[in] dev Device (initialized)
+ * @param[in] SectAddr First of two sectors
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_CntMount(W25Q_CNT *cnt, W25Q_Device *dev, u32_t SectAddr) {
+	memset(cnt, 0, sizeof(W25Q_CNT));
+	if (SectAddr >= dev->size / dev->sectorSize - 1U)
+		return W25Q_PARAM_ERR;
+	cnt->dev = dev;
+	cnt->sect = SectAddr;
+
+	cnt_hdr hdr[2];
+	bool valid[2];
+	for (u8_t i = 0; i < 2; i++) {
+		W25Q_STATE state = W25Q_ReadRaw(dev, (u8_t*) &hdr[i], sizeof(cnt_hdr), sector_addr(cnt, i));
+		if (state != W25Q_OK) {
+			cnt->dev = NULL;
+			return state;
+		}
+		valid[i] = hdr[i].magic == W25Q_CNT_MAGIC
+				&& hdr[i].crc == W25Q_CalcCRC(0, &hdr[i], sizeof(cnt_hdr) - 4);
+	}
+
+	// new counter: first rollover makes sector 0 with 0
+	if (!valid[0] && !valid[1]) {
+		cnt->cur = 1;
+		W25Q_STATE state = cnt_roll(cnt, 0);
+		if (state != W25Q_OK)
+			cnt->dev = NULL;
+		return state;
+	}
+
+	u8_t cur = valid[0] && (!valid[1] || (i32_t) (hdr[0].seq - hdr[1].seq) > 0) ? 0 : 1;
+	cnt->cur = cur;
+	cnt->seq = hdr[cur].seq;
+	cnt->base = hdr[cur].base;
+	W25Q_STATE state = bits_find(cnt);
+	if (state != W25Q_OK) {
+		cnt->dev = NULL;
+		return state;
+	}
+	cnt->value = cnt->base + cnt->bits;
+	return W25Q_OK;
+}
+
+/**
+ * @brief W25Q Counter add
+ * Clear next n bits of bitmap, roll over to other sector if they don't fit
+ *
+ * @note Increment is one program of one byte
+ * @param[in] cnt Counter
+ * @param[in] n Value to add
+ * @return W25Q_STATE enum (W25Q_PARAM_ERR - value would overflow)
+ */
+W25Q_STATE W25Q_CntAdd(W25Q_CNT *cnt, u32_t n) {
+	if (!cnt->dev || n > 0xFFFFFFFFU - cnt->value)
+		return W25Q_PARAM_ERR;
+	if (!n)
+		return W25Q_OK;
+	if (n > bits_max(cnt) - cnt->bits)
+		return cnt_roll(cnt, cnt->value + n);
+
+	u32_t end = cnt->bits + n;
+	u32_t first = cnt->bits / 8U;
+	u32_t last = (end - 1U) / 8U;
+	u8_t buf[CNT_CHUNK];
+	for (u32_t b = first; b <= last;) {
+		u32_t len = last - b + 1U;
+		if (len > CNT_CHUNK)
+			len = CNT_CHUNK;
+		for (u32_t i = 0; i < len; i++) {
+			// bits of byte before end are cleared, from bit 7
+			u32_t clr = end - (b + i) * 8U;
+			buf[i] = clr >= 8U ? 0x00 : (u8_t) (0xFFU >> clr);
+		}
+		W25Q_STATE state = W25Q_ProgramBulk(cnt->dev, buf, len,
+				sector_addr(cnt, cnt->cur) + W25Q_CNT_HDR_SIZE + b, 0);
+		if (state != W25Q_OK)
+			return state;
+		b += len;
+	}
+
+	cnt->bits = end;
+	cnt->value += n;
+	return W25Q_OK;
+}
+
+/**
+ * @brief W25Q Counter increment
+ *
+ * @param[in] cnt Counter
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_CntInc(W25Q_CNT *cnt) {
+	return W25Q_CntAdd(cnt, 1);
+}
+
+/**
+ * @brief W25Q Counter flag set
+ * Flag is counter's parity, increment toggles it
+ *
+ * @param[in] cnt Counter
+ * @param[in] on 1-set/0-clear
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_CntSetFlag(W25Q_CNT *cnt, bool on) {
+	if (W25Q_CntFlag(cnt) == on)
+		return W25Q_OK;
+	return W25Q_CntAdd(cnt, 1);
+}
+
+/**
+ * @brief W25Q Counter value
+ *
+ * @param[in] cnt Counter
+ * @return Value
+ */
+u32_t W25Q_CntGet(const W25Q_CNT *cnt) {
+	return cnt->value;
+}
+
+/**
+ * @brief W25Q Counter flag
+ *
+ * @param[in] cnt Counter
+ * @return 1-set/0-clear
+ */
+bool W25Q_CntFlag(const W25Q_CNT *cnt) {
+	return cnt->value & 1U;
+}
+
+/**
+ * @brief Sector address
+ *
+ * @param[in] cnt Counter
+ * @param[in] i Counter's sector (0/1)
+ * @return Chip address
+ */
+u32_t sector_addr(W25Q_CNT *cnt, u8_t i) {
+	return (cnt->sect + i) * cnt->dev->sectorSize;
+}
+
+/**
+ * @brief Bitmap bits
+ *
+ * @param[in] cnt Counter
+ * @return Increments per sector
+ */
+u32_t bits_max(W25Q_CNT *cnt) {
+	return (cnt->dev->sectorSize - W25Q_CNT_HDR_SIZE) * 8U;
+}
+
+/**
+ * @brief Bits find
+ * Binary search of first not 0x00 byte, then its cleared bits
+ *
+ * @param[in,out] cnt Counter (bits out)
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE bits_find(W25Q_CNT *cnt) {
+	u32_t addr = sector_addr(cnt, cnt->cur) + W25Q_CNT_HDR_SIZE;
+	u32_t lo = 0, hi = bits_max(cnt) / 8U;
+	u8_t b;
+	W25Q_STATE state;
+
+	while (lo < hi) {
+		u32_t mid = (lo + hi) / 2U;
+		state = W25Q_ReadRaw(cnt->dev, &b, 1, addr + mid);
+		if (state != W25Q_OK)
+			return state;
+		if (b == 0x00)
+			lo = mid + 1U;
+		else
+			hi = mid;
+	}
+
+	cnt->bits = lo * 8U;
+	if (lo < bits_max(cnt) / 8U) {
+		state = W25Q_ReadRaw(cnt->dev, &b, 1, addr + lo);
+		if (state != W25Q_OK)
+			return state;
+		for (u8_t mask = 0x80; mask && !(b & mask); mask >>= 1)
+			cnt->bits++;
+	}
+	return W25Q_OK;
+}
+
+/**
+ * @brief Counter rollover
+ * Erase other sector and program its header: it becomes current
+ *
+ * @param[in,out] cnt Counter
+ * @param[in] value Value at start of new sector
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE cnt_roll(W25Q_CNT *cnt, u32_t value) {
+	u8_t next = cnt->cur ^ 1U;
+	W25Q_STATE state = W25Q_EraseSector(cnt->dev, cnt->sect + next);
+	if (state != W25Q_OK)
+		return state;
+	cnt->erases++;
+
+	cnt_hdr hdr = { .magic = W25Q_CNT_MAGIC, .seq = cnt->seq + 1U, .base = value };
+	hdr.crc = W25Q_CalcCRC(0, &hdr, sizeof(cnt_hdr) - 4);
+	state = W25Q_ProgramBulk(cnt->dev, (u8_t*) &hdr, sizeof(cnt_hdr), sector_addr(cnt, next), 0);
+	if (state != W25Q_OK)
+		return state;
+
+	cnt->cur = next;
+	cnt->seq = hdr.seq;
+	cnt->base = value;
+	cnt->bits = 0;
+	cnt->value = value;
+	return W25Q_OK;
+}
+
+/// @}
+
+/// @}
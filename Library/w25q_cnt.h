@@ -0,0 +1,76 @@
+/**
+ *******************************************
+ * @file    w25q_cnt.h
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Erase-free counters for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Counter of two sectors: every increment programs one more
+ * zero bit (NOR program only clears bits), erase is done only when
+ * sector is full and counter rolls over to the other one. Sector of
+ * 4 KB takes 32640 increments per erase. Flag is counter's parity:
+ * @code
+ * static W25Q_CNT boots;
+ * W25Q_CntMount(&boots, &flash, 2);	// sectors 2 and 3
+ * W25Q_CntInc(&boots);
+ * printf("boot %lu\n", W25Q_CntGet(&boots));
+ * @endcode
+ */
+
+#ifndef W25Q_QSPI_W25Q_CNT_H_
+#define W25Q_QSPI_W25Q_CNT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "w25q_mem.h"
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @defgroup W25Q_Cnt W25Q Counters
+ * @brief Monotonic counters and flags by bit-walking programs
+ * @{
+ */
+
+#define W25Q_CNT_MAGIC 0x544E4357U	///< Sector header magic ("WCNT")
+#define W25Q_CNT_HDR_SIZE 16U		///< Header size, bitmap follows it
+
+/**
+ * @struct W25Q_CNT
+ * @brief  W25Q Mounted counter
+ * @{
+ */
+typedef struct{
+	W25Q_Device *dev;	///< Device
+	u32_t sect;			///< First of two sectors
+	u32_t seq;			///< Generation of current sector
+	u32_t base;			///< Value at start of current sector
+	u32_t bits;			///< Cleared bits in current sector
+	u32_t value;		///< Counter value
+	u32_t erases;		///< Rollover erases since mount
+	u8_t cur;			///< Current sector (0/1)
+}W25Q_CNT;
+/** @} */
+
+W25Q_STATE W25Q_CntMount(W25Q_CNT *cnt, W25Q_Device *dev, u32_t SectAddr);	///< Mount counter (2 sectors from SectAddr, new one is 0)
+W25Q_STATE W25Q_CntAdd(W25Q_CNT *cnt, u32_t n);		///< Add n to counter
+W25Q_STATE W25Q_CntInc(W25Q_CNT *cnt);				///< Increment counter
+W25Q_STATE W25Q_CntSetFlag(W25Q_CNT *cnt, bool on);	///< Set flag (counter's parity)
+u32_t W25Q_CntGet(const W25Q_CNT *cnt);				///< Counter value
+bool W25Q_CntFlag(const W25Q_CNT *cnt);				///< Flag (counter's parity)
+
+/// @}
+
+/// @}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* W25Q_QSPI_W25Q_CNT_H_ */
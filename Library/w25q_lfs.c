@@ -0,0 +1,324 @@
+/**
+ *******************************************
+ * @file    w25q_lfs.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   littlefs block device for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note read - one fast read command of any size, prog - page programs
+ * of the whole cache (0xFF pages skipped), erase - sector or block
+ * command, skipped if littlefs block is already blank. With sector
+ * blocks W25Q_LfsPreErase erases free areas by block commands ahead,
+ * so later block erases are skipped
+ */
+
+#include "w25q_lfs.h"
+
+#if W25Q_USE_LFS
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @addtogroup W25Q_Lfs
+ * @{
+ */
+
+/**
+ * @brief Block address
+ *
+ * @param[in] wl Block device
+ * @param[in] block littlefs block
+ * @param[in] off Offset in block
+ * @return Byte address in chip
+ */
+static inline u32_t bd_addr(W25Q_LFS *wl, lfs_block_t block, lfs_off_t off) {
+	return wl->base * wl->dev->sectorSize + block * wl->blockSize + off;
+}
+
+/**
+ * @brief Area blank check
+ * Sector by sector, stops at first programmed one
+ *
+ * @param[in] wl Block device
+ * @param[out] blank 1-all erased/0-has data
+ * @param[in] addr Start address (sector-aligned)
+ * @param[in] len Length (multiple of sector)
+ * @return W25Q_STATE enum
+ */
+static W25Q_STATE area_blank(W25Q_LFS *wl, bool *blank, u32_t addr, u32_t len) {
+	W25Q_Device *dev = wl->dev;
+	*blank = 1;
+	for (u32_t a = addr; a < addr + len && *blank; a += dev->sectorSize) {
+		W25Q_STATE state = W25Q_SectorBlankCheck(dev, blank, a / dev->sectorSize);
+		if (state != W25Q_OK)
+			return state;
+	}
+	return W25Q_OK;
+}
+
+/**
+ * @brief Erase unit
+ * Erase sector, 32K or 64K block by one command unless it's blank
+ *
+ * @param[in] wl Block device
+ * @param[in] addr Start address (aligned to len)
+ * @param[in] len Sector, half block or block size
+ * @return W25Q_STATE enum
+ */
+static W25Q_STATE erase_unit(W25Q_LFS *wl, u32_t addr, u32_t len) {
+	W25Q_Device *dev = wl->dev;
+	bool blank;
+	W25Q_STATE state = area_blank(wl, &blank, addr, len);
+	if (state != W25Q_OK)
+		return state;
+	if (blank) {
+		wl->erasesSkipped++;
+		return W25Q_OK;
+	}
+
+	wl->erases++;
+	if (len == dev->sectorSize)
+		return W25Q_EraseSector(dev, addr / len);
+	return W25Q_EraseBlock(dev, addr / len, len == dev->blockSize ? 64 : 32);
+}
+
+/**
+ * @brief littlefs read
+ *
+ * @param[in] c littlefs config
+ * @param[in] block Block
+ * @param[in] off Offset in block
+ * @param[out] buffer Data
+ * @param[in] size Length of data
+ * @return littlefs error
+ */
+static int bd_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off,
+		void *buffer, lfs_size_t size) {
+	W25Q_LFS *wl = c->context;
+	return W25Q_LfsError(W25Q_ReadBulk(wl->dev, buffer, size, bd_addr(wl, block, off)));
+}
+
+/**
+ * @brief littlefs program
+ *
+ * @param[in] c littlefs config
+ * @param[in] block Block
+ * @param[in] off Offset in block
+ * @param[in] buffer Data
+ * @param[in] size Length of data
+ * @return littlefs error
+ */
+static int bd_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off,
+		const void *buffer, lfs_size_t size) {
+	W25Q_LFS *wl = c->context;
+	return W25Q_LfsError(W25Q_ProgramBulk(wl->dev, (u8_t*) buffer, size,
+			bd_addr(wl, block, off), 0));
+}
+
+/**
+ * @brief littlefs erase
+ *
+ * @param[in] c littlefs config
+ * @param[in] block Block
+ * @return littlefs error
+ */
+static int bd_erase(const struct lfs_config *c, lfs_block_t block) {
+	W25Q_LFS *wl = c->context;
+	return W25Q_LfsError(erase_unit(wl, bd_addr(wl, block, 0), wl->blockSize));
+}
+
+/**
+ * @brief littlefs sync
+ * Finish user's write pipeline and wait for chip's running write
+ * (other task's program/erase) for W25Q_LFS_SYNC_MS
+ *
+ * @param[in] c littlefs config
+ * @return littlefs error
+ */
+static int bd_sync(const struct lfs_config *c) {
+	W25Q_LFS *wl = c->context;
+	W25Q_STATE state = wl->syncHook ? wl->syncHook(wl->syncCtx) : W25Q_OK;
+	u32_t start = w25q_os_tick();
+	while (state == W25Q_OK && (state = W25Q_IsBusy(wl->dev)) == W25Q_BUSY
+			&& w25q_os_tick() - start < W25Q_LFS_SYNC_MS) {
+		w25q_os_sleep(1);
+		state = W25Q_OK;
+	}
+	return W25Q_LfsError(state);
+}
+
+/**
+ * @brief Used block
+ * littlefs traverse callback: mark block in map
+ *
+ * @param[in] data Map of used blocks
+ * @param[in] block Used block
+ * @return littlefs error
+ */
+static int bd_used(void *data, lfs_block_t block) {
+	u8_t *map = data;
+	map[block / 8U] |= 1U << (block % 8U);
+	return LFS_ERR_OK;
+}
+
+/**
+ * @brief W25Q littlefs config
+ * Fill callbacks and geometry for area of chip
+ *
+ * @note Sizes: read 16, prog 16, cache - chip's page (one program
+ * command per cache flush), lookahead 32, block_cycles 500.
+ * Change them in cfg after the call if needed
+ * @param[out] wl Block device
+ * @param[out] cfg littlefs config
+ * @param[in] dev Device (initialized)
+ * @param[in] base First sector of area (aligned to blockSize)
+ * @param[in] blocks littlefs blocks count
+ * @param[in] blockSize littlefs block: 0/sector, 32K or 64K block of chip
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_LfsConfig(W25Q_LFS *wl, struct lfs_config *cfg, W25Q_Device *dev,
+		u32_t base, u32_t blocks, u32_t blockSize) {
+	if (!blockSize)
+		blockSize = dev->sectorSize;
+	if ((blockSize != dev->sectorSize && blockSize != dev->blockSize
+			&& blockSize != dev->blockSize / 2) || !blocks
+			|| base * dev->sectorSize % blockSize
+			|| base * dev->sectorSize >= dev->size
+			|| blocks > (dev->size - base * dev->sectorSize) / blockSize)
+		return W25Q_PARAM_ERR;
+
+	memset(wl, 0, sizeof(W25Q_LFS));
+	wl->dev = dev;
+	wl->base = base;
+	wl->blockSize = blockSize;
+
+	memset(cfg, 0, sizeof(struct lfs_config));
+	cfg->context = wl;
+	cfg->read = bd_read;
+	cfg->prog = bd_prog;
+	cfg->erase = bd_erase;
+	cfg->sync = bd_sync;
+	cfg->read_size = 16;
+	cfg->prog_size = 16;
+	cfg->block_size = blockSize;
+	cfg->block_count = blocks;
+	cfg->cache_size = dev->pageSize;
+	cfg->lookahead_size = 32;
+	cfg->block_cycles = 500;
+	return W25Q_OK;
+}
+
+/**
+ * @brief W25Q littlefs wipe
+ * Erase area before lfs_format: 64K blocks where possible,
+ * then 32K and sectors at the edges. Blank units are skipped
+ *
+ * @param[in] wl Block device
+ * @param[in] blocks littlefs blocks count
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_LfsWipe(W25Q_LFS *wl, u32_t blocks) {
+	W25Q_Device *dev = wl->dev;
+	u32_t addr = bd_addr(wl, 0, 0);
+	u32_t end = addr + blocks * wl->blockSize;
+	W25Q_STATE state = W25Q_OK;
+
+	while (addr < end && state == W25Q_OK) {
+		u32_t len = dev->blockSize;
+		while (len > dev->sectorSize && (addr % len || addr + len > end))
+			len = len == dev->blockSize ? len / 2 : dev->sectorSize;
+		state = erase_unit(wl, addr, len);
+		addr += len;
+	}
+	return state;
+}
+
+/**
+ * @brief Free area
+ *
+ * @param[in] wl Block device
+ * @param[in] map Map of used blocks
+ * @param[in] addr Start address
+ * @param[in] len Length
+ * @return 1-no used blocks in area
+ */
+static bool area_free(W25Q_LFS *wl, const u8_t *map, u32_t addr, u32_t len) {
+	u32_t first = (addr - bd_addr(wl, 0, 0)) / wl->blockSize;
+	for (u32_t b = first; b < first + len / wl->blockSize; b++)
+		if (map[b / 8U] & (1U << (b % 8U)))
+			return 0;
+	return 1;
+}
+
+/**
+ * @brief W25Q littlefs pre-erase
+ * Erase 64K/32K areas without used blocks by one command each,
+ * littlefs erases of their blocks are skipped later as blank
+ *
+ * @note For sector blocks only (block command replaces 8/16 sector
+ * erases). Call it between file system calls of the same task, e.g.
+ * in idle time: blocks are taken from lfs_fs_traverse (files, dirs,
+ * open files). Blank areas aren't erased again
+ * @param[in] wl Block device
+ * @param[in] lfs Mounted littlefs of wl
+ * @param[out] map Work buffer of (blocks + 7) / 8 bytes
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_LfsPreErase(W25Q_LFS *wl, lfs_t *lfs, u8_t *map) {
+	W25Q_Device *dev = wl->dev;
+	u32_t blocks = lfs->cfg->block_count;
+	if (wl->blockSize != dev->sectorSize || !map)
+		return W25Q_PARAM_ERR;
+
+	memset(map, 0, (blocks + 7U) / 8U);
+	if (lfs_fs_traverse(lfs, bd_used, map) < 0)
+		return W25Q_CHIP_ERR;
+
+	u32_t addr = bd_addr(wl, 0, 0);
+	u32_t end = addr + blocks * wl->blockSize;
+	W25Q_STATE state = W25Q_OK;
+	while (addr < end && state == W25Q_OK) {
+		// biggest free unit, single blocks are erased by littlefs
+		u32_t len = dev->blockSize;
+		while (len > dev->sectorSize && (addr % len || addr + len > end
+				|| !area_free(wl, map, addr, len)))
+			len = len == dev->blockSize ? len / 2 : dev->sectorSize;
+		if (len > dev->sectorSize) {
+			u32_t erases = wl->erases;
+			state = erase_unit(wl, addr, len);
+			if (wl->erases != erases)
+				wl->erasesBatched += len / wl->blockSize;
+		}
+		addr += len;
+	}
+	return state;
+}
+
+/**
+ * @brief W25Q littlefs error
+ *
+ * @param[in] state Driver state
+ * @return littlefs error
+ */
+int W25Q_LfsError(W25Q_STATE state) {
+	switch (state) {
+	case W25Q_OK:
+		return LFS_ERR_OK;
+	case W25Q_PARAM_ERR:
+		return LFS_ERR_INVAL;
+	case W25Q_VERIFY_ERR:
+		return LFS_ERR_CORRUPT;
+	default:
+		return LFS_ERR_IO;
+	}
+}
+
+/// @}
+
+/// @}
+
+#endif
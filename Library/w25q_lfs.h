@@ -0,0 +1,81 @@
+/**
+ *******************************************
+ * @file    w25q_lfs.h
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   littlefs block device for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Set W25Q_USE_LFS = 1 and add littlefs to the project:
+ * @code
+ * static W25Q_LFS wl;
+ * static struct lfs_config cfg;
+ * W25Q_LfsConfig(&wl, &cfg, &flash, 0, 1024, 0);	// 4 MB from 0, 4K blocks
+ * lfs_mount(&lfs, &cfg);
+ * W25Q_LfsPreErase(&wl, &lfs, map);	// idle time: free 64K/32K areas by one erase
+ * @endcode
+ */
+
+#ifndef W25Q_QSPI_W25Q_LFS_H_
+#define W25Q_QSPI_W25Q_LFS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "w25q_mem.h"
+
+#if W25Q_USE_LFS
+#include "lfs.h"
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @defgroup W25Q_Lfs W25Q littlefs adapter
+ * @brief littlefs callbacks on streaming reads and multi-page programs
+ * @{
+ */
+
+#ifndef W25Q_LFS_SYNC_MS
+/// Max time of littlefs sync waiting for running program/erase, ms
+#define W25Q_LFS_SYNC_MS 2000U
+#endif
+
+/**
+ * @struct W25Q_LFS
+ * @brief  W25Q littlefs block device
+ * @{
+ */
+typedef struct{
+	W25Q_Device *dev;		///< Device
+	u32_t base;				///< First sector of file system
+	u32_t blockSize;		///< littlefs block: sector, 32K or 64K block of chip
+	/// Called by littlefs sync before chip is checked (finish own write pipeline)
+	W25Q_STATE (*syncHook)(void *ctx);
+	void *syncCtx;			///< Context of syncHook
+	u32_t erases;			///< Erase commands sent
+	u32_t erasesSkipped;	///< Erases skipped - block was blank
+	u32_t erasesBatched;	///< Free blocks erased by 32K/64K commands of W25Q_LfsPreErase
+}W25Q_LFS;
+/** @} */
+
+W25Q_STATE W25Q_LfsConfig(W25Q_LFS *wl, struct lfs_config *cfg, W25Q_Device *dev,
+		u32_t base, u32_t blocks, u32_t blockSize);		///< Fill littlefs config for chip's area
+W25Q_STATE W25Q_LfsWipe(W25Q_LFS *wl, u32_t blocks);	///< Erase whole area by biggest commands
+W25Q_STATE W25Q_LfsPreErase(W25Q_LFS *wl, lfs_t *lfs, u8_t *map); ///< Erase free 32K/64K areas of small blocks
+int W25Q_LfsError(W25Q_STATE state);					///< Driver state to littlefs error
+
+/// @}
+
+/// @}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* W25Q_QSPI_W25Q_LFS_H_ */
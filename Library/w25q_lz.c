@@ -0,0 +1,623 @@
+/**
+ *******************************************
+ * @file    w25q_lz.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Compressed storage for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Data is cut to W25Q_LZ_BLOCK logical blocks (W25Q_LzSync can
+ * write a short one), every block is LZ4 block format or stored as is
+ * if it doesn't shrink. Blocks go one after another in data sectors,
+ * sectors are erased only when reached. Index entry of block is
+ * programmed after its data, torn entry fails CRC and is skipped.
+ * Slot of block with logical offset is never before offset / BLOCK,
+ * lookup is binary search of index from there.
+ * Decoder takes compressed data by short reads into the caller's
+ * buffer (whole block) or into rbuf (part of block, kept for next reads).
+ * Area is used by one task (no locking over driver's one)
+ */
+
+#include "w25q_lz.h"
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @addtogroup W25Q_Lz
+ * @{
+ */
+
+#define LZ_MIN_MATCH 4U		///< LZ4 min match length
+#define LZ_LAST_LIT 5U		///< LZ4: last bytes of block are literals
+#define LZ_MF_LIMIT 12U		///< LZ4: last match starts 12 bytes before end
+#define LZ_WINDOW 4U		///< Index entries read per lookup step
+
+/// Index entry (as stored in chip)
+typedef struct{
+	u32_t logEnd;	///< Logical end of block
+	u32_t start;	///< Block offset in data sectors
+	u16_t len;		///< Stored length (== raw - stored uncompressed)
+	u16_t raw;		///< Logical length
+	u32_t crc;		///< CRC-32 of fields above
+}lz_entry;
+
+/// Compressed data reader
+typedef struct{
+	W25Q_Device *dev;	///< Device
+	u32_t addr;			///< Next chip address to fetch
+	u32_t left;			///< Bytes in chip not fetched yet
+	u16_t pos;			///< Position in buf
+	u16_t fill;			///< Bytes in buf
+	u8_t buf[MEM_PAGE_SIZE];	///< Fetched data
+}lz_in;
+
+/**
+ * @addtogroup W25Q_Lz_Private
+ * @brief Private methods
+ * @{
+ */
+static inline u32_t index_addr(W25Q_LZ *lz, u32_t slot);	///< Chip address of index slot
+static inline u32_t data_addr(W25Q_LZ *lz, u32_t offset);	///< Chip address of data offset
+static bool entry_valid(W25Q_LZ *lz, const lz_entry *e);	///< Check entry's CRC and fields
+static W25Q_STATE block_write(W25Q_LZ *lz, const u8_t *data, u16_t len);	///< Compress and write block
+static W25Q_STATE block_find(W25Q_LZ *lz, u32_t offset, lz_entry *e);		///< Find block of logical offset
+static W25Q_STATE block_decode(W25Q_LZ *lz, const lz_entry *e, u8_t *dst);	///< Decompress block
+static W25Q_STATE in_get(lz_in *in, u8_t *dst, u32_t len);	///< Take compressed bytes
+static W25Q_STATE in_len(lz_in *in, u32_t *len);				///< Take LZ4 length extension
+static u32_t lz_compress(W25Q_LZ *lz, const u8_t *src, u32_t len, u8_t *dst, u32_t cap); ///< LZ4 block compression
+static u32_t lz_emit(u8_t *dst, u32_t op, u32_t cap, const u8_t *lit, u32_t litLen,
+		u32_t offset, u32_t match);							///< Write LZ4 sequence
+/// @}
+
+/**
+ * @brief W25Q Compressed area mount
+ * Find end of index, skip torn tail of data
+ *
+ * @param[out] lz Area state
+ * @param[in] dev Device (initialized)
+ * @param[in] cfg Area
+ * @param[in] format 1-erase index (drop all data)/0-keep data
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_LzMount(W25Q_LZ *lz, W25Q_Device *dev, const W25Q_LZ_CFG *cfg, bool format) {
+	memset(lz, 0, sizeof(W25Q_LZ));
+	lz->dev = dev;
+	lz->cfg = *cfg;
+	u32_t total = dev->size / dev->sectorSize;
+	if (!cfg->indexSectors || !cfg->dataSectors || cfg->base >= total
+			|| cfg->indexSectors + cfg->dataSectors > total - cfg->base) {
+		lz->dev = NULL;
+		return W25Q_PARAM_ERR;
+	}
+
+	W25Q_STATE state = W25Q_OK;
+	if (format) {
+		// data sectors are erased when reached
+		for (u16_t i = 0; i < cfg->indexSectors && state == W25Q_OK; i++) {
+			bool blank;
+			state = W25Q_SectorBlankCheck(dev, &blank, cfg->base + i);
+			if (state == W25Q_OK && !blank)
+				state = W25Q_EraseSector(dev, cfg->base + i);
+		}
+		return state;
+	}
+
+	// slots are written in order: binary search of first erased one
+	u32_t lo = 0, hi = cfg->indexSectors * dev->sectorSize / W25Q_LZ_ENTRY;
+	lz_entry e;
+	while (lo < hi) {
+		u32_t mid = (lo + hi) / 2U;
+		state = W25Q_ReadRaw(dev, (u8_t*) &e, sizeof(lz_entry), index_addr(lz, mid));
+		if (state != W25Q_OK)
+			return state;
+		const u32_t *w = (const u32_t*) &e;
+		if ((w[0] & w[1] & w[2] & w[3]) == 0xFFFFFFFFU)
+			hi = mid;
+		else
+			lo = mid + 1U;
+	}
+	lz->next = lo;
+
+	// newest valid entry, torn ones after it are skipped
+	for (u32_t s = lo; s-- > 0;) {
+		state = W25Q_ReadRaw(dev, (u8_t*) &e, sizeof(lz_entry), index_addr(lz, s));
+		if (state != W25Q_OK)
+			return state;
+		if (entry_valid(lz, &e)) {
+			lz->logEnd = e.logEnd;
+			lz->dataEnd = e.start + e.len;
+			break;
+		}
+	}
+	lz->size = lz->logEnd;
+
+	// rest of last sector may have torn block - continue from next sector then
+	lz->erasedTo = (lz->dataEnd + dev->sectorSize - 1U) / dev->sectorSize * dev->sectorSize;
+	for (u32_t off = lz->dataEnd; off < lz->erasedTo;) {
+		u32_t n = lz->erasedTo - off;
+		if (n > W25Q_LZ_BLOCK)
+			n = W25Q_LZ_BLOCK;
+		state = W25Q_ReadBulk(dev, lz->rbuf, n, data_addr(lz, off));
+		if (state != W25Q_OK)
+			return state;
+		u32_t i = 0;
+		while (i < n && lz->rbuf[i] == 0xFF)
+			i++;
+		if (i < n) {
+			lz->dataEnd = lz->erasedTo;
+			break;
+		}
+		off += n;
+	}
+	return W25Q_OK;
+}
+
+/**
+ * @brief W25Q Compressed area append
+ * Collect data to blocks, full blocks are compressed and written
+ *
+ * @note Whole blocks of caller's data are compressed without copy
+ * @param[in] lz Area state
+ * @param[in] buf Pointer to data
+ * @param[in] len Length of data
+ * @return W25Q_STATE enum (W25Q_PARAM_ERR - area is full)
+ */
+W25Q_STATE W25Q_LzAppend(W25Q_LZ *lz, const u8_t *buf, u32_t len) {
+	if (!lz->dev)
+		return W25Q_PARAM_ERR;
+
+	W25Q_STATE state = W25Q_OK;
+	while (len && state == W25Q_OK) {
+		u32_t n;
+		if (!lz->wlen && len >= W25Q_LZ_BLOCK) {
+			n = W25Q_LZ_BLOCK;
+			state = block_write(lz, buf, n);
+			if (state != W25Q_OK)
+				break;
+		} else {
+			n = W25Q_LZ_BLOCK - lz->wlen;
+			if (n > len)
+				n = len;
+			memcpy(lz->wbuf + lz->wlen, buf, n);
+			lz->wlen += n;
+			if (lz->wlen == W25Q_LZ_BLOCK) {
+				state = block_write(lz, lz->wbuf, W25Q_LZ_BLOCK);
+				if (state == W25Q_OK)
+					lz->wlen = 0;
+			}
+		}
+		buf += n;
+		len -= n;
+	}
+	lz->size = lz->logEnd + lz->wlen;
+	return state;
+}
+
+/**
+ * @brief W25Q Compressed area sync
+ * Write pending data as short block
+ *
+ * @param[in] lz Area state
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_LzSync(W25Q_LZ *lz) {
+	if (!lz->dev)
+		return W25Q_PARAM_ERR;
+	if (!lz->wlen)
+		return W25Q_OK;
+
+	W25Q_STATE state = block_write(lz, lz->wbuf, lz->wlen);
+	if (state == W25Q_OK)
+		lz->wlen = 0;
+	return state;
+}
+
+/**
+ * @brief W25Q Compressed area read
+ * Decompress data of logical range
+ *
+ * @param[in] lz Area state
+ * @param[out] buf Pointer to data
+ * @param[in] offset Logical offset
+ * @param[in] len Length of data
+ * @return W25Q_STATE enum (W25Q_VERIFY_ERR - damaged block)
+ */
+W25Q_STATE W25Q_LzRead(W25Q_LZ *lz, u8_t *buf, u32_t offset, u32_t len) {
+	if (!lz->dev || offset > lz->size || len > lz->size - offset)
+		return W25Q_PARAM_ERR;
+
+	W25Q_STATE state = W25Q_OK;
+	while (len && state == W25Q_OK) {
+		u32_t n;
+		if (offset >= lz->logEnd) {
+			// pending data
+			memcpy(buf, lz->wbuf + offset - lz->logEnd, len);
+			break;
+		}
+		if (lz->rlen && offset >= lz->rstart && offset - lz->rstart < lz->rlen) {
+			n = lz->rstart + lz->rlen - offset;
+			if (n > len)
+				n = len;
+			memcpy(buf, lz->rbuf + offset - lz->rstart, n);
+		} else {
+			lz_entry e;
+			state = block_find(lz, offset, &e);
+			if (state != W25Q_OK)
+				break;
+			u32_t start = e.logEnd - e.raw;
+			u32_t skip = offset - start;
+			n = e.raw - skip;
+			if (n > len)
+				n = len;
+
+			if (e.len == e.raw) {
+				state = W25Q_ReadBulk(lz->dev, buf, n, data_addr(lz, e.start + skip));
+			} else if (!skip && n == e.raw) {
+				state = block_decode(lz, &e, buf);
+			} else {
+				lz->rlen = 0;
+				state = block_decode(lz, &e, lz->rbuf);
+				if (state == W25Q_OK) {
+					lz->rstart = start;
+					lz->rlen = e.raw;
+					memcpy(buf, lz->rbuf + skip, n);
+				}
+			}
+		}
+		buf += n;
+		offset += n;
+		len -= n;
+	}
+	return state;
+}
+
+/// @}
+
+/**
+ * @addtogroup W25Q_Lz_Private
+ * @{
+ */
+
+/**
+ * @brief Index slot address
+ *
+ * @param[in] lz Area state
+ * @param[in] slot Index slot
+ * @return Byte address in chip
+ */
+u32_t index_addr(W25Q_LZ *lz, u32_t slot) {
+	return lz->cfg.base * lz->dev->sectorSize + slot * W25Q_LZ_ENTRY;
+}
+
+/**
+ * @brief Data address
+ *
+ * @param[in] lz Area state
+ * @param[in] offset Offset in data sectors
+ * @return Byte address in chip
+ */
+u32_t data_addr(W25Q_LZ *lz, u32_t offset) {
+	return (lz->cfg.base + lz->cfg.indexSectors) * lz->dev->sectorSize + offset;
+}
+
+/**
+ * @brief Entry check
+ *
+ * @param[in] lz Area state
+ * @param[in] e Index entry
+ * @return 1-valid/0-torn or damaged
+ */
+bool entry_valid(W25Q_LZ *lz, const lz_entry *e) {
+	return e->crc == W25Q_CalcCRC(0, e, sizeof(lz_entry) - 4)
+			&& e->raw && e->raw <= W25Q_LZ_BLOCK && e->len <= e->raw
+			&& e->start + e->len <= lz->cfg.dataSectors * lz->dev->sectorSize;
+}
+
+/**
+ * @brief Block write
+ * Compress block (stored as is if it doesn't shrink), program
+ * it after previous one, then its index entry
+ *
+ * @note Failed write leaves the rest of its sector unused
+ * @param[in] lz Area state
+ * @param[in] data Block data
+ * @param[in] len Block length
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE block_write(W25Q_LZ *lz, const u8_t *data, u16_t len) {
+	W25Q_Device *dev = lz->dev;
+	if (lz->next >= lz->cfg.indexSectors * dev->sectorSize / W25Q_LZ_ENTRY)
+		return W25Q_PARAM_ERR;
+
+	lz->rlen = 0;	// rbuf is compressor output now
+	u32_t stored = lz_compress(lz, data, len, lz->rbuf, len - 1U);
+	const u8_t *out = lz->rbuf;
+	if (!stored) {
+		stored = len;
+		out = data;
+	}
+	if (stored > lz->cfg.dataSectors * dev->sectorSize - lz->dataEnd)
+		return W25Q_PARAM_ERR;
+
+	W25Q_STATE state = W25Q_OK;
+	while (lz->erasedTo < lz->dataEnd + stored && state == W25Q_OK) {
+		state = W25Q_EraseSector(dev, data_addr(lz, lz->erasedTo) / dev->sectorSize);
+		if (state == W25Q_OK)
+			lz->erasedTo += dev->sectorSize;
+	}
+	if (state == W25Q_OK)
+		state = W25Q_ProgramBulk(dev, (u8_t*) out, stored, data_addr(lz, lz->dataEnd), 0);
+	if (state != W25Q_OK) {
+		lz->dataEnd = lz->erasedTo;
+		return state;
+	}
+
+	lz_entry e = { lz->logEnd + len, lz->dataEnd, stored, len, 0 };
+	e.crc = W25Q_CalcCRC(0, &e, sizeof(lz_entry) - 4);
+	state = W25Q_ProgramRaw(dev, (u8_t*) &e, sizeof(lz_entry), index_addr(lz, lz->next));
+	lz->next++;
+	if (state != W25Q_OK) {
+		lz->dataEnd = lz->erasedTo;
+		return state;
+	}
+	lz->logEnd += len;
+	lz->dataEnd += stored;
+	return W25Q_OK;
+}
+
+/**
+ * @brief Block find
+ * Index entry of block with logical offset: binary search of
+ * first valid slot with logEnd over offset, from slot
+ * offset / W25Q_LZ_BLOCK (logEnd grows over valid slots)
+ *
+ * @param[in] lz Area state
+ * @param[in] offset Logical offset (< logEnd)
+ * @param[out] e Index entry
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE block_find(W25Q_LZ *lz, u32_t offset, lz_entry *e) {
+	lz_entry win[LZ_WINDOW];
+	u32_t lo = offset / W25Q_LZ_BLOCK, hi = lz->next;
+	bool found = 0;
+
+	while (lo < hi) {
+		u32_t mid = (lo + hi) / 2U;
+		// torn slots have no logEnd: take first valid one from mid
+		u32_t s = mid;
+		const lz_entry *cur = NULL;
+		while (!cur && s < hi) {
+			u32_t n = hi - s;
+			if (n > LZ_WINDOW)
+				n = LZ_WINDOW;
+			W25Q_STATE state = W25Q_ReadRaw(lz->dev, (u8_t*) win, n * sizeof(lz_entry), index_addr(lz, s));
+			if (state != W25Q_OK)
+				return state;
+			for (u32_t i = 0; i < n && !cur; i++, s++)
+				if (entry_valid(lz, &win[i]))
+					cur = &win[i];
+		}
+		if (!cur)
+			hi = mid;	// mid..hi are torn
+		else if (cur->logEnd > offset) {
+			*e = *cur;
+			found = 1;
+			hi = mid;
+		} else
+			lo = s;		// s is after cur
+	}
+	return found ? W25Q_OK : W25Q_VERIFY_ERR;
+}
+
+/**
+ * @brief Block decode
+ * LZ4 block decompression, input is read from chip by pages
+ *
+ * @param[in] lz Area state
+ * @param[in] e Index entry (compressed block)
+ * @param[out] dst Output (e->raw bytes)
+ * @return W25Q_STATE enum (W25Q_VERIFY_ERR - damaged block)
+ */
+W25Q_STATE block_decode(W25Q_LZ *lz, const lz_entry *e, u8_t *dst) {
+	lz_in in = { .dev = lz->dev, .addr = data_addr(lz, e->start), .left = e->len };
+	u32_t op = 0;
+	W25Q_STATE state;
+
+	for (;;) {
+		u8_t token, offset[2];
+		state = in_get(&in, &token, 1);
+		if (state != W25Q_OK)
+			return state;
+
+		u32_t lit = token >> 4;
+		if (lit == 15U && (state = in_len(&in, &lit)) != W25Q_OK)
+			return state;
+		if (lit > e->raw - op)
+			return W25Q_VERIFY_ERR;
+		state = in_get(&in, dst + op, lit);
+		if (state != W25Q_OK)
+			return state;
+		op += lit;
+		// last sequence has literals only
+		if (!in.left && in.pos == in.fill)
+			break;
+
+		state = in_get(&in, offset, 2);
+		if (state != W25Q_OK)
+			return state;
+		u32_t dist = offset[0] | (u32_t) offset[1] << 8;
+		u32_t match = token & 15U;
+		if (match == 15U && (state = in_len(&in, &match)) != W25Q_OK)
+			return state;
+		match += LZ_MIN_MATCH;
+		if (!dist || dist > op || match > e->raw - op)
+			return W25Q_VERIFY_ERR;
+		// overlapping copy repeats the pattern
+		for (u8_t *p = dst + op, *end = p + match; p < end; p++)
+			*p = *(p - dist);
+		op += match;
+	}
+	return op == e->raw ? W25Q_OK : W25Q_VERIFY_ERR;
+}
+
+/**
+ * @brief Input get
+ * Copy bytes of compressed block, long runs are read straight to dst
+ *
+ * @param[in] in Reader
+ * @param[out] dst Output
+ * @param[in] len Length
+ * @return W25Q_STATE enum (W25Q_VERIFY_ERR - block ended)
+ */
+W25Q_STATE in_get(lz_in *in, u8_t *dst, u32_t len) {
+	while (len) {
+		if (in->pos == in->fill) {
+			if (len > in->left)
+				return W25Q_VERIFY_ERR;
+			if (len >= sizeof(in->buf)) {
+				W25Q_STATE state = W25Q_ReadBulk(in->dev, dst, len, in->addr);
+				in->addr += len;
+				in->left -= len;
+				return state;
+			}
+			u32_t n = in->left < sizeof(in->buf) ? in->left : sizeof(in->buf);
+			W25Q_STATE state = W25Q_ReadRaw(in->dev, in->buf, n, in->addr);
+			if (state != W25Q_OK)
+				return state;
+			in->addr += n;
+			in->left -= n;
+			in->pos = 0;
+			in->fill = n;
+		}
+		u32_t n = in->fill - in->pos;
+		if (n > len)
+			n = len;
+		memcpy(dst, in->buf + in->pos, n);
+		in->pos += n;
+		dst += n;
+		len -= n;
+	}
+	return W25Q_OK;
+}
+
+/**
+ * @brief Input length
+ * Add LZ4 length extension bytes (255 - more follow)
+ *
+ * @param[in] in Reader
+ * @param[in,out] len Length
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE in_len(lz_in *in, u32_t *len) {
+	u8_t b;
+	do {
+		W25Q_STATE state = in_get(in, &b, 1);
+		if (state != W25Q_OK)
+			return state;
+		*len += b;
+	} while (b == 255U && *len <= W25Q_LZ_BLOCK);
+	return W25Q_OK;
+}
+
+/**
+ * @brief LZ4 compress
+ * Greedy LZ4 block compression with one-way hash table
+ *
+ * @param[in] lz Area state (hash table)
+ * @param[in] src Data
+ * @param[in] len Length of data
+ * @param[out] dst Output
+ * @param[in] cap Output size
+ * @return Compressed length (0 - doesn't fit to cap)
+ */
+u32_t lz_compress(W25Q_LZ *lz, const u8_t *src, u32_t len, u8_t *dst, u32_t cap) {
+	u32_t ip = 0, anchor = 0, op = 0;
+	memset(lz->hash, 0, sizeof(lz->hash));
+
+	if (len > LZ_MF_LIMIT) {
+		u32_t limit = len - LZ_MF_LIMIT;
+		u32_t matchLimit = len - LZ_LAST_LIT;
+		while (ip < limit) {
+			u32_t seq, ref;
+			memcpy(&seq, src + ip, 4);
+			u32_t h = (seq * 2654435761U) >> (32U - W25Q_LZ_HASH_LOG);
+			ref = lz->hash[h];
+			lz->hash[h] = ip + 1U;
+			if (ref) {
+				u32_t old;
+				memcpy(&old, src + ref - 1U, 4);
+				if (old != seq)
+					ref = 0;
+			}
+			if (!ref) {
+				// step grows on data without matches
+				ip += 1U + ((ip - anchor) >> 6);
+				continue;
+			}
+			ref--;
+
+			u32_t match = LZ_MIN_MATCH;
+			while (ip + match < matchLimit && src[ref + match] == src[ip + match])
+				match++;
+			op = lz_emit(dst, op, cap, src + anchor, ip - anchor, ip - ref, match);
+			if (!op)
+				return 0;
+			ip += match;
+			anchor = ip;
+		}
+	}
+	return lz_emit(dst, op, cap, src + anchor, len - anchor, 0, 0);
+}
+
+/**
+ * @brief LZ4 sequence
+ * Token, literals, offset and match length extension
+ *
+ * @param[out] dst Output
+ * @param[in] op Output position
+ * @param[in] cap Output size
+ * @param[in] lit Literals
+ * @param[in] litLen Literals length
+ * @param[in] offset Match distance (0 - last sequence, literals only)
+ * @param[in] match Match length
+ * @return New output position (0 - doesn't fit to cap)
+ */
+u32_t lz_emit(u8_t *dst, u32_t op, u32_t cap, const u8_t *lit, u32_t litLen,
+		u32_t offset, u32_t match) {
+	u32_t need = 1U + litLen / 255U + 1U + litLen + (offset ? 3U + match / 255U : 0);
+	if (need > cap - op)
+		return 0;
+
+	u8_t *token = &dst[op++];
+	*token = (litLen < 15U ? litLen : 15U) << 4;
+	if (litLen >= 15U) {
+		u32_t l = litLen - 15U;
+		for (; l >= 255U; l -= 255U)
+			dst[op++] = 255U;
+		dst[op++] = l;
+	}
+	memcpy(dst + op, lit, litLen);
+	op += litLen;
+
+	if (offset) {
+		dst[op++] = offset;
+		dst[op++] = offset >> 8;
+		u32_t m = match - LZ_MIN_MATCH;
+		*token |= m < 15U ? m : 15U;
+		if (m >= 15U) {
+			for (m -= 15U; m >= 255U; m -= 255U)
+				dst[op++] = 255U;
+			dst[op++] = m;
+		}
+	}
+	return op;
+}
+
+/// @}
+
+/// @}
+
+/// @}
@@ -0,0 +1,104 @@
+/**
+ *******************************************
+ * @file    w25q_lz.h
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Compressed storage for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Append-only area of LZ4 blocks with random access by logical
+ * offset. Logs and tables usually take 2-4 times less chip: less
+ * bytes over QSPI, less sectors erased
+ * @code
+ * static W25Q_LZ lz;
+ * W25Q_LZ_CFG cfg = { .base = 512, .indexSectors = 4, .dataSectors = 1024 };
+ * W25Q_LzMount(&lz, &flash, &cfg, 0);
+ * W25Q_LzAppend(&lz, rec, sizeof(rec));
+ * W25Q_LzRead(&lz, buf, offset, len);
+ * @endcode
+ */
+
+#ifndef W25Q_QSPI_W25Q_LZ_H_
+#define W25Q_QSPI_W25Q_LZ_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "w25q_mem.h"
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @defgroup W25Q_Lz W25Q Compressed Storage
+ * @brief LZ4 blocks with index, streaming decompression
+ * @{
+ */
+
+#ifndef W25Q_LZ_BLOCK
+/// Logical block size, power of 2 up to 32K (2 blocks of RAM)
+#define W25Q_LZ_BLOCK 4096U
+#endif
+#ifndef W25Q_LZ_HASH_LOG
+/// Compressor hash table size, log2 (2 bytes of RAM each)
+#define W25Q_LZ_HASH_LOG 10U
+#endif
+
+#if W25Q_LZ_BLOCK > 32768U || (W25Q_LZ_BLOCK & (W25Q_LZ_BLOCK - 1U))
+#error "W25Q_LZ_BLOCK must be power of 2 up to 32768"
+#endif
+
+#define W25Q_LZ_ENTRY 16U	///< Index entry size
+
+/**
+ * @struct W25Q_LZ_CFG
+ * @brief  W25Q Compressed area
+ * Sectors from base: index, then data
+ * @{
+ */
+typedef struct{
+	u32_t base;				///< First sector of area
+	u16_t indexSectors;		///< Index sectors (16 bytes per block)
+	u32_t dataSectors;		///< Data sectors
+}W25Q_LZ_CFG;
+/** @} */
+
+/**
+ * @struct W25Q_LZ
+ * @brief  W25Q Compressed area state
+ * @{
+ */
+typedef struct{
+	W25Q_Device *dev;		///< Device
+	W25Q_LZ_CFG cfg;		///< Area
+	u32_t size;				///< Logical size (written blocks + pending data)
+	u32_t logEnd;			///< Logical end of written blocks
+	u32_t next;				///< Next index slot
+	u32_t dataEnd;			///< Next block's offset in data (chip bytes used)
+	u32_t erasedTo;			///< Data erased up to (sector-aligned)
+	u32_t rstart;			///< Logical start of block in rbuf
+	u16_t rlen;				///< Logical length of block in rbuf (0 - none)
+	u16_t wlen;				///< Pending data in wbuf
+	u16_t hash[1U << W25Q_LZ_HASH_LOG];	///< Compressor positions (+1)
+	u8_t wbuf[W25Q_LZ_BLOCK];	///< Block being appended
+	u8_t rbuf[W25Q_LZ_BLOCK];	///< Decompressed block / compressor output
+}W25Q_LZ;
+/** @} */
+
+W25Q_STATE W25Q_LzMount(W25Q_LZ *lz, W25Q_Device *dev, const W25Q_LZ_CFG *cfg, bool format); ///< Mount area (format - erase index)
+W25Q_STATE W25Q_LzAppend(W25Q_LZ *lz, const u8_t *buf, u32_t len);		///< Append data
+W25Q_STATE W25Q_LzSync(W25Q_LZ *lz);										///< Write pending data as short block
+W25Q_STATE W25Q_LzRead(W25Q_LZ *lz, u8_t *buf, u32_t offset, u32_t len);	///< Read by logical offset
+
+/// @}
+
+/// @}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* W25Q_QSPI_W25Q_LZ_H_ */
@@ -24,16 +24,148 @@
  * @brief External fields and data
  * @{
  */
-extern QSPI_HandleTypeDef hqspi;	///< Quad SPI HAL Instance
+#if W25Q_USE_HW_CRC
+extern CRC_HandleTypeDef hcrc;		///< CRC HAL Instance
+static w25q_mutex_t w25q_crc_mutex;	///< CRC unit is shared by all devices
+#endif
 /// @}
 
 /**
  * @addtogroup W25Q_PrivFi Private fields
  * @brief Private variables and defines
+ *
+ * @note Macros below use device pointer "dev" of calling function
  * @{
  */
-#define w25q_delay(x) HAL_Delay(x) 	///< Delay define to provide future support of RTOS
-W25Q_STATUS_REG w25q_status; 		///< Internal status structure instance
+#if W25Q_STATS_ENABLE
+#define w25q_stat_inc(field) (dev->stats.field++)			///< Increment statistics counter
+#define w25q_stat_add(field, n) (dev->stats.field += (n))	///< Add to statistics counter
+#define w25q_stat_start() u32_t w25q_stat_t0 = W25Q_STATS_TIMER() ///< Start latency measure
+#define w25q_stat_latency(api) stat_latency(dev, api, W25Q_STATS_TIMER() - w25q_stat_t0, 0) ///< End latency measure
+#define w25q_stat_deadline(api, us) stat_latency(dev, api, W25Q_STATS_TIMER() - w25q_stat_t0, us) ///< End measure of call with own deadline
+#else
+#define w25q_stat_inc(field) ((void) 0)
+#define w25q_stat_add(field, n) ((void) 0)
+#define w25q_stat_start()
+#define w25q_stat_latency(api) ((void) 0)
+#define w25q_stat_deadline(api, us) ((void) 0)
+#endif
+#if W25Q_TRACE_ENABLE
+#define w25q_trace_begin(com) trace_begin(dev, com)	///< Open trace record
+#define w25q_trace_end(flags) trace_end(dev, flags)	///< Close trace record
+#else
+#define w25q_trace_begin(com) ((void) 0)
+#define w25q_trace_end(flags) ((void) 0)
+#endif
+#define w25q_delay(x) do { w25q_stat_inc(delays); w25q_os_sleep(x); } while (0) ///< Delay (sleep in RTOS)
+/// Take device's mutex, wake the chip if it's powered down
+#define w25q_lock() do { lock_take(dev, 0); \
+	if (dev->status.SLEEP) power_wake(dev); } while (0)
+/// Give device's mutex, idle time starts
+#define w25q_unlock() do { dev->power.lastUse = w25q_os_tick(); dev->lockDepth--; \
+	w25q_os_mutex_unlock(dev->mutex); } while (0)
+#define W25Q_TIMEOUT_SR 15U			///< Status register write max time, ms
+#define W25Q_TIMEOUT_INIT W25Q_TIMEOUT_SR	///< Init waits for unfinished write, ms
+#define W25Q_TDP_US 3U				///< Power-down entry time (tDP), us
+#define W25Q_TRES1_US 3U			///< Release from power-down time (tRES1), us
+#define W25Q_TSUS_US 20U			///< Suspend latency and resume to suspend time (tSUS), us
+#define W25Q_TIMEOUT_PP 3U			///< Page program max time, ms
+#define W25Q_TIMEOUT_SE 400U		///< Sector erase max time, ms
+#define W25Q_TIMEOUT_BE32 1600U		///< 32KB block erase max time, ms
+#define W25Q_TIMEOUT_BE64 2000U		///< 64KB block erase max time, ms
+#define W25Q_TIMEOUT_CE ((dev->size / w25q_chips(dev) >> 16) * 800U) ///< Chip erase max time, ms (~400 s for 256 Mbit)
+#define W25Q_TYP_PP_US 400U			///< Page program typical time, us
+#define W25Q_TYP_SE_US 45000U		///< Sector erase typical time, us
+#define W25Q_TYP_BE32_US 120000U	///< 32KB block erase typical time, us
+#define W25Q_TYP_BE64_US 150000U	///< 64KB block erase typical time, us
+#define W25Q_TYP_CE_US ((dev->size / w25q_chips(dev) >> 16) * 160000U) ///< Chip erase typical time, us (~80 s for 256 Mbit)
+#define W25Q_ADDR3_MAX 0x1000000U	///< Chip size reachable by 3-byte address
+#define W25Q_CACHE_LINE 32U	///< Cortex-M7 D-cache line, bytes
+#define W25Q_CAL_PAGES 4U	///< Calibration pattern pages
+#if W25Q_STREAM_CHUNK % 4U
+#error "W25Q_STREAM_CHUNK must be multiple of 4 (W25Q_ProgramArray swaps whole elements)"
+#endif
+#if W25Q_TRACE_DEPTH & (W25Q_TRACE_DEPTH - 1U)
+#error "W25Q_TRACE_DEPTH must be power of 2"
+#endif
+#if W25Q_USE_DCACHE
+#if W25Q_STREAM_CHUNK % W25Q_CACHE_LINE
+#error "W25Q_STREAM_CHUNK must be multiple of cache line"
+#endif
+/// D-cache is on (maintenance is needed)
+#define w25q_dcache_on() (SCB->CCR & SCB_CCR_DC_Msk)
+/// Drop cached lines of DMA receive buffer (buffer owns whole lines)
+#define w25q_dcache_invalidate(buf, len) do { if (w25q_dcache_on()) \
+	SCB_InvalidateDCache_by_Addr((void*) (buf), (int32_t) (len)); } while (0)
+/// Write cached data of DMA transmit buffer to RAM
+#define w25q_dcache_clean(buf, len) do { if (w25q_dcache_on()) \
+	SCB_CleanDCache_by_Addr((uint32_t*) ((uintptr_t) (buf) & ~(W25Q_CACHE_LINE - 1U)), \
+	(int32_t) ((len) + ((uintptr_t) (buf) & (W25Q_CACHE_LINE - 1U)))); } while (0)
+#else
+#define w25q_dcache_on() 0
+#define w25q_dcache_invalidate(buf, len) ((void) 0)
+#define w25q_dcache_clean(buf, len) ((void) 0)
+#endif
+/// Chips working in parallel (status and ID are read per chip)
+#define w25q_chips(dev) ((dev)->dual ? 2U : 1U)
+/// Raw bytes from address to the end of its 16 MB bank (no banks in 4-byte mode)
+#define w25q_bank_left(dev, addr) ((dev)->ear ? W25Q_ADDR3_MAX * w25q_chips(dev) \
+	- (addr) % (W25Q_ADDR3_MAX * w25q_chips(dev)) : 0xFFFFFFFFU)
+/// Device waits by transport's interrupts
+#define w25q_use_it(dev) (W25Q_USE_IT && (dev)->bus->autopoll)
+
+#if W25Q_USE_IT && W25Q_HAL_CALLBACKS
+static W25Q_Device *w25q_devs[W25Q_MAX_DEVICES];	///< Devices for HAL callbacks
+#endif
+
+/// Streaming consumer: gets every read part, stops stream if returns not W25Q_OK
+typedef W25Q_CHUNK_FN stream_fn;
+/// CRC-32 table (IEEE 802.3, reflected 0xEDB88320)
+static const u32_t crc_table[256] = {
+	0x00000000U, 0x77073096U, 0xEE0E612CU, 0x990951BAU, 0x076DC419U, 0x706AF48FU,
+	0xE963A535U, 0x9E6495A3U, 0x0EDB8832U, 0x79DCB8A4U, 0xE0D5E91EU, 0x97D2D988U,
+	0x09B64C2BU, 0x7EB17CBDU, 0xE7B82D07U, 0x90BF1D91U, 0x1DB71064U, 0x6AB020F2U,
+	0xF3B97148U, 0x84BE41DEU, 0x1ADAD47DU, 0x6DDDE4EBU, 0xF4D4B551U, 0x83D385C7U,
+	0x136C9856U, 0x646BA8C0U, 0xFD62F97AU, 0x8A65C9ECU, 0x14015C4FU, 0x63066CD9U,
+	0xFA0F3D63U, 0x8D080DF5U, 0x3B6E20C8U, 0x4C69105EU, 0xD56041E4U, 0xA2677172U,
+	0x3C03E4D1U, 0x4B04D447U, 0xD20D85FDU, 0xA50AB56BU, 0x35B5A8FAU, 0x42B2986CU,
+	0xDBBBC9D6U, 0xACBCF940U, 0x32D86CE3U, 0x45DF5C75U, 0xDCD60DCFU, 0xABD13D59U,
+	0x26D930ACU, 0x51DE003AU, 0xC8D75180U, 0xBFD06116U, 0x21B4F4B5U, 0x56B3C423U,
+	0xCFBA9599U, 0xB8BDA50FU, 0x2802B89EU, 0x5F058808U, 0xC60CD9B2U, 0xB10BE924U,
+	0x2F6F7C87U, 0x58684C11U, 0xC1611DABU, 0xB6662D3DU, 0x76DC4190U, 0x01DB7106U,
+	0x98D220BCU, 0xEFD5102AU, 0x71B18589U, 0x06B6B51FU, 0x9FBFE4A5U, 0xE8B8D433U,
+	0x7807C9A2U, 0x0F00F934U, 0x9609A88EU, 0xE10E9818U, 0x7F6A0DBBU, 0x086D3D2DU,
+	0x91646C97U, 0xE6635C01U, 0x6B6B51F4U, 0x1C6C6162U, 0x856530D8U, 0xF262004EU,
+	0x6C0695EDU, 0x1B01A57BU, 0x8208F4C1U, 0xF50FC457U, 0x65B0D9C6U, 0x12B7E950U,
+	0x8BBEB8EAU, 0xFCB9887CU, 0x62DD1DDFU, 0x15DA2D49U, 0x8CD37CF3U, 0xFBD44C65U,
+	0x4DB26158U, 0x3AB551CEU, 0xA3BC0074U, 0xD4BB30E2U, 0x4ADFA541U, 0x3DD895D7U,
+	0xA4D1C46DU, 0xD3D6F4FBU, 0x4369E96AU, 0x346ED9FCU, 0xAD678846U, 0xDA60B8D0U,
+	0x44042D73U, 0x33031DE5U, 0xAA0A4C5FU, 0xDD0D7CC9U, 0x5005713CU, 0x270241AAU,
+	0xBE0B1010U, 0xC90C2086U, 0x5768B525U, 0x206F85B3U, 0xB966D409U, 0xCE61E49FU,
+	0x5EDEF90EU, 0x29D9C998U, 0xB0D09822U, 0xC7D7A8B4U, 0x59B33D17U, 0x2EB40D81U,
+	0xB7BD5C3BU, 0xC0BA6CADU, 0xEDB88320U, 0x9ABFB3B6U, 0x03B6E20CU, 0x74B1D29AU,
+	0xEAD54739U, 0x9DD277AFU, 0x04DB2615U, 0x73DC1683U, 0xE3630B12U, 0x94643B84U,
+	0x0D6D6A3EU, 0x7A6A5AA8U, 0xE40ECF0BU, 0x9309FF9DU, 0x0A00AE27U, 0x7D079EB1U,
+	0xF00F9344U, 0x8708A3D2U, 0x1E01F268U, 0x6906C2FEU, 0xF762575DU, 0x806567CBU,
+	0x196C3671U, 0x6E6B06E7U, 0xFED41B76U, 0x89D32BE0U, 0x10DA7A5AU, 0x67DD4ACCU,
+	0xF9B9DF6FU, 0x8EBEEFF9U, 0x17B7BE43U, 0x60B08ED5U, 0xD6D6A3E8U, 0xA1D1937EU,
+	0x38D8C2C4U, 0x4FDFF252U, 0xD1BB67F1U, 0xA6BC5767U, 0x3FB506DDU, 0x48B2364BU,
+	0xD80D2BDAU, 0xAF0A1B4CU, 0x36034AF6U, 0x41047A60U, 0xDF60EFC3U, 0xA867DF55U,
+	0x316E8EEFU, 0x4669BE79U, 0xCB61B38CU, 0xBC66831AU, 0x256FD2A0U, 0x5268E236U,
+	0xCC0C7795U, 0xBB0B4703U, 0x220216B9U, 0x5505262FU, 0xC5BA3BBEU, 0xB2BD0B28U,
+	0x2BB45A92U, 0x5CB36A04U, 0xC2D7FFA7U, 0xB5D0CF31U, 0x2CD99E8BU, 0x5BDEAE1DU,
+	0x9B64C2B0U, 0xEC63F226U, 0x756AA39CU, 0x026D930AU, 0x9C0906A9U, 0xEB0E363FU,
+	0x72076785U, 0x05005713U, 0x95BF4A82U, 0xE2B87A14U, 0x7BB12BAEU, 0x0CB61B38U,
+	0x92D28E9BU, 0xE5D5BE0DU, 0x7CDCEFB7U, 0x0BDBDF21U, 0x86D3D2D4U, 0xF1D4E242U,
+	0x68DDB3F8U, 0x1FDA836EU, 0x81BE16CDU, 0xF6B9265BU, 0x6FB077E1U, 0x18B74777U,
+	0x88085AE6U, 0xFF0F6A70U, 0x66063BCAU, 0x11010B5CU, 0x8F659EFFU, 0xF862AE69U,
+	0x616BFFD3U, 0x166CCF45U, 0xA00AE278U, 0xD70DD2EEU, 0x4E048354U, 0x3903B3C2U,
+	0xA7672661U, 0xD06016F7U, 0x4969474DU, 0x3E6E77DBU, 0xAED16A4AU, 0xD9D65ADCU,
+	0x40DF0B66U, 0x37D83BF0U, 0xA9BCAE53U, 0xDEBB9EC5U, 0x47B2CF7FU, 0x30B5FFE9U,
+	0xBDBDF21CU, 0xCABAC28AU, 0x53B39330U, 0x24B4A3A6U, 0xBAD03605U, 0xCDD70693U,
+	0x54DE5729U, 0x23D967BFU, 0xB3667A2EU, 0xC4614AB8U, 0x5D681B02U, 0x2A6F2B94U,
+	0xB40BBE37U, 0xC30C8EA1U, 0x5A05DF1BU, 0x2D02EF8DU
+};
 
 /// @}
 
@@ -42,13 +174,58 @@ W25Q_STATUS_REG w25q_status; 		///< Internal status structure instance
  * @brief Internal lib's functions
  * @{
  */
-W25Q_STATE W25Q_WriteEnable(bool enable); 	///< Toggle WOL bit
-W25Q_STATE W25Q_EnableQSPI(bool enable);	///< Toggle QE bit
-W25Q_STATE W25Q_Enter4ByteMode(bool enable); 	///< Toggle ADS bit
-W25Q_STATE W25Q_SetExtendedAddr(u8_t Addr);  	///< Set addr in 3-byte mode
-W25Q_STATE W25Q_GetExtendedAddr(u8_t *outAddr); ///< Get addr in 3-byte mode
-
-static inline u32_t page_to_addr(u32_t pageNum, u8_t pageShift); ///< Translate page addr to byte addr
+W25Q_STATE W25Q_WriteEnable(W25Q_Device *dev, bool enable); 	///< Toggle WOL bit
+W25Q_STATE W25Q_EnableQSPI(W25Q_Device *dev, bool enable);	///< Toggle QE bit
+W25Q_STATE W25Q_Enter4ByteMode(W25Q_Device *dev, bool enable); 	///< Toggle ADS bit
+W25Q_STATE W25Q_SetExtendedAddr(W25Q_Device *dev, u8_t Addr);  	///< Set addr in 3-byte mode
+W25Q_STATE W25Q_GetExtendedAddr(W25Q_Device *dev, u8_t *outAddr); ///< Get addr in 3-byte mode
+
+static inline u32_t page_to_addr(W25Q_Device *dev, u32_t pageNum, u8_t pageShift); ///< Translate page addr to byte addr
+static bool need_swap(u8_t size, W25Q_ORDER order);	///< Check if element's bytes must be swapped
+static void swap_bytes(u8_t *dst, const u8_t *src, u32_t len, u8_t size); ///< Reverse bytes of elements
+static u8_t cal_byte(u32_t i);	///< Calibration pattern byte
+static W25Q_STATE cal_check(W25Q_Device *dev, u32_t rawAddr, u16_t passes); ///< Read calibration pattern at current clock
+static u8_t status_merge(u8_t reg_num, const u8_t *sr);	///< Dual-flash status of the pair
+static W25Q_STATE program_pairs(W25Q_Device *dev, u8_t *buf, u16_t len, u32_t rawAddr); ///< Dual-flash odd program
+static W25Q_STATE bank_select(W25Q_Device *dev, u32_t rawAddr); ///< Write extended address register on bank change
+static u32_t op_unit(W25Q_Device *dev, const W25Q_OP *op);	///< Next command's bytes of operation
+static u32_t op_typ(W25Q_Device *dev, const W25Q_OP *op, u32_t unit); ///< Command's typical time, us
+static W25Q_STATE op_issue(W25Q_Device *dev, W25Q_OP *op);	///< Send next command of operation
+static void op_progress(W25Q_OP *op);						///< Update progress and ETA
+static void addr_command(W25Q_Device *dev, QSPI_CommandTypeDef *com, u8_t op3,
+		u8_t op4, u32_t addr);	///< Set opcode and address by addr mode
+static W25Q_STATE fast_read(W25Q_Device *dev, u8_t *buf, u32_t len, u32_t rawAddr, bool dma); ///< Send fast read command
+static W25Q_STATE dma_wait(W25Q_Device *dev);	///< Wait for DMA transfer end
+static W25Q_STATE read_direct(W25Q_Device *dev, u8_t *buf, u32_t len, u32_t rawAddr); ///< DMA read to caller's buffer
+static W25Q_STATE stream_read(W25Q_Device *dev, u32_t len, u32_t rawAddr, stream_fn consume, void *ctx); ///< Stream data to consumer
+static W25Q_STATE erased_part(u8_t *data, u32_t len, void *ctx); ///< Blank check consumer
+static W25Q_STATE stream_run(W25Q_Device *dev, u8_t *buf0, u8_t *buf1, u32_t chunk,
+		u32_t len, u32_t rawAddr, stream_fn consume, void *ctx); ///< Stream ready chip
+static bool vec_check(W25Q_Device *dev, const W25Q_IOVEC *vec, u32_t count); ///< Check vector's segments
+static u32_t crc32_update(u32_t crc, const u8_t *data, u32_t len); ///< Software CRC-32 step
+static HAL_StatusTypeDef bus_command(W25Q_Device *dev, QSPI_CommandTypeDef *com);	///< Send command to transport
+static HAL_StatusTypeDef bus_receive(W25Q_Device *dev, u8_t *buf, bool dma);		///< Receive command's data
+static HAL_StatusTypeDef bus_transmit(W25Q_Device *dev, u8_t *buf, bool dma);	///< Transmit command's data
+static HAL_StatusTypeDef bus_autopoll(W25Q_Device *dev, QSPI_CommandTypeDef *com,
+		QSPI_AutoPollingTypeDef *cfg);	///< Start status polling by transport
+static W25Q_STATE wait_ready(W25Q_Device *dev, u32_t timeout);	///< Wait for BUSY == 0
+static W25Q_STATE wait_write(W25Q_Device *dev, u32_t addr, u32_t len, u32_t typUs,
+		u32_t timeout);	///< Wait for sent program/erase with device given
+static void lock_take(W25Q_Device *dev, bool urgent);	///< Take device's mutex, wait for blocking write
+static u8_t lock_give(W25Q_Device *dev);				///< Give all levels of device's mutex
+static void lock_retake(W25Q_Device *dev, u8_t depth);	///< Take levels given by lock_give back
+static W25Q_STATE init_chip(W25Q_Device *dev);				///< Chip's settings check
+static void status_decode(W25Q_Device *dev, const u8_t *SRs);	///< Status registers to cache
+static W25Q_STATE power_wake(W25Q_Device *dev);		///< Release from power-down
+static void delay_us(u32_t us);						///< Microsecond busy-wait
+static W25Q_STATE write_status(W25Q_Device *dev, u8_t reg_data, u8_t reg_num, bool vol); ///< Write status register
+#if W25Q_STATS_ENABLE
+static void stat_latency(W25Q_Device *dev, W25Q_API api, u32_t ticks, u32_t deadlineUs); ///< Add latency to histogram
+#endif
+#if W25Q_TRACE_ENABLE
+static void trace_begin(W25Q_Device *dev, QSPI_CommandTypeDef *com);	///< Add command to trace ring
+static void trace_end(W25Q_Device *dev, u8_t flags);					///< Finish command's trace record
+#endif
 /// @}
 
 /**
@@ -66,64 +243,135 @@ static inline u32_t page_to_addr(u32_t pageNum, u8_t pageShift); ///< Translate
 /**
  * @brief W25Q Init function
  *
- * @param none
+ * @note Call it before device is used from several tasks
+ * @note Chip busy with a write started before MCU reset is waited
+ * for W25Q_TIMEOUT_INIT, then W25Q_BUSY is returned
+ * (W25Q_SwReset(dev, 1) aborts the write)
+ * @note Boot-to-first-read: tRES1 (3 us), 3 status reads, ReadID and
+ * at most 0xB7/0xE9, EAR read and volatile QE write (no tW). Worst case
+ * adds W25Q_TIMEOUT_INIT (chip busy from before reset) and one tW
+ * (W25Q_TIMEOUT_SR, only non-volatile QE write with W25Q_VOLATILE_QE=0).
+ * Tests/test_init.c measures it on chip model: 9 us at 100 MHz
+ * @param[in] dev Device (made by W25Q_DEVICE_xxx)
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_Init(W25Q_Device *dev) {
+	if (!dev || !dev->bus || !dev->size || !dev->pageSize
+			|| !dev->sectorSize || !dev->blockSize)
+		return W25Q_PARAM_ERR;
+
+	// OS objects are created on first init
+	if (!dev->mutex && !w25q_os_mutex_create(&dev->mutex))
+		return W25Q_CHIP_ERR;
+	if (!dev->sem && !w25q_os_sem_create(&dev->sem))
+		return W25Q_CHIP_ERR;
+#if W25Q_USE_HW_CRC
+	if (!w25q_crc_mutex && !w25q_os_mutex_create(&w25q_crc_mutex))
+		return W25Q_CHIP_ERR;
+#endif
+
+#if W25Q_USE_IT && W25Q_HAL_CALLBACKS
+	// register for HAL callbacks
+	u8_t i, free = W25Q_MAX_DEVICES;
+	for (i = 0; i < W25Q_MAX_DEVICES && w25q_devs[i] != dev; i++)
+		if (!w25q_devs[i] && free == W25Q_MAX_DEVICES)
+			free = i;
+	if (i == W25Q_MAX_DEVICES) {
+		if (free == W25Q_MAX_DEVICES)
+			return W25Q_PARAM_ERR;
+		w25q_devs[free] = dev;
+	}
+#endif
+
+	// big chip: 4-byte commands or 3-byte ones in banks of extended address register
+	dev->ear = W25Q_USE_EAR && dev->size / w25q_chips(dev) > W25Q_ADDR3_MAX;
+	dev->addr4 = !dev->ear && dev->size / w25q_chips(dev) > W25Q_ADDR3_MAX;
+	dev->bank = 0xFF;
+
+	// cycle counter for microsecond waits
+	w25q_os_cycles_start();
+
+	w25q_stat_start();
+	w25q_lock();
+	W25Q_STATE state = init_chip(dev);
+	w25q_unlock();
+	w25q_stat_latency(W25Q_API_INIT);
+
+	return state;
+}
+
+/**
+ * @brief W25Q Init chip
+ * Read chip's state and set 4-byte/quad modes
+ *
+ * @note Status registers are read once, only differing bits are
+ * written: 4-byte mode by command, QE by volatile write (W25Q_VOLATILE_QE),
+ * so cold start has no tW waits and doesn't wear non-volatile bits
+ * @note Called under device's lock
+ * @param[in] dev Device
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_Init(void) {
+W25Q_STATE init_chip(W25Q_Device *dev) {
 	W25Q_STATE state;		// temp status variable
+	u8_t SRs[3] = { 0, };
 
-	// read id
-	u8_t id = 0;
-	state = W25Q_ReadID(&id);
+	// chip could be left powered down before MCU reset
+	state = power_wake(dev);
 	if (state != W25Q_OK)
 		return state;
-	// u can check id here
 
 	// read chip's state to private lib's struct
-	state = W25Q_ReadStatusStruct(NULL);
-	if (state != W25Q_OK)
-		return state;
-
-#if MEM_FLASH_SIZE > 128 // if 4-byte mode
-
-	/* If power-default 4-byte
-	 mode disabled */
-	if (!w25q_status.ADP) {
-		u8_t buf_reg = 0;
-		state = W25Q_ReadStatusReg(&buf_reg, 3);
+	for (u8_t i = 0; i < 3; i++) {
+		state = W25Q_ReadStatusReg(dev, &SRs[i], i + 1);
 		if (state != W25Q_OK)
 			return state;
-		buf_reg |= 0b10; 	// set ADP bit
-		state = W25Q_WriteStatusReg(buf_reg, 3);
+	}
+	status_decode(dev, SRs);
+
+	// chip ignores commands while write runs
+	if (dev->status.BUSY) {
+		state = wait_ready(dev, W25Q_TIMEOUT_INIT);
 		if (state != W25Q_OK)
 			return state;
 	}
 
+	// read id
+	u8_t id = 0;
+	state = W25Q_ReadID(dev, &id);
+	if (state != W25Q_OK)
+		return state;
+	// u can check id here
+
 	/* If current 4-byte
 	 mode disabled */
-	if (!w25q_status.ADS) {
-		state = W25Q_Enter4ByteMode(1);
+	if (dev->addr4 && !dev->status.ADS) {
+		state = W25Q_Enter4ByteMode(dev, 1);
 		if (state != W25Q_OK)
 			return state;
 	}
-#endif
 
-	/* If Quad-SPI mode disabled */
-	if (!w25q_status.QE) {
-		u8_t buf_reg = 0;
-		state = W25Q_ReadStatusReg(&buf_reg, 2);
+	/* Banks need 3-byte mode (ADP could set 4-byte at power-up) */
+	if (dev->ear) {
+		if (dev->status.ADS) {
+			state = W25Q_Enter4ByteMode(dev, 0);
+			if (state != W25Q_OK)
+				return state;
+		}
+		// register is cached, so first access writes it only if needed
+		state = W25Q_GetExtendedAddr(dev, &dev->bank);
 		if (state != W25Q_OK)
 			return state;
-		buf_reg |= 0b10;
-		state = W25Q_WriteStatusReg(buf_reg, 2);
+	}
+
+	/* If Quad-SPI mode disabled */
+	if (dev->quad && !dev->status.QE) {
+		state = write_status(dev, SRs[1] | 0b10, 2, W25Q_VOLATILE_QE);
 		if (state != W25Q_OK)
 			return state;
+		dev->status.QE = 1;
 	}
 
-	// make another read
-	state = W25Q_ReadStatusStruct(NULL);
-	// return communication status
-	return state;
+	return W25Q_OK;
 }
 
 /**
@@ -135,26 +383,60 @@ W25Q_STATE W25Q_Init(void) {
 
 /**
  * @brief W25Q Enable Volatile SR
- * Makes status register volatile (temporary)
+ * Makes next status register write volatile (temporary)
  *
- * @attention Func in development
- * @param none
+ * @note Must be followed by status register write, no WEL is needed.
+ * Volatile write takes effect at once (no tW) and is lost at power off
+ * @param[in] dev Device
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_EnableVolatileSR(void) {
-	return W25Q_PARAM_ERR;
+W25Q_STATE W25Q_EnableVolatileSR(W25Q_Device *dev) {
+	QSPI_CommandTypeDef com;
+
+	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
+	com.Instruction = W25Q_ENABLE_VOLATILE_SR;	 // Command
+
+	com.AddressMode = QSPI_ADDRESS_NONE;
+	com.AddressSize = QSPI_ADDRESS_NONE;
+	com.Address = 0x0U;
+
+	com.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+	com.AlternateBytes = QSPI_ALTERNATE_BYTES_NONE;
+	com.AlternateBytesSize = QSPI_ALTERNATE_BYTES_NONE;
+
+	com.DummyCycles = 0;
+	com.DataMode = QSPI_DATA_NONE;
+	com.NbData = 0;
+
+	com.DdrMode = QSPI_DDR_MODE_DISABLE;
+	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+	w25q_lock();
+	W25Q_STATE state = W25Q_OK;
+	if (bus_command(dev, &com) != HAL_OK)
+		state = W25Q_SPI_ERR;
+	w25q_unlock();
+
+	return state;
 }
 
 /**
  * @brief W25Q Read Status Register
  * Read one status register
  *
+ * @note Dual-flash: bit is set only if it's set in both chips,
+ * BUSY and SUS - if in any chip
+ * @param[in] dev Device
  * @param[out] reg_data 1 byte
  * @param[in] reg_num Desired register 1..3
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ReadStatusReg(u8_t *reg_data, u8_t reg_num) {
+W25Q_STATE W25Q_ReadStatusReg(W25Q_Device *dev, u8_t *reg_data, u8_t reg_num) {
 	QSPI_CommandTypeDef com;
+	u8_t sr[2] = { 0, };
+
+	w25q_stat_inc(statusReads);
 
 	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
 
@@ -167,6 +449,8 @@ W25Q_STATE W25Q_ReadStatusReg(u8_t *reg_data, u8_t reg_num) {
 	else
 		return W25Q_PARAM_ERR;
 
+	w25q_lock();
+
 	com.AddressMode = QSPI_ADDRESS_NONE;
 	com.AddressSize = QSPI_ADDRESS_NONE;
 	com.Address = 0x0U;
@@ -177,41 +461,49 @@ W25Q_STATE W25Q_ReadStatusReg(u8_t *reg_data, u8_t reg_num) {
 
 	com.DummyCycles = 0;
 	com.DataMode = QSPI_DATA_1_LINE;
-	com.NbData = 1;
+	com.NbData = w25q_chips(dev);
 
 	com.DdrMode = QSPI_DDR_MODE_DISABLE;
 	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
-	if (HAL_QSPI_Command(&hqspi, &com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK) {
-		return W25Q_SPI_ERR;
-	}
-	if (HAL_QSPI_Receive(&hqspi, reg_data, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK) {
-		return W25Q_SPI_ERR;
-	}
+	W25Q_STATE state = W25Q_OK;
+	if (bus_command(dev, &com) != HAL_OK || bus_receive(dev, sr, 0) != HAL_OK)
+		state = W25Q_SPI_ERR;
+	else
+		*reg_data = dev->dual ? status_merge(reg_num, sr) : sr[0];
 
-	return W25Q_OK;
+	w25q_unlock();
+	return state;
 }
 
 /**
  * @brief W25Q Write Status Register
  * Write one status register
  *
+ * @note Dual-flash: both chips get the same value
+ * @param[in] dev Device
  * @param[in] reg_data 1 byte
  * @param[in] reg_num Desired register 1..3
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_WriteStatusReg(u8_t reg_data, u8_t reg_num) {
-	while (W25Q_IsBusy() == W25Q_BUSY)
-		w25q_delay(1);
-
-	W25Q_STATE state = W25Q_WriteEnable(1);
-	if (state != W25Q_OK)
-		return state;
+W25Q_STATE W25Q_WriteStatusReg(W25Q_Device *dev, u8_t reg_data, u8_t reg_num) {
+	return write_status(dev, reg_data, reg_num, 0);
+}
 
+/**
+ * @brief Write Status Register
+ * Non-volatile (WEL + tW) or volatile (0x50, at once) write
+ *
+ * @param[in] dev Device
+ * @param[in] reg_data 1 byte
+ * @param[in] reg_num Desired register 1..3
+ * @param[in] vol 1-volatile/0-non-volatile
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE write_status(W25Q_Device *dev, u8_t reg_data, u8_t reg_num, bool vol) {
 	QSPI_CommandTypeDef com;
+	u8_t sr[2] = { reg_data, reg_data };
 
 	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
 
@@ -234,62 +526,62 @@ W25Q_STATE W25Q_WriteStatusReg(u8_t reg_data, u8_t reg_num) {
 
 	com.DummyCycles = 0;
 	com.DataMode = QSPI_DATA_1_LINE;
-	com.NbData = 1;
+	com.NbData = w25q_chips(dev);
 
 	com.DdrMode = QSPI_DDR_MODE_DISABLE;
 	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
-	if (HAL_QSPI_Command(&hqspi, &com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK) {
-		return W25Q_SPI_ERR;
-	}
-	if (HAL_QSPI_Transmit(&hqspi, &reg_data, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK) {
-		return W25Q_SPI_ERR;
-	}
+	w25q_lock();
 
-	return W25Q_OK;
+	W25Q_STATE state = wait_ready(dev, W25Q_TIMEOUT_CE);
+	if (state == W25Q_OK)
+		state = vol ? W25Q_EnableVolatileSR(dev) : W25Q_WriteEnable(dev, 1);
+	if (state == W25Q_OK
+			&& (bus_command(dev, &com) != HAL_OK || bus_transmit(dev, sr, 0) != HAL_OK))
+		state = W25Q_SPI_ERR;
+	if (state == W25Q_OK && !vol)
+		state = wait_ready(dev, W25Q_TIMEOUT_SR);
+
+	w25q_unlock();
+	return state;
 }
 
 /**
  * @brief W25Q Read Status Registers
  * Read all status registers to struct
  *
- * @param[out] status W25Q_STATUS_REG Pointer
+ * @param[in] dev Device
+ * @param[out] status W25Q_STATUS_REG Pointer (NULL - update device's cache only)
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ReadStatusStruct(W25Q_STATUS_REG *status) {
+W25Q_STATE W25Q_ReadStatusStruct(W25Q_Device *dev, W25Q_STATUS_REG *status) {
+	w25q_stat_start();
 	// buffer enum-variable
 	W25Q_STATE state;
 
 	// buffer register variables
 	u8_t SRs[3] = { 0, };
 
+	w25q_lock();
 	// first portion
-	state = W25Q_ReadStatusReg(&SRs[0], 1);
-	if (state != W25Q_OK)
-		return state;
-
+	state = W25Q_ReadStatusReg(dev, &SRs[0], 1);
 	// second portion
-	state = W25Q_ReadStatusReg(&SRs[1], 2);
-	if (state != W25Q_OK)
-		return state;
-
+	if (state == W25Q_OK)
+		state = W25Q_ReadStatusReg(dev, &SRs[1], 2);
 	// third portion
-	state = W25Q_ReadStatusReg(&SRs[2], 3);
-	if (state != W25Q_OK)
-		return state;
-	if(status){
-		status->BUSY = w25q_status.BUSY = SRs[0] & 0b1;
-		status->WEL = w25q_status.WEL = (SRs[0] >> 1) & 0b1;
-		status->QE = w25q_status.QE = (SRs[1] >> 1) & 0b1;
-		status->SUS = w25q_status.SUS = (SRs[1] >> 7) & 0b1;
-		status->ADS = w25q_status.ADS = SRs[2] & 0b1;
-		status->ADP = w25q_status.ADP = (SRs[2] >> 1) & 0b1;
-		status->SLEEP = w25q_status.SLEEP; // возможно нужно вынести в начало (тестить)
+	if (state == W25Q_OK)
+		state = W25Q_ReadStatusReg(dev, &SRs[2], 3);
+	// cache is updated even without output struct, under the lock
+	// (other task could change the chip's state after unlock)
+	if (state == W25Q_OK) {
+		status_decode(dev, SRs);
+		if (status)
+			*status = dev->status;
 	}
+	w25q_unlock();
 
+	w25q_stat_latency(W25Q_API_STATUS);
 	return state;
 }
 
@@ -297,20 +589,25 @@ W25Q_STATE W25Q_ReadStatusStruct(W25Q_STATUS_REG *status) {
  * @brief W25Q Check Busy flag
  * Fast checking Busy flag
  *
- * @param none
+ * @param[in] dev Device
  * @return W25Q_STATE enum (W25Q_OK / W25Q_BUSY)
  */
-W25Q_STATE W25Q_IsBusy(void) {
+W25Q_STATE W25Q_IsBusy(W25Q_Device *dev) {
 	W25Q_STATE state;
 	u8_t sr = 0;
 
-	state = W25Q_ReadStatusReg(&sr, 1);
-	if (state != W25Q_OK)
-		return state;
-
-	w25q_status.BUSY = sr & 0b1;
+	w25q_lock();
+	state = W25Q_ReadStatusReg(dev, &sr, 1);
+	if (state == W25Q_OK) {
+		dev->status.BUSY = sr & 0b1;
+		if (dev->status.BUSY) {
+			w25q_stat_inc(busyPolls);
+			state = W25Q_BUSY;
+		}
+	}
+	w25q_unlock();
 
-	return w25q_status.BUSY ? W25Q_BUSY : W25Q_OK;
+	return state;
 }
 
 /**
@@ -324,38 +621,35 @@ W25Q_STATE W25Q_IsBusy(void) {
  * @brief W25Q Read single Signed Byte
  * Read signed 8-bit byte variable
  *
+ * @param[in] dev Device
  * @param[out] buf Data to be read (single)
  * @param[in] pageShift Byte shift inside page (0..255)
- * @param[in] pageNum Page number (0..PAGE_COUNT-1)
+ * @param[in] pageNum Page number (0..page count - 1)
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ReadSByte(i8_t *buf, u8_t pageShift, u32_t pageNum) {
-	if (pageNum >= PAGE_COUNT)
+W25Q_STATE W25Q_ReadSByte(W25Q_Device *dev, i8_t *buf, u8_t pageShift, u32_t pageNum) {
+	if (pageNum >= dev->size / dev->pageSize)
 		return W25Q_PARAM_ERR;
-	u32_t rawAddr = page_to_addr(pageNum, pageShift);
-	u8_t data;
-	W25Q_STATE state = W25Q_ReadRaw(&data, 1, rawAddr);
-	if (state != W25Q_OK)
-		return state;
-	memcpy(buf, &data, 1);
-	return W25Q_OK;
+	u32_t rawAddr = page_to_addr(dev, pageNum, pageShift);
+	return W25Q_ReadRaw(dev, (u8_t*) buf, 1, rawAddr);
 }
 
 /**
  * @brief W25Q Read single Unsigned Byte
  * Read unsigned 8-bit byte variable
  *
+ * @param[in] dev Device
  * @param[out] buf Data to be read (single)
  * @param[in] pageShift Byte shift inside page (0..255)
- * @param[in] pageNum Page number (0..PAGE_COUNT-1)
+ * @param[in] pageNum Page number (0..page count - 1)
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ReadByte(u8_t *buf, u8_t pageShift, u32_t pageNum) {
-	if (pageNum >= PAGE_COUNT)
+W25Q_STATE W25Q_ReadByte(W25Q_Device *dev, u8_t *buf, u8_t pageShift, u32_t pageNum) {
+	if (pageNum >= dev->size / dev->pageSize)
 		return W25Q_PARAM_ERR;
-	u32_t rawAddr = page_to_addr(pageNum, pageShift);
+	u32_t rawAddr = page_to_addr(dev, pageNum, pageShift);
 	u8_t data;
-	W25Q_STATE state = W25Q_ReadRaw(&data, 1, rawAddr);
+	W25Q_STATE state = W25Q_ReadRaw(dev, &data, 1, rawAddr);
 	if (state != W25Q_OK)
 		return state;
 	buf[0] = data;
@@ -366,84 +660,72 @@ W25Q_STATE W25Q_ReadByte(u8_t *buf, u8_t pageShift, u32_t pageNum) {
  * @brief W25Q Read single Signed Word
  * Read signed 16-bit word variable
  *
+ * @param[in] dev Device
  * @param[out] buf Data to be read (single)
  * @param[in] pageShift Byte shift inside page (0..254)
- * @param[in] pageNum Page number (0..PAGE_COUNT-1)
+ * @param[in] pageNum Page number (0..page count - 1)
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ReadSWord(i16_t *buf, u8_t pageShift, u32_t pageNum) {
-	if (pageNum >= PAGE_COUNT || pageShift > 256 - 2)
+W25Q_STATE W25Q_ReadSWord(W25Q_Device *dev, i16_t *buf, u8_t pageShift, u32_t pageNum) {
+	if (pageNum >= dev->size / dev->pageSize || pageShift > 256 - 2)
 		return W25Q_PARAM_ERR;
-	u32_t rawAddr = page_to_addr(pageNum, pageShift);
-	u8_t data[2];
-	W25Q_STATE state = W25Q_ReadRaw(data, 2, rawAddr);
-	if (state != W25Q_OK)
-		return state;
-	memcpy(buf, data, 2);
-	return W25Q_OK;
+	u32_t rawAddr = page_to_addr(dev, pageNum, pageShift);
+	// straight to variable, no copy
+	return W25Q_ReadRaw(dev, (u8_t*) buf, 2, rawAddr);
 }
 
 /**
  * @brief W25Q Read single Unsigned Word
  * Read unsigned 16-bit word variable
  *
+ * @param[in] dev Device
  * @param[out] buf Data to be read (single)
  * @param[in] pageShift Byte shift inside page (0..254)
- * @param[in] pageNum Page number (0..PAGE_COUNT-1)
+ * @param[in] pageNum Page number (0..page count - 1)
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ReadWord(u16_t *buf, u8_t pageShift, u32_t pageNum) {
-	if (pageNum >= PAGE_COUNT || pageShift > 256 - 2)
+W25Q_STATE W25Q_ReadWord(W25Q_Device *dev, u16_t *buf, u8_t pageShift, u32_t pageNum) {
+	if (pageNum >= dev->size / dev->pageSize || pageShift > 256 - 2)
 		return W25Q_PARAM_ERR;
-	u32_t rawAddr = page_to_addr(pageNum, pageShift);
-	u8_t data[2];
-	W25Q_STATE state = W25Q_ReadRaw(data, 2, rawAddr);
-	if (state != W25Q_OK)
-		return state;
-	memcpy(buf, data, 2);
-	return W25Q_OK;
+	u32_t rawAddr = page_to_addr(dev, pageNum, pageShift);
+	// straight to variable, no copy
+	return W25Q_ReadRaw(dev, (u8_t*) buf, 2, rawAddr);
 }
 
 /**
  * @brief W25Q Read single Signed Long
  * Read signed 32-bit long variable
  *
+ * @param[in] dev Device
  * @param[out] buf Data to be read (single)
  * @param[in] pageShift Byte shift inside page (0..252)
- * @param[in] pageNum Page number (0..PAGE_COUNT-1)
+ * @param[in] pageNum Page number (0..page count - 1)
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ReadSLong(i32_t *buf, u8_t pageShift, u32_t pageNum) {
-	if (pageNum >= PAGE_COUNT || pageShift > 256 - 4)
+W25Q_STATE W25Q_ReadSLong(W25Q_Device *dev, i32_t *buf, u8_t pageShift, u32_t pageNum) {
+	if (pageNum >= dev->size / dev->pageSize || pageShift > 256 - 4)
 		return W25Q_PARAM_ERR;
-	u32_t rawAddr = page_to_addr(pageNum, pageShift);
-	u8_t data[4];
-	W25Q_STATE state = W25Q_ReadRaw(data, 4, rawAddr);
-	if (state != W25Q_OK)
-		return state;
-	memcpy(buf, data, 4);
-	return W25Q_OK;
+	u32_t rawAddr = page_to_addr(dev, pageNum, pageShift);
+	// straight to variable, no copy
+	return W25Q_ReadRaw(dev, (u8_t*) buf, 4, rawAddr);
 }
 
 /**
  * @brief W25Q Read single Signed Long
  * Read signed 32-bit long variable
  *
+ * @param[in] dev Device
  * @param[out] buf Data to be read (single)
  * @param[in] pageShift Byte shift inside page (0..252)
- * @param[in] pageNum Page number (0..PAGE_COUNT-1)
+ * @param[in] pageNum Page number (0..page count - 1)
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ReadLong(u32_t *buf, u8_t pageShift, u32_t pageNum) {
-	if (pageNum >= PAGE_COUNT || pageShift > 256 - 4)
+W25Q_STATE W25Q_ReadLong(W25Q_Device *dev, u32_t *buf, u8_t pageShift, u32_t pageNum) {
+	if (pageNum >= dev->size / dev->pageSize || pageShift > 256 - 4)
 		return W25Q_PARAM_ERR;
-	u32_t rawAddr = page_to_addr(pageNum, pageShift);
-	u8_t data[4];
-	W25Q_STATE state = W25Q_ReadRaw(data, 4, rawAddr);
-	if (state != W25Q_OK)
-		return state;
-	memcpy(buf, data, 4);
-	return W25Q_OK;
+	u32_t rawAddr = page_to_addr(dev, pageNum, pageShift);
+	// straight to variable, no copy
+	return W25Q_ReadRaw(dev, (u8_t*) buf, 4, rawAddr);
 }
 
 /**
@@ -451,17 +733,18 @@ W25Q_STATE W25Q_ReadLong(u32_t *buf, u8_t pageShift, u32_t pageNum) {
  * Read any 8-bit data from preffered page place
  *
  * @note Use memcpy to decode data
+ * @param[in] dev Device
  * @param[out] buf Pointer to data to be read (single or array)
  * @param[in] len Length of data (1..256)
  * @param[in] pageShift Byte shift inside page (0..256 - len)
- * @param[in] pageNum Page number (0..PAGE_COUNT-1)
+ * @param[in] pageNum Page number (0..page count - 1)
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ReadData(u8_t *buf, u16_t len, u8_t pageShift, u32_t pageNum) {
-	if (pageNum >= PAGE_COUNT || len == 0 || len > 256 || pageShift > 256 - len)
+W25Q_STATE W25Q_ReadData(W25Q_Device *dev, u8_t *buf, u16_t len, u8_t pageShift, u32_t pageNum) {
+	if (pageNum >= dev->size / dev->pageSize || len == 0 || len > 256 || pageShift > 256 - len)
 		return W25Q_PARAM_ERR;
-	u32_t rawAddr = page_to_addr(pageNum, pageShift);
-	return W25Q_ReadRaw(buf, len, rawAddr);
+	u32_t rawAddr = page_to_addr(dev, pageNum, pageShift);
+	return W25Q_ReadRaw(dev, buf, len, rawAddr);
 }
 
 /**
@@ -470,52 +753,24 @@ W25Q_STATE W25Q_ReadData(u8_t *buf, u16_t len, u8_t pageShift, u32_t pageNum) {
  *
  * @note Address is in [byte] size
  * @note Be carefull with page overrun
+ * @param[in] dev Device
  * @param[out] buf Pointer to data to be written (single or array)
- * @param[in] data_len Length of data (1..256)
+ * @param[in] data_len Length of data (1..page size)
  * @param[in] rawAddr Start address of chip's cell
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ReadRaw(u8_t *buf, u16_t data_len, u32_t rawAddr) {
-	if (data_len > 256 || data_len == 0)
+W25Q_STATE W25Q_ReadRaw(W25Q_Device *dev, u8_t *buf, u16_t data_len, u32_t rawAddr) {
+	if (data_len > dev->pageSize || data_len == 0)
 		return W25Q_PARAM_ERR;
-
-	while (W25Q_IsBusy() == W25Q_BUSY)
-		w25q_delay(1);
-
-	QSPI_CommandTypeDef com;
-
-	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
-#if MEM_FLASH_SIZE > 128U
-	com.Instruction = W25Q_FAST_READ_QUAD_IO_4B;	 // Command
-	com.AddressSize = QSPI_ADDRESS_32_BITS;
-#else
-		com.Instruction = W25Q_FAST_READ_QUAD_IO;	 // Command
-		com.AddressSize = QSPI_ADDRESS_24_BITS;
-	#endif
-	com.AddressMode = QSPI_ADDRESS_4_LINES;
-
-	com.Address = rawAddr;
-
-	com.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
-	com.AlternateBytes = QSPI_ALTERNATE_BYTES_NONE;
-	com.AlternateBytesSize = QSPI_ALTERNATE_BYTES_NONE;
-
-	com.DummyCycles = 6;
-	com.DataMode = QSPI_DATA_4_LINES;
-	com.NbData = data_len;
-
-	com.DdrMode = QSPI_DDR_MODE_DISABLE;
-	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
-	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
-
-	if (HAL_QSPI_Command(&hqspi, &com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK)
-		return W25Q_SPI_ERR;
-
-	if (HAL_QSPI_Receive(&hqspi, buf, HAL_QSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK)
-		return W25Q_SPI_ERR;
-
-	return W25Q_OK;
+	w25q_stat_start();
+
+	w25q_lock();
+	W25Q_STATE state = wait_ready(dev, W25Q_TIMEOUT_CE);
+	if (state == W25Q_OK)
+		state = fast_read(dev, buf, data_len, rawAddr, 0);
+	w25q_unlock();
+	w25q_stat_latency(W25Q_API_READ);
+	return state;
 }
 
 /**
@@ -523,26 +778,32 @@ W25Q_STATE W25Q_ReadRaw(u8_t *buf, u16_t data_len, u32_t rawAddr) {
  * Read any 8-bit data from preffered chip address by SINGLE SPI
  *
  * @note Works only with SINGLE SPI Line
+ * @note Dual-flash: Addr and len must be even
+ * @param[in] dev Device
  * @param[out] buf Pointer to data array
  * @param[in] len Length of array
  * @param[in] Addr Address to data
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_SingleRead(u8_t *buf, u32_t len, u32_t Addr) {
+W25Q_STATE W25Q_SingleRead(W25Q_Device *dev, u8_t *buf, u32_t len, u32_t Addr) {
+	if (dev->dual && ((Addr | len) & 1U))
+		return W25Q_PARAM_ERR;
+	// command reaches one bank: longer read is split at its end
+	u32_t left = w25q_bank_left(dev, Addr);
+	if (len > left) {
+		w25q_lock();
+		W25Q_STATE state = W25Q_SingleRead(dev, buf, left, Addr);
+		if (state == W25Q_OK)
+			state = W25Q_SingleRead(dev, buf + left, len - left, Addr + left);
+		w25q_unlock();
+		return state;
+	}
 	QSPI_CommandTypeDef com;
 
 	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
-#if MEM_FLASH_SIZE > 128U
-	com.Instruction = W25Q_READ_DATA_4B;	 // Command
-	com.AddressSize = QSPI_ADDRESS_32_BITS;
-#else
-	com.Instruction = W25Q_READ_DATA;	 // Command
-	com.AddressSize = QSPI_ADDRESS_24_BITS;
-#endif
+	addr_command(dev, &com, W25Q_READ_DATA, W25Q_READ_DATA_4B, Addr);
 	com.AddressMode = QSPI_ADDRESS_1_LINE;
 
-	com.Address = Addr;
-
 	com.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
 	com.AlternateBytes = QSPI_ALTERNATE_BYTES_NONE;
 	com.AlternateBytesSize = QSPI_ALTERNATE_BYTES_NONE;
@@ -555,141 +816,522 @@ W25Q_STATE W25Q_SingleRead(u8_t *buf, u32_t len, u32_t Addr) {
 	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
-	if (HAL_QSPI_Command(&hqspi, &com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK)
-		return W25Q_SPI_ERR;
-
-	if (HAL_QSPI_Receive(&hqspi, buf, HAL_QSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK)
-		return W25Q_SPI_ERR;
+	w25q_lock();
+	W25Q_STATE state = bank_select(dev, Addr);
+	if (state == W25Q_OK && (bus_command(dev, &com) != HAL_OK || bus_receive(dev, buf, 0) != HAL_OK))
+		state = W25Q_SPI_ERR;
+	w25q_unlock();
 
-	return W25Q_OK;
+	return state;
 }
 
 /**
- * @}
- * @addtogroup W25Q_Write Write functions
- * @brief Program/write operations - single data type variables or raw 8-bit blocks
- * @{
- */
-
-/**
- * @brief W25Q Burst Wrap settings
- *
- * @attention Func in development
+ * @brief W25Q Read big data from raw addr
+ * Read data of any length by one fast read command
  *
- * @param[in] WrapSize Wrap size: 8/16/32/64 / 0 - disable
+ * @note Address is in [byte] size
+ * @note With W25Q_USE_DMA reads from W25Q_DMA_MIN go by DMA
+ * straight to buf (cache lines are maintained on Cortex-M7)
+ * @param[in] dev Device
+ * @param[out] buf Pointer to data array
+ * @param[in] len Length of data
+ * @param[in] rawAddr Start address of chip's cell
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_SetBurstWrap(u8_t WrapSize) {
-	return W25Q_PARAM_ERR;
+W25Q_STATE W25Q_ReadBulk(W25Q_Device *dev, u8_t *buf, u32_t len, u32_t rawAddr) {
+	if (len == 0 || rawAddr >= dev->size
+			|| len > dev->size - rawAddr)
+		return W25Q_PARAM_ERR;
+	w25q_stat_start();
+
+	w25q_lock();
+	W25Q_STATE state = wait_ready(dev, W25Q_TIMEOUT_CE);
+	if (state == W25Q_OK) {
+		if (W25Q_USE_DMA && dev->bus->dma && len >= W25Q_DMA_MIN)
+			state = read_direct(dev, buf, len, rawAddr);
+		else
+			state = fast_read(dev, buf, len, rawAddr, 0);
+	}
+	w25q_unlock();
+	w25q_stat_latency(W25Q_API_READ_BULK);
+	return state;
 }
 
+/// Scatter consumer's context
+typedef struct {
+	const W25Q_IOVEC *vec;	///< Current segment
+	u32_t off;				///< Offset in current segment
+} scatter_ctx;
+
 /**
- * @brief W25Q Program single Signed Byte
- * Program signed 8-bit byte variable
+ * @brief Scatter consumer
+ * Copy streamed part to vector's segments
  *
- * @param[in] buf Data to be written (single)
- * @param[in] pageShift Byte shift inside page (0..255)
- * @param[in] pageNum Page number (0..PAGE_COUNT-1)
+ * @param[in] data Streamed part
+ * @param[in] len Part length
+ * @param[in,out] ctx Pointer to scatter_ctx
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ProgramSByte(i8_t buf, u8_t pageShift, u32_t pageNum) {
-	if (pageNum >= PAGE_COUNT)
-		return W25Q_PARAM_ERR;
-	u32_t rawAddr = page_to_addr(pageNum, pageShift);
-	u8_t data;
-	memcpy(&data, &buf, 1);
-	return W25Q_ProgramRaw(&data, 1, rawAddr);
+static W25Q_STATE scatter_part(u8_t *data, u32_t len, void *ctx) {
+	scatter_ctx *sc = ctx;
+	while (len) {
+		u32_t n = sc->vec->len - sc->off;
+		if (n > len)
+			n = len;
+		memcpy(sc->vec->buf + sc->off, data, n);
+		data += n;
+		len -= n;
+		sc->off += n;
+		if (sc->off == sc->vec->len) {
+			sc->vec++;
+			sc->off = 0;
+		}
+	}
+	return W25Q_OK;
 }
 
 /**
- * @brief W25Q Program single Unsigned Byte
- * Program unsigned 8-bit byte vairable
+ * @brief W25Q Read vector
+ * Read several segments by one batch
  *
- * @param[in] buf Data to be written (single)
- * @param[in] pageShift Byte shift inside page (0..255)
- * @param[in] pageNum Page number (0..PAGE_COUNT-1)
+ * @note Chip is checked for BUSY once. Segments following each other
+ * in chip are read by one long command: directly if their buffers
+ * follow each other too, else through stream buffer
+ * @param[in] dev Device
+ * @param[in] vec Segments {addr, buf, len}
+ * @param[in] count Count of segments
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ProgramByte(u8_t buf, u8_t pageShift, u32_t pageNum) {
-	if (pageNum >= PAGE_COUNT)
+W25Q_STATE W25Q_ReadV(W25Q_Device *dev, const W25Q_IOVEC *vec, u32_t count) {
+	if (!vec_check(dev, vec, count))
 		return W25Q_PARAM_ERR;
-	u32_t rawAddr = page_to_addr(pageNum, pageShift);
-	u8_t data;
-	memcpy(&data, &buf, 1);
-	return W25Q_ProgramRaw(&data, 1, rawAddr);
+	w25q_stat_start();
+
+	w25q_lock();
+	W25Q_STATE state = wait_ready(dev, W25Q_TIMEOUT_CE);
+	for (u32_t i = 0; i < count && state == W25Q_OK;) {
+		// run of segments continuing each other in chip
+		u32_t len = vec[i].len, j = i + 1;
+		bool linear = 1;
+		for (; j < count && vec[j].addr == vec[i].addr + len; j++) {
+			linear = linear && vec[j].buf == vec[i].buf + len;
+			len += vec[j].len;
+		}
+
+		if (linear)
+			state = fast_read(dev, vec[i].buf, len, vec[i].addr, 0);
+		else {
+			scatter_ctx sc = { &vec[i], 0 };
+			state = stream_run(dev, dev->streamBuf[0], dev->streamBuf[1],
+					W25Q_STREAM_CHUNK, len, vec[i].addr, scatter_part, &sc);
+		}
+		i = j;
+	}
+	w25q_unlock();
+
+	w25q_stat_latency(W25Q_API_READ_V);
+	return state;
 }
 
 /**
- * @brief W25Q Program single Signed Word
- * Program signed 16-bit word vairable
+ * @brief W25Q Read pipeline
+ * Read region by chunks to caller's ping-pong buffers and give
+ * every chunk to consumer while the next one is read by DMA
  *
- * @param[in] buf Data to be written (single)
- * @param[in] pageShift Byte shift inside page (0..254)
- * @param[in] pageNum Page number (0..PAGE_COUNT-1)
- * @return W25Q_STATE enum
+ * @note Chunk's buffer is read again after consumer returns, so
+ * consumer must be done with it (copy or wait for own peripheral).
+ * Longer chunks have less command overhead per byte.
+ * Device is locked till the end
+ * @note With D-cache buffers must be cache-line aligned and
+ * chunk - multiple of cache line
+ * @param[in] dev Device
+ * @param[in] buf0 First buffer
+ * @param[in] buf1 Second buffer
+ * @param[in] chunk Size of each buffer (even in dual-flash)
+ * @param[in] len Length of data
+ * @param[in] rawAddr Start address of chip's cell
+ * @param[in] consume Chunk callback, stops the pipeline if returns not W25Q_OK
+ * @param[in] ctx Callback's context
+ * @return W25Q_STATE enum (callback's state on stop)
  */
-W25Q_STATE W25Q_ProgramSWord(i16_t buf, u8_t pageShift, u32_t pageNum) {
-	if (pageNum >= PAGE_COUNT || pageShift > 256 - 2)
+W25Q_STATE W25Q_ReadPipe(W25Q_Device *dev, u8_t *buf0, u8_t *buf1, u32_t chunk,
+		u32_t len, u32_t rawAddr, W25Q_CHUNK_FN consume, void *ctx) {
+	if (!buf0 || !buf1 || buf0 == buf1 || !consume || chunk < 2
+			|| (dev->dual && (chunk & 1U)))
 		return W25Q_PARAM_ERR;
-	u32_t rawAddr = page_to_addr(pageNum, pageShift);
-	u8_t data[2];
-	memcpy(data, &buf, 2);
-	return W25Q_ProgramRaw(data, 2, rawAddr);
+	if (len == 0 || rawAddr >= dev->size || len > dev->size - rawAddr)
+		return W25Q_PARAM_ERR;
+	// DMA'd lines mustn't be shared with other data
+	if (W25Q_USE_DCACHE && (((uintptr_t) buf0 | (uintptr_t) buf1 | chunk)
+			& (W25Q_CACHE_LINE - 1U)))
+		return W25Q_PARAM_ERR;
+	w25q_stat_start();
+
+	w25q_lock();
+	W25Q_STATE state = wait_ready(dev, W25Q_TIMEOUT_CE);
+	if (state == W25Q_OK)
+		state = stream_run(dev, buf0, buf1, chunk, len, rawAddr, consume, ctx);
+	w25q_unlock();
+
+	w25q_stat_latency(W25Q_API_READ_PIPE);
+	return state;
 }
 
 /**
- * @brief W25Q Program single Unsigned Word
- * Program unsigned 16-bit word vairable
+ * @brief W25Q Read array
+ * Read array of 8/16/32-bit elements by one fast read command
  *
- * @param[in] buf Data to be written (single)
- * @param[in] pageShift Byte shift inside page (0..254)
- * @param[in] pageNum Page number (0..PAGE_COUNT-1)
+ * @note Elements are read straight to buf, then converted
+ * to MCU's byte order in place word-at-a-time
+ * @param[in] dev Device
+ * @param[out] buf Pointer to array
+ * @param[in] count Count of elements
+ * @param[in] size Size of element (1, 2 or 4 bytes)
+ * @param[in] order Byte order of elements in chip
+ * @param[in] rawAddr Start address of chip's cell
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ProgramWord(u16_t buf, u8_t pageShift, u32_t pageNum) {
-	if (pageNum >= PAGE_COUNT || pageShift > 256 - 2)
+W25Q_STATE W25Q_ReadArray(W25Q_Device *dev, void *buf, u32_t count, u8_t size,
+		W25Q_ORDER order, u32_t rawAddr) {
+	if ((size != 1 && size != 2 && size != 4) || count == 0
+			|| count > dev->size / size)
 		return W25Q_PARAM_ERR;
-	u32_t rawAddr = page_to_addr(pageNum, pageShift);
-	u8_t data[2];
-	memcpy(data, &buf, 2);
-	return W25Q_ProgramRaw(data, 2, rawAddr);
+	W25Q_STATE state = W25Q_ReadBulk(dev, buf, count * size, rawAddr);
+	if (state == W25Q_OK && need_swap(size, order))
+		swap_bytes(buf, buf, count * size, size);
+	return state;
 }
 
-/**
- * @brief W25Q Program single Signed Long
- * Program signed 32-bit long vairable
- *
- * @param[in] buf Data to be written (single)
- * @param[in] pageShift Byte shift inside page (0..252)
- * @param[in] pageNum Page number (0..PAGE_COUNT-1)
- * @return W25Q_STATE enum
- */
-W25Q_STATE W25Q_ProgramSLong(i32_t buf, u8_t pageShift, u32_t pageNum) {
-	if (pageNum >= PAGE_COUNT || pageShift > 256 - 4)
-		return W25Q_PARAM_ERR;
-	u32_t rawAddr = page_to_addr(pageNum, pageShift);
-	u8_t data[4];
-	memcpy(data, &buf, 4);
-	return W25Q_ProgramRaw(data, 4, rawAddr);
+/// @brief W25Q Read signed 8-bit array @see W25Q_ReadArray
+W25Q_STATE W25Q_ReadArraySByte(W25Q_Device *dev, i8_t *buf, u32_t count, u32_t rawAddr) {
+	return W25Q_ReadArray(dev, buf, count, 1, W25Q_ORDER_NATIVE, rawAddr);
 }
 
-/**
- * @brief W25Q Program single Unigned Long
- * Program unsigned 32-bit long vairable
- *
- * @param[in] buf Data to be written (single)
- * @param[in] pageShift Byte shift inside page (0..252)
- * @param[in] pageNum Page number (0..PAGE_COUNT-1)
+/// @brief W25Q Read 8-bit array @see W25Q_ReadArray
+W25Q_STATE W25Q_ReadArrayByte(W25Q_Device *dev, u8_t *buf, u32_t count, u32_t rawAddr) {
+	return W25Q_ReadArray(dev, buf, count, 1, W25Q_ORDER_NATIVE, rawAddr);
+}
+
+/// @brief W25Q Read signed 16-bit array @see W25Q_ReadArray
+W25Q_STATE W25Q_ReadArraySWord(W25Q_Device *dev, i16_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr) {
+	return W25Q_ReadArray(dev, buf, count, 2, order, rawAddr);
+}
+
+/// @brief W25Q Read 16-bit array @see W25Q_ReadArray
+W25Q_STATE W25Q_ReadArrayWord(W25Q_Device *dev, u16_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr) {
+	return W25Q_ReadArray(dev, buf, count, 2, order, rawAddr);
+}
+
+/// @brief W25Q Read signed 32-bit array @see W25Q_ReadArray
+W25Q_STATE W25Q_ReadArraySLong(W25Q_Device *dev, i32_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr) {
+	return W25Q_ReadArray(dev, buf, count, 4, order, rawAddr);
+}
+
+/// @brief W25Q Read 32-bit array @see W25Q_ReadArray
+W25Q_STATE W25Q_ReadArrayLong(W25Q_Device *dev, u32_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr) {
+	return W25Q_ReadArray(dev, buf, count, 4, order, rawAddr);
+}
+
+/// @brief W25Q Read float array (IEEE 754 single) @see W25Q_ReadArray
+W25Q_STATE W25Q_ReadArrayFloat(W25Q_Device *dev, fl_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr) {
+	return W25Q_ReadArray(dev, buf, count, sizeof(fl_t), order, rawAddr);
+}
+
+/**
+ * @}
+ * @addtogroup W25Q_Check Verify functions
+ * @brief Compare or checksum chip's data without user's read buffers
+ * @{
+ */
+
+/**
+ * @brief Verify consumer
+ * Compare streamed part with user's data
+ *
+ * @param[in] data Streamed part
+ * @param[in] len Part length
+ * @param[in,out] ctx Pointer to user's data pointer
+ * @return W25Q_STATE enum (W25Q_OK / W25Q_VERIFY_ERR)
+ */
+static W25Q_STATE verify_part(u8_t *data, u32_t len, void *ctx) {
+	u8_t **ref = ctx;
+	if (memcmp(data, *ref, len))
+		return W25Q_VERIFY_ERR;
+	*ref += len;
+	return W25Q_OK;
+}
+
+/// Checksum consumer's context
+typedef struct {
+	W25Q_CRC_ALGO algo;	///< Algorithm
+	u32_t crc;			///< Current value
+	bool first;			///< First part flag
+} crc_ctx;
+
+/**
+ * @brief Checksum consumer
+ * Add streamed part to checksum
+ *
+ * @param[in] data Streamed part
+ * @param[in] len Part length
+ * @param[in,out] ctx crc_ctx pointer
+ * @return W25Q_STATE enum
+ */
+static W25Q_STATE crc_part(u8_t *data, u32_t len, void *ctx) {
+	crc_ctx *c = ctx;
+#if W25Q_USE_HW_CRC
+	if (c->algo == W25Q_CRC32_HW) {
+		if (c->first)
+			c->crc = HAL_CRC_Calculate(&hcrc, (u32_t*) data, len / 4);
+		else
+			c->crc = HAL_CRC_Accumulate(&hcrc, (u32_t*) data, len / 4);
+		c->first = 0;
+		return W25Q_OK;
+	}
+#endif
+	c->crc = crc32_update(c->crc, data, len);
+	return W25Q_OK;
+}
+
+/**
+ * @brief W25Q Verify data
+ * Compare chip's data with buffer
+ *
+ * @note Chip is read by long fast read commands, stops at first mismatch
+ * @param[in] dev Device
+ * @param[in] buf Pointer to reference data
+ * @param[in] len Length of data
+ * @param[in] rawAddr Start address of chip's cell
+ * @return W25Q_STATE enum (W25Q_OK / W25Q_VERIFY_ERR on mismatch)
+ */
+W25Q_STATE W25Q_Verify(W25Q_Device *dev, u8_t *buf, u32_t len, u32_t rawAddr) {
+	w25q_stat_start();
+	W25Q_STATE state = stream_read(dev, len, rawAddr, verify_part, &buf);
+	w25q_stat_latency(W25Q_API_VERIFY);
+	return state;
+}
+
+/**
+ * @brief W25Q Checksum
+ * Calculate checksum of chip's data
+ *
+ * @note W25Q_CRC32_HW result depends on CRC unit's configuration
+ * (e.g. CRC-32/MPEG-2 on 32-bit words for STM32F4)
+ * @note W25Q_CRC32_HW calls of all devices are serialized by one mutex,
+ * application mustn't use hcrc while a checksum runs
+ * @param[in] dev Device
+ * @param[out] crc Checksum
+ * @param[in] len Length of data (multiple of 4 for W25Q_CRC32_HW)
+ * @param[in] rawAddr Start address of chip's cell
+ * @param[in] algo Checksum algorithm
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_Checksum(W25Q_Device *dev, u32_t *crc, u32_t len, u32_t rawAddr, W25Q_CRC_ALGO algo) {
+	crc_ctx c = { algo, 0xFFFFFFFFU, 1 };
+
+	if (algo == W25Q_CRC32_HW) {
+#if W25Q_USE_HW_CRC
+		if (len % 4)
+			return W25Q_PARAM_ERR;
+#else
+		return W25Q_PARAM_ERR;
+#endif
+	} else if (algo != W25Q_CRC32)
+		return W25Q_PARAM_ERR;
+
+	w25q_stat_start();
+#if W25Q_USE_HW_CRC
+	// unit keeps sum between parts, other device mustn't feed it
+	if (algo == W25Q_CRC32_HW)
+		w25q_os_mutex_lock(w25q_crc_mutex);
+#endif
+	W25Q_STATE state = stream_read(dev, len, rawAddr, crc_part, &c);
+#if W25Q_USE_HW_CRC
+	if (algo == W25Q_CRC32_HW)
+		w25q_os_mutex_unlock(w25q_crc_mutex);
+#endif
+	w25q_stat_latency(W25Q_API_CHECKSUM);
+	if (state != W25Q_OK)
+		return state;
+
+	*crc = algo == W25Q_CRC32 ? ~c.crc : c.crc;
+	return W25Q_OK;
+}
+
+/**
+ * @brief W25Q CRC-32 of RAM data
+ * Same CRC-32 as W25Q_Checksum, for records of modules over the driver
+ *
+ * @param[in] crc Previous result (0 - new calculation)
+ * @param[in] data Pointer to data
+ * @param[in] len Length of data
+ * @return CRC-32
+ */
+u32_t W25Q_CalcCRC(u32_t crc, const void *data, u32_t len) {
+	return ~crc32_update(~crc, data, len);
+}
+
+/**
+ * @brief W25Q Erased data check
+ * Check if data is all 0xFF (erased state) word-at-a-time,
+ * for blank page skipping of modules over the driver
+ *
+ * @param[in] buf Pointer to data
+ * @param[in] len Length of data
+ * @return 1-all 0xFF/0-has programmed bits
+ */
+bool W25Q_IsErased(const u8_t *buf, u32_t len) {
+	// unaligned head
+	while (len && ((uintptr_t) buf & 0b11)) {
+		if (*buf++ != 0xFF)
+			return 0;
+		len--;
+	}
+	// aligned words
+	const u32_t *word = (const u32_t*) buf;
+	for (; len >= 4; len -= 4)
+		if (*word++ != 0xFFFFFFFFU)
+			return 0;
+	// tail
+	buf = (const u8_t*) word;
+	while (len--)
+		if (*buf++ != 0xFF)
+			return 0;
+	return 1;
+}
+
+/**
+ * @}
+ * @addtogroup W25Q_Write Write functions
+ * @brief Program/write operations - single data type variables or raw 8-bit blocks
+ * @{
+ */
+
+/**
+ * @brief W25Q Burst Wrap settings
+ *
+ * @attention Func in development
+ *
+ * @param[in] dev Device
+ * @param[in] WrapSize Wrap size: 8/16/32/64 / 0 - disable
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_SetBurstWrap(W25Q_Device *dev, u8_t WrapSize) {
+	return W25Q_PARAM_ERR;
+}
+
+/**
+ * @brief W25Q Program single Signed Byte
+ * Program signed 8-bit byte variable
+ *
+ * @param[in] dev Device
+ * @param[in] buf Data to be written (single)
+ * @param[in] pageShift Byte shift inside page (0..255)
+ * @param[in] pageNum Page number (0..page count - 1)
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_ProgramSByte(W25Q_Device *dev, i8_t buf, u8_t pageShift, u32_t pageNum) {
+	if (pageNum >= dev->size / dev->pageSize)
+		return W25Q_PARAM_ERR;
+	u32_t rawAddr = page_to_addr(dev, pageNum, pageShift);
+	u8_t data;
+	memcpy(&data, &buf, 1);
+	return W25Q_ProgramRaw(dev, &data, 1, rawAddr);
+}
+
+/**
+ * @brief W25Q Program single Unsigned Byte
+ * Program unsigned 8-bit byte vairable
+ *
+ * @param[in] dev Device
+ * @param[in] buf Data to be written (single)
+ * @param[in] pageShift Byte shift inside page (0..255)
+ * @param[in] pageNum Page number (0..page count - 1)
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_ProgramByte(W25Q_Device *dev, u8_t buf, u8_t pageShift, u32_t pageNum) {
+	if (pageNum >= dev->size / dev->pageSize)
+		return W25Q_PARAM_ERR;
+	u32_t rawAddr = page_to_addr(dev, pageNum, pageShift);
+	u8_t data;
+	memcpy(&data, &buf, 1);
+	return W25Q_ProgramRaw(dev, &data, 1, rawAddr);
+}
+
+/**
+ * @brief W25Q Program single Signed Word
+ * Program signed 16-bit word vairable
+ *
+ * @param[in] dev Device
+ * @param[in] buf Data to be written (single)
+ * @param[in] pageShift Byte shift inside page (0..254)
+ * @param[in] pageNum Page number (0..page count - 1)
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_ProgramSWord(W25Q_Device *dev, i16_t buf, u8_t pageShift, u32_t pageNum) {
+	if (pageNum >= dev->size / dev->pageSize || pageShift > 256 - 2)
+		return W25Q_PARAM_ERR;
+	u32_t rawAddr = page_to_addr(dev, pageNum, pageShift);
+	u8_t data[2];
+	memcpy(data, &buf, 2);
+	return W25Q_ProgramRaw(dev, data, 2, rawAddr);
+}
+
+/**
+ * @brief W25Q Program single Unsigned Word
+ * Program unsigned 16-bit word vairable
+ *
+ * @param[in] dev Device
+ * @param[in] buf Data to be written (single)
+ * @param[in] pageShift Byte shift inside page (0..254)
+ * @param[in] pageNum Page number (0..page count - 1)
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_ProgramWord(W25Q_Device *dev, u16_t buf, u8_t pageShift, u32_t pageNum) {
+	if (pageNum >= dev->size / dev->pageSize || pageShift > 256 - 2)
+		return W25Q_PARAM_ERR;
+	u32_t rawAddr = page_to_addr(dev, pageNum, pageShift);
+	u8_t data[2];
+	memcpy(data, &buf, 2);
+	return W25Q_ProgramRaw(dev, data, 2, rawAddr);
+}
+
+/**
+ * @brief W25Q Program single Signed Long
+ * Program signed 32-bit long vairable
+ *
+ * @param[in] dev Device
+ * @param[in] buf Data to be written (single)
+ * @param[in] pageShift Byte shift inside page (0..252)
+ * @param[in] pageNum Page number (0..page count - 1)
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_ProgramSLong(W25Q_Device *dev, i32_t buf, u8_t pageShift, u32_t pageNum) {
+	if (pageNum >= dev->size / dev->pageSize || pageShift > 256 - 4)
+		return W25Q_PARAM_ERR;
+	u32_t rawAddr = page_to_addr(dev, pageNum, pageShift);
+	u8_t data[4];
+	memcpy(data, &buf, 4);
+	return W25Q_ProgramRaw(dev, data, 4, rawAddr);
+}
+
+/**
+ * @brief W25Q Program single Unigned Long
+ * Program unsigned 32-bit long vairable
+ *
+ * @param[in] dev Device
+ * @param[in] buf Data to be written (single)
+ * @param[in] pageShift Byte shift inside page (0..252)
+ * @param[in] pageNum Page number (0..page count - 1)
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ProgramLong(u32_t buf, u8_t pageShift, u32_t pageNum) {
-	if (pageNum >= PAGE_COUNT || pageShift > 256 - 4)
+W25Q_STATE W25Q_ProgramLong(W25Q_Device *dev, u32_t buf, u8_t pageShift, u32_t pageNum) {
+	if (pageNum >= dev->size / dev->pageSize || pageShift > 256 - 4)
 		return W25Q_PARAM_ERR;
-	u32_t rawAddr = page_to_addr(pageNum, pageShift);
+	u32_t rawAddr = page_to_addr(dev, pageNum, pageShift);
 	u8_t data[4];
 	memcpy(data, &buf, 4);
-	return W25Q_ProgramRaw(data, 4, rawAddr);
+	return W25Q_ProgramRaw(dev, data, 4, rawAddr);
 }
 
 /**
@@ -697,17 +1339,18 @@ W25Q_STATE W25Q_ProgramLong(u32_t buf, u8_t pageShift, u32_t pageNum) {
  * Program any 8-bit data to preffered page place
  *
  * @note Use memcpy to prepare data
+ * @param[in] dev Device
  * @param[in] buf Pointer to data to be written (single or array)
  * @param[in] len Length of data (1..256)
  * @param[in] pageShift Byte shift inside page (0..256 - len)
- * @param[in] pageNum Page number (0..PAGE_COUNT-1)
+ * @param[in] pageNum Page number (0..page count - 1)
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ProgramData(u8_t *buf, u16_t len, u8_t pageShift, u32_t pageNum) {
-	if (pageNum >= PAGE_COUNT || len == 0 || len > 256 || pageShift > 256 - len)
+W25Q_STATE W25Q_ProgramData(W25Q_Device *dev, u8_t *buf, u16_t len, u8_t pageShift, u32_t pageNum) {
+	if (pageNum >= dev->size / dev->pageSize || len == 0 || len > 256 || pageShift > 256 - len)
 		return W25Q_PARAM_ERR;
-	u32_t rawAddr = page_to_addr(pageNum, pageShift);
-	return W25Q_ProgramRaw(buf, len, rawAddr);
+	u32_t rawAddr = page_to_addr(dev, pageNum, pageShift);
+	return W25Q_ProgramRaw(dev, buf, len, rawAddr);
 }
 
 /**
@@ -716,60 +1359,271 @@ W25Q_STATE W25Q_ProgramData(u8_t *buf, u16_t len, u8_t pageShift, u32_t pageNum)
  *
  * @note Address is in [byte] size
  * @note Be carefull with page overrun
+ * @param[in] dev Device
  * @param[in] buf Pointer to data to be written (single or array)
- * @param[in] data_len Length of data (1..256)
+ * @param[in] data_len Length of data (1..page size)
  * @param[in] rawAddr Start address of chip's cell
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ProgramRaw(u8_t *buf, u16_t data_len, u32_t rawAddr) {
-	if (data_len > 256 || data_len == 0)
+W25Q_STATE W25Q_ProgramRaw(W25Q_Device *dev, u8_t *buf, u16_t data_len, u32_t rawAddr) {
+	if (data_len > dev->pageSize || data_len == 0)
 		return W25Q_PARAM_ERR;
-
-	while (W25Q_IsBusy() == W25Q_BUSY)
-		w25q_delay(1);
-
-	W25Q_STATE state = W25Q_WriteEnable(1);
-	if (state != W25Q_OK)
-		return state;
+	if (dev->dual && ((rawAddr | data_len) & 1U))
+		return program_pairs(dev, buf, data_len, rawAddr);
+	w25q_stat_start();
 
 	QSPI_CommandTypeDef com;
 
 	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
-#if MEM_FLASH_SIZE > 128U
-	com.Instruction = W25Q_PAGE_PROGRAM_QUAD_INP_4B;	 // Command
-	com.AddressSize = QSPI_ADDRESS_32_BITS;
-#else
-		com.Instruction = W25Q_PAGE_PROGRAM_QUAD_INP;	 // Command
-		com.AddressSize = QSPI_ADDRESS_24_BITS;
-	#endif
+	if (dev->quad)
+		addr_command(dev, &com, W25Q_PAGE_PROGRAM_QUAD_INP,
+				W25Q_PAGE_PROGRAM_QUAD_INP_4B, rawAddr);
+	else
+		addr_command(dev, &com, W25Q_PAGE_PROGRAM, W25Q_PAGE_PROGRAM_4B, rawAddr);
 	com.AddressMode = QSPI_ADDRESS_1_LINE;
 
-	com.Address = rawAddr;
-
 	com.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
 	com.AlternateBytes = QSPI_ALTERNATE_BYTES_NONE;
 	com.AlternateBytesSize = QSPI_ALTERNATE_BYTES_NONE;
 
 	com.DummyCycles = 0;
-	com.DataMode = QSPI_DATA_4_LINES;
+	com.DataMode = dev->quad ? QSPI_DATA_4_LINES : QSPI_DATA_1_LINE;
 	com.NbData = data_len;
 
 	com.DdrMode = QSPI_DDR_MODE_DISABLE;
 	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
-	if (HAL_QSPI_Command(&hqspi, &com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK)
-		return W25Q_SPI_ERR;
+	w25q_lock();
+	W25Q_STATE state = wait_ready(dev, W25Q_TIMEOUT_CE);
+	if (state == W25Q_OK)
+		state = bank_select(dev, rawAddr);
+	if (state == W25Q_OK)
+		state = W25Q_WriteEnable(dev, 1);
+	// long page goes by DMA from caller's buffer
+	bool dma = W25Q_USE_DMA && dev->bus->dma && data_len >= W25Q_DMA_MIN;
+	if (dma)
+		w25q_dcache_clean(buf, data_len);
+	if (state == W25Q_OK && (bus_command(dev, &com) != HAL_OK || bus_transmit(dev, buf, dma) != HAL_OK))
+		state = W25Q_SPI_ERR;
+	if (state == W25Q_OK && dma)
+		state = dma_wait(dev);
+	if (state == W25Q_OK)
+		state = wait_write(dev, rawAddr - rawAddr % dev->pageSize, dev->pageSize,
+				W25Q_TYP_PP_US, W25Q_TIMEOUT_PP);
+	w25q_unlock();
+
+	w25q_stat_latency(W25Q_API_PROGRAM);
+	return state;
+}
 
-	if (HAL_QSPI_Transmit(&hqspi, buf, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK)
-		return W25Q_SPI_ERR;
+/**
+ * @brief W25Q Program big data to raw addr
+ * Program data of any length (firmware image etc.) page by page
+ *
+ * @note Pages filled with 0xFF are skipped - programming 0xFF
+ * doesn't change erased NOR cells, so the result is the same
+ * @note With erase enabled every sector covered by data is
+ * blank-checked first and erased only if it's not blank.
+ * Covered sectors are owned by the data: rawAddr must be
+ * sector-aligned and the rest of the last sector after data is
+ * erased too (shorter image over longer one leaves no old tail)
+ * @note Device is held for the whole call, so other tasks
+ * can't write between blank check and program (only W25Q_ReadUrgent
+ * reads while a command runs)
+ * @param[in] dev Device
+ * @param[in] buf Pointer to data to be written
+ * @param[in] len Length of data
+ * @param[in] rawAddr Start address of chip's cell
+ * @param[in] erase 1-erase covered sectors if needed/0-area is already erased
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_ProgramBulk(W25Q_Device *dev, u8_t *buf, u32_t len, u32_t rawAddr, bool erase) {
+	if (len == 0 || rawAddr >= dev->size
+			|| len > dev->size - rawAddr)
+		return W25Q_PARAM_ERR;
+	if (erase && rawAddr % dev->sectorSize)
+		return W25Q_PARAM_ERR;
+	w25q_stat_start();
+
+	W25Q_STATE state = W25Q_OK;
+	u32_t end = rawAddr + len;
+
+	w25q_lock();
+	while (state == W25Q_OK && rawAddr < end) {
+		// new sector - erase it if it's not blank yet
+		if (erase && rawAddr % dev->sectorSize == 0) {
+			bool blank = 0;
+			u32_t sect = rawAddr / dev->sectorSize;
+			state = W25Q_SectorBlankCheck(dev, &blank, sect);
+			if (state == W25Q_OK && !blank)
+				state = W25Q_EraseSector(dev, sect);
+			if (state != W25Q_OK)
+				break;
+		}
+
+		// till the end of the page
+		u32_t chunk = dev->pageSize - rawAddr % dev->pageSize;
+		if (chunk > end - rawAddr)
+			chunk = end - rawAddr;
+
+		if (!W25Q_IsErased(buf, chunk))
+			state = W25Q_ProgramRaw(dev, buf, chunk, rawAddr);
+
+		buf += chunk;
+		rawAddr += chunk;
+	}
+	w25q_unlock();
 
-	while (W25Q_IsBusy() == W25Q_BUSY)
-		w25q_delay(1);
+	w25q_stat_latency(W25Q_API_PROGRAM_BULK);
+	return state;
+}
 
-	return W25Q_OK;
+/**
+ * @brief W25Q Program vector
+ * Program several segments by one batch
+ *
+ * @note Segments following each other in chip are packed to whole
+ * pages (stream buffer), every page is programmed by one command.
+ * Pages filled with 0xFF are skipped. Area must be erased
+ * @param[in] dev Device
+ * @param[in] vec Segments {addr, buf, len}
+ * @param[in] count Count of segments
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_ProgramV(W25Q_Device *dev, const W25Q_IOVEC *vec, u32_t count) {
+	if (!vec_check(dev, vec, count))
+		return W25Q_PARAM_ERR;
+	w25q_stat_start();
+
+	w25q_lock();
+	W25Q_STATE state = W25Q_OK;
+	u8_t *page = dev->streamBuf[0];
+	u32_t start = 0, fill = 0;	// packed data: address and length
+
+	for (u32_t i = 0; i < count && state == W25Q_OK; i++) {
+		u32_t addr = vec[i].addr;
+		u8_t *src = vec[i].buf;
+		u32_t left = vec[i].len;
+
+		while (left && state == W25Q_OK) {
+			// gap in chip - program what is packed
+			if (fill && addr != start + fill) {
+				if (!W25Q_IsErased(page, fill))
+					state = W25Q_ProgramRaw(dev, page, fill, start);
+				fill = 0;
+				if (state != W25Q_OK)
+					break;
+			}
+
+			// till the end of the page
+			u32_t room = dev->pageSize - addr % dev->pageSize;
+			u32_t n = left < room ? left : room;
+
+			// whole rest of the page from one segment - no copy
+			if (!fill && n == room) {
+				if (!W25Q_IsErased(src, n))
+					state = W25Q_ProgramRaw(dev, src, n, addr);
+			} else {
+				if (n > W25Q_STREAM_CHUNK - fill)
+					n = W25Q_STREAM_CHUNK - fill;
+				if (!fill)
+					start = addr;
+				memcpy(page + fill, src, n);
+				fill += n;
+				// page is packed
+				if ((start + fill) % dev->pageSize == 0 || fill == W25Q_STREAM_CHUNK) {
+					if (!W25Q_IsErased(page, fill))
+						state = W25Q_ProgramRaw(dev, page, fill, start);
+					fill = 0;
+				}
+			}
+			src += n;
+			addr += n;
+			left -= n;
+		}
+	}
+	if (state == W25Q_OK && fill && !W25Q_IsErased(page, fill))
+		state = W25Q_ProgramRaw(dev, page, fill, start);
+	w25q_unlock();
+
+	w25q_stat_latency(W25Q_API_PROGRAM_V);
+	return state;
+}
+
+/**
+ * @brief W25Q Program array
+ * Program array of 8/16/32-bit elements page by page
+ *
+ * @note Area must be erased. Pages filled with 0xFF are skipped.
+ * Elements needing byte order conversion are converted word-at-a-time
+ * to stream buffer by W25Q_STREAM_CHUNK, caller's array isn't changed
+ * @param[in] dev Device
+ * @param[in] buf Pointer to array
+ * @param[in] count Count of elements
+ * @param[in] size Size of element (1, 2 or 4 bytes)
+ * @param[in] order Byte order of elements in chip
+ * @param[in] rawAddr Start address of chip's cell
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_ProgramArray(W25Q_Device *dev, const void *buf, u32_t count, u8_t size,
+		W25Q_ORDER order, u32_t rawAddr) {
+	if ((size != 1 && size != 2 && size != 4) || count == 0
+			|| count > dev->size / size)
+		return W25Q_PARAM_ERR;
+	u32_t len = count * size;
+	if (!need_swap(size, order))
+		return W25Q_ProgramBulk(dev, (u8_t*) buf, len, rawAddr, 0);
+
+	const u8_t *src = buf;
+	w25q_lock();
+	W25Q_STATE state = W25Q_OK;
+	while (len && state == W25Q_OK) {
+		// chunk is multiple of 4, elements aren't split
+		u32_t n = len < W25Q_STREAM_CHUNK ? len : W25Q_STREAM_CHUNK;
+		swap_bytes(dev->streamBuf[0], src, n, size);
+		state = W25Q_ProgramBulk(dev, dev->streamBuf[0], n, rawAddr, 0);
+		src += n;
+		rawAddr += n;
+		len -= n;
+	}
+	w25q_unlock();
+	return state;
+}
+
+/// @brief W25Q Program signed 8-bit array @see W25Q_ProgramArray
+W25Q_STATE W25Q_ProgramArraySByte(W25Q_Device *dev, const i8_t *buf, u32_t count, u32_t rawAddr) {
+	return W25Q_ProgramArray(dev, buf, count, 1, W25Q_ORDER_NATIVE, rawAddr);
+}
+
+/// @brief W25Q Program 8-bit array @see W25Q_ProgramArray
+W25Q_STATE W25Q_ProgramArrayByte(W25Q_Device *dev, const u8_t *buf, u32_t count, u32_t rawAddr) {
+	return W25Q_ProgramArray(dev, buf, count, 1, W25Q_ORDER_NATIVE, rawAddr);
+}
+
+/// @brief W25Q Program signed 16-bit array @see W25Q_ProgramArray
+W25Q_STATE W25Q_ProgramArraySWord(W25Q_Device *dev, const i16_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr) {
+	return W25Q_ProgramArray(dev, buf, count, 2, order, rawAddr);
+}
+
+/// @brief W25Q Program 16-bit array @see W25Q_ProgramArray
+W25Q_STATE W25Q_ProgramArrayWord(W25Q_Device *dev, const u16_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr) {
+	return W25Q_ProgramArray(dev, buf, count, 2, order, rawAddr);
+}
+
+/// @brief W25Q Program signed 32-bit array @see W25Q_ProgramArray
+W25Q_STATE W25Q_ProgramArraySLong(W25Q_Device *dev, const i32_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr) {
+	return W25Q_ProgramArray(dev, buf, count, 4, order, rawAddr);
+}
+
+/// @brief W25Q Program 32-bit array @see W25Q_ProgramArray
+W25Q_STATE W25Q_ProgramArrayLong(W25Q_Device *dev, const u32_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr) {
+	return W25Q_ProgramArray(dev, buf, count, 4, order, rawAddr);
+}
+
+/// @brief W25Q Program float array (IEEE 754 single) @see W25Q_ProgramArray
+W25Q_STATE W25Q_ProgramArrayFloat(W25Q_Device *dev, const fl_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr) {
+	return W25Q_ProgramArray(dev, buf, count, sizeof(fl_t), order, rawAddr);
 }
 
 /**
@@ -784,36 +1638,23 @@ W25Q_STATE W25Q_ProgramRaw(u8_t *buf, u16_t data_len, u32_t rawAddr) {
  * Minimal size operation to erase data
  *
  * @note Should be executed before writing
+ * @param[in] dev Device
  * @param[in] SectAddr Sector start address
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_EraseSector(u32_t SectAddr) {
-	if (SectAddr >= SECTOR_COUNT)
+W25Q_STATE W25Q_EraseSector(W25Q_Device *dev, u32_t SectAddr) {
+	if (SectAddr >= dev->size / dev->sectorSize)
 		return W25Q_PARAM_ERR;
+	w25q_stat_start();
 
-	while (W25Q_IsBusy() == W25Q_BUSY)
-		w25q_delay(1);
-
-	u32_t rawAddr = SectAddr * MEM_SECTOR_SIZE * 1024U;
-
-	W25Q_STATE state = W25Q_WriteEnable(1);
-	if (state != W25Q_OK)
-		return state;
+	u32_t rawAddr = SectAddr * dev->sectorSize;
 
 	QSPI_CommandTypeDef com;
 
 	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
-#if MEM_FLASH_SIZE > 128U
-	com.Instruction = W25Q_SECTOR_ERASE_4B;	 // Command
-	com.AddressSize = QSPI_ADDRESS_32_BITS;
-#else
-	com.Instruction = W25Q_SECTOR_ERASE;	 // Command
-	com.AddressSize = QSPI_ADDRESS_24_BITS;
-#endif
+	addr_command(dev, &com, W25Q_SECTOR_ERASE, W25Q_SECTOR_ERASE_4B, rawAddr);
 	com.AddressMode = QSPI_ADDRESS_1_LINE;
 
-	com.Address = rawAddr;
-
 	com.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
 	com.AlternateBytes = QSPI_ALTERNATE_BYTES_NONE;
 	com.AlternateBytesSize = QSPI_ALTERNATE_BYTES_NONE;
@@ -826,14 +1667,24 @@ W25Q_STATE W25Q_EraseSector(u32_t SectAddr) {
 	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
-	if (HAL_QSPI_Command(&hqspi, &com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK)
-		return W25Q_SPI_ERR;
-
-	while (W25Q_IsBusy() == W25Q_BUSY)
-		w25q_delay(1);
+	w25q_lock();
+	W25Q_STATE state = wait_ready(dev, W25Q_TIMEOUT_CE);
+	if (state == W25Q_OK)
+		state = bank_select(dev, rawAddr);
+	if (state == W25Q_OK)
+		state = W25Q_WriteEnable(dev, 1);
+	if (state == W25Q_OK && bus_command(dev, &com) != HAL_OK)
+		state = W25Q_SPI_ERR;
+	if (state == W25Q_OK)
+		state = wait_write(dev, rawAddr, dev->sectorSize, W25Q_TYP_SE_US, W25Q_TIMEOUT_SE);
+#if W25Q_STATS_SECTORS
+	if (state == W25Q_OK && SectAddr < SECTOR_COUNT)
+		w25q_stat_inc(sectorErases[SectAddr]);
+#endif
+	w25q_unlock();
 
-	return W25Q_OK;
+	w25q_stat_latency(W25Q_API_ERASE_SECTOR);
+	return state;
 }
 
 /**
@@ -841,53 +1692,31 @@ W25Q_STATE W25Q_EraseSector(u32_t SectAddr) {
  * Func to erase big block
  *
  * @note Should be executed before writing
+ * @param[in] dev Device
  * @param[in] BlockAddr Block start address
- * @param[in] size Size of block: 32KB or 64KB
+ * @param[in] size Size of block: 32KB or 64KB (of each chip in dual-flash)
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_EraseBlock(u32_t BlockAddr, u8_t size) {
+W25Q_STATE W25Q_EraseBlock(W25Q_Device *dev, u32_t BlockAddr, u8_t size) {
 	if (size != 32 && size != 64)
 		return W25Q_PARAM_ERR;
-	if ((size == 64 && BlockAddr >= BLOCK_COUNT)
-			|| (size == 32 && BlockAddr >= BLOCK_COUNT * 2))
+	u32_t blockSize = size * 1024U * w25q_chips(dev);
+	if (BlockAddr >= dev->size / blockSize)
 		return W25Q_PARAM_ERR;
+	w25q_stat_start();
 
-	while (W25Q_IsBusy() == W25Q_BUSY)
-		w25q_delay(1);
-
-	u32_t rawAddr = BlockAddr * MEM_SECTOR_SIZE * 1024U * 16;
-	if (size == 32)
-		rawAddr /= 2;
-
-	W25Q_STATE state = W25Q_WriteEnable(1);
-	if (state != W25Q_OK)
-		return state;
+	u32_t rawAddr = BlockAddr * blockSize;
 
 	QSPI_CommandTypeDef com;
 
 	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
 
-	if (size == 32) {
-		com.Instruction = W25Q_32KB_BLOCK_ERASE;	 // Command
-#if MEM_FLASH_SIZE > 128U
-		com.AddressSize = QSPI_ADDRESS_32_BITS;
-#else
-	com.AddressSize = QSPI_ADDRESS_24_BITS;
-#endif
-	} else if (size == 64) {
-#if MEM_FLASH_SIZE > 128U
-		com.Instruction = W25Q_64KB_BLOCK_ERASE_4B;	 // Command
-		com.AddressSize = QSPI_ADDRESS_32_BITS;
-#else
-	com.Instruction = W25Q_64KB_BLOCK_ERASE;	 // Command
-	com.AddressSize = QSPI_ADDRESS_24_BITS;
-#endif
-	}
-
+	if (size == 32)
+		addr_command(dev, &com, W25Q_32KB_BLOCK_ERASE, W25Q_32KB_BLOCK_ERASE, rawAddr);
+	else
+		addr_command(dev, &com, W25Q_64KB_BLOCK_ERASE, W25Q_64KB_BLOCK_ERASE_4B, rawAddr);
 	com.AddressMode = QSPI_ADDRESS_1_LINE;
 
-	com.Address = rawAddr;
-
 	com.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
 	com.AlternateBytes = QSPI_ALTERNATE_BYTES_NONE;
 	com.AlternateBytesSize = QSPI_ALTERNATE_BYTES_NONE;
@@ -900,14 +1729,26 @@ W25Q_STATE W25Q_EraseBlock(u32_t BlockAddr, u8_t size) {
 	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
-	if (HAL_QSPI_Command(&hqspi, &com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK)
-		return W25Q_SPI_ERR;
-
-	while (W25Q_IsBusy() == W25Q_BUSY)
-		w25q_delay(1);
+	w25q_lock();
+	W25Q_STATE state = wait_ready(dev, W25Q_TIMEOUT_CE);
+	if (state == W25Q_OK)
+		state = bank_select(dev, rawAddr);
+	if (state == W25Q_OK)
+		state = W25Q_WriteEnable(dev, 1);
+	if (state == W25Q_OK && bus_command(dev, &com) != HAL_OK)
+		state = W25Q_SPI_ERR;
+	if (state == W25Q_OK)
+		state = wait_write(dev, rawAddr, blockSize, size == 32 ? W25Q_TYP_BE32_US : W25Q_TYP_BE64_US,
+				size == 32 ? W25Q_TIMEOUT_BE32 : W25Q_TIMEOUT_BE64);
+#if W25Q_STATS_SECTORS
+	for (u32_t i = rawAddr / dev->sectorSize; state == W25Q_OK
+			&& i < (rawAddr + blockSize) / dev->sectorSize && i < SECTOR_COUNT; i++)
+		w25q_stat_inc(sectorErases[i]);
+#endif
+	w25q_unlock();
 
-	return W25Q_OK;
+	w25q_stat_latency(W25Q_API_ERASE_BLOCK);
+	return state;
 }
 
 /**
@@ -915,18 +1756,12 @@ W25Q_STATE W25Q_EraseBlock(u32_t BlockAddr, u8_t size) {
  * Func to erase all the data on chip
  *
  * @note Should be executed before writing
- * @param none
+ * @param[in] dev Device
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_EraseChip(void) {
-	while (W25Q_IsBusy() == W25Q_BUSY)
-		w25q_delay(1);
-
-	W25Q_STATE state = W25Q_WriteEnable(1);
-	if (state != W25Q_OK)
-		return state;
-
-	QSPI_CommandTypeDef com;
+W25Q_STATE W25Q_EraseChip(W25Q_Device *dev) {
+	w25q_stat_start();
+	QSPI_CommandTypeDef com;
 
 	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
 	com.Instruction = W25Q_CHIP_ERASE;	 // Command
@@ -947,14 +1782,185 @@ W25Q_STATE W25Q_EraseChip(void) {
 	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
-	if (HAL_QSPI_Command(&hqspi, &com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK)
-		return W25Q_SPI_ERR;
+	w25q_lock();
+	W25Q_STATE state = wait_ready(dev, W25Q_TIMEOUT_CE);
+	if (state == W25Q_OK)
+		state = W25Q_WriteEnable(dev, 1);
+	if (state == W25Q_OK && bus_command(dev, &com) != HAL_OK)
+		state = W25Q_SPI_ERR;
+	if (state == W25Q_OK)
+		state = wait_write(dev, 0, dev->size, W25Q_TYP_CE_US, W25Q_TIMEOUT_CE);
+#if W25Q_STATS_SECTORS
+	for (u32_t i = 0; state == W25Q_OK && i < dev->size / dev->sectorSize
+			&& i < SECTOR_COUNT; i++)
+		w25q_stat_inc(sectorErases[i]);
+#endif
+	w25q_unlock();
 
-	while (W25Q_IsBusy() == W25Q_BUSY)
-		w25q_delay(1);
+	w25q_stat_latency(W25Q_API_ERASE_CHIP);
+	return state;
+}
 
-	return W25Q_OK;
+/**
+ * @brief Blank check consumer
+ *
+ * @param[in] data Streamed part
+ * @param[in] len Part length
+ * @param ctx Unused
+ * @return W25Q_STATE enum (W25Q_OK / W25Q_VERIFY_ERR if not erased)
+ */
+W25Q_STATE erased_part(u8_t *data, u32_t len, void *ctx) {
+	return W25Q_IsErased(data, len) ? W25Q_OK : W25Q_VERIFY_ERR;
+}
+
+/**
+ * @brief W25Q Sector blank check (4KB)
+ * Check if all the sector is filled with 0xFF
+ *
+ * @note Stops at first programmed streaming part
+ * @param[in] dev Device
+ * @param[out] blank Sector status (1-erased/0-has data)
+ * @param[in] SectAddr Sector start address
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_SectorBlankCheck(W25Q_Device *dev, bool *blank, u32_t SectAddr) {
+	if (SectAddr >= dev->size / dev->sectorSize)
+		return W25Q_PARAM_ERR;
+
+	W25Q_STATE state = stream_read(dev, dev->sectorSize,
+			SectAddr * dev->sectorSize, erased_part, NULL);
+	*blank = state == W25Q_OK;
+	if (state == W25Q_VERIFY_ERR)
+		return W25Q_OK;
+
+	return state;
+}
+
+/**
+ * @}
+ * @addtogroup W25Q_Op Non-blocking functions
+ * @brief Start/poll erase and program for main loops without RTOS
+ * @{
+ */
+
+/**
+ * @brief W25Q Erase start
+ * Start erase of range, W25Q_OpPoll runs it to the end
+ *
+ * @note Range is erased by the biggest commands fitting it:
+ * whole chip, 64KB/32KB blocks, sectors
+ * @param[in] dev Device
+ * @param[out] op Operation
+ * @param[in] rawAddr Start address (sector-aligned)
+ * @param[in] len Length (multiple of sector size)
+ * @return W25Q_STATE enum (W25Q_BUSY - chip runs other operation, not started)
+ */
+W25Q_STATE W25Q_EraseStart(W25Q_Device *dev, W25Q_OP *op, u32_t rawAddr, u32_t len) {
+	if (len == 0 || rawAddr >= dev->size || len > dev->size - rawAddr
+			|| (rawAddr | len) % dev->sectorSize)
+		return W25Q_PARAM_ERR;
+
+	memset(op, 0, sizeof(W25Q_OP));
+	op->addr = rawAddr;
+	op->left = len;
+	// typical time of whole range by the same commands
+	W25Q_OP plan = *op;
+	while (plan.left) {
+		u32_t unit = op_unit(dev, &plan);
+		op->totalUs += op_typ(dev, &plan, unit);
+		plan.addr += unit;
+		plan.left -= unit;
+	}
+	w25q_stat_start();
+
+	w25q_lock();
+	W25Q_STATE state = W25Q_IsBusy(dev);
+	if (state == W25Q_OK)
+		state = op_issue(dev, op);
+	w25q_unlock();
+	op_progress(op);
+	w25q_stat_latency(W25Q_API_OP);
+	return state;
+}
+
+/**
+ * @brief W25Q Program start
+ * Start program of data to erased area, W25Q_OpPoll runs it to the end
+ *
+ * @note Data must stay valid till the end. Pages filled
+ * with 0xFF are skipped like in W25Q_ProgramBulk
+ * @param[in] dev Device
+ * @param[out] op Operation
+ * @param[in] buf Pointer to data to be written
+ * @param[in] len Length of data
+ * @param[in] rawAddr Start address of chip's cell (even in dual-flash)
+ * @return W25Q_STATE enum (W25Q_BUSY - chip runs other operation, not started)
+ */
+W25Q_STATE W25Q_ProgramStart(W25Q_Device *dev, W25Q_OP *op, const u8_t *buf, u32_t len, u32_t rawAddr) {
+	if (len == 0 || rawAddr >= dev->size || len > dev->size - rawAddr
+			|| (dev->dual && ((rawAddr | len) & 1U)))
+		return W25Q_PARAM_ERR;
+
+	memset(op, 0, sizeof(W25Q_OP));
+	op->addr = rawAddr;
+	op->left = len;
+	op->buf = buf;
+	op->totalUs = ((rawAddr + len - 1) / dev->pageSize - rawAddr / dev->pageSize + 1) * W25Q_TYP_PP_US;
+	w25q_stat_start();
+
+	w25q_lock();
+	W25Q_STATE state = W25Q_IsBusy(dev);
+	if (state == W25Q_OK)
+		state = op_issue(dev, op);
+	w25q_unlock();
+	op_progress(op);
+	w25q_stat_latency(W25Q_API_OP);
+	return state;
+}
+
+/**
+ * @brief W25Q Operation poll
+ * Check running command without waiting, send the next one
+ * when it's done. Call it from main loop till not W25Q_BUSY
+ *
+ * @note Progress and ETA are updated from datasheet's typical
+ * times. Other API calls wait for the running command
+ * @param[in] dev Device
+ * @param[in,out] op Operation
+ * @return W25Q_STATE enum (W25Q_BUSY - runs, W25Q_OK - done,
+ * W25Q_CHIP_ERR - command is over its max time)
+ */
+W25Q_STATE W25Q_OpPoll(W25Q_Device *dev, W25Q_OP *op) {
+	if (!op->run)
+		return W25Q_OK;
+
+	w25q_stat_start();
+	w25q_lock();
+	W25Q_STATE state = W25Q_IsBusy(dev);
+	// time suspended by urgent reads isn't command's
+	if (state == W25Q_BUSY && w25q_os_tick() - op->start
+			> op->maxMs + (dev->suspendUs - op->suspendUs) / 1000U) {
+		dev->opLen = 0; // chip's state is unknown now
+		state = W25Q_CHIP_ERR;
+	}
+	else if (state == W25Q_OK) {
+		// running command is done
+		op->doneUs += op->unitUs;
+		op->addr += op->unit;
+		op->left -= op->unit;
+		if (op->buf)
+			op->buf += op->unit;
+		state = op_issue(dev, op);
+		if (state == W25Q_OK && op->run)
+			state = W25Q_BUSY;
+	}
+	w25q_unlock();
+
+	if (state != W25Q_BUSY)
+		op->run = 0;
+	op_progress(op);
+	w25q_stat_latency(W25Q_API_OP);
+	return state;
 }
 
 /**
@@ -970,13 +1976,10 @@ W25Q_STATE W25Q_EraseChip(void) {
  *
  * @note SUS == 0 && BUSY == 1, otherwise ignored
  * @note Power loose during suspend state may corrupt data
- * @param none
+ * @param[in] dev Device
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ProgSuspend(void) {
-	if (W25Q_BUSY != W25Q_IsBusy())
-		return W25Q_CHIP_IGNORE;
-
+W25Q_STATE W25Q_ProgSuspend(W25Q_Device *dev) {
 	QSPI_CommandTypeDef com;
 
 	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
@@ -998,11 +2001,15 @@ W25Q_STATE W25Q_ProgSuspend(void) {
 	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
-	if (HAL_QSPI_Command(&hqspi, &com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK)
-		return W25Q_SPI_ERR;
+	w25q_lock();
+	W25Q_STATE state = W25Q_IsBusy(dev);
+	if (state == W25Q_OK)
+		state = W25Q_CHIP_IGNORE;
+	else if (state == W25Q_BUSY)
+		state = bus_command(dev, &com) != HAL_OK ? W25Q_SPI_ERR : W25Q_OK;
+	w25q_unlock();
 
-	return W25Q_OK;
+	return state;
 }
 
 /**
@@ -1010,18 +2017,10 @@ W25Q_STATE W25Q_ProgSuspend(void) {
  * Resume suspended state
  *
  * @note SUS == 1, otherwise ignored
- * @param none
+ * @param[in] dev Device
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ProgResume(void) {
-
-	W25Q_STATE state = W25Q_ReadStatusStruct(NULL);
-	if (state != W25Q_OK)
-		return state;
-
-	if (w25q_status.SUS != 1)
-		return W25Q_CHIP_IGNORE;
-
+W25Q_STATE W25Q_ProgResume(W25Q_Device *dev) {
 	QSPI_CommandTypeDef com;
 
 	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
@@ -1043,11 +2042,113 @@ W25Q_STATE W25Q_ProgResume(void) {
 	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
-	if (HAL_QSPI_Command(&hqspi, &com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK)
-		return W25Q_SPI_ERR;
+	w25q_lock();
+	W25Q_STATE state = W25Q_ReadStatusStruct(dev, NULL);
+	if (state == W25Q_OK && dev->status.SUS != 1)
+		state = W25Q_CHIP_IGNORE;
+	if (state == W25Q_OK && bus_command(dev, &com) != HAL_OK)
+		state = W25Q_SPI_ERR;
+	w25q_unlock();
 
-	return W25Q_OK;
+	return state;
+}
+
+/**
+ * @brief W25Q Urgent read
+ * High priority read: running program/erase is waited for if it ends
+ * before the deadline, else it's suspended for the read and resumed after
+ *
+ * @note Commands of W25Q_EraseStart/W25Q_ProgramStart and blocking
+ * program/erase of other tasks are suspended, but not for read of their
+ * own cells (undefined while suspended) and not chip erase: read waits
+ * for them. End of command is estimated by typical time
+ * @param[in] dev Device
+ * @param[out] buf Pointer to data array
+ * @param[in] len Length of data
+ * @param[in] rawAddr Start address of chip's cell
+ * @param[in] deadlineUs Max read time, us (0 - W25Q_DEADLINE_HIGH_US,
+ * if it's 0 too, command is always suspended)
+ * @return W25Q_STATE enum (W25Q_BUSY - command didn't end in chip erase
+ * max time)
+ */
+W25Q_STATE W25Q_ReadUrgent(W25Q_Device *dev, u8_t *buf, u32_t len, u32_t rawAddr, u32_t deadlineUs) {
+	if (len == 0 || rawAddr >= dev->size
+			|| len > dev->size - rawAddr)
+		return W25Q_PARAM_ERR;
+	w25q_stat_start();
+
+	const u32_t cyclesUs = w25q_os_cycles_hz() / 1000000U;
+	const u32_t start = w25q_os_cycles();
+	const u32_t startTick = w25q_os_tick();
+	if (!deadlineUs)
+		deadlineUs = W25Q_DEADLINE_HIGH_US;
+	bool sus = 0, tried = 0;
+	u32_t t0 = 0;
+
+	lock_take(dev, 1);
+	if (dev->status.SLEEP)
+		power_wake(dev);
+	W25Q_STATE state;
+	while ((state = W25Q_IsBusy(dev)) == W25Q_BUSY) {
+		u32_t now = w25q_os_cycles();
+		u32_t spent = (now - start) / cyclesUs;
+		u32_t ran = (now - dev->opStart) / cyclesUs;
+		u32_t left = ran < dev->opUs ? dev->opUs - ran : 0;
+		if (!tried && dev->opLen && dev->opLen < dev->size
+				&& (rawAddr >= dev->opAddr + dev->opLen || dev->opAddr >= rawAddr + len)
+				&& (!deadlineUs || spent + left + W25Q_TSUS_US > deadlineUs)) {
+			tried = 1;
+			// chip needs tSUS from resume to the next suspend
+			u32_t gap = (now - dev->resumeAt) / cyclesUs;
+			if (gap < W25Q_TSUS_US)
+				delay_us(W25Q_TSUS_US - gap);
+			t0 = w25q_os_cycles();
+			state = W25Q_ProgSuspend(dev);
+			if (state == W25Q_OK) {
+				// tSUS counts from the command, last poll is after it
+				u32_t sent = w25q_os_cycles();
+				bool late;
+				do {
+					late = w25q_os_cycles() - sent >= W25Q_TSUS_US * cyclesUs;
+					state = W25Q_IsBusy(dev);
+				} while (state == W25Q_BUSY && !late);
+				// suspended is ready with SUS set, else command finished meanwhile
+				if (state == W25Q_OK)
+					state = W25Q_ReadStatusStruct(dev, NULL);
+				if (state == W25Q_OK && dev->status.SUS) {
+					sus = 1;
+					w25q_stat_inc(suspends);
+				} else if (state == W25Q_BUSY)
+					W25Q_ProgResume(dev); // not suspended in tSUS: cancel late suspend
+			}
+			if (state == W25Q_CHIP_IGNORE || state == W25Q_BUSY)
+				continue; // finished before suspend or wait for it
+			break;
+		}
+		// wait: command ends in time, can't be suspended or was tried
+		if (w25q_os_tick() - startTick > W25Q_TIMEOUT_CE)
+			break;
+		if (left >= 1000U) {
+			u8_t depth = lock_give(dev);
+			w25q_delay(1);
+			lock_retake(dev, depth);
+		} else
+			delay_us(W25Q_TSUS_US);
+	}
+	if (state == W25Q_OK)
+		state = fast_read(dev, buf, len, rawAddr, 0);
+	if (sus) {
+		W25Q_STATE res = W25Q_ProgResume(dev);
+		dev->resumeAt = w25q_os_cycles();
+		dev->suspendUs += (dev->resumeAt - t0) / cyclesUs;
+		dev->opStart += dev->resumeAt - t0; // suspended time isn't command's
+		if (state == W25Q_OK && res != W25Q_CHIP_IGNORE)
+			state = res;
+	}
+	w25q_unlock();
+
+	w25q_stat_deadline(W25Q_API_READ_URGENT, deadlineUs);
+	return state;
 }
 
 /**
@@ -1061,11 +2162,11 @@ W25Q_STATE W25Q_ProgResume(void) {
  * @brief W25Q Sleep / Power Down
  * Set chip to low-power state
  *
- * @note Use WakeUP or ReadID
- * @param none
+ * @note Any API call wakes the chip up (tRES1, few us)
+ * @param[in] dev Device
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_Sleep(void) {
+W25Q_STATE W25Q_Sleep(W25Q_Device *dev) {
 	QSPI_CommandTypeDef com;
 
 	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
@@ -1087,52 +2188,94 @@ W25Q_STATE W25Q_Sleep(void) {
 	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
-	if (HAL_QSPI_Command(&hqspi, &com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK) {
-		return W25Q_SPI_ERR;
+	// own lock: w25q_lock would wake the chip
+	lock_take(dev, 0);
+	W25Q_STATE state = W25Q_OK;
+	if (!dev->status.SLEEP) {
+		if (bus_command(dev, &com) != HAL_OK)
+			state = W25Q_SPI_ERR;
+		else {
+			delay_us(W25Q_TDP_US); // Give a little time to sleep
+			dev->status.SLEEP = 1;
+			dev->power.sleepStart = w25q_os_tick();
+		}
 	}
-	w25q_delay(1); // Give a little time to sleep
+	dev->lockDepth--;
+	w25q_os_mutex_unlock(dev->mutex);
 
-	w25q_status.SLEEP = 1;
-
-	return W25Q_OK;
+	return state;
 }
 
 /**
  * @brief W25Q WakeUP
  * Wake UP function
  *
- * @param none
+ * @note Release command is sent even if chip isn't known as sleeping
+ * @param[in] dev Device
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_WakeUP(void) {
-	QSPI_CommandTypeDef com;
-
-	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
-	com.Instruction = W25Q_POWERUP;	 // Command
-
-	com.AddressMode = QSPI_ADDRESS_NONE;
-	com.AddressSize = QSPI_ADDRESS_NONE;
-	com.Address = 0x0U;
+W25Q_STATE W25Q_WakeUP(W25Q_Device *dev) {
+	lock_take(dev, 0);
+	W25Q_STATE state = power_wake(dev);
+	w25q_unlock();
 
-	com.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
-	com.AlternateBytes = QSPI_ALTERNATE_BYTES_NONE;
-	com.AlternateBytesSize = QSPI_ALTERNATE_BYTES_NONE;
+	return state;
+}
 
-	com.DummyCycles = 0;
-	com.DataMode = QSPI_DATA_NONE;
-	com.NbData = 0;
+/**
+ * @brief W25Q Power task
+ * Power the chip down if it's idle for power.idleMs
+ *
+ * @note Call it periodically (idle hook, timer task, main loop)
+ * @param[in] dev Device
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_PowerTask(W25Q_Device *dev) {
+	if (!dev->power.idleMs || dev->status.SLEEP
+			|| w25q_os_tick() - dev->power.lastUse < dev->power.idleMs)
+		return W25Q_OK;
+
+	lock_take(dev, 0);
+	W25Q_STATE state = W25Q_OK;
+	// check again: chip could be used while we waited for lock,
+	// suspended or running operation ignores power-down
+	if (!dev->status.SLEEP && !dev->status.BUSY && !dev->status.SUS
+			&& w25q_os_tick() - dev->power.lastUse >= dev->power.idleMs)
+		state = W25Q_Sleep(dev);
+	dev->lockDepth--;
+	w25q_os_mutex_unlock(dev->mutex);
 
-	com.DdrMode = QSPI_DDR_MODE_DISABLE;
-	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
-	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+	return state;
+}
 
-	if (HAL_QSPI_Command(&hqspi, &com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK) {
-		return W25Q_SPI_ERR;
-	}
-	w25q_delay(1); // Give a little time to wake
+/**
+ * @brief W25Q Power idle time
+ *
+ * @param[in] dev Device
+ * @param[in] idleMs Idle time before power-down, ms (0 - never)
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_PowerIdle(W25Q_Device *dev, u32_t idleMs) {
+	dev->power.idleMs = idleMs;
+	return W25Q_OK;
+}
 
+/**
+ * @brief W25Q Power counters
+ * Get power manager snapshot, sleepMs includes current power-down
+ *
+ * @param[in] dev Device
+ * @param[out] power Pointer to output struct
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_PowerGet(W25Q_Device *dev, W25Q_POWER *power) {
+	if (!power)
+		return W25Q_PARAM_ERR;
+	w25q_os_mutex_lock(dev->mutex);
+	*power = dev->power;
+	if (dev->status.SLEEP)
+		power->sleepMs += w25q_os_tick() - dev->power.sleepStart;
+	w25q_os_mutex_unlock(dev->mutex);
 	return W25Q_OK;
 }
 
@@ -1147,11 +2290,14 @@ W25Q_STATE W25Q_WakeUP(void) {
  * @brief W25Q Read ID
  * Function for reading chip ID
  *
+ * @note Dual-flash: ID of the first chip, W25Q_CHIP_ERR if chips differ
+ * @param[in] dev Device
  * @param[out] buf Pointer to output data (1 byte)
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ReadID(u8_t *buf) {
+W25Q_STATE W25Q_ReadID(W25Q_Device *dev, u8_t *buf) {
 	QSPI_CommandTypeDef com;
+	u8_t id[2] = { 0, };
 
 	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
 	com.Instruction = W25Q_DEVID;	 // Command
@@ -1166,21 +2312,22 @@ W25Q_STATE W25Q_ReadID(u8_t *buf) {
 
 	com.DummyCycles = 0;
 	com.DataMode = QSPI_DATA_1_LINE;
-	com.NbData = 1;
+	com.NbData = w25q_chips(dev);
 
 	com.DdrMode = QSPI_DDR_MODE_DISABLE;
 	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
-	if (HAL_QSPI_Command(&hqspi, &com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK) {
-		return W25Q_SPI_ERR;
-	}
-	if (HAL_QSPI_Receive(&hqspi, buf, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK) {
-		return W25Q_SPI_ERR;
-	}
-	return W25Q_OK;
+	w25q_lock();
+	W25Q_STATE state = W25Q_OK;
+	if (bus_command(dev, &com) != HAL_OK || bus_receive(dev, id, 0) != HAL_OK)
+		state = W25Q_SPI_ERR;
+	else if (dev->dual && id[0] != id[1])
+		state = W25Q_CHIP_ERR;
+	*buf = id[0];
+	w25q_unlock();
+
+	return state;
 }
 
 /**
@@ -1188,10 +2335,11 @@ W25Q_STATE W25Q_ReadID(u8_t *buf) {
  * Read Manufacturer ID + Device ID
  *
  * @attention Func in development
+ * @param[in] dev Device
  * @param[out] buf Pointer to data from ID register
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ReadFullID(u8_t *buf) {
+W25Q_STATE W25Q_ReadFullID(W25Q_Device *dev, u8_t *buf) {
 	return W25Q_PARAM_ERR;
 }
 
@@ -1200,10 +2348,11 @@ W25Q_STATE W25Q_ReadFullID(u8_t *buf) {
  * Read Unique ID
  *
  * @attention Func in development
+ * @param[in] dev Device
  * @param[out] buf Pointer to data from ID register
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ReadUID(u8_t *buf) {
+W25Q_STATE W25Q_ReadUID(W25Q_Device *dev, u8_t *buf) {
 	return W25Q_PARAM_ERR;
 }
 
@@ -1212,10 +2361,11 @@ W25Q_STATE W25Q_ReadUID(u8_t *buf) {
  * Read ID by JEDEC standards
  *
  * @attention Func in development
+ * @param[in] dev Device
  * @param[out] buf Pointer to data from ID register
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ReadJEDECID(u8_t *buf) {
+W25Q_STATE W25Q_ReadJEDECID(W25Q_Device *dev, u8_t *buf) {
 	return W25Q_PARAM_ERR;
 }
 
@@ -1224,10 +2374,11 @@ W25Q_STATE W25Q_ReadJEDECID(u8_t *buf) {
  * Read device descriptor by SFDP standard
  *
  * @attention Func in development
+ * @param[in] dev Device
  * @param[out] buf Pointer to data from ID register
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ReadSFDPRegister(u8_t *buf) {
+W25Q_STATE W25Q_ReadSFDPRegister(W25Q_Device *dev, u8_t *buf) {
 	return W25Q_PARAM_ERR;
 }
 
@@ -1243,10 +2394,11 @@ W25Q_STATE W25Q_ReadSFDPRegister(u8_t *buf) {
  * Clean security registers (one or all)
  *
  * @attention Func in development
+ * @param[in] dev Device
  * @param[in] numReg Number of security register (1..3 / 0-all)
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_EraseSecurityRegisters(u8_t numReg) {
+W25Q_STATE W25Q_EraseSecurityRegisters(W25Q_Device *dev, u8_t numReg) {
 	return W25Q_PARAM_ERR;
 }
 
@@ -1255,12 +2407,13 @@ W25Q_STATE W25Q_EraseSecurityRegisters(u8_t numReg) {
  * Write data to security reg
  *
  * @attention Func in development
+ * @param[in] dev Device
  * @param[in] buf Pointer to 8-bit data bufer
  * @param[in] numReg Number of security register (1..3)
  * @param[in] byteAddr Byte addr in register (0..255)
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ProgSecurityRegisters(u8_t *buf, u8_t numReg, u8_t byteAddr) {
+W25Q_STATE W25Q_ProgSecurityRegisters(W25Q_Device *dev, u8_t *buf, u8_t numReg, u8_t byteAddr) {
 	return W25Q_PARAM_ERR;
 }
 
@@ -1269,12 +2422,13 @@ W25Q_STATE W25Q_ProgSecurityRegisters(u8_t *buf, u8_t numReg, u8_t byteAddr) {
  * Read data from security reg
  *
  * @attention Func in development
+ * @param[in] dev Device
  * @param[out] buf Pointer to 8-bit data bufer
  * @param[in] numReg Number of security register (1..3)
  * @param[in] byteAddr Byte addr in register (0..255)
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_ReadSecurityRegisters(u8_t *buf, u8_t numReg, u8_t byteAddr) {
+W25Q_STATE W25Q_ReadSecurityRegisters(W25Q_Device *dev, u8_t *buf, u8_t numReg, u8_t byteAddr) {
 	return W25Q_PARAM_ERR;
 }
 
@@ -1290,11 +2444,12 @@ W25Q_STATE W25Q_ReadSecurityRegisters(u8_t *buf, u8_t numReg, u8_t byteAddr) {
  * Set read-only status to 4K block
  *
  * @attention Func in development
+ * @param[in] dev Device
  * @param[in] Addr Block address
  * @param[in] enable 1-Enable/0-Disable
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_BlockReadOnly(u32_t Addr, bool enable) {
+W25Q_STATE W25Q_BlockReadOnly(W25Q_Device *dev, u32_t Addr, bool enable) {
 	return W25Q_PARAM_ERR;
 }
 
@@ -1303,11 +2458,12 @@ W25Q_STATE W25Q_BlockReadOnly(u32_t Addr, bool enable) {
  * Check read-only status from 4K block
  *
  * @attention Func in development
+ * @param[in] dev Device
  * @param[out] state Block read-only status (1-locked/0-unlocked)
  * @param[in] Addr Block address
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_BlockReadOnlyCheck(bool *state, u32_t Addr) {
+W25Q_STATE W25Q_BlockReadOnlyCheck(W25Q_Device *dev, bool *state, u32_t Addr) {
 	return W25Q_PARAM_ERR;
 }
 
@@ -1316,10 +2472,11 @@ W25Q_STATE W25Q_BlockReadOnlyCheck(bool *state, u32_t Addr) {
  * Set read-only status to the whole chip
  *
  * @attention Func in development
+ * @param[in] dev Device
  * @param[in] enable 1-enable/0-disable
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_GlobalReadOnly(bool enable){
+W25Q_STATE W25Q_GlobalReadOnly(W25Q_Device *dev, bool enable){
 	return W25Q_PARAM_ERR;
 }
 
@@ -1334,27 +2491,13 @@ W25Q_STATE W25Q_GlobalReadOnly(bool enable){
  * @brief W25Q Software Reset
  * Reset by register (not by external GPIO pin)
  *
+ * @param[in] dev Device
  * @param[in] force Enable/disable (0/1) force reset - wait for BUSY and SUSpend
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_SwReset(bool force) {
+W25Q_STATE W25Q_SwReset(W25Q_Device *dev, bool force) {
 
 	W25Q_STATE state;	// temp status reg
-
-	state = W25Q_ReadStatusStruct(NULL); // read settings
-	if (state != W25Q_OK)
-		return state;
-
-	if (!force || w25q_status.BUSY || w25q_status.SUS) // if busy or suspend
-		return W25Q_CHIP_ERR;
-
-	if (force) {
-		while (W25Q_IsBusy() == W25Q_BUSY)
-			w25q_delay(1);
-		if (w25q_status.SUS)
-			W25Q_ProgResume();
-	}
-
 	QSPI_CommandTypeDef com;
 
 	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
@@ -1376,24 +2519,273 @@ W25Q_STATE W25Q_SwReset(bool force) {
 	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
-	if (HAL_QSPI_Command(&hqspi, &com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK) {
-		return W25Q_SPI_ERR;
+	w25q_lock();
+
+	state = W25Q_ReadStatusStruct(dev, NULL); // read settings
+	if (state == W25Q_OK && !force && (dev->status.BUSY || dev->status.SUS))
+		state = W25Q_CHIP_ERR; // if busy or suspend
+
+	if (state == W25Q_OK && force) {
+		if (dev->status.SUS)
+			W25Q_ProgResume(dev);
+		state = wait_ready(dev, W25Q_TIMEOUT_CE);
+	}
+
+	if (state == W25Q_OK && bus_command(dev, &com) != HAL_OK)
+		state = W25Q_SPI_ERR;
+	if (state == W25Q_OK) {
+		w25q_delay(1); // Give a little time to prepare
+		com.Instruction = W25Q_RESET;
+		if (bus_command(dev, &com) != HAL_OK)
+			state = W25Q_SPI_ERR;
 	}
-	w25q_delay(1); // Give a little time to prepare
+	if (state == W25Q_OK) {
+		w25q_delay(5); // Give a little time to reset
+		state = init_chip(dev);
+	}
+
+	w25q_unlock();
+	return state;
+}
 
-	com.Instruction = W25Q_RESET;
+/**
+ * @}
+ * @addtogroup W25Q_Clock Clock calibration functions
+ * @brief Fastest reliable read clock of the board
+ * @{
+ */
 
-	if (HAL_QSPI_Command(&hqspi, &com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK) {
+/**
+ * @brief W25Q Calibrate
+ * Sweep prescaler and sample shifting from configured clock to
+ * faster ones by quad reads of known pattern, apply fastest
+ * reliable setting slowed by margin
+ *
+ * @note Pattern is programmed to the sector once (erase only if it
+ * isn't there), so calibration can be run again any time. Store
+ * cal->clock and apply it by W25Q_SetClock at boot.
+ * Dummy cycles of quad I/O read are fixed by the chip in SPI mode,
+ * so they aren't swept
+ * @param[in] dev Device (transport with clock op)
+ * @param[in] SectAddr Sector reserved for pattern
+ * @param[in,out] cal Margin and passes in, settings out
+ * @return W25Q_STATE enum (W25Q_VERIFY_ERR - configured clock fails,
+ * it's restored)
+ */
+W25Q_STATE W25Q_Calibrate(W25Q_Device *dev, u32_t SectAddr, W25Q_CAL *cal) {
+	if (!cal || !dev->bus->clock || SectAddr >= dev->size / dev->sectorSize)
+		return W25Q_PARAM_ERR;
+	u16_t passes = cal->passes ? cal->passes : 8U;
+	u32_t addr = SectAddr * dev->sectorSize;
+	u8_t page[MEM_PAGE_SIZE * 2U];
+	W25Q_CLOCK safe;
+
+	w25q_lock();
+	if (dev->bus->clock(dev, &safe, 0) != HAL_OK) {
+		w25q_unlock();
 		return W25Q_SPI_ERR;
 	}
-	w25q_delay(5); // Give a little time to reset
 
-	state = W25Q_Init();
+	// pattern at configured clock
+	W25Q_STATE state = wait_ready(dev, W25Q_TIMEOUT_CE);
+	if (state == W25Q_OK)
+		state = cal_check(dev, addr, 1);
+	if (state == W25Q_VERIFY_ERR) {
+		state = W25Q_EraseSector(dev, SectAddr);
+		for (u32_t p = 0; p < W25Q_CAL_PAGES && state == W25Q_OK; p++) {
+			for (u32_t i = 0; i < dev->pageSize; i++)
+				page[i] = cal_byte(p * dev->pageSize + i);
+			state = W25Q_ProgramRaw(dev, page, dev->pageSize, addr + p * dev->pageSize);
+		}
+		if (state == W25Q_OK)
+			state = wait_ready(dev, W25Q_TIMEOUT_PP);
+		if (state == W25Q_OK)
+			state = cal_check(dev, addr, 1);
+	}
+	if (state != W25Q_OK) {
+		w25q_unlock();
+		return state;
+	}
+
+	// faster while it reads - passed range has no holes
+	u8_t best[2] = { safe.prescaler + 1U, safe.prescaler + 1U };
+	cal->pass[0] = cal->pass[1] = 0;
+	for (u8_t s = 0; s < 2; s++) {
+		for (i16_t p = safe.prescaler; p >= 0; p--) {
+			W25Q_CLOCK clk = { (u8_t) p, s };
+			if (dev->bus->clock(dev, &clk, 1) != HAL_OK
+					|| cal_check(dev, addr, passes) != W25Q_OK)
+				break;
+			if (p < 32)
+				cal->pass[s] |= 1UL << p;
+			best[s] = p;
+		}
+	}
+
+	// half-cycle shift on tie: more setup time for the MCU
+	u8_t s = best[1] <= best[0];
+	if (best[s] > safe.prescaler) {
+		dev->bus->clock(dev, &safe, 1);
+		w25q_unlock();
+		return W25Q_VERIFY_ERR;
+	}
+	cal->fastest.prescaler = best[s];
+	cal->fastest.shift = s;
+	cal->clock.prescaler = safe.prescaler - best[s] > cal->margin ? best[s] + cal->margin : safe.prescaler;
+	cal->clock.shift = s;
+
+	if (dev->bus->clock(dev, &cal->clock, 1) != HAL_OK
+			|| cal_check(dev, addr, passes) != W25Q_OK) {
+		dev->bus->clock(dev, &safe, 1);
+		state = W25Q_VERIFY_ERR;
+	}
+	w25q_unlock();
+	return state;
+}
+
+/**
+ * @brief W25Q Set clock
+ * Apply clock setting (stored result of W25Q_Calibrate)
+ *
+ * @param[in] dev Device (transport with clock op)
+ * @param[in] clk Clock setting
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_SetClock(W25Q_Device *dev, const W25Q_CLOCK *clk) {
+	if (!clk || !dev->bus->clock)
+		return W25Q_PARAM_ERR;
+	W25Q_CLOCK c = *clk;
 
+	w25q_lock();
+	W25Q_STATE state = wait_ready(dev, W25Q_TIMEOUT_CE);
+	if (state == W25Q_OK && dev->bus->clock(dev, &c, 1) != HAL_OK)
+		state = W25Q_SPI_ERR;
+	w25q_unlock();
 	return state;
 }
+
+#if W25Q_STATS_ENABLE
+/**
+ * @}
+ * @addtogroup W25Q_Stats Statistics functions
+ * @brief Where the time goes
+ * @{
+ */
+
+/**
+ * @brief W25Q Statistics snapshot
+ * Copy collected statistics
+ *
+ * @param[in] dev Device
+ * @param[out] stats Pointer to statistics struct
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_StatsGet(W25Q_Device *dev, W25Q_STATS *stats) {
+	if (!dev || !dev->mutex || !stats)
+		return W25Q_PARAM_ERR;
+	// consistent snapshot: counters are changed under device's mutex
+	w25q_os_mutex_lock(dev->mutex);
+	memcpy(stats, &dev->stats, sizeof(W25Q_STATS));
+	w25q_os_mutex_unlock(dev->mutex);
+	return W25Q_OK;
+}
+
+/**
+ * @brief W25Q Statistics reset
+ * Clear all counters and start the cycle counter
+ *
+ * @note Call it before first measurement if W25Q_STATS_TIMER is default
+ * @param[in] dev Device
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_StatsReset(W25Q_Device *dev) {
+	if (!dev)
+		return W25Q_PARAM_ERR;
+	if (dev->mutex)
+		w25q_os_mutex_lock(dev->mutex);
+	memset(&dev->stats, 0, sizeof(W25Q_STATS));
+	if (dev->mutex)
+		w25q_os_mutex_unlock(dev->mutex);
+	w25q_os_cycles_start();
+	return W25Q_OK;
+}
+#endif
+
+#if W25Q_TRACE_ENABLE
+/**
+ * @}
+ * @addtogroup W25Q_Trace Trace functions
+ * @brief Record QSPI access pattern
+ * @{
+ */
+
+/**
+ * @brief W25Q Trace dump header
+ * Fill header to be sent before records
+ *
+ * @param[in] dev Device
+ * @param[out] hdr Pointer to header
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_TraceHeader(W25Q_Device *dev, W25Q_TRACE_HDR *hdr) {
+	if (!hdr)
+		return W25Q_PARAM_ERR;
+	hdr->magic = W25Q_TRACE_MAGIC;
+	hdr->version = W25Q_TRACE_VERSION;
+	hdr->recSize = sizeof(W25Q_TRACE_REC);
+	hdr->timerHz = W25Q_STATS_TIMER_HZ;
+	hdr->dropped = dev->trace.dropped;
+	return W25Q_OK;
+}
+
+/**
+ * @brief W25Q Trace read
+ * Take oldest records out of the ring
+ *
+ * @note Call it periodically to stream trace out (UART, USB, file)
+ * @param[in] dev Device
+ * @param[out] recs Pointer to records array
+ * @param[in] maxCount Size of array
+ * @param[out] count Count of taken records
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_TraceRead(W25Q_Device *dev, W25Q_TRACE_REC *recs, u32_t maxCount, u32_t *count) {
+	if (!recs || !count)
+		return W25Q_PARAM_ERR;
+
+	*count = 0;
+	// recorder runs under the lock, chip needn't wake for it
+	w25q_os_mutex_lock(dev->mutex);
+	// open record isn't finished yet
+	u32_t head = dev->trace.head - (dev->trace.open ? 1 : 0);
+	while (dev->trace.tail != head && *count < maxCount) {
+		recs[(*count)++] = dev->trace.ring[dev->trace.tail % W25Q_TRACE_DEPTH];
+		dev->trace.tail++;
+	}
+	w25q_os_mutex_unlock(dev->mutex);
+	return W25Q_OK;
+}
+
+/**
+ * @brief W25Q Trace reset
+ * Clear trace ring and start the cycle counter
+ *
+ * @note Call it before tracing if W25Q_STATS_TIMER is default
+ * @param[in] dev Device
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_TraceReset(W25Q_Device *dev) {
+	// before Init there's no mutex and no other user
+	if (dev->mutex)
+		w25q_os_mutex_lock(dev->mutex);
+	dev->trace.head = dev->trace.tail = dev->trace.dropped = 0;
+	dev->trace.open = NULL;
+	if (dev->mutex)
+		w25q_os_mutex_unlock(dev->mutex);
+	w25q_os_cycles_start();
+	return W25Q_OK;
+}
+#endif
 /// @}
 // addgroup{
 /// @}
@@ -1403,10 +2795,11 @@ W25Q_STATE W25Q_SwReset(bool force) {
  * @brief W25Q Toggle WEL bit
  * Toggle write enable latch
  *
+ * @param[in] dev Device
  * @param[in] enable 1-enable write/0-disable write
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_WriteEnable(bool enable) {
+W25Q_STATE W25Q_WriteEnable(W25Q_Device *dev, bool enable) {
 	QSPI_CommandTypeDef com;
 
 	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
@@ -1428,29 +2821,26 @@ W25Q_STATE W25Q_WriteEnable(bool enable) {
 	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
-	if (HAL_QSPI_Command(&hqspi, &com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK) {
-		return W25Q_SPI_ERR;
-	}
-	w25q_delay(1); // Give a little time to sleep
-
-	w25q_status.WEL = 1;
+	w25q_lock();
+	W25Q_STATE state = W25Q_OK;
+	if (bus_command(dev, &com) != HAL_OK)
+		state = W25Q_SPI_ERR;
+	else
+		dev->status.WEL = enable; // latch is set at CS rise
+	w25q_unlock();
 
-	return W25Q_OK;
+	return state;
 }
 
 /**
  * @brief W25Q Toggle 4-byte mode
  *
  * @note Affects only ADS bit
+ * @param[in] dev Device
  * @param[in] enable 1-enable/0-disable
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_Enter4ByteMode(bool enable) {
-
-	while (W25Q_IsBusy() == W25Q_BUSY)
-		w25q_delay(1);
-
+W25Q_STATE W25Q_Enter4ByteMode(W25Q_Device *dev, bool enable) {
 	QSPI_CommandTypeDef com;
 
 	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
@@ -1472,50 +2862,1396 @@ W25Q_STATE W25Q_Enter4ByteMode(bool enable) {
 	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
-	if (HAL_QSPI_Command(&hqspi, &com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)
-			!= HAL_OK) {
-		return W25Q_SPI_ERR;
-	}
-
-	w25q_delay(1); // Give a little time to set command
+	w25q_lock();
+	W25Q_STATE state = wait_ready(dev, W25Q_TIMEOUT_CE);
+	if (state == W25Q_OK && bus_command(dev, &com) != HAL_OK)
+		state = W25Q_SPI_ERR;
+	if (state == W25Q_OK)
+		dev->status.ADS = enable; // mode is switched at CS rise
+	w25q_unlock();
 
-	return W25Q_ReadStatusStruct(NULL);
+	return state;
 }
 
 /**
  * @brief W25Q Set extended byte
- * Extended byte in 3-byte mode
+ * Write extended address register: 4th byte of addr in 3-byte mode
  *
- * @attention Func in development
- * @param[in] Addr 4th byte of addr
+ * @note Register is volatile (00h after power-up and reset)
+ * @param[in] dev Device
+ * @param[in] Addr 4th byte of addr (16 MB bank of each chip)
  * @return W25Q_STATE enum
  */
-W25Q_STATE W25Q_SetExtendedAddr(u8_t Addr) {
-	return W25Q_PARAM_ERR;
-}
+W25Q_STATE W25Q_SetExtendedAddr(W25Q_Device *dev, u8_t Addr) {
+	if (dev->addr4 || Addr >= (dev->size / w25q_chips(dev) + W25Q_ADDR3_MAX - 1) / W25Q_ADDR3_MAX)
+		return W25Q_PARAM_ERR;
+	QSPI_CommandTypeDef com;
 
-/**
- * @brief W25Q Get extended byte
- * Read extended byte in 3-byte mode
- *
- * @attention Func in development
- * @param[out] Addr 4th byte of addr
- * @return W25Q_STATE enum
- */
-W25Q_STATE W25Q_GetExtendedAddr(u8_t *outAddr) {
-	return W25Q_PARAM_ERR;
-}
+	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
+	com.Instruction = W25Q_WRITE_EXT_ADDR_REG;
 
-/**
- * @brief Page to address
- * Translate page to byte-address
- *
+	com.AddressMode = QSPI_ADDRESS_NONE;
+	com.AddressSize = QSPI_ADDRESS_NONE;
+	com.Address = 0x0U;
+
+	com.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+	com.AlternateBytes = QSPI_ALTERNATE_BYTES_NONE;
+	com.AlternateBytesSize = QSPI_ALTERNATE_BYTES_NONE;
+
+	com.DummyCycles = 0;
+	com.DataMode = QSPI_DATA_1_LINE;
+	com.NbData = w25q_chips(dev);
+
+	com.DdrMode = QSPI_DDR_MODE_DISABLE;
+	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+	u8_t buf[2] = { Addr, Addr }; // same bank in both chips of dual-flash
+
+	w25q_lock();
+	W25Q_STATE state = wait_ready(dev, W25Q_TIMEOUT_CE);
+	if (state == W25Q_OK)
+		state = W25Q_WriteEnable(dev, 1);
+	if (state == W25Q_OK && (bus_command(dev, &com) != HAL_OK || bus_transmit(dev, buf, 0) != HAL_OK))
+		state = W25Q_SPI_ERR;
+	if (state == W25Q_OK) {
+		if (dev->bank != Addr)
+			dev->bankSwitches++;
+		dev->bank = Addr;
+		dev->status.WEL = 0;
+	} else
+		dev->bank = 0xFF; // write could be half-done
+	w25q_unlock();
+
+	return state;
+}
+
+/**
+ * @brief W25Q Get extended byte
+ * Read extended address register: 4th byte of addr in 3-byte mode
+ *
+ * @param[in] dev Device
+ * @param[out] outAddr 4th byte of addr
+ * @return W25Q_STATE enum (W25Q_CHIP_ERR - chips of dual-flash differ)
+ */
+W25Q_STATE W25Q_GetExtendedAddr(W25Q_Device *dev, u8_t *outAddr) {
+	QSPI_CommandTypeDef com;
+
+	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
+	com.Instruction = W25Q_READ_EXT_ADDR_REG;
+
+	com.AddressMode = QSPI_ADDRESS_NONE;
+	com.AddressSize = QSPI_ADDRESS_NONE;
+	com.Address = 0x0U;
+
+	com.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+	com.AlternateBytes = QSPI_ALTERNATE_BYTES_NONE;
+	com.AlternateBytesSize = QSPI_ALTERNATE_BYTES_NONE;
+
+	com.DummyCycles = 0;
+	com.DataMode = QSPI_DATA_1_LINE;
+	com.NbData = w25q_chips(dev);
+
+	com.DdrMode = QSPI_DDR_MODE_DISABLE;
+	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+	u8_t buf[2] = { 0, };
+
+	w25q_lock();
+	W25Q_STATE state = W25Q_OK;
+	if (bus_command(dev, &com) != HAL_OK || bus_receive(dev, buf, 0) != HAL_OK)
+		state = W25Q_SPI_ERR;
+	else if (dev->dual && buf[0] != buf[1])
+		state = W25Q_CHIP_ERR;
+	// unknown bank is written by next access
+	dev->bank = state == W25Q_OK ? buf[0] : 0xFF;
+	w25q_unlock();
+
+	*outAddr = buf[0];
+	return state;
+}
+
+/**
+ * @brief Page to address
+ * Translate page to byte-address
+ *
+ * @param[in] dev Device
  * @param[in] pageNum Number of page
  * @param[in] pageShift Byte to shift inside page
  * @return byte-address
  */
-u32_t page_to_addr(u32_t pageNum, u8_t pageShift) {
-	return pageNum * MEM_PAGE_SIZE + pageShift;
+u32_t page_to_addr(W25Q_Device *dev, u32_t pageNum, u8_t pageShift) {
+	return pageNum * dev->pageSize + pageShift;
+}
+
+/**
+ * @brief Vector check
+ * Every segment is not empty and inside the chip
+ *
+ * @param[in] dev Device
+ * @param[in] vec Segments
+ * @param[in] count Count of segments
+ * @return 1-valid/0-parameters error
+ */
+bool vec_check(W25Q_Device *dev, const W25Q_IOVEC *vec, u32_t count) {
+	if (!vec || !count)
+		return 0;
+	for (u32_t i = 0; i < count; i++)
+		if (!vec[i].buf || !vec[i].len || vec[i].addr >= dev->size
+				|| vec[i].len > dev->size - vec[i].addr)
+			return 0;
+	return 1;
+}
+
+/**
+ * @brief Power wake
+ * Release chip from power-down and count the sleep
+ *
+ * @note Called under device's mutex (by w25q_lock too)
+ * @param[in] dev Device
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE power_wake(W25Q_Device *dev) {
+	QSPI_CommandTypeDef com;
+
+	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
+	com.Instruction = W25Q_POWERUP;	 // Command
+
+	com.AddressMode = QSPI_ADDRESS_NONE;
+	com.AddressSize = QSPI_ADDRESS_NONE;
+	com.Address = 0x0U;
+
+	com.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+	com.AlternateBytes = QSPI_ALTERNATE_BYTES_NONE;
+	com.AlternateBytesSize = QSPI_ALTERNATE_BYTES_NONE;
+
+	com.DummyCycles = 0;
+	com.DataMode = QSPI_DATA_NONE;
+	com.NbData = 0;
+
+	com.DdrMode = QSPI_DDR_MODE_DISABLE;
+	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+	if (bus_command(dev, &com) != HAL_OK)
+		return W25Q_SPI_ERR;
+	delay_us(W25Q_TRES1_US); // Give a little time to wake
+
+	if (dev->status.SLEEP) {
+		dev->status.SLEEP = 0;
+		dev->power.wakeups++;
+		dev->power.sleepMs += w25q_os_tick() - dev->power.sleepStart;
+	}
+	return W25Q_OK;
+}
+
+/**
+ * @brief Microsecond delay
+ * Busy-wait by OS layer's cycle counter (started by Init)
+ *
+ * @param[in] us Time in us
+ */
+void delay_us(u32_t us) {
+	u32_t t0 = w25q_os_cycles();
+	u32_t cycles = us * (w25q_os_cycles_hz() / 1000000U);
+	while (w25q_os_cycles() - t0 < cycles)
+		;
+}
+
+/**
+ * @brief Status decode
+ * Put status registers' bits to device's cache
+ *
+ * @param[in] dev Device
+ * @param[in] SRs Status registers 1..3
+ */
+void status_decode(W25Q_Device *dev, const u8_t *SRs) {
+	dev->status.BUSY = SRs[0] & 0b1;
+	dev->status.WEL = (SRs[0] >> 1) & 0b1;
+	dev->status.QE = (SRs[1] >> 1) & 0b1;
+	dev->status.SUS = (SRs[1] >> 7) & 0b1;
+	dev->status.ADS = SRs[2] & 0b1;
+	dev->status.ADP = (SRs[2] >> 1) & 0b1;
+	// SLEEP isn't in registers, it's kept by Sleep/WakeUP
+}
+
+/**
+ * @brief Dual-flash status merge
+ * Status of the pair: flag is set if it's set in both chips,
+ * BUSY (SR1) and SUS (SR2) - if in any chip
+ *
+ * @param[in] reg_num Register 1..3
+ * @param[in] sr Register of chip 1 and chip 2
+ * @return Register value
+ */
+u8_t status_merge(u8_t reg_num, const u8_t *sr) {
+	u8_t any = reg_num == 1 ? 0x01 : reg_num == 2 ? 0x80 : 0x00;
+	return (sr[0] & sr[1]) | ((sr[0] | sr[1]) & any);
+}
+
+/**
+ * @brief Dual-flash odd program
+ * Program odd head/tail byte with its pair, pair byte is 0xFF
+ * (programming 0xFF doesn't change the cell)
+ *
+ * @param[in] dev Device
+ * @param[in] buf Pointer to data
+ * @param[in] len Length of data
+ * @param[in] rawAddr Start address
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE program_pairs(W25Q_Device *dev, u8_t *buf, u16_t len, u32_t rawAddr) {
+	u8_t pair[2];
+	W25Q_STATE state = W25Q_OK;
+
+	w25q_lock();
+	if (rawAddr & 1U) {
+		pair[0] = 0xFF;
+		pair[1] = *buf++;
+		state = W25Q_ProgramRaw(dev, pair, 2, rawAddr - 1);
+		rawAddr++;
+		len--;
+	}
+	if (state == W25Q_OK && len > 1)
+		state = W25Q_ProgramRaw(dev, buf, len & ~1U, rawAddr);
+	if (state == W25Q_OK && (len & 1U)) {
+		pair[0] = buf[len - 1];
+		pair[1] = 0xFF;
+		state = W25Q_ProgramRaw(dev, pair, 2, rawAddr + len - 1);
+	}
+	w25q_unlock();
+	return state;
+}
+
+/**
+ * @brief Byte order check
+ *
+ * @param[in] size Size of element
+ * @param[in] order Byte order of elements in chip
+ * @return 1-bytes must be swapped/0-same order
+ */
+bool need_swap(u8_t size, W25Q_ORDER order) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return size > 1 && order == W25Q_ORDER_LE;
+#else
+	return size > 1 && order == W25Q_ORDER_BE;
+#endif
+}
+
+/**
+ * @brief Byte swap
+ * Reverse bytes of every 16/32-bit element, word-at-a-time
+ * (REV16/REV) when both buffers are word-aligned
+ *
+ * @param[out] dst Destination (may be equal to src)
+ * @param[in] src Source elements
+ * @param[in] len Length of data (multiple of size)
+ * @param[in] size Size of element (2 or 4)
+ */
+void swap_bytes(u8_t *dst, const u8_t *src, u32_t len, u8_t size) {
+	// unaligned head - element by element
+	while (len && (((uintptr_t) dst | (uintptr_t) src) & 0b11)) {
+		u8_t b0 = src[0], b1 = src[1];
+		if (size == 2) {
+			dst[0] = b1;
+			dst[1] = b0;
+		} else {
+			u8_t b2 = src[2], b3 = src[3];
+			dst[0] = b3;
+			dst[1] = b2;
+			dst[2] = b1;
+			dst[3] = b0;
+		}
+		src += size;
+		dst += size;
+		len -= size;
+	}
+	// aligned words
+	const u32_t *in = (const u32_t*) src;
+	u32_t *out = (u32_t*) dst;
+	if (size == 2)
+		for (; len >= 4; len -= 4)
+			*out++ = __REV16(*in++);
+	else
+		for (; len >= 4; len -= 4)
+			*out++ = __REV(*in++);
+	// last odd halfword
+	if (len) {
+		src = (const u8_t*) in;
+		dst = (u8_t*) out;
+		u8_t b0 = src[0];
+		dst[0] = src[1];
+		dst[1] = b0;
+	}
+}
+
+/**
+ * @brief Calibration pattern
+ * Pages: all lines toggle, neighbour lines opposite,
+ * walking one/zero, pseudo-random
+ *
+ * @param[in] i Byte index in pattern
+ * @return Pattern byte
+ */
+u8_t cal_byte(u32_t i) {
+	switch ((i / MEM_PAGE_SIZE) % W25Q_CAL_PAGES) {
+	case 0:
+		return i & 1U ? 0xFF : 0x00;
+	case 1:
+		return i & 1U ? 0xAA : 0x55;
+	case 2:
+		return (u8_t) (1U << (i & 7U)) ^ (i & 8U ? 0xFF : 0x00);
+	default:
+		return (u8_t) ((i * 2654435761U) >> 24);
+	}
+}
+
+/**
+ * @brief Calibration check
+ * Read pattern by quad reads without status polls
+ * (status can't be trusted at untested clock)
+ *
+ * @note Chip must be ready
+ * @param[in] dev Device
+ * @param[in] rawAddr Pattern address
+ * @param[in] passes Reads of whole pattern
+ * @return W25Q_STATE enum (W25Q_VERIFY_ERR - pattern mismatch)
+ */
+W25Q_STATE cal_check(W25Q_Device *dev, u32_t rawAddr, u16_t passes) {
+	u8_t buf[MEM_PAGE_SIZE * 2U];
+	while (passes--) {
+		for (u32_t p = 0; p < W25Q_CAL_PAGES; p++) {
+			W25Q_STATE state = fast_read(dev, buf, dev->pageSize, rawAddr + p * dev->pageSize, 0);
+			if (state != W25Q_OK) {
+				dev->bus->abort(dev);
+				return state;
+			}
+			for (u32_t i = 0; i < dev->pageSize; i++)
+				if (buf[i] != cal_byte(p * dev->pageSize + i))
+					return W25Q_VERIFY_ERR;
+		}
+	}
+	return W25Q_OK;
+}
+
+/**
+ * @brief Fast read
+ * Send fast read command (quad I/O if device is quad) and receive data
+ *
+ * @note Chip should be checked for BUSY before
+ * @param[in] dev Device
+ * @param[out] buf Pointer to data array
+ * @param[in] len Length of data
+ * @param[in] rawAddr Start address of chip's cell
+ * @param[in] dma 1-start DMA receive and return (use dma_wait)/0-blocking
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE fast_read(W25Q_Device *dev, u8_t *buf, u32_t len, u32_t rawAddr, bool dma) {
+	QSPI_CommandTypeDef com;
+
+	// dual-flash moves byte pairs: odd head/tail is read with its pair
+	// (read_direct and stream_read give DMA even start and length,
+	// so CPU never writes bytes of lines invalidated after DMA)
+	if (dev->dual && ((rawAddr | len) & 1U)) {
+		u8_t pair[2];
+		W25Q_STATE state;
+		if (rawAddr & 1U) {
+			state = fast_read(dev, pair, 2, rawAddr - 1, 0);
+			if (state != W25Q_OK)
+				return state;
+			*buf++ = pair[1];
+			rawAddr++;
+			if (!--len)
+				return W25Q_OK;
+		}
+		if (len & 1U) {
+			state = fast_read(dev, pair, 2, rawAddr + len - 1, 0);
+			if (state != W25Q_OK)
+				return state;
+			buf[len - 1] = pair[0];
+			if (!--len)
+				return W25Q_OK;
+		}
+	}
+
+	// command reaches one bank: longer read is split at its end
+	u32_t left = w25q_bank_left(dev, rawAddr);
+	if (len > left) {
+		W25Q_STATE state = fast_read(dev, buf, left, rawAddr, dma);
+		if (state == W25Q_OK && dma)
+			state = dma_wait(dev);
+		if (state == W25Q_OK)
+			state = fast_read(dev, buf + left, len - left, rawAddr + left, dma);
+		return state;
+	}
+	W25Q_STATE state = bank_select(dev, rawAddr);
+	if (state != W25Q_OK)
+		return state;
+
+	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
+	if (dev->quad)
+		addr_command(dev, &com, W25Q_FAST_READ_QUAD_IO, W25Q_FAST_READ_QUAD_IO_4B, rawAddr);
+	else
+		addr_command(dev, &com, W25Q_FAST_READ, W25Q_FAST_READ_4B, rawAddr);
+	com.AddressMode = dev->quad ? QSPI_ADDRESS_4_LINES : QSPI_ADDRESS_1_LINE;
+
+	com.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+	com.AlternateBytes = QSPI_ALTERNATE_BYTES_NONE;
+	com.AlternateBytesSize = QSPI_ALTERNATE_BYTES_NONE;
+
+	com.DummyCycles = dev->quad ? 6 : 8;
+	com.DataMode = dev->quad ? QSPI_DATA_4_LINES : QSPI_DATA_1_LINE;
+	com.NbData = len;
+
+	com.DdrMode = QSPI_DDR_MODE_DISABLE;
+	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+	if (dma) {
+		// no dirty line may be evicted over DMA data
+		w25q_dcache_invalidate(buf, len);
+		dev->dmaBuf = buf;
+	}
+
+	if (bus_command(dev, &com) != HAL_OK)
+		return W25Q_SPI_ERR;
+
+	if (bus_receive(dev, buf, dma) != HAL_OK)
+		return W25Q_SPI_ERR;
+
+	return W25Q_OK;
+}
+
+/**
+ * @brief Read direct
+ * DMA read to caller's buffer. Partial cache lines of unaligned
+ * head and tail are read by CPU, whole lines - by DMA
+ *
+ * @note Chip should be checked for BUSY before
+ * @param[in] dev Device
+ * @param[out] buf Pointer to data array
+ * @param[in] len Length of data
+ * @param[in] rawAddr Start address of chip's cell
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE read_direct(W25Q_Device *dev, u8_t *buf, u32_t len, u32_t rawAddr) {
+	u32_t head = 0, tail = 0;
+	if (w25q_dcache_on()) {
+		head = -(uintptr_t) buf & (W25Q_CACHE_LINE - 1U);
+		if (head > len)
+			head = len;
+		tail = (len - head) & (W25Q_CACHE_LINE - 1U);
+	}
+	// dual-flash DMA part must be of byte pairs. Line-aligned buffer
+	// part at odd address can't be one: whole read goes by CPU
+	if (dev->dual && ((rawAddr + head) & 1U)) {
+		if (w25q_dcache_on())
+			return fast_read(dev, buf, len, rawAddr, 0);
+		head = 1;
+	}
+	if (dev->dual)
+		tail |= (len - head) & 1U;
+
+	W25Q_STATE state = W25Q_OK;
+	u32_t mid = len - head - tail;
+	if (head)
+		state = fast_read(dev, buf, head, rawAddr, 0);
+	if (state == W25Q_OK && mid) {
+		state = fast_read(dev, buf + head, mid, rawAddr + head, 1);
+		if (state == W25Q_OK)
+			state = dma_wait(dev);
+	}
+	if (state == W25Q_OK && tail)
+		state = fast_read(dev, buf + head + mid, tail, rawAddr + head + mid, 0);
+	return state;
+}
+
+/**
+ * @brief DMA wait
+ * Wait for the end of DMA receive/transmit
+ *
+ * @param[in] dev Device
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE dma_wait(W25Q_Device *dev) {
+#if W25Q_USE_DMA
+	if (!dev->bus->dma)
+		return W25Q_OK; // transfer was blocking
+
+	HAL_StatusTypeDef st;
+	if (w25q_use_it(dev)) {
+		// transport's interrupt gives the semaphore
+		if (!w25q_os_sem_take(dev->sem, HAL_QSPI_TIMEOUT_DEFAULT_VALUE)) {
+			dev->bus->abort(dev);
+			dev->dmaBuf = NULL;
+			w25q_trace_end(dev->dmaFlags | W25Q_TRACE_ERR);
+			return W25Q_SPI_ERR;
+		}
+		st = dev->bus->status(dev);
+	} else
+		while ((st = dev->bus->status(dev)) == HAL_BUSY)
+			;
+	// drop lines speculatively loaded while DMA wrote
+	if (dev->dmaBuf && st == HAL_OK)
+		w25q_dcache_invalidate(dev->dmaBuf, dev->nbData);
+	dev->dmaBuf = NULL;
+	w25q_trace_end(dev->dmaFlags | (st != HAL_OK ? W25Q_TRACE_ERR : 0));
+	if (st != HAL_OK)
+		return W25Q_SPI_ERR;
+#endif
+	return W25Q_OK;
+}
+
+/**
+ * @brief Stream read
+ * Read region by W25Q_STREAM_CHUNK parts to double buffer
+ * and give every part to consumer
+ *
+ * @note With W25Q_USE_DMA the next part is read while consumer works
+ * @param[in] dev Device
+ * @param[in] len Length of data
+ * @param[in] rawAddr Start address of chip's cell
+ * @param[in] consume Consumer, stops the stream if returns not W25Q_OK
+ * @param[in] ctx Consumer's context
+ * @return W25Q_STATE enum (consumer's state on stop)
+ */
+W25Q_STATE stream_read(W25Q_Device *dev, u32_t len, u32_t rawAddr, stream_fn consume, void *ctx) {
+	if (len == 0 || rawAddr >= dev->size
+			|| len > dev->size - rawAddr)
+		return W25Q_PARAM_ERR;
+
+	// stream buffers are device's, so the whole stream is under lock
+	w25q_lock();
+	W25Q_STATE state = wait_ready(dev, W25Q_TIMEOUT_CE);
+	if (state == W25Q_OK)
+		state = stream_run(dev, dev->streamBuf[0], dev->streamBuf[1],
+				W25Q_STREAM_CHUNK, len, rawAddr, consume, ctx);
+	w25q_unlock();
+	return state;
+}
+
+/**
+ * @brief Stream run
+ * Stream read body: chip is ready, device is locked
+ *
+ * @param[in] dev Device
+ * @param[in] buf0 First buffer
+ * @param[in] buf1 Second buffer
+ * @param[in] chunk Size of buffers (even in dual-flash)
+ * @param[in] len Length of data
+ * @param[in] rawAddr Start address of chip's cell
+ * @param[in] consume Consumer, stops the stream if returns not W25Q_OK
+ * @param[in] ctx Consumer's context
+ * @return W25Q_STATE enum (consumer's state on stop)
+ */
+W25Q_STATE stream_run(W25Q_Device *dev, u8_t *buf0, u8_t *buf1, u32_t chunk,
+		u32_t len, u32_t rawAddr, stream_fn consume, void *ctx) {
+	// dual-flash reads whole byte pairs, extra bytes aren't consumed
+	u32_t skip = dev->dual ? rawAddr & 1U : 0;
+	rawAddr -= skip;
+	len += skip;
+	u32_t pad = dev->dual ? len & 1U : 0;
+	len += pad;
+
+	bool dma = W25Q_USE_DMA && dev->bus->dma;
+	u8_t *buf[2] = { buf0, buf1 };
+	u8_t cur = 0;
+	u32_t part = len > chunk ? chunk : len;
+	W25Q_STATE state = fast_read(dev, buf[cur], part, rawAddr, dma);
+
+	while (state == W25Q_OK) {
+		state = dma_wait(dev);
+		if (state != W25Q_OK)
+			break;
+
+		u32_t done = part;
+		len -= done;
+		rawAddr += done;
+
+		// next part goes to another buffer
+		if (len) {
+			part = len > chunk ? chunk : len;
+			state = fast_read(dev, buf[cur ^ 1], part, rawAddr, dma);
+			if (state != W25Q_OK)
+				break;
+		}
+
+		state = consume(buf[cur] + skip, done - skip - (len ? 0 : pad), ctx);
+		skip = 0;
+		if (state != W25Q_OK) {
+			if (len)
+				dma_wait(dev); // don't leave DMA running
+			break;
+		}
+		if (!len)
+			break;
+		cur ^= 1;
+	}
+
+	return state;
+}
+
+/**
+ * @brief CRC-32 step
+ * Table-driven CRC-32 (IEEE 802.3), data loaded word-at-a-time
+ *
+ * @param[in] crc Current CRC (0xFFFFFFFF at start)
+ * @param[in] data Pointer to data
+ * @param[in] len Length of data
+ * @return CRC (invert it at the end)
+ */
+u32_t crc32_update(u32_t crc, const u8_t *data, u32_t len) {
+	// unaligned head
+	while (len && ((uintptr_t) data & 0b11)) {
+		crc = crc_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+		len--;
+	}
+	// aligned words (little-endian core)
+	const u32_t *word = (const u32_t*) data;
+	for (; len >= 4; len -= 4) {
+		crc ^= *word++;
+		crc = crc_table[crc & 0xFF] ^ (crc >> 8);
+		crc = crc_table[crc & 0xFF] ^ (crc >> 8);
+		crc = crc_table[crc & 0xFF] ^ (crc >> 8);
+		crc = crc_table[crc & 0xFF] ^ (crc >> 8);
+	}
+	// tail
+	data = (const u8_t*) word;
+	while (len--)
+		crc = crc_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+
+	return crc;
+}
+
+/**
+ * @brief Operation unit
+ * Bytes of operation's next command
+ *
+ * @param[in] dev Device
+ * @param[in] op Operation
+ * @return Page's part, or size of biggest erase fitting the rest
+ */
+u32_t op_unit(W25Q_Device *dev, const W25Q_OP *op) {
+	if (op->buf) {
+		u32_t unit = dev->pageSize - op->addr % dev->pageSize;
+		return unit < op->left ? unit : op->left;
+	}
+	if (op->addr == 0 && op->left == dev->size)
+		return dev->size;
+	if (op->addr % dev->blockSize == 0 && op->left >= dev->blockSize)
+		return dev->blockSize;
+	if (op->addr % (dev->blockSize / 2U) == 0 && op->left >= dev->blockSize / 2U)
+		return dev->blockSize / 2U;
+	return dev->sectorSize;
+}
+
+/**
+ * @brief Operation typical time
+ *
+ * @param[in] dev Device
+ * @param[in] op Operation
+ * @param[in] unit Command's bytes (op_unit)
+ * @return Datasheet's typical time, us
+ */
+u32_t op_typ(W25Q_Device *dev, const W25Q_OP *op, u32_t unit) {
+	if (op->buf)
+		return W25Q_TYP_PP_US;
+	if (unit == dev->size)
+		return W25Q_TYP_CE_US;
+	if (unit == dev->blockSize)
+		return W25Q_TYP_BE64_US;
+	if (unit == dev->blockSize / 2U)
+		return W25Q_TYP_BE32_US;
+	return W25Q_TYP_SE_US;
+}
+
+/**
+ * @brief Operation issue
+ * Send next command of operation and return without waiting
+ *
+ * @note Called under device's lock, chip must be ready
+ * @param[in] dev Device
+ * @param[in,out] op Operation (run = 0 if nothing is left)
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE op_issue(W25Q_Device *dev, W25Q_OP *op) {
+	// pages filled with 0xFF needn't program
+	while (op->buf && op->left) {
+		u32_t unit = op_unit(dev, op);
+		if (!W25Q_IsErased(op->buf, unit))
+			break;
+		op->doneUs += W25Q_TYP_PP_US;
+		op->addr += unit;
+		op->left -= unit;
+		op->buf += unit;
+	}
+	op->run = 0;
+	op->unit = 0;
+	dev->opLen = 0;
+	if (!op->left)
+		return W25Q_OK;
+
+	u32_t unit = op_unit(dev, op);
+	QSPI_CommandTypeDef com;
+
+	com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
+	com.AddressMode = QSPI_ADDRESS_1_LINE;
+	com.DataMode = QSPI_DATA_NONE;
+	com.NbData = 0;
+	if (op->buf) {
+		if (dev->quad)
+			addr_command(dev, &com, W25Q_PAGE_PROGRAM_QUAD_INP,
+					W25Q_PAGE_PROGRAM_QUAD_INP_4B, op->addr);
+		else
+			addr_command(dev, &com, W25Q_PAGE_PROGRAM, W25Q_PAGE_PROGRAM_4B, op->addr);
+		com.DataMode = dev->quad ? QSPI_DATA_4_LINES : QSPI_DATA_1_LINE;
+		com.NbData = unit;
+		op->maxMs = W25Q_TIMEOUT_PP;
+	} else if (unit == dev->size) {
+		com.Instruction = W25Q_CHIP_ERASE;
+		com.AddressMode = QSPI_ADDRESS_NONE;
+		com.AddressSize = QSPI_ADDRESS_NONE;
+		com.Address = 0x0U;
+		op->maxMs = W25Q_TIMEOUT_CE;
+	} else if (unit == dev->blockSize) {
+		addr_command(dev, &com, W25Q_64KB_BLOCK_ERASE, W25Q_64KB_BLOCK_ERASE_4B, op->addr);
+		op->maxMs = W25Q_TIMEOUT_BE64;
+	} else if (unit == dev->blockSize / 2U) {
+		addr_command(dev, &com, W25Q_32KB_BLOCK_ERASE, W25Q_32KB_BLOCK_ERASE, op->addr);
+		op->maxMs = W25Q_TIMEOUT_BE32;
+	} else {
+		addr_command(dev, &com, W25Q_SECTOR_ERASE, W25Q_SECTOR_ERASE_4B, op->addr);
+		op->maxMs = W25Q_TIMEOUT_SE;
+	}
+
+	com.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+	com.AlternateBytes = QSPI_ALTERNATE_BYTES_NONE;
+	com.AlternateBytesSize = QSPI_ALTERNATE_BYTES_NONE;
+
+	com.DummyCycles = 0;
+
+	com.DdrMode = QSPI_DDR_MODE_DISABLE;
+	com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+	W25Q_STATE state = W25Q_OK;
+	if (com.AddressMode != QSPI_ADDRESS_NONE)
+		state = bank_select(dev, op->addr);
+	if (state == W25Q_OK)
+		state = W25Q_WriteEnable(dev, 1);
+	if (state == W25Q_OK && (bus_command(dev, &com) != HAL_OK
+			|| (op->buf && bus_transmit(dev, (u8_t*) op->buf, 0) != HAL_OK)))
+		state = W25Q_SPI_ERR;
+	if (state != W25Q_OK)
+		return state;
+
+	dev->status.BUSY = 1; // power manager keeps chip on till poll sees the end
+	dev->opAddr = op->addr;
+	dev->opLen = unit;
+	op->unit = unit;
+	op->unitUs = op_typ(dev, op, unit);
+	dev->opStart = w25q_os_cycles();
+	dev->opUs = op->unitUs;
+	op->start = w25q_os_tick();
+	op->suspendUs = dev->suspendUs;
+	op->run = 1;
+#if W25Q_STATS_SECTORS
+	if (!op->buf)
+		for (u32_t i = op->addr / dev->sectorSize;
+				i < (op->addr + unit) / dev->sectorSize && i < SECTOR_COUNT; i++)
+			w25q_stat_inc(sectorErases[i]);
+#endif
+	return W25Q_OK;
+}
+
+/**
+ * @brief Operation progress
+ * Running command counts by its elapsed time, but not
+ * over its typical time
+ *
+ * @param[in,out] op Operation
+ */
+void op_progress(W25Q_OP *op) {
+	if (!op->run) {
+		op->progress = op->left ? op->progress : 100U;
+		op->etaMs = 0;
+		return;
+	}
+	u32_t us = (w25q_os_tick() - op->start) * 1000U;
+	us = op->doneUs + (us < op->unitUs ? us : op->unitUs);
+	u32_t pct = op->totalUs ? (u32_t) ((uint64_t) us * 100U / op->totalUs) : 0;
+	op->progress = pct > 99U ? 99U : pct; // 100 % is the end only
+	op->etaMs = us < op->totalUs ? (op->totalUs - us + 999U) / 1000U : 1U;
+}
+
+/**
+ * @brief Address command
+ * Set opcode and address size by device's address mode
+ *
+ * @param[in] dev Device
+ * @param[out] com Command
+ * @param[in] op3 Opcode for 3-byte address
+ * @param[in] op4 Opcode for 4-byte address
+ * @param[in] addr Address
+ */
+void addr_command(W25Q_Device *dev, QSPI_CommandTypeDef *com, u8_t op3,
+		u8_t op4, u32_t addr) {
+	com->Instruction = dev->addr4 ? op4 : op3;	 // Command
+	com->AddressSize = dev->addr4 ? QSPI_ADDRESS_32_BITS : QSPI_ADDRESS_24_BITS;
+	// upper bits are in extended address register (bank_select)
+	com->Address = dev->ear ? addr % (W25Q_ADDR3_MAX * w25q_chips(dev)) : addr;
+}
+
+/**
+ * @brief Bank select
+ * Write extended address register if address is in other 16 MB
+ * bank than the last one, so commands stay 3-byte (8 address
+ * clocks less in single line, 2 in quad)
+ *
+ * @note Called under device's lock, command must not cross bank
+ * @param[in] dev Device
+ * @param[in] rawAddr Address of next command
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE bank_select(W25Q_Device *dev, u32_t rawAddr) {
+	u8_t bank = rawAddr / w25q_chips(dev) / W25Q_ADDR3_MAX;
+	if (!dev->ear || bank == dev->bank)
+		return W25Q_OK;
+	return W25Q_SetExtendedAddr(dev, bank);
+}
+
+/**
+ * @brief Bus Command
+ * Send command to transport (single point for all commands)
+ *
+ * @param[in] dev Device
+ * @param[in] com Command
+ * @return HAL_StatusTypeDef enum
+ */
+HAL_StatusTypeDef bus_command(W25Q_Device *dev, QSPI_CommandTypeDef *com) {
+	w25q_stat_inc(commands[com->Instruction & 0xFF]);
+	dev->nbData = com->DataMode == QSPI_DATA_NONE ? 0 : com->NbData;
+	w25q_trace_begin(com);
+	HAL_StatusTypeDef st = dev->bus->command(dev, com);
+	if (st != HAL_OK)
+		w25q_trace_end(W25Q_TRACE_ERR);
+	else if (com->DataMode == QSPI_DATA_NONE)
+		w25q_trace_end(0);
+	return st;
+}
+
+/**
+ * @brief Bus Receive
+ * Receive data of the last command
+ *
+ * @param[in] dev Device
+ * @param[out] buf Pointer to data array
+ * @param[in] dma 1-start DMA receive/0-blocking
+ * @return HAL_StatusTypeDef enum
+ */
+HAL_StatusTypeDef bus_receive(W25Q_Device *dev, u8_t *buf, bool dma) {
+	w25q_stat_add(bytesRead, dev->nbData);
+	HAL_StatusTypeDef st = dev->bus->receive(dev, buf, dma);
+	if (dma) {
+		// trace record is finished in dma_wait
+		dev->dmaFlags = W25Q_TRACE_DMA;
+		if (st != HAL_OK)
+			w25q_trace_end(W25Q_TRACE_DMA | W25Q_TRACE_ERR);
+		return st;
+	}
+	w25q_trace_end(st != HAL_OK ? W25Q_TRACE_ERR : 0);
+	return st;
+}
+
+/**
+ * @brief Bus Transmit
+ * Transmit data of the last command
+ *
+ * @param[in] dev Device
+ * @param[in] buf Pointer to data array
+ * @param[in] dma 1-start DMA transmit (cache cleaned by caller)/0-blocking
+ * @return HAL_StatusTypeDef enum
+ */
+HAL_StatusTypeDef bus_transmit(W25Q_Device *dev, u8_t *buf, bool dma) {
+	w25q_stat_add(bytesWritten, dev->nbData);
+	HAL_StatusTypeDef st = dev->bus->transmit(dev, buf, dma);
+	if (dma) {
+		// trace record is finished in dma_wait
+		dev->dmaFlags = W25Q_TRACE_WRITE | W25Q_TRACE_DMA;
+		dev->dmaBuf = NULL;
+		if (st != HAL_OK)
+			w25q_trace_end(W25Q_TRACE_WRITE | W25Q_TRACE_DMA | W25Q_TRACE_ERR);
+		return st;
+	}
+	w25q_trace_end(W25Q_TRACE_WRITE | (st != HAL_OK ? W25Q_TRACE_ERR : 0));
+	return st;
+}
+
+/**
+ * @brief Bus Auto-polling
+ * Start status polling by transport, match interrupt finishes it
+ *
+ * @note Trace record is finished in wait_ready
+ * @param[in] dev Device
+ * @param[in] com Status read command
+ * @param[in] cfg Polling config
+ * @return HAL_StatusTypeDef enum
+ */
+HAL_StatusTypeDef bus_autopoll(W25Q_Device *dev, QSPI_CommandTypeDef *com,
+		QSPI_AutoPollingTypeDef *cfg) {
+	w25q_stat_inc(commands[com->Instruction & 0xFF]);
+	w25q_trace_begin(com);
+	HAL_StatusTypeDef st = dev->bus->autopoll(dev, com, cfg);
+	if (st != HAL_OK)
+		w25q_trace_end(W25Q_TRACE_ERR);
+	return st;
+}
+
+/**
+ * @brief Wait for ready
+ * Wait till BUSY == 0 or timeout
+ *
+ * @note With W25Q_USE_IT the transport polls SR1 itself and calling
+ * task sleeps on semaphore till status match interrupt, else SR1 is
+ * read every 1 ms (w25q_delay sleeps in RTOS)
+ * @param[in] dev Device
+ * @param[in] timeout Max operation time in ms
+ * @return W25Q_STATE enum (W25Q_BUSY on timeout)
+ */
+W25Q_STATE wait_ready(W25Q_Device *dev, u32_t timeout) {
+	W25Q_STATE state = W25Q_IsBusy(dev);
+	if (state != W25Q_BUSY)
+		return state;
+
+	if (w25q_use_it(dev)) {
+		QSPI_CommandTypeDef com;
+
+		com.InstructionMode = QSPI_INSTRUCTION_1_LINE; // QSPI_INSTRUCTION_...
+		com.Instruction = W25Q_READ_SR1;	 // Command
+
+		com.AddressMode = QSPI_ADDRESS_NONE;
+		com.AddressSize = QSPI_ADDRESS_NONE;
+		com.Address = 0x0U;
+
+		com.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+		com.AlternateBytes = QSPI_ALTERNATE_BYTES_NONE;
+		com.AlternateBytesSize = QSPI_ALTERNATE_BYTES_NONE;
+
+		com.DummyCycles = 0;
+		com.DataMode = QSPI_DATA_1_LINE;
+		com.NbData = w25q_chips(dev);
+
+		com.DdrMode = QSPI_DDR_MODE_DISABLE;
+		com.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+		com.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+		QSPI_AutoPollingTypeDef cfg;
+
+		cfg.Match = 0x00;	// BUSY == 0 (of both chips in dual-flash)
+		cfg.Mask = dev->dual ? 0x0101 : 0x01;
+		cfg.MatchMode = QSPI_MATCH_MODE_AND;
+		cfg.StatusBytesSize = w25q_chips(dev);
+		cfg.Interval = 0x10;
+		cfg.AutomaticStop = QSPI_AUTOMATIC_STOP_ENABLE;
+
+		if (bus_autopoll(dev, &com, &cfg) != HAL_OK)
+			return W25Q_SPI_ERR;
+
+		if (!w25q_os_sem_take(dev->sem, timeout)) {
+			dev->bus->abort(dev);
+			w25q_os_sem_take(dev->sem, 0); // drop late signal
+			w25q_trace_end(W25Q_TRACE_ERR);
+			return W25Q_BUSY;
+		}
+		if (dev->bus->status(dev) != HAL_OK) {
+			w25q_trace_end(W25Q_TRACE_ERR);
+			return W25Q_SPI_ERR;
+		}
+		w25q_trace_end(0);
+		dev->status.BUSY = 0;
+		return W25Q_OK;
+	}
+
+	u32_t start = w25q_os_tick();
+	while (state == W25Q_BUSY) {
+		if (w25q_os_tick() - start > timeout)
+			return W25Q_BUSY;
+		w25q_delay(1);
+		state = W25Q_IsBusy(dev);
+	}
+	return state;
+}
+
+/**
+ * @brief Wait for write
+ * Wait till sent program/erase ends, device is given between polls
+ *
+ * @note Other calls wait for the end, only W25Q_ReadUrgent
+ * gets the device meanwhile: it reads outside addr..addr+len with the
+ * command suspended. Commands shorter than 1 ms are polled every tSUS
+ * (no autopoll: it would hold the bus)
+ * @param[in] dev Device
+ * @param[in] addr Start of command's cells
+ * @param[in] len Length of command's cells (device size - not suspendable)
+ * @param[in] typUs Typical command time, us
+ * @param[in] timeout Max operation time in ms
+ * @return W25Q_STATE enum (W25Q_BUSY on timeout)
+ */
+W25Q_STATE wait_write(W25Q_Device *dev, u32_t addr, u32_t len, u32_t typUs,
+		u32_t timeout) {
+	dev->status.BUSY = 1;
+	dev->opAddr = addr;
+	dev->opLen = len;
+	dev->opUs = typUs;
+	dev->opStart = w25q_os_cycles();
+	dev->writeWait = 1;
+
+	W25Q_STATE state = W25Q_BUSY;
+	u32_t start = w25q_os_tick();
+	u32_t sus = dev->suspendUs;
+	// time suspended by urgent reads isn't command's
+	while (state == W25Q_BUSY
+			&& w25q_os_tick() - start <= timeout + (dev->suspendUs - sus) / 1000U) {
+		u8_t depth = lock_give(dev);
+		if (typUs >= 1000U)
+			w25q_delay(1);
+		else
+			delay_us(W25Q_TSUS_US);
+		lock_retake(dev, depth);
+		state = W25Q_IsBusy(dev);
+	}
+	dev->writeWait = 0;
+	dev->opLen = 0;
+	return state;
+}
+
+/**
+ * @brief Take device
+ * Take device's mutex, wait while other task's blocking program/erase
+ * runs with the device given (wait_write)
+ *
+ * @param[in] dev Device
+ * @param[in] urgent 1-don't wait for the write (W25Q_ReadUrgent)
+ */
+void lock_take(W25Q_Device *dev, bool urgent) {
+	w25q_os_mutex_lock(dev->mutex);
+#if W25Q_OS != W25Q_OS_NONE
+	while (dev->writeWait && !dev->lockDepth && !urgent) {
+		w25q_os_mutex_unlock(dev->mutex);
+		w25q_os_sleep(1);
+		w25q_os_mutex_lock(dev->mutex);
+	}
+#endif
+	dev->lockDepth++;
 }
 
+/**
+ * @brief Give device
+ * Give all levels of device's mutex taken by the calling task
+ *
+ * @param[in] dev Device
+ * @return Levels given
+ */
+u8_t lock_give(W25Q_Device *dev) {
+	u8_t depth = dev->lockDepth;
+	dev->lockDepth = 0;
+	for (u8_t i = 0; i < depth; i++)
+		w25q_os_mutex_unlock(dev->mutex);
+	return depth;
+}
+
+/**
+ * @brief Take device back
+ * Take levels given by lock_give
+ *
+ * @param[in] dev Device
+ * @param[in] depth Levels given
+ */
+void lock_retake(W25Q_Device *dev, u8_t depth) {
+	for (u8_t i = 0; i < depth; i++)
+		w25q_os_mutex_lock(dev->mutex);
+	dev->lockDepth = depth;
+}
+
+#if W25Q_STATS_ENABLE
+/**
+ * @brief Latency to statistics
+ * Add measure to log2 histogram
+ *
+ * @param[in] dev Device
+ * @param[in] api Measured function
+ * @param[in] ticks Duration in W25Q_STATS_TIMER ticks
+ * @param[in] deadlineUs Call's own deadline, us (0 - class's one)
+ */
+void stat_latency(W25Q_Device *dev, W25Q_API api, u32_t ticks, u32_t deadlineUs) {
+	static const u32_t deadline[W25Q_PRIO_COUNT] = { W25Q_DEADLINE_HIGH_US,
+			W25Q_DEADLINE_NORMAL_US, W25Q_DEADLINE_LOW_US };
+	// measure ends after unlock, snapshot is taken under the mutex
+	w25q_os_mutex_lock(dev->mutex);
+	w25q_stat_inc(latency[api][31 - __CLZ(ticks | 1)]);
+
+	// class is given by function
+	W25Q_PRIO prio = W25Q_PRIO_NORMAL;
+	if (api == W25Q_API_READ_URGENT)
+		prio = W25Q_PRIO_HIGH;
+	else if (api == W25Q_API_OP)
+		prio = W25Q_PRIO_LOW;
+	w25q_stat_inc(prioLatency[prio][31 - __CLZ(ticks | 1)]);
+	if (!deadlineUs)
+		deadlineUs = deadline[prio];
+	if (deadlineUs && (uint64_t) ticks * 1000000U > (uint64_t) deadlineUs * W25Q_STATS_TIMER_HZ)
+		w25q_stat_inc(deadlineMissed[prio]);
+	w25q_os_mutex_unlock(dev->mutex);
+}
+#endif
+
+#if W25Q_TRACE_ENABLE
+/**
+ * @brief Trace begin
+ * Put command to the trace ring (oldest record is overwritten if full)
+ *
+ * @param[in] dev Device
+ * @param[in] com Command
+ */
+void trace_begin(W25Q_Device *dev, QSPI_CommandTypeDef *com) {
+	if (dev->trace.head - dev->trace.tail == W25Q_TRACE_DEPTH) {
+		dev->trace.tail++;
+		dev->trace.dropped++;
+	}
+	W25Q_TRACE_REC *rec = &dev->trace.ring[dev->trace.head % W25Q_TRACE_DEPTH];
+	rec->time = W25Q_STATS_TIMER();
+	rec->duration = 0;
+	rec->addr = com->AddressMode == QSPI_ADDRESS_NONE ? 0 : com->Address;
+	rec->len = com->DataMode == QSPI_DATA_NONE ? 0 : com->NbData;
+	rec->opcode = com->Instruction;
+	rec->flags = 0;
+	rec->seq = dev->trace.head;
+	dev->trace.head++;
+	dev->trace.open = rec;
+}
+
+/**
+ * @brief Trace end
+ * Finish record of command in progress
+ *
+ * @param[in] dev Device
+ * @param[in] flags W25Q_TRACE_xxx flags
+ */
+void trace_end(W25Q_Device *dev, u8_t flags) {
+	if (!dev->trace.open)
+		return;
+	dev->trace.open->duration = W25Q_STATS_TIMER() - dev->trace.open->time;
+	dev->trace.open->flags |= flags;
+	dev->trace.open = NULL;
+}
+#endif
+
+/**
+ * @addtogroup W25Q_QSPI QSPI transport
+ * @brief STM32 QUADSPI HAL transport
+ * @{
+ */
+
+/**
+ * @brief QSPI Command
+ *
+ * @param[in] dev Device
+ * @param[in] com Command
+ * @return HAL_StatusTypeDef enum
+ */
+static HAL_StatusTypeDef qspi_command(W25Q_Device *dev, QSPI_CommandTypeDef *com) {
+	return HAL_QSPI_Command(dev->handle, com, HAL_QSPI_TIMEOUT_DEFAULT_VALUE);
+}
+
+/**
+ * @brief QSPI Receive
+ *
+ * @param[in] dev Device
+ * @param[out] buf Pointer to data array
+ * @param[in] dma 1-start DMA receive/0-blocking
+ * @return HAL_StatusTypeDef enum
+ */
+static HAL_StatusTypeDef qspi_receive(W25Q_Device *dev, u8_t *buf, bool dma) {
+	if (dma)
+		return HAL_QSPI_Receive_DMA(dev->handle, buf);
+	return HAL_QSPI_Receive(dev->handle, buf, HAL_QSPI_TIMEOUT_DEFAULT_VALUE);
+}
+
+/**
+ * @brief QSPI Transmit
+ *
+ * @param[in] dev Device
+ * @param[in] buf Pointer to data array
+ * @param[in] dma 1-start DMA transmit/0-blocking
+ * @return HAL_StatusTypeDef enum
+ */
+static HAL_StatusTypeDef qspi_transmit(W25Q_Device *dev, u8_t *buf, bool dma) {
+	if (dma)
+		return HAL_QSPI_Transmit_DMA(dev->handle, buf);
+	return HAL_QSPI_Transmit(dev->handle, buf, HAL_QSPI_TIMEOUT_DEFAULT_VALUE);
+}
+
+/**
+ * @brief QSPI Auto-polling
+ *
+ * @param[in] dev Device
+ * @param[in] com Status read command
+ * @param[in] cfg Polling config
+ * @return HAL_StatusTypeDef enum
+ */
+static HAL_StatusTypeDef qspi_autopoll(W25Q_Device *dev, QSPI_CommandTypeDef *com,
+		QSPI_AutoPollingTypeDef *cfg) {
+	return HAL_QSPI_AutoPolling_IT(dev->handle, com, cfg);
+}
+
+/**
+ * @brief QSPI Transfer state
+ *
+ * @param[in] dev Device
+ * @return HAL_StatusTypeDef enum (HAL_BUSY while running)
+ */
+static HAL_StatusTypeDef qspi_status(W25Q_Device *dev) {
+	QSPI_HandleTypeDef *hq = dev->handle;
+	HAL_QSPI_StateTypeDef st = HAL_QSPI_GetState(hq);
+	if (st == HAL_QSPI_STATE_ERROR || hq->ErrorCode != HAL_QSPI_ERROR_NONE)
+		return HAL_ERROR;
+	return st == HAL_QSPI_STATE_READY ? HAL_OK : HAL_BUSY;
+}
+
+/**
+ * @brief QSPI Abort
+ *
+ * @param[in] dev Device
+ * @return HAL_StatusTypeDef enum
+ */
+static HAL_StatusTypeDef qspi_abort(W25Q_Device *dev) {
+	return HAL_QSPI_Abort(dev->handle);
+}
+
+/**
+ * @brief QSPI Clock
+ * Prescaler and sample shifting of QUADSPI (re-init keeps the rest)
+ *
+ * @param[in] dev Device
+ * @param[in,out] clk Clock setting
+ * @param[in] set 1-apply clk/0-read current one to clk
+ * @return HAL_StatusTypeDef enum
+ */
+static HAL_StatusTypeDef qspi_clock(W25Q_Device *dev, W25Q_CLOCK *clk, bool set) {
+	QSPI_HandleTypeDef *hq = dev->handle;
+	if (!set) {
+		clk->prescaler = hq->Init.ClockPrescaler;
+		clk->shift = hq->Init.SampleShifting != QSPI_SAMPLE_SHIFTING_NONE;
+		return HAL_OK;
+	}
+	hq->Init.ClockPrescaler = clk->prescaler;
+	hq->Init.SampleShifting = clk->shift ? QSPI_SAMPLE_SHIFTING_HALFCYCLE : QSPI_SAMPLE_SHIFTING_NONE;
+	return HAL_QSPI_Init(hq);
+}
+
+/// STM32 QUADSPI transport
+const W25Q_BUS w25q_qspi_bus = {
+	.command = qspi_command,
+	.receive = qspi_receive,
+	.transmit = qspi_transmit,
+	.autopoll = qspi_autopoll,
+	.status = qspi_status,
+	.abort = qspi_abort,
+	.dma = 1,
+	.clock = qspi_clock,
+};
+
+/**
+ * @brief W25Q Bus done
+ * Transport's interrupt: status match, receive complete or error
+ *
+ * @note Call it from own transport's interrupt callbacks. With W25Q_USE_IT
+ * and W25Q_HAL_CALLBACKS = 0 call it from application's
+ * HAL_QSPI_StatusMatchCallback, RxCpltCallback, TxCpltCallback and
+ * ErrorCallback for the device of the handle
+ * @param[in] dev Device
+ */
+void W25Q_BusDone(W25Q_Device *dev) {
+	w25q_os_sem_give_isr(dev->sem);
+}
+
+/**
+ * @brief W25Q Lock
+ * Hold device for several calls of calling task (recursive)
+ *
+ * @note Modules use it for multi-command updates. Blocking program/erase
+ * inside gives the device to W25Q_ReadUrgent only
+ * @param[in] dev Device
+ */
+void W25Q_Lock(W25Q_Device *dev) {
+	lock_take(dev, 0);
+}
+
+/**
+ * @brief W25Q Unlock
+ * Give device held by W25Q_Lock
+ *
+ * @param[in] dev Device
+ */
+void W25Q_Unlock(W25Q_Device *dev) {
+	w25q_unlock();
+}
+
+#if W25Q_USE_IT && W25Q_HAL_CALLBACKS
+/**
+ * @brief Device by handle
+ * Find initialized device of transport's handle
+ *
+ * @param[in] handle Transport's handle
+ */
+static void bus_done(void *handle) {
+	for (u8_t i = 0; i < W25Q_MAX_DEVICES; i++)
+		if (w25q_devs[i] && w25q_devs[i]->handle == handle)
+			W25Q_BusDone(w25q_devs[i]);
+}
+
+/**
+ * @brief QSPI status match callback
+ * Chip is ready, wake waiting task
+ *
+ * @param[in] hq QSPI handle
+ */
+void HAL_QSPI_StatusMatchCallback(QSPI_HandleTypeDef *hq) {
+	bus_done(hq);
+}
+
+/**
+ * @brief QSPI receive complete callback
+ * DMA read is done, wake waiting task
+ *
+ * @param[in] hq QSPI handle
+ */
+void HAL_QSPI_RxCpltCallback(QSPI_HandleTypeDef *hq) {
+	bus_done(hq);
+}
+
+/**
+ * @brief QSPI transmit complete callback
+ * DMA program is done, wake waiting task
+ *
+ * @param[in] hq QSPI handle
+ */
+void HAL_QSPI_TxCpltCallback(QSPI_HandleTypeDef *hq) {
+	bus_done(hq);
+}
+
+/**
+ * @brief QSPI error callback
+ * Wake waiting task, it checks transfer state
+ *
+ * @param[in] hq QSPI handle
+ */
+void HAL_QSPI_ErrorCallback(QSPI_HandleTypeDef *hq) {
+	bus_done(hq);
+}
+#endif
+
+/// @}
+
 ///@}
@@ -20,6 +20,12 @@ extern "C" {
 #endif
 
 #include "libs.h"
+#include "w25q_os.h"
+
+#ifndef HAL_QSPI_MODULE_ENABLED
+// commands are described by QUADSPI HAL types for every transport
+#error "W25Q driver needs QUADSPI HAL (QSPI_CommandTypeDef), OCTOSPI-only parts aren't supported"
+#endif
 
 /**
  * @addtogroup W25Q_Driver
@@ -30,6 +36,7 @@ extern "C" {
 /**
  * @defgroup W25Q_Param W25Q Chip's Parameters
  * @brief User's chip parameters
+ * Default geometry for W25Q_DEVICE_xxx initializers
  * @{
  */
 // YOUR CHIP'S SETTINGS
@@ -52,6 +59,105 @@ extern "C" {
 
 /**@}*/
 
+/**
+ * @defgroup W25Q_Opt W25Q Driver's Options
+ * @brief Compile-time driver options (can be set from compiler flags)
+ * @{
+ */
+#ifndef W25Q_USE_DMA
+/// Use QSPI DMA for streaming reads (1-enable / 0-blocking)
+#define W25Q_USE_DMA 0U
+#endif
+#ifndef W25Q_STREAM_CHUNK
+/// Streaming read chunk in bytes, multiple of 4 (2 buffers are allocated)
+#define W25Q_STREAM_CHUNK 1024U
+#endif
+#ifndef W25Q_DMA_MIN
+/// Shorter transfers are done by CPU, longer - by DMA into/from caller's buffer
+#define W25Q_DMA_MIN 256U
+#endif
+#ifndef W25Q_USE_DCACHE
+#if defined(__DCACHE_PRESENT) && __DCACHE_PRESENT
+/// D-cache maintenance of DMA buffers (Cortex-M7: clean/invalidate by address)
+#define W25Q_USE_DCACHE 1U
+#else
+#define W25Q_USE_DCACHE 0U
+#endif
+#endif
+#ifndef W25Q_USE_HW_CRC
+/// Use STM32 CRC unit for W25Q_CRC32_HW (needs hcrc instance)
+#define W25Q_USE_HW_CRC 0U
+#endif
+#ifndef W25Q_STATS_ENABLE
+/// Collect driver statistics (1-enable / 0-disable, no code and RAM)
+#define W25Q_STATS_ENABLE 0U
+#endif
+#ifndef W25Q_STATS_SECTORS
+/// Count erases per sector in statistics (SECTOR_COUNT * 2 bytes of RAM)
+#define W25Q_STATS_SECTORS 0U
+#endif
+#ifndef W25Q_STATS_TIMER
+/// Statistics and trace timestamp source (OS layer's cycle counter by default)
+#define W25Q_STATS_TIMER() w25q_os_cycles()
+#endif
+#ifndef W25Q_STATS_TIMER_HZ
+/// Statistics and trace timestamp frequency
+#define W25Q_STATS_TIMER_HZ w25q_os_cycles_hz()
+#endif
+#ifndef W25Q_TRACE_ENABLE
+/// Record every QSPI command to RAM ring (1-enable / 0-disable, no code and RAM)
+#define W25Q_TRACE_ENABLE 0U
+#endif
+#ifndef W25Q_TRACE_DEPTH
+/// Trace ring size in records (power of 2, 20 bytes each)
+#define W25Q_TRACE_DEPTH 256U
+#endif
+#ifndef W25Q_USE_IT
+/// Wait for chip by QSPI auto-polling interrupt instead of SR1 reads (needs QUADSPI IRQ)
+#define W25Q_USE_IT (W25Q_OS != W25Q_OS_NONE)
+#endif
+#ifndef W25Q_HAL_CALLBACKS
+/**
+ * Driver defines HAL_QSPI_StatusMatchCallback, RxCpltCallback, TxCpltCallback
+ * and ErrorCallback for W25Q_USE_IT (1-define / 0-application's callbacks
+ * call W25Q_BusDone for the device of their handle)
+ */
+#define W25Q_HAL_CALLBACKS 0U
+#endif
+#ifndef W25Q_MAX_DEVICES
+/// Devices to find by HAL interrupt callbacks (W25Q_HAL_CALLBACKS)
+#define W25Q_MAX_DEVICES 4U
+#endif
+#ifndef W25Q_POWER_IDLE_MS
+/// Default idle time before automatic power-down by W25Q_PowerTask, ms (0 - never)
+#define W25Q_POWER_IDLE_MS 0U
+#endif
+#ifndef W25Q_VOLATILE_QE
+/// Init sets QE by volatile SR2 write (1 - fast, every boot / 0 - non-volatile, once)
+#define W25Q_VOLATILE_QE 1U
+#endif
+#ifndef W25Q_DEADLINE_HIGH_US
+/// Default deadline of W25Q_ReadUrgent and high priority class in statistics, us (0 - none)
+#define W25Q_DEADLINE_HIGH_US 100U
+#endif
+#ifndef W25Q_DEADLINE_NORMAL_US
+/// Deadline of normal priority class (other measured calls) in statistics, us (0 - none)
+#define W25Q_DEADLINE_NORMAL_US 0U
+#endif
+#ifndef W25Q_DEADLINE_LOW_US
+/// Deadline of low priority class (W25Q_OP calls) in statistics, us (0 - none)
+#define W25Q_DEADLINE_LOW_US 0U
+#endif
+#ifndef W25Q_USE_EAR
+/// Chips > 16 MB: 3-byte commands, bank by extended address register (1) / 4-byte mode (0)
+#define W25Q_USE_EAR 0U
+#endif
+#ifndef W25Q_USE_LFS
+/// Build littlefs block device adapter w25q_lfs.c (needs lfs.h)
+#define W25Q_USE_LFS 0U
+#endif
+/**@}*/
+
 /**
  * @enum W25Q_STATE
  * @brief W25Q Return State
@@ -65,9 +171,48 @@ typedef enum{
 	W25Q_CHIP_ERR = 3,	///< Chip error
 	W25Q_SPI_ERR = 4, 	///< SPI Bus err
 	W25Q_CHIP_IGNORE = 5, ///< Chip ignore state
+	W25Q_VERIFY_ERR = 6,  ///< Data in chip doesn't match
 }W25Q_STATE;
 /** @} */
 
+/**
+ * @enum W25Q_CRC_ALGO
+ * @brief W25Q Checksum algorithm
+ * @{
+ */
+typedef enum{
+	W25Q_CRC32 = 0,		///< CRC-32 (IEEE 802.3, zlib), software
+	W25Q_CRC32_HW = 1,	///< STM32 CRC unit with its current config (len % 4 == 0)
+}W25Q_CRC_ALGO;
+/** @} */
+
+/**
+ * @struct W25Q_IOVEC
+ * @brief  W25Q Vector segment
+ * @{
+ */
+typedef struct{
+	u32_t addr;		///< Chip's address
+	u8_t *buf;		///< Data buffer
+	u32_t len;		///< Length of data (1..)
+}W25Q_IOVEC;
+/** @} */
+
+/// Chunk consumer of W25Q_ReadPipe: gets every chunk, stops pipeline if returns not W25Q_OK
+typedef W25Q_STATE (*W25Q_CHUNK_FN)(u8_t *data, u32_t len, void *ctx);
+
+/**
+ * @enum W25Q_ORDER
+ * @brief W25Q Byte order of array's elements in chip
+ * @{
+ */
+typedef enum{
+	W25Q_ORDER_NATIVE = 0,	///< Same as MCU, no conversion
+	W25Q_ORDER_LE,			///< Little-endian
+	W25Q_ORDER_BE,			///< Big-endian (network order)
+}W25Q_ORDER;
+/** @} */
+
 /**
  * @struct W25Q_STATUS_REG
  * @brief  W25Q Status Registers
@@ -87,61 +232,423 @@ typedef struct{
 }W25Q_STATUS_REG;
 /** @} */
 
+#if W25Q_STATS_ENABLE
+/**
+ * @enum W25Q_API
+ * @brief W25Q Measured functions
+ * Rows of latency histogram
+ * @{
+ */
+typedef enum{
+	W25Q_API_READ = 0,		///< W25Q_ReadRaw
+	W25Q_API_READ_BULK,		///< W25Q_ReadBulk
+	W25Q_API_PROGRAM,		///< W25Q_ProgramRaw
+	W25Q_API_PROGRAM_BULK,	///< W25Q_ProgramBulk
+	W25Q_API_ERASE_SECTOR,	///< W25Q_EraseSector
+	W25Q_API_ERASE_BLOCK,	///< W25Q_EraseBlock
+	W25Q_API_ERASE_CHIP,	///< W25Q_EraseChip
+	W25Q_API_STATUS,		///< W25Q_ReadStatusStruct
+	W25Q_API_VERIFY,		///< W25Q_Verify
+	W25Q_API_INIT,			///< W25Q_Init (boot to first read)
+	W25Q_API_READ_V,		///< W25Q_ReadV
+	W25Q_API_PROGRAM_V,		///< W25Q_ProgramV
+	W25Q_API_READ_PIPE,		///< W25Q_ReadPipe
+	W25Q_API_READ_URGENT,	///< W25Q_ReadUrgent
+	W25Q_API_OP,			///< W25Q_EraseStart / W25Q_ProgramStart / W25Q_OpPoll
+	W25Q_API_CHECKSUM,		///< W25Q_Checksum
+	W25Q_API_COUNT,			///< Count of measured functions
+}W25Q_API;
+/** @} */
 
-W25Q_STATE W25Q_Init(void);		///< Initalize function
+/**
+ * @enum W25Q_PRIO
+ * @brief W25Q Priority classes
+ * Class is given by function: urgent reads, plain calls, background operations
+ * @{
+ */
+typedef enum{
+	W25Q_PRIO_HIGH = 0,	///< W25Q_ReadUrgent: waits or suspends running program/erase by its deadline
+	W25Q_PRIO_NORMAL,	///< Other calls: wait for running command
+	W25Q_PRIO_LOW,		///< W25Q_OP calls: one command per call
+	W25Q_PRIO_COUNT,	///< Count of classes
+}W25Q_PRIO;
+/** @} */
 
-W25Q_STATE W25Q_EnableVolatileSR(void);						 ///< Make Status Register Volatile
-W25Q_STATE W25Q_ReadStatusReg(u8_t *reg_data, u8_t reg_num); ///< Read status register to variable
-W25Q_STATE W25Q_WriteStatusReg(u8_t reg_data, u8_t reg_num);///< Write status register from variable
-W25Q_STATE W25Q_ReadStatusStruct(W25Q_STATUS_REG *status);	 ///< Read all status registers to struct
-W25Q_STATE W25Q_IsBusy(void);	///< Check chip's busy status
+/**
+ * @struct W25Q_STATS
+ * @brief  W25Q Driver statistics
+ *
+ * Latency bin N counts calls that took 2^N..2^(N+1)-1
+ * timer ticks (W25Q_STATS_TIMER, CPU cycles by default)
+ * @{
+ */
+typedef struct{
+	u32_t commands[256];	///< Sent commands count per opcode
+	u32_t bytesRead;		///< Data bytes received
+	u32_t bytesWritten;		///< Data bytes transmitted
+	u32_t statusReads;		///< Status register reads
+	u32_t busyPolls;		///< Busy checks that found chip busy
+	u32_t delays;			///< Delay calls
+	u32_t latency[W25Q_API_COUNT][32]; ///< log2 latency histogram per function
+	u32_t prioLatency[W25Q_PRIO_COUNT][32]; ///< log2 latency histogram per priority class
+	u32_t deadlineMissed[W25Q_PRIO_COUNT];	///< Calls over deadline (urgent read's own, else W25Q_DEADLINE_xxx_US)
+	u32_t suspends;			///< Program/erase suspends by urgent reads
+#if W25Q_STATS_SECTORS
+	u16_t sectorErases[SECTOR_COUNT]; ///< Erase count per sector (first SECTOR_COUNT)
+#endif
+}W25Q_STATS;
+/** @} */
+#endif
 
-W25Q_STATE W25Q_ReadSByte(i8_t *buf, u8_t pageShift, u32_t pageNum);			///< Read signed 8-bit variable
-W25Q_STATE W25Q_ReadByte(u8_t *buf, u8_t pageShift, u32_t pageNum);			 	///< Read 8-bit variable
-W25Q_STATE W25Q_ReadSWord(i16_t *buf, u8_t pageShift, u32_t pageNum);			///< Read signed 16-bit variable
-W25Q_STATE W25Q_ReadWord(u16_t *buf, u8_t pageShift, u32_t pageNum);			///< Read 16-bit variable
-W25Q_STATE W25Q_ReadSLong(i32_t *buf, u8_t pageShift, u32_t pageNum);			///< Read signed 32-bit variable
-W25Q_STATE W25Q_ReadLong(u32_t *buf, u8_t pageShift, u32_t pageNum);			///< Read 32-bit variable
-W25Q_STATE W25Q_ReadData(u8_t *buf, u16_t len, u8_t pageShift, u32_t pageNum);  ///< Read any 8-bit data
-W25Q_STATE W25Q_ReadRaw(u8_t *buf, u16_t data_len, u32_t rawAddr);				///< Read data from raw addr
-W25Q_STATE W25Q_SingleRead(u8_t *buf, u32_t len, u32_t Addr);					///< Read data from raw addr by single line
+#define W25Q_TRACE_WRITE 0x01U	///< Trace flag: command transmitted data
+#define W25Q_TRACE_DMA 0x02U	///< Trace flag: data moved by DMA
+#define W25Q_TRACE_ERR 0x04U	///< Trace flag: HAL returned error
 
-W25Q_STATE W25Q_EraseSector(u32_t SectAddr);			///< Erase 4KB Sector
-W25Q_STATE W25Q_EraseBlock(u32_t BlockAddr, u8_t size); ///< Erase 32KB/64KB Sector
-W25Q_STATE W25Q_EraseChip(void);						///< Erase all chip
+#if W25Q_TRACE_ENABLE
+/// Trace dump magic ("W25T")
+#define W25Q_TRACE_MAGIC 0x54353257U
+/// Trace format version
+#define W25Q_TRACE_VERSION 1U
 
-W25Q_STATE W25Q_ProgramSByte(i8_t buf, u8_t pageShift, u32_t pageNum);			 ///< Program signed 8-bit variable
-W25Q_STATE W25Q_ProgramByte(u8_t buf, u8_t pageShift, u32_t pageNum);			 ///< Program 8-bit variable
-W25Q_STATE W25Q_ProgramSWord(i16_t buf, u8_t pageShift, u32_t pageNum);			 ///< Program signed 16-bit variable
-W25Q_STATE W25Q_ProgramWord(u16_t buf, u8_t pageShift, u32_t pageNum);			 ///< Program 16-bit variable
-W25Q_STATE W25Q_ProgramSLong(i32_t buf, u8_t pageShift, u32_t pageNum);			 ///< Program signed 32-bit variable
-W25Q_STATE W25Q_ProgramLong(u32_t buf, u8_t pageShift, u32_t pageNum);			 ///< Program 32-bit variable
-W25Q_STATE W25Q_ProgramData(u8_t *buf, u16_t len, u8_t pageShift, u32_t pageNum); ///< Program any 8-bit data
-W25Q_STATE W25Q_ProgramRaw(u8_t *buf, u16_t data_len, u32_t rawAddr); 					 ///< Program data to raw addr
+/**
+ * @struct W25Q_TRACE_HDR
+ * @brief  W25Q Trace dump header
+ *
+ * Dump = header + records, all fields are little-endian
+ * @{
+ */
+typedef struct{
+	u32_t magic;	///< W25Q_TRACE_MAGIC
+	u16_t version;	///< W25Q_TRACE_VERSION
+	u16_t recSize;	///< sizeof(W25Q_TRACE_REC)
+	u32_t timerHz;	///< Timestamp frequency
+	u32_t dropped;	///< Records overwritten before read
+}W25Q_TRACE_HDR;
+/** @} */
 
-W25Q_STATE W25Q_SetBurstWrap(u8_t WrapSize);		///< Set Burst with Wrap
+/**
+ * @struct W25Q_TRACE_REC
+ * @brief  W25Q Trace record
+ * One QSPI command (with its data phase)
+ * @{
+ */
+typedef struct{
+	u32_t time;		///< Command start timestamp
+	u32_t duration;	///< Command + data phase duration
+	u32_t addr;		///< Command address (0 if none)
+	u32_t len;		///< Data length
+	u8_t opcode;	///< Command opcode
+	u8_t flags;		///< W25Q_TRACE_xxx flags
+	u16_t seq;		///< Record sequence number
+}W25Q_TRACE_REC;
+/** @} */
 
-W25Q_STATE W25Q_ProgSuspend(void);	///< Pause Programm/Erase operation
-W25Q_STATE W25Q_ProgResume(void);	///< Resume Programm/Erase operation
+/**
+ * @struct W25Q_TRACE
+ * @brief  W25Q Trace ring of device
+ * @{
+ */
+typedef struct{
+	W25Q_TRACE_REC ring[W25Q_TRACE_DEPTH]; ///< Records
+	u32_t head;				///< Records written
+	u32_t tail;				///< Records taken
+	u32_t dropped;			///< Records overwritten
+	W25Q_TRACE_REC *open;	///< Record of command in progress
+}W25Q_TRACE;
+/** @} */
+#endif
 
-W25Q_STATE W25Q_Sleep(void);	///< Set low current consumption
-W25Q_STATE W25Q_WakeUP(void);	///< Wake the chip up from sleep mode
+/**
+ * @struct W25Q_POWER
+ * @brief  W25Q Power manager state
+ * @{
+ */
+typedef struct{
+	u32_t idleMs;		///< Power-down after idle time, ms (0 - never)
+	u32_t lastUse;		///< Tick of last API call end
+	u32_t sleepStart;	///< Tick of power-down
+	u32_t wakeups;		///< Wake count
+	u32_t sleepMs;		///< Time in power-down, ms
+}W25Q_POWER;
+/** @} */
 
-W25Q_STATE W25Q_ReadID(u8_t *buf);				///< Read chip ID
-W25Q_STATE W25Q_ReadFullID(u8_t *buf);			///< Read full chip ID (Manufacturer ID + Device ID)
-W25Q_STATE W25Q_ReadUID(u8_t *buf);				///< Read unique chip ID
-W25Q_STATE W25Q_ReadJEDECID(u8_t *buf); 		///< Read ID by JEDEC Standards
-W25Q_STATE W25Q_ReadSFDPRegister(u8_t *buf); 	///< Read device descriptor (SFDP Standard)
+/**
+ * @struct W25Q_CLOCK
+ * @brief  W25Q Bus clock setting
+ * @{
+ */
+typedef struct{
+	u8_t prescaler;		///< Clock divider - 1 (QUADSPI ClockPrescaler)
+	u8_t shift;			///< Sample shifting by half cycle (0/1)
+}W25Q_CLOCK;
+/** @} */
 
-W25Q_STATE W25Q_EraseSecurityRegisters(u8_t numReg);							///< Erase security register
-W25Q_STATE W25Q_ProgSecurityRegisters(u8_t *buf, u8_t numReg, u8_t byteAddr);	///< Program security register
-W25Q_STATE W25Q_ReadSecurityRegisters(u8_t *buf, u8_t numReg, u8_t byteAddr);	///< Read security register
+/**
+ * @struct W25Q_CAL
+ * @brief  W25Q Clock calibration
+ * @{
+ */
+typedef struct{
+	u8_t margin;		///< Prescaler steps slower than fastest reliable one (in)
+	u16_t passes;		///< Pattern reads per setting (in, 0 - 8)
+	W25Q_CLOCK clock;	///< Chosen setting, applied (out)
+	W25Q_CLOCK fastest;	///< Fastest reliable setting (out)
+	u32_t pass[2];		///< Prescalers 0..31 read reliably without/with shift (out, bit mask)
+}W25Q_CAL;
+/** @} */
+
+/**
+ * @struct W25Q_OP
+ * @brief  W25Q Non-blocking operation
+ * Started by W25Q_EraseStart/W25Q_ProgramStart, run by W25Q_OpPoll
+ * @{
+ */
+typedef struct{
+	u32_t addr;			///< Running command's address
+	u32_t left;			///< Bytes left, running command's included
+	const u8_t *buf;	///< Data of running command (NULL - erase)
+	u32_t unit;			///< Running command's bytes
+	u32_t start;		///< Running command's start tick
+	u32_t maxMs;		///< Running command's max time, ms
+	u32_t unitUs;		///< Running command's typical time, us
+	u32_t doneUs;		///< Typical time of finished commands, us
+	u32_t totalUs;		///< Typical time of whole operation, us
+	u32_t suspendUs;	///< Device's suspendUs at running command's start
+	u32_t etaMs;		///< Estimated time remaining, ms (out)
+	u8_t progress;		///< Done, % (out)
+	bool run;			///< Operation runs
+}W25Q_OP;
+/** @} */
 
-W25Q_STATE W25Q_BlockReadOnly(u32_t Addr, bool enable);			///< Individual block/sector read-only lock
-W25Q_STATE W25Q_BlockReadOnlyCheck(bool *state, u32_t Addr);	///< Check block's/sector's read-only lock status
-W25Q_STATE W25Q_GlobalReadOnly(bool enable);		///< Set read-only param to all chip
+typedef struct W25Q_Device W25Q_Device;
+
+/**
+ * @struct W25Q_BUS
+ * @brief  W25Q Transport
+ *
+ * Bus operations of device. Commands are described by
+ * QSPI_CommandTypeDef for any bus, transport translates it
+ * (SPI transport sends it byte-by-byte by single line)
+ * @{
+ */
+typedef struct{
+	/// Send command, data phase follows if DataMode isn't NONE
+	HAL_StatusTypeDef (*command)(W25Q_Device *dev, QSPI_CommandTypeDef *com);
+	/// Receive data phase (dma: start and return)
+	HAL_StatusTypeDef (*receive)(W25Q_Device *dev, u8_t *buf, bool dma);
+	/// Transmit data phase (dma: start and return)
+	HAL_StatusTypeDef (*transmit)(W25Q_Device *dev, u8_t *buf, bool dma);
+	/// Start status polling with match interrupt (NULL: not supported)
+	HAL_StatusTypeDef (*autopoll)(W25Q_Device *dev, QSPI_CommandTypeDef *com,
+			QSPI_AutoPollingTypeDef *cfg);
+	/// Transfer state: HAL_BUSY while running, HAL_ERROR if failed
+	HAL_StatusTypeDef (*status)(W25Q_Device *dev);
+	/// Abort transfer in progress
+	HAL_StatusTypeDef (*abort)(W25Q_Device *dev);
+	bool dma;	///< Receive can run by DMA
+	/// Get (set = 0) or set bus clock (NULL: fixed clock)
+	HAL_StatusTypeDef (*clock)(W25Q_Device *dev, W25Q_CLOCK *clk, bool set);
+}W25Q_BUS;
+/** @} */
+
+/**
+ * @struct W25Q_Device
+ * @brief  W25Q Device
+ *
+ * Transport, geometry and state of one chip.
+ * Make it by W25Q_DEVICE_xxx initializer, then W25Q_Init
+ * @{
+ */
+struct W25Q_Device{
+	const W25Q_BUS *bus;	///< Transport
+	void *handle;			///< Transport's handle (QSPI_HandleTypeDef, W25Q_SPI_PORT...)
+	u32_t size;				///< Chip size in bytes
+	u32_t pageSize;			///< Page size in bytes (program unit)
+	u32_t sectorSize;		///< Sector size in bytes (smallest erase unit)
+	u32_t blockSize;		///< Big block size in bytes
+	bool quad;				///< Quad commands (0 - single line only)
+	bool dual;				///< QUADSPI dual-flash: two same chips, sizes are of the pair
+	bool addr4;				///< 4-byte address mode (set by Init for chips > 16 MB)
+	bool ear;				///< 3-byte commands in 16 MB banks (set by Init with W25Q_USE_EAR)
+	u8_t bank;				///< Extended address register of chip (0xFF - unknown)
+	u32_t bankSwitches;		///< Extended address register writes
+	W25Q_STATUS_REG status;	///< Status registers cache
+	W25Q_POWER power;		///< Power manager
+	u32_t resumeAt;			///< Last resume after urgent read (w25q_os_cycles), next suspend waits tSUS
+	u32_t suspendUs;		///< Time program/erase was suspended by urgent reads, us
+	u32_t opAddr;			///< Start of running program/erase (blocking or W25Q_OpPoll/xxxStart)
+	u32_t opLen;			///< Bytes of that command (0 - none), urgent reads don't suspend it under them
+	u32_t opStart;			///< Start of that command (w25q_os_cycles, moved on by suspends)
+	u32_t opUs;				///< Typical time of that command, us
+	u8_t lockDepth;			///< Levels of mutex taken by its holder (W25Q_Lock and API calls)
+	bool writeWait;			///< Blocking program/erase waits with device given (only urgent reads take it)
+	u32_t nbData;			///< Data length of last command
+	u8_t *dmaBuf;			///< Running DMA receive buffer (invalidated at the end)
+	u8_t dmaFlags;			///< Running DMA trace flags
+	w25q_mutex_t mutex;		///< API lock (recursive)
+	w25q_sem_t sem;			///< Interrupt to waiting task signal
+	u8_t streamBuf[2][W25Q_STREAM_CHUNK] __ALIGNED(32); ///< Streaming double buffer
+#if W25Q_STATS_ENABLE
+	W25Q_STATS stats;		///< Driver statistics
+#endif
+#if W25Q_TRACE_ENABLE
+	W25Q_TRACE trace;		///< Command trace
+#endif
+};
+/** @} */
+
+extern const W25Q_BUS w25q_qspi_bus;	///< STM32 QUADSPI transport
+
+/// QSPI device initializer: W25Q_Device flash = W25Q_DEVICE_QSPI(&hqspi, 256);
+#define W25Q_DEVICE_QSPI(hq, mbit) { .bus = &w25q_qspi_bus, .handle = (hq), \
+	.size = (mbit) * 1024UL * 1024UL / 8U, .pageSize = MEM_PAGE_SIZE, \
+	.sectorSize = MEM_SECTOR_SIZE * 1024U, .blockSize = MEM_BLOCK_SIZE * 1024U, \
+	.quad = 1, .power = { .idleMs = W25Q_POWER_IDLE_MS } }
+
+/**
+ * Dual-flash device initializer (QUADSPI DualFlash enabled, FlashSize of the pair):
+ * W25Q_Device flash = W25Q_DEVICE_QSPI_DUAL(&hqspi, 256); - two 256 Mbit chips.
+ * Byte 2n is in chip 1, byte 2n+1 - in chip 2, so page, sector and block sizes
+ * are doubled and one command moves twice more data
+ */
+#define W25Q_DEVICE_QSPI_DUAL(hq, mbit) { .bus = &w25q_qspi_bus, .handle = (hq), \
+	.size = (mbit) * 1024UL * 1024UL / 4U, .pageSize = MEM_PAGE_SIZE * 2U, \
+	.sectorSize = MEM_SECTOR_SIZE * 2048U, .blockSize = MEM_BLOCK_SIZE * 2048U, \
+	.quad = 1, .dual = 1, .power = { .idleMs = W25Q_POWER_IDLE_MS } }
+
+#ifdef HAL_SPI_MODULE_ENABLED
+/**
+ * @struct W25Q_SPI_PORT
+ * @brief  W25Q SPI connection
+ * @{
+ */
+typedef struct{
+	SPI_HandleTypeDef *spi;	///< SPI HAL Instance
+	GPIO_TypeDef *csPort;	///< Chip select port
+	u16_t csPin;			///< Chip select pin
+}W25Q_SPI_PORT;
+/** @} */
+
+extern const W25Q_BUS w25q_spi_bus;	///< STM32 SPI transport (single line, blocking)
+
+/// SPI device initializer: W25Q_Device flash = W25Q_DEVICE_SPI(&port, 128);
+#define W25Q_DEVICE_SPI(port, mbit) { .bus = &w25q_spi_bus, .handle = (port), \
+	.size = (mbit) * 1024UL * 1024UL / 8U, .pageSize = MEM_PAGE_SIZE, \
+	.sectorSize = MEM_SECTOR_SIZE * 1024U, .blockSize = MEM_BLOCK_SIZE * 1024U, \
+	.quad = 0, .power = { .idleMs = W25Q_POWER_IDLE_MS } }
+#endif
+
+
+W25Q_STATE W25Q_Init(W25Q_Device *dev);		///< Initalize function
+
+W25Q_STATE W25Q_EnableVolatileSR(W25Q_Device *dev);						 ///< Make Status Register Volatile
+W25Q_STATE W25Q_ReadStatusReg(W25Q_Device *dev, u8_t *reg_data, u8_t reg_num); ///< Read status register to variable
+W25Q_STATE W25Q_WriteStatusReg(W25Q_Device *dev, u8_t reg_data, u8_t reg_num);///< Write status register from variable
+W25Q_STATE W25Q_ReadStatusStruct(W25Q_Device *dev, W25Q_STATUS_REG *status);	 ///< Read all status registers to struct
+W25Q_STATE W25Q_IsBusy(W25Q_Device *dev);	///< Check chip's busy status
+
+W25Q_STATE W25Q_ReadSByte(W25Q_Device *dev, i8_t *buf, u8_t pageShift, u32_t pageNum);			///< Read signed 8-bit variable
+W25Q_STATE W25Q_ReadByte(W25Q_Device *dev, u8_t *buf, u8_t pageShift, u32_t pageNum);			 	///< Read 8-bit variable
+W25Q_STATE W25Q_ReadSWord(W25Q_Device *dev, i16_t *buf, u8_t pageShift, u32_t pageNum);			///< Read signed 16-bit variable
+W25Q_STATE W25Q_ReadWord(W25Q_Device *dev, u16_t *buf, u8_t pageShift, u32_t pageNum);			///< Read 16-bit variable
+W25Q_STATE W25Q_ReadSLong(W25Q_Device *dev, i32_t *buf, u8_t pageShift, u32_t pageNum);			///< Read signed 32-bit variable
+W25Q_STATE W25Q_ReadLong(W25Q_Device *dev, u32_t *buf, u8_t pageShift, u32_t pageNum);			///< Read 32-bit variable
+W25Q_STATE W25Q_ReadData(W25Q_Device *dev, u8_t *buf, u16_t len, u8_t pageShift, u32_t pageNum);  ///< Read any 8-bit data
+W25Q_STATE W25Q_ReadRaw(W25Q_Device *dev, u8_t *buf, u16_t data_len, u32_t rawAddr);				///< Read data from raw addr
+W25Q_STATE W25Q_SingleRead(W25Q_Device *dev, u8_t *buf, u32_t len, u32_t Addr);					///< Read data from raw addr by single line
+W25Q_STATE W25Q_ReadBulk(W25Q_Device *dev, u8_t *buf, u32_t len, u32_t rawAddr);					///< Read big data by one quad command
+W25Q_STATE W25Q_ReadV(W25Q_Device *dev, const W25Q_IOVEC *vec, u32_t count);						///< Read several segments at once
+W25Q_STATE W25Q_ReadPipe(W25Q_Device *dev, u8_t *buf0, u8_t *buf1, u32_t chunk,
+		u32_t len, u32_t rawAddr, W25Q_CHUNK_FN consume, void *ctx);	///< Read by chunks to ping-pong buffers
+W25Q_STATE W25Q_ReadArray(W25Q_Device *dev, void *buf, u32_t count, u8_t size,
+		W25Q_ORDER order, u32_t rawAddr);	///< Read array of 8/16/32-bit elements by one command
+W25Q_STATE W25Q_ReadArraySByte(W25Q_Device *dev, i8_t *buf, u32_t count, u32_t rawAddr);						///< Read signed 8-bit array
+W25Q_STATE W25Q_ReadArrayByte(W25Q_Device *dev, u8_t *buf, u32_t count, u32_t rawAddr);						///< Read 8-bit array
+W25Q_STATE W25Q_ReadArraySWord(W25Q_Device *dev, i16_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr);	///< Read signed 16-bit array
+W25Q_STATE W25Q_ReadArrayWord(W25Q_Device *dev, u16_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr);	///< Read 16-bit array
+W25Q_STATE W25Q_ReadArraySLong(W25Q_Device *dev, i32_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr);	///< Read signed 32-bit array
+W25Q_STATE W25Q_ReadArrayLong(W25Q_Device *dev, u32_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr);	///< Read 32-bit array
+W25Q_STATE W25Q_ReadArrayFloat(W25Q_Device *dev, fl_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr);	///< Read float array
+
+W25Q_STATE W25Q_Verify(W25Q_Device *dev, u8_t *buf, u32_t len, u32_t rawAddr);					///< Compare chip's data with buffer
+W25Q_STATE W25Q_Checksum(W25Q_Device *dev, u32_t *crc, u32_t len, u32_t rawAddr, W25Q_CRC_ALGO algo); ///< Calculate checksum of chip's data
+u32_t W25Q_CalcCRC(u32_t crc, const void *data, u32_t len);	///< CRC-32 of RAM data (continues crc)
+bool W25Q_IsErased(const u8_t *buf, u32_t len);				///< Check if RAM data is all 0xFF
+
+W25Q_STATE W25Q_EraseSector(W25Q_Device *dev, u32_t SectAddr);			///< Erase 4KB Sector
+W25Q_STATE W25Q_EraseBlock(W25Q_Device *dev, u32_t BlockAddr, u8_t size); ///< Erase 32KB/64KB Sector
+W25Q_STATE W25Q_EraseChip(W25Q_Device *dev);						///< Erase all chip
+
+W25Q_STATE W25Q_EraseStart(W25Q_Device *dev, W25Q_OP *op, u32_t rawAddr, u32_t len);	///< Start non-blocking erase of range
+W25Q_STATE W25Q_ProgramStart(W25Q_Device *dev, W25Q_OP *op, const u8_t *buf, u32_t len, u32_t rawAddr); ///< Start non-blocking program
+W25Q_STATE W25Q_OpPoll(W25Q_Device *dev, W25Q_OP *op);	///< Run started operation (W25Q_BUSY till the end)
+
+W25Q_STATE W25Q_ProgramSByte(W25Q_Device *dev, i8_t buf, u8_t pageShift, u32_t pageNum);			 ///< Program signed 8-bit variable
+W25Q_STATE W25Q_ProgramByte(W25Q_Device *dev, u8_t buf, u8_t pageShift, u32_t pageNum);			 ///< Program 8-bit variable
+W25Q_STATE W25Q_ProgramSWord(W25Q_Device *dev, i16_t buf, u8_t pageShift, u32_t pageNum);			 ///< Program signed 16-bit variable
+W25Q_STATE W25Q_ProgramWord(W25Q_Device *dev, u16_t buf, u8_t pageShift, u32_t pageNum);			 ///< Program 16-bit variable
+W25Q_STATE W25Q_ProgramSLong(W25Q_Device *dev, i32_t buf, u8_t pageShift, u32_t pageNum);			 ///< Program signed 32-bit variable
+W25Q_STATE W25Q_ProgramLong(W25Q_Device *dev, u32_t buf, u8_t pageShift, u32_t pageNum);			 ///< Program 32-bit variable
+W25Q_STATE W25Q_ProgramData(W25Q_Device *dev, u8_t *buf, u16_t len, u8_t pageShift, u32_t pageNum); ///< Program any 8-bit data
+W25Q_STATE W25Q_ProgramRaw(W25Q_Device *dev, u8_t *buf, u16_t data_len, u32_t rawAddr); 					 ///< Program data to raw addr
+W25Q_STATE W25Q_ProgramBulk(W25Q_Device *dev, u8_t *buf, u32_t len, u32_t rawAddr, bool erase);	 ///< Program big data, skip erased pages/sectors
+W25Q_STATE W25Q_ProgramV(W25Q_Device *dev, const W25Q_IOVEC *vec, u32_t count);					 ///< Program several segments packed to pages
+W25Q_STATE W25Q_ProgramArray(W25Q_Device *dev, const void *buf, u32_t count, u8_t size,
+		W25Q_ORDER order, u32_t rawAddr);	///< Program array of 8/16/32-bit elements
+W25Q_STATE W25Q_ProgramArraySByte(W25Q_Device *dev, const i8_t *buf, u32_t count, u32_t rawAddr);						///< Program signed 8-bit array
+W25Q_STATE W25Q_ProgramArrayByte(W25Q_Device *dev, const u8_t *buf, u32_t count, u32_t rawAddr);						///< Program 8-bit array
+W25Q_STATE W25Q_ProgramArraySWord(W25Q_Device *dev, const i16_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr);	///< Program signed 16-bit array
+W25Q_STATE W25Q_ProgramArrayWord(W25Q_Device *dev, const u16_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr);	///< Program 16-bit array
+W25Q_STATE W25Q_ProgramArraySLong(W25Q_Device *dev, const i32_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr);	///< Program signed 32-bit array
+W25Q_STATE W25Q_ProgramArrayLong(W25Q_Device *dev, const u32_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr);	///< Program 32-bit array
+W25Q_STATE W25Q_ProgramArrayFloat(W25Q_Device *dev, const fl_t *buf, u32_t count, W25Q_ORDER order, u32_t rawAddr);	///< Program float array
+W25Q_STATE W25Q_SectorBlankCheck(W25Q_Device *dev, bool *blank, u32_t SectAddr);					 ///< Check if sector is erased
+
+W25Q_STATE W25Q_SetBurstWrap(W25Q_Device *dev, u8_t WrapSize);		///< Set Burst with Wrap
+
+W25Q_STATE W25Q_ProgSuspend(W25Q_Device *dev);	///< Pause Programm/Erase operation
+W25Q_STATE W25Q_ProgResume(W25Q_Device *dev);	///< Resume Programm/Erase operation
+W25Q_STATE W25Q_ReadUrgent(W25Q_Device *dev, u8_t *buf, u32_t len, u32_t rawAddr, u32_t deadlineUs); ///< High priority read (waits or suspends program/erase)
+
+W25Q_STATE W25Q_Sleep(W25Q_Device *dev);	///< Set low current consumption
+W25Q_STATE W25Q_WakeUP(W25Q_Device *dev);	///< Wake the chip up from sleep mode
+W25Q_STATE W25Q_PowerTask(W25Q_Device *dev);	///< Power down after idle time (call periodically)
+W25Q_STATE W25Q_PowerIdle(W25Q_Device *dev, u32_t idleMs);	///< Set idle time before power-down
+W25Q_STATE W25Q_PowerGet(W25Q_Device *dev, W25Q_POWER *power);	///< Get power manager counters
+
+W25Q_STATE W25Q_ReadID(W25Q_Device *dev, u8_t *buf);				///< Read chip ID
+W25Q_STATE W25Q_ReadFullID(W25Q_Device *dev, u8_t *buf);			///< Read full chip ID (Manufacturer ID + Device ID)
+W25Q_STATE W25Q_ReadUID(W25Q_Device *dev, u8_t *buf);				///< Read unique chip ID
+W25Q_STATE W25Q_ReadJEDECID(W25Q_Device *dev, u8_t *buf); 		///< Read ID by JEDEC Standards
+W25Q_STATE W25Q_ReadSFDPRegister(W25Q_Device *dev, u8_t *buf); 	///< Read device descriptor (SFDP Standard)
+
+W25Q_STATE W25Q_EraseSecurityRegisters(W25Q_Device *dev, u8_t numReg);							///< Erase security register
+W25Q_STATE W25Q_ProgSecurityRegisters(W25Q_Device *dev, u8_t *buf, u8_t numReg, u8_t byteAddr);	///< Program security register
+W25Q_STATE W25Q_ReadSecurityRegisters(W25Q_Device *dev, u8_t *buf, u8_t numReg, u8_t byteAddr);	///< Read security register
+
+W25Q_STATE W25Q_BlockReadOnly(W25Q_Device *dev, u32_t Addr, bool enable);			///< Individual block/sector read-only lock
+W25Q_STATE W25Q_BlockReadOnlyCheck(W25Q_Device *dev, bool *state, u32_t Addr);	///< Check block's/sector's read-only lock status
+W25Q_STATE W25Q_GlobalReadOnly(W25Q_Device *dev, bool enable);		///< Set read-only param to all chip
+
+W25Q_STATE W25Q_SwReset(W25Q_Device *dev, bool force);	///< Software reset
+
+W25Q_STATE W25Q_Calibrate(W25Q_Device *dev, u32_t SectAddr, W25Q_CAL *cal);	///< Find fastest reliable read clock
+W25Q_STATE W25Q_SetClock(W25Q_Device *dev, const W25Q_CLOCK *clk);			///< Apply stored clock setting
+
+#if W25Q_STATS_ENABLE
+W25Q_STATE W25Q_StatsGet(W25Q_Device *dev, W25Q_STATS *stats);	///< Get statistics snapshot
+W25Q_STATE W25Q_StatsReset(W25Q_Device *dev);				///< Clear statistics
+#endif
+
+#if W25Q_TRACE_ENABLE
+W25Q_STATE W25Q_TraceHeader(W25Q_Device *dev, W25Q_TRACE_HDR *hdr);	///< Get trace dump header
+W25Q_STATE W25Q_TraceRead(W25Q_Device *dev, W25Q_TRACE_REC *recs, u32_t maxCount, u32_t *count); ///< Take oldest trace records
+W25Q_STATE W25Q_TraceReset(W25Q_Device *dev);					///< Clear trace ring
+#endif
 
-W25Q_STATE W25Q_SwReset(bool force);	///< Software reset
+void W25Q_BusDone(W25Q_Device *dev);	///< Transport's interrupt: operation is done
+void W25Q_Lock(W25Q_Device *dev);		///< Hold device for several calls of this task
+void W25Q_Unlock(W25Q_Device *dev);	///< Give device held by W25Q_Lock
 
 
 /**
@@ -159,7 +666,7 @@ W25Q_STATE W25Q_SwReset(bool force);	///< Software reset
 #define W25Q_WRITE_SR2 0x31U			///< write status-register 2 (8.2.5)
 #define W25Q_WRITE_SR3 0x11U			///< write status-register 3 (8.2.5)
 #define W25Q_READ_EXT_ADDR_REG 0xC8U	///< read extended addr reg (only in 3-byte mode)
-#define W25Q_WRITE_EXT_ADDR_REG 0xC8U	///< write extended addr reg (only in 3-byte mode)
+#define W25Q_WRITE_EXT_ADDR_REG 0xC5U	///< write extended addr reg (only in 3-byte mode)
 #define W25Q_ENABLE_4B_MODE 0xB7U			///< enable 4-byte mode (128+ MB address)
 #define W25Q_DISABLE_4B_MODE 0xE9U			///< disable 4-byte mode (<=128MB)
 #define W25Q_READ_DATA 0x03U				///< read data by standard SPI
@@ -0,0 +1,286 @@
+/**
+ *******************************************
+ * @file    w25q_mem.hpp
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   C++17 front end for W25Qxxx lib (header-only)
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Geometry is a constexpr chip descriptor given as template parameter,
+ * so addresses known at compile time are checked by static_assert:
+ * @code
+ * w25q::Flash<w25q::W25Q256> flash(&hqspi);
+ * flash.init();
+ * flash.write<flash.sector<3>()>(config);		// page-split by driver
+ * flash.read<flash.sector<3>()>(config);		// one fast read command
+ * flash.writePage<flash.page<10>() + 16>(calib);	// one page program
+ * @endcode
+ * Accesses are plain calls of the C driver, this layer adds no runtime checks
+ */
+
+#ifndef W25Q_QSPI_W25Q_MEM_HPP_
+#define W25Q_QSPI_W25Q_MEM_HPP_
+
+#include "w25q_mem.h"
+#include <cstddef>
+#include <type_traits>
+
+namespace w25q {
+
+/**
+ * @brief Chip descriptor
+ * Geometry of one chip or of dual-flash pair (sizes are doubled)
+ *
+ * @tparam Mbit Chip size in Mbit
+ * @tparam Dual Two same chips in QUADSPI dual-flash mode
+ * @tparam Quad Quad commands (0 - single line only)
+ */
+template<u32_t Mbit, bool Dual = false, bool Quad = true>
+struct Chip {
+	static constexpr u32_t chips = Dual ? 2U : 1U;	///< Chips in parallel
+	static constexpr u32_t size = Mbit * 1024UL * 1024UL / 8U * chips; ///< Size in bytes
+	static constexpr u32_t pageSize = MEM_PAGE_SIZE * chips;			///< Program unit
+	static constexpr u32_t sectorSize = MEM_SECTOR_SIZE * 1024U * chips;	///< Smallest erase unit
+	static constexpr u32_t blockSize = MEM_BLOCK_SIZE * 1024U * chips;	///< Big erase unit
+	static constexpr u32_t pageCount = size / pageSize;		///< Pages count
+	static constexpr u32_t sectorCount = size / sectorSize;	///< Sectors count
+	static constexpr u32_t blockCount = size / blockSize;	///< Blocks count
+	static constexpr bool dual = Dual;	///< Dual-flash pair
+	static constexpr bool quad = Quad;	///< Quad commands
+
+	static_assert(Mbit && (Mbit & (Mbit - 1)) == 0, "Chip size must be power of 2");
+	static_assert(Mbit <= 512, "Chip size is above 512 Mbit");
+};
+
+using W25Q32 = Chip<32>;		///< W25Q32: 4 MB
+using W25Q64 = Chip<64>;		///< W25Q64: 8 MB
+using W25Q128 = Chip<128>;		///< W25Q128: 16 MB
+using W25Q256 = Chip<256>;		///< W25Q256: 32 MB
+using W25Q512 = Chip<512>;		///< W25Q512: 64 MB
+using Default = Chip<MEM_FLASH_SIZE>;	///< Chip of MEM_FLASH_SIZE
+
+/**
+ * @brief W25Q Flash
+ * Device of chip C with typed, compile-time checked access
+ *
+ * @tparam C Chip descriptor
+ */
+template<class C>
+class Flash {
+public:
+	using chip = C;	///< Chip descriptor
+
+	/**
+	 * @brief QUADSPI device
+	 *
+	 * @param[in] hqspi QSPI HAL instance
+	 */
+	explicit Flash(QSPI_HandleTypeDef *hqspi) :
+			Flash(&w25q_qspi_bus, hqspi) {
+	}
+
+	/**
+	 * @brief Device on any transport
+	 *
+	 * @param[in] bus Transport
+	 * @param[in] handle Transport's handle
+	 */
+	Flash(const W25Q_BUS *bus, void *handle) :
+			dev_ { } {
+		dev_.bus = bus;
+		dev_.handle = handle;
+		dev_.size = C::size;
+		dev_.pageSize = C::pageSize;
+		dev_.sectorSize = C::sectorSize;
+		dev_.blockSize = C::blockSize;
+		dev_.quad = C::quad;
+		dev_.dual = C::dual;
+		dev_.power.idleMs = W25Q_POWER_IDLE_MS;
+	}
+
+	Flash(const Flash&) = delete;
+	Flash& operator=(const Flash&) = delete;
+
+	/// C driver's device (for functions without wrapper)
+	W25Q_Device* device() {
+		return &dev_;
+	}
+
+	/// Initialize chip
+	W25Q_STATE init() {
+		return W25Q_Init(&dev_);
+	}
+
+	/// Address of page N
+	template<u32_t N>
+	static constexpr u32_t page() {
+		static_assert(N < C::pageCount, "Page is out of chip");
+		return N * C::pageSize;
+	}
+
+	/// Address of sector N
+	template<u32_t N>
+	static constexpr u32_t sector() {
+		static_assert(N < C::sectorCount, "Sector is out of chip");
+		return N * C::sectorSize;
+	}
+
+	/// Address of block N
+	template<u32_t N>
+	static constexpr u32_t block() {
+		static_assert(N < C::blockCount, "Block is out of chip");
+		return N * C::blockSize;
+	}
+
+	/// Object of Len bytes at Addr is inside the chip
+	template<u32_t Addr, std::size_t Len>
+	static constexpr bool fitsChip = Len && Addr < C::size && Len <= C::size - Addr;
+
+	/// Object of Len bytes at Addr is inside one page
+	template<u32_t Addr, std::size_t Len>
+	static constexpr bool fitsPage = Len && Addr % C::pageSize + Len <= C::pageSize;
+
+	/// Object of Len bytes at Addr is inside one sector
+	template<u32_t Addr, std::size_t Len>
+	static constexpr bool fitsSector = Len && Addr % C::sectorSize + Len <= C::sectorSize;
+
+	/**
+	 * @brief Read object
+	 * Read variable, struct or array by one fast read command
+	 *
+	 * @tparam Addr Chip's address
+	 * @param[out] val Object
+	 * @return W25Q_STATE enum
+	 */
+	template<u32_t Addr, class T>
+	W25Q_STATE read(T &val) {
+		static_assert(std::is_trivially_copyable_v<T>, "Type must be trivially copyable");
+		static_assert(fitsChip<Addr, sizeof(T)>, "Object is out of chip");
+		return W25Q_ReadBulk(&dev_, reinterpret_cast<u8_t*>(&val), sizeof(T), Addr);
+	}
+
+	/**
+	 * @brief Read array with byte order conversion
+	 *
+	 * @tparam Addr Chip's address
+	 * @param[out] arr Array of 8/16/32-bit elements
+	 * @param[in] order Byte order of elements in chip
+	 * @return W25Q_STATE enum
+	 */
+	template<u32_t Addr, class T, std::size_t N>
+	W25Q_STATE read(T (&arr)[N], W25Q_ORDER order) {
+		static_assert(std::is_arithmetic_v<T> && (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4),
+				"Element must be 8/16/32-bit number");
+		static_assert(fitsChip<Addr, sizeof(arr)>, "Array is out of chip");
+		return W25Q_ReadArray(&dev_, arr, N, sizeof(T), order, Addr);
+	}
+
+	/**
+	 * @brief Program object
+	 * Program variable, struct or array, area must be erased
+	 *
+	 * @note Object inside one page is programmed by one command,
+	 * bigger ones are split to pages by driver
+	 * @tparam Addr Chip's address
+	 * @param[in] val Object
+	 * @return W25Q_STATE enum
+	 */
+	template<u32_t Addr, class T>
+	W25Q_STATE write(const T &val) {
+		static_assert(std::is_trivially_copyable_v<T>, "Type must be trivially copyable");
+		static_assert(fitsChip<Addr, sizeof(T)>, "Object is out of chip");
+		u8_t *data = const_cast<u8_t*>(reinterpret_cast<const u8_t*>(&val));
+		if constexpr (fitsPage<Addr, sizeof(T)>)
+			return W25Q_ProgramRaw(&dev_, data, sizeof(T), Addr);
+		else
+			return W25Q_ProgramBulk(&dev_, data, sizeof(T), Addr, 0);
+	}
+
+	/**
+	 * @brief Program object to one page
+	 * Same as write, but object crossing page boundary is compile error
+	 *
+	 * @tparam Addr Chip's address
+	 * @param[in] val Object
+	 * @return W25Q_STATE enum
+	 */
+	template<u32_t Addr, class T>
+	W25Q_STATE writePage(const T &val) {
+		static_assert(fitsPage<Addr, sizeof(T)>, "Object crosses page boundary");
+		return write<Addr>(val);
+	}
+
+	/**
+	 * @brief Program array with byte order conversion
+	 *
+	 * @tparam Addr Chip's address
+	 * @param[in] arr Array of 8/16/32-bit elements
+	 * @param[in] order Byte order of elements in chip
+	 * @return W25Q_STATE enum
+	 */
+	template<u32_t Addr, class T, std::size_t N>
+	W25Q_STATE write(const T (&arr)[N], W25Q_ORDER order) {
+		static_assert(std::is_arithmetic_v<T> && (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4),
+				"Element must be 8/16/32-bit number");
+		static_assert(fitsChip<Addr, sizeof(arr)>, "Array is out of chip");
+		return W25Q_ProgramArray(&dev_, arr, N, sizeof(T), order, Addr);
+	}
+
+	/**
+	 * @brief Erase sector, then program object
+	 * Object must be inside the sector
+	 *
+	 * @tparam Addr Chip's address
+	 * @param[in] val Object
+	 * @return W25Q_STATE enum
+	 */
+	template<u32_t Addr, class T>
+	W25Q_STATE update(const T &val) {
+		static_assert(fitsSector<Addr, sizeof(T)>, "Object crosses sector boundary");
+		W25Q_STATE state = W25Q_EraseSector(&dev_, Addr / C::sectorSize);
+		return state == W25Q_OK ? write<Addr>(val) : state;
+	}
+
+	/// Erase sector N
+	template<u32_t N>
+	W25Q_STATE eraseSector() {
+		static_assert(N < C::sectorCount, "Sector is out of chip");
+		return W25Q_EraseSector(&dev_, N);
+	}
+
+	/**
+	 * @brief Read object from runtime address
+	 * Address is checked by driver
+	 *
+	 * @param[in] addr Chip's address
+	 * @param[out] val Object
+	 * @return W25Q_STATE enum
+	 */
+	template<class T>
+	W25Q_STATE read(u32_t addr, T &val) {
+		static_assert(std::is_trivially_copyable_v<T>, "Type must be trivially copyable");
+		return W25Q_ReadBulk(&dev_, reinterpret_cast<u8_t*>(&val), sizeof(T), addr);
+	}
+
+	/**
+	 * @brief Program object to runtime address
+	 * Address is checked by driver, area must be erased
+	 *
+	 * @param[in] addr Chip's address
+	 * @param[in] val Object
+	 * @return W25Q_STATE enum
+	 */
+	template<class T>
+	W25Q_STATE write(u32_t addr, const T &val) {
+		static_assert(std::is_trivially_copyable_v<T>, "Type must be trivially copyable");
+		return W25Q_ProgramBulk(&dev_, const_cast<u8_t*>(reinterpret_cast<const u8_t*>(&val)),
+				sizeof(T), addr, 0);
+	}
+
+private:
+	W25Q_Device dev_;	///< C driver's device
+};
+
+} // namespace w25q
+
+#endif /* W25Q_QSPI_W25Q_MEM_HPP_ */
@@ -0,0 +1,63 @@
+/**
+ *******************************************
+ * @file    w25q_os.h
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   OS abstraction layer for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * Port is selected by W25Q_OS, every port is in its own w25q_os_xxx.c
+ * file, so all of them can be added to the project
+*/
+
+#ifndef W25Q_QSPI_W25Q_OS_H_
+#define W25Q_QSPI_W25Q_OS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "libs.h"
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @defgroup W25Q_OS W25Q OS Abstraction
+ * @brief Mutex, semaphore, sleep, tick and cycle counter for the driver
+ * @{
+ */
+#define W25Q_OS_NONE 0U		///< Bare-metal: HAL_Delay, no locking
+#define W25Q_OS_FREERTOS 1U	///< FreeRTOS (CMSIS-RTOS v1/v2 projects too)
+#define W25Q_OS_POSIX 2U	///< POSIX threads (Linux host builds)
+
+#ifndef W25Q_OS
+/// Used OS port
+#define W25Q_OS W25Q_OS_NONE
+#endif
+
+typedef void *w25q_mutex_t;	///< Recursive mutex handle
+typedef void *w25q_sem_t;	///< Binary semaphore handle
+
+bool w25q_os_mutex_create(w25q_mutex_t *mutex);	///< Create recursive mutex
+void w25q_os_mutex_lock(w25q_mutex_t mutex);	///< Take mutex (waits forever)
+void w25q_os_mutex_unlock(w25q_mutex_t mutex);	///< Give mutex
+bool w25q_os_sem_create(w25q_sem_t *sem);		///< Create empty binary semaphore
+bool w25q_os_sem_take(w25q_sem_t sem, u32_t timeout); ///< Wait for semaphore (ms)
+void w25q_os_sem_give_isr(w25q_sem_t sem);		///< Give semaphore from interrupt
+void w25q_os_sleep(u32_t ms);					///< Sleep calling task
+u32_t w25q_os_tick(void);						///< Milliseconds tick
+void w25q_os_cycles_start(void);				///< Start cycle counter
+u32_t w25q_os_cycles(void);						///< Free-running cycle counter (wraps)
+u32_t w25q_os_cycles_hz(void);					///< Cycle counter's frequency
+/// @}
+
+/// @}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* W25Q_QSPI_W25Q_OS_H_ */
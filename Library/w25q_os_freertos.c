@@ -0,0 +1,138 @@
+/**
+ *******************************************
+ * @file    w25q_os_freertos.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   FreeRTOS port of W25Qxxx lib OS layer
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note configUSE_RECURSIVE_MUTEXES must be 1
+ */
+
+#include "w25q_os.h"
+
+#if W25Q_OS == W25Q_OS_FREERTOS
+
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+
+/**
+ * @addtogroup W25Q_OS
+ * @{
+ */
+
+/**
+ * @brief Create mutex
+ *
+ * @param[out] mutex Mutex handle
+ * @return 1-created/0-error
+ */
+bool w25q_os_mutex_create(w25q_mutex_t *mutex) {
+	*mutex = xSemaphoreCreateRecursiveMutex();
+	return *mutex != NULL;
+}
+
+/**
+ * @brief Take mutex
+ *
+ * @param[in] mutex Mutex handle
+ */
+void w25q_os_mutex_lock(w25q_mutex_t mutex) {
+	xSemaphoreTakeRecursive((SemaphoreHandle_t) mutex, portMAX_DELAY);
+}
+
+/**
+ * @brief Give mutex
+ *
+ * @param[in] mutex Mutex handle
+ */
+void w25q_os_mutex_unlock(w25q_mutex_t mutex) {
+	xSemaphoreGiveRecursive((SemaphoreHandle_t) mutex);
+}
+
+/**
+ * @brief Create semaphore
+ *
+ * @param[out] sem Semaphore handle
+ * @return 1-created/0-error
+ */
+bool w25q_os_sem_create(w25q_sem_t *sem) {
+	*sem = xSemaphoreCreateBinary();
+	return *sem != NULL;
+}
+
+/**
+ * @brief Take semaphore
+ * Calling task is blocked, others keep running
+ *
+ * @param[in] sem Semaphore handle
+ * @param[in] timeout Timeout in ms
+ * @return 1-taken/0-timeout
+ */
+bool w25q_os_sem_take(w25q_sem_t sem, u32_t timeout) {
+	return xSemaphoreTake((SemaphoreHandle_t) sem, pdMS_TO_TICKS(timeout))
+			== pdTRUE;
+}
+
+/**
+ * @brief Give semaphore from interrupt
+ *
+ * @param[in] sem Semaphore handle
+ */
+void w25q_os_sem_give_isr(w25q_sem_t sem) {
+	BaseType_t woken = pdFALSE;
+	xSemaphoreGiveFromISR((SemaphoreHandle_t) sem, &woken);
+	portYIELD_FROM_ISR(woken);
+}
+
+/**
+ * @brief Sleep
+ *
+ * @param[in] ms Time in ms
+ */
+void w25q_os_sleep(u32_t ms) {
+	vTaskDelay(pdMS_TO_TICKS(ms) ? pdMS_TO_TICKS(ms) : 1);
+}
+
+/**
+ * @brief Tick
+ *
+ * @return Milliseconds from start
+ */
+u32_t w25q_os_tick(void) {
+	// portTICK_PERIOD_MS is 0 with tick rate above 1 kHz
+	return (u32_t) ((uint64_t) xTaskGetTickCount() * 1000U / configTICK_RATE_HZ);
+}
+
+
+/**
+ * @brief Start cycle counter
+ * Enable DWT cycle counter
+ */
+void w25q_os_cycles_start(void) {
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/**
+ * @brief Cycle counter
+ *
+ * @return DWT cycles
+ */
+u32_t w25q_os_cycles(void) {
+	return DWT->CYCCNT;
+}
+
+/**
+ * @brief Cycle counter's frequency
+ *
+ * @return Core clock, Hz
+ */
+u32_t w25q_os_cycles_hz(void) {
+	return SystemCoreClock;
+}
+
+/// @}
+
+#endif
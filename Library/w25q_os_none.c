@@ -0,0 +1,142 @@
+/**
+ *******************************************
+ * @file    w25q_os_none.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Bare-metal port of W25Qxxx lib OS layer
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ */
+
+#include "w25q_os.h"
+
+#if W25Q_OS == W25Q_OS_NONE
+
+/**
+ * @addtogroup W25Q_OS
+ * @{
+ */
+
+#define W25Q_OS_SEM_COUNT 4U	///< Semaphores pool size (one per device)
+
+static volatile bool w25q_sem_flag[W25Q_OS_SEM_COUNT];	///< Semaphores pool
+static u8_t w25q_sem_used;	///< Given semaphores count
+
+/**
+ * @brief Create mutex
+ * Nothing to lock without OS
+ *
+ * @param[out] mutex Mutex handle
+ * @return 1-created/0-error
+ */
+bool w25q_os_mutex_create(w25q_mutex_t *mutex) {
+	*mutex = (w25q_mutex_t) w25q_sem_flag;
+	return 1;
+}
+
+/**
+ * @brief Take mutex
+ *
+ * @param[in] mutex Mutex handle
+ */
+void w25q_os_mutex_lock(w25q_mutex_t mutex) {
+}
+
+/**
+ * @brief Give mutex
+ *
+ * @param[in] mutex Mutex handle
+ */
+void w25q_os_mutex_unlock(w25q_mutex_t mutex) {
+}
+
+/**
+ * @brief Create semaphore
+ * Flag set from interrupt
+ *
+ * @param[out] sem Semaphore handle
+ * @return 1-created/0-error (pool is empty)
+ */
+bool w25q_os_sem_create(w25q_sem_t *sem) {
+	if (w25q_sem_used >= W25Q_OS_SEM_COUNT)
+		return 0;
+	w25q_sem_flag[w25q_sem_used] = 0;
+	*sem = (w25q_sem_t) &w25q_sem_flag[w25q_sem_used++];
+	return 1;
+}
+
+/**
+ * @brief Take semaphore
+ * Spin until interrupt sets the flag
+ *
+ * @param[in] sem Semaphore handle
+ * @param[in] timeout Timeout in ms
+ * @return 1-taken/0-timeout
+ */
+bool w25q_os_sem_take(w25q_sem_t sem, u32_t timeout) {
+	volatile bool *flag = sem;
+	u32_t start = HAL_GetTick();
+	while (!*flag)
+		if (HAL_GetTick() - start > timeout)
+			return 0;
+	*flag = 0;
+	return 1;
+}
+
+/**
+ * @brief Give semaphore from interrupt
+ *
+ * @param[in] sem Semaphore handle
+ */
+void w25q_os_sem_give_isr(w25q_sem_t sem) {
+	*(volatile bool*) sem = 1;
+}
+
+/**
+ * @brief Sleep
+ *
+ * @param[in] ms Time in ms
+ */
+void w25q_os_sleep(u32_t ms) {
+	HAL_Delay(ms);
+}
+
+/**
+ * @brief Tick
+ *
+ * @return Milliseconds from start
+ */
+u32_t w25q_os_tick(void) {
+	return HAL_GetTick();
+}
+
+
+/**
+ * @brief Start cycle counter
+ * Enable DWT cycle counter
+ */
+void w25q_os_cycles_start(void) {
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/**
+ * @brief Cycle counter
+ *
+ * @return DWT cycles
+ */
+u32_t w25q_os_cycles(void) {
+	return DWT->CYCCNT;
+}
+
+/**
+ * @brief Cycle counter's frequency
+ *
+ * @return Core clock, Hz
+ */
+u32_t w25q_os_cycles_hz(void) {
+	return SystemCoreClock;
+}
+
+/// @}
+
+#endif
@@ -0,0 +1,173 @@
+/**
+ *******************************************
+ * @file    w25q_os_posix.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   POSIX threads port of W25Qxxx lib OS layer
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note For host builds (Linux). Chip can be the RAM model of w25q_sim.c,
+ * QSPI HAL types come from host's main.h (see Tests/host)
+ */
+
+#include "w25q_os.h"
+
+#if W25Q_OS == W25Q_OS_POSIX
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+
+/**
+ * @addtogroup W25Q_OS
+ * @{
+ */
+
+/**
+ * @brief Create mutex
+ *
+ * @param[out] mutex Mutex handle
+ * @return 1-created/0-error
+ */
+bool w25q_os_mutex_create(w25q_mutex_t *mutex) {
+	pthread_mutexattr_t attr;
+	pthread_mutex_t *m = malloc(sizeof(pthread_mutex_t));
+	if (!m)
+		return 0;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	if (pthread_mutex_init(m, &attr)) {
+		free(m);
+		return 0;
+	}
+	pthread_mutexattr_destroy(&attr);
+	*mutex = m;
+	return 1;
+}
+
+/**
+ * @brief Take mutex
+ *
+ * @param[in] mutex Mutex handle
+ */
+void w25q_os_mutex_lock(w25q_mutex_t mutex) {
+	pthread_mutex_lock((pthread_mutex_t*) mutex);
+}
+
+/**
+ * @brief Give mutex
+ *
+ * @param[in] mutex Mutex handle
+ */
+void w25q_os_mutex_unlock(w25q_mutex_t mutex) {
+	pthread_mutex_unlock((pthread_mutex_t*) mutex);
+}
+
+/**
+ * @brief Create semaphore
+ *
+ * @param[out] sem Semaphore handle
+ * @return 1-created/0-error
+ */
+bool w25q_os_sem_create(w25q_sem_t *sem) {
+	sem_t *s = malloc(sizeof(sem_t));
+	if (!s)
+		return 0;
+	if (sem_init(s, 0, 0)) {
+		free(s);
+		return 0;
+	}
+	*sem = s;
+	return 1;
+}
+
+/**
+ * @brief Take semaphore
+ *
+ * @param[in] sem Semaphore handle
+ * @param[in] timeout Timeout in ms
+ * @return 1-taken/0-timeout
+ */
+bool w25q_os_sem_take(w25q_sem_t sem, u32_t timeout) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout / 1000U;
+	ts.tv_nsec += (long) (timeout % 1000U) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	int res;
+	while ((res = sem_timedwait((sem_t*) sem, &ts)) && errno == EINTR)
+		;
+	return res == 0;
+}
+
+/**
+ * @brief Give semaphore from "interrupt"
+ * sem_post is async-signal-safe
+ *
+ * @param[in] sem Semaphore handle
+ */
+void w25q_os_sem_give_isr(w25q_sem_t sem) {
+	int val = 0;
+	sem_getvalue((sem_t*) sem, &val);
+	if (!val) // binary semaphore
+		sem_post((sem_t*) sem);
+}
+
+/**
+ * @brief Sleep
+ *
+ * @param[in] ms Time in ms
+ */
+void w25q_os_sleep(u32_t ms) {
+	struct timespec ts = { ms / 1000U, (long) (ms % 1000U) * 1000000L };
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+/**
+ * @brief Tick
+ *
+ * @return Milliseconds from start
+ */
+u32_t w25q_os_tick(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u32_t) (ts.tv_sec * 1000U + ts.tv_nsec / 1000000L);
+}
+
+
+/**
+ * @brief Start cycle counter
+ * Monotonic clock runs always
+ */
+void w25q_os_cycles_start(void) {
+}
+
+/**
+ * @brief Cycle counter
+ *
+ * @return Microseconds of monotonic clock
+ */
+u32_t w25q_os_cycles(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u32_t) (ts.tv_sec * 1000000U + ts.tv_nsec / 1000L);
+}
+
+/**
+ * @brief Cycle counter's frequency
+ *
+ * @return 1 MHz
+ */
+u32_t w25q_os_cycles_hz(void) {
+	return 1000000U;
+}
+
+/// @}
+
+#endif
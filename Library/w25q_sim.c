@@ -0,0 +1,616 @@
+/**
+ *******************************************
+ * @file    w25q_sim.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   RAM model of W25Q chip for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Commands are decoded from QSPI_CommandTypeDef like chip does:
+ * 3-byte opcodes take 4-byte address in 4-byte mode (ADS), else upper
+ * byte is extended address register. Program/erase changes cells at
+ * start, then chip is busy for typical time: array reads are violations
+ * till the end, or till suspend for cells outside the command.
+ * Transfer time is counted by clocks of every phase at busHz
+ */
+
+#include "w25q_sim.h"
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @addtogroup W25Q_Sim
+ * @{
+ */
+
+#define SIM_TBP1_NS 30000U		///< First byte program time (tBP1), ns
+#define SIM_TBP2_NS 2500U		///< Next byte program time (tBP2), ns
+#define SIM_TPP_NS 400000U		///< Page program typical time (tPP), ns
+#define SIM_TSE_NS 45000000U	///< Sector erase typical time, ns
+#define SIM_TBE32_NS 120000000U	///< 32KB block erase typical time, ns
+#define SIM_TBE64_NS 150000000U	///< 64KB block erase typical time, ns
+#define SIM_TCE_US_64K 160000U	///< Chip erase typical time per 64 KB, us
+#define SIM_TW_NS 10000000U		///< Status register write typical time (tW), ns
+#define SIM_TSUS_NS 20000U		///< Suspend latency (tSUS), ns
+#define SIM_TRST_NS 30000U		///< Reset time (tRST), ns
+#define SIM_BANK 0x1000000U		///< Bank of 3-byte address
+
+static uint64_t sim_ns;	///< Virtual clock, ns
+
+/**
+ * @brief Next pseudo-random word
+ * xorshift32 of model's seed
+ *
+ * @param[in] sim Model
+ * @return Random word
+ */
+static u32_t sim_rand(W25Q_SIM *sim) {
+	u32_t x = sim->seed ? sim->seed : 0x2545F491U;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return sim->seed = x;
+}
+
+/**
+ * @brief Lines of phase
+ *
+ * @param[in] mode Phase mode
+ * @param[in] none Mode of absent phase
+ * @param[in] one Mode of single line
+ * @param[in] two Mode of two lines
+ * @return Lines (0 - phase is absent)
+ */
+static u32_t sim_lines(u32_t mode, u32_t none, u32_t one, u32_t two) {
+	if (mode == none)
+		return 0;
+	return mode == one ? 1U : mode == two ? 2U : 4U;
+}
+
+/**
+ * @brief Transfer time
+ * Advance virtual clock by phase clocks at bus clock
+ *
+ * @param[in] sim Model
+ * @param[in] com Command
+ * @param[in] data 0-instruction, address and dummy phases/1-data phase
+ */
+static void sim_transfer(W25Q_SIM *sim, const QSPI_CommandTypeDef *com, bool data) {
+	u32_t clocks = 0, n;
+	if (data) {
+		n = sim_lines(com->DataMode, QSPI_DATA_NONE, QSPI_DATA_1_LINE, QSPI_DATA_2_LINES);
+		if (n)
+			clocks = com->NbData * 8U / n;
+	} else {
+		n = sim_lines(com->InstructionMode, QSPI_INSTRUCTION_NONE,
+				QSPI_INSTRUCTION_1_LINE, QSPI_INSTRUCTION_2_LINES);
+		if (n)
+			clocks += 8U / n;
+		n = sim_lines(com->AddressMode, QSPI_ADDRESS_NONE,
+				QSPI_ADDRESS_1_LINE, QSPI_ADDRESS_2_LINES);
+		if (n)
+			clocks += (com->AddressSize == QSPI_ADDRESS_32_BITS ? 32U : 24U) / n;
+		n = sim_lines(com->AlternateByteMode, QSPI_ALTERNATE_BYTES_NONE,
+				QSPI_ALTERNATE_BYTES_1_LINE, QSPI_ALTERNATE_BYTES_2_LINES);
+		if (n)
+			clocks += 8U / n;
+		clocks += com->DummyCycles;
+	}
+	sim_ns += (uint64_t) clocks * 1000000000U / sim->busHz;
+}
+
+/**
+ * @brief Power check
+ * Count program/erase down to power loss
+ *
+ * @param[in] sim Model
+ * @return 1-command runs/0-power is lost, command is torn
+ */
+static bool sim_power(W25Q_SIM *sim) {
+	if (sim->failAfter < 0 || sim->failAfter-- > 0)
+		return 1;
+	sim->dead = 1;
+	return 0;
+}
+
+/**
+ * @brief Busy start
+ * Program/erase/status write runs for given time
+ *
+ * @param[in] sim Model
+ * @param[in] ns Typical time
+ * @param[in] addr First cell of command
+ * @param[in] len Cells of command (0 - status write)
+ */
+static void sim_busy(W25Q_SIM *sim, uint64_t ns, u32_t addr, u32_t len) {
+	sim->busyEnd = sim_ns + ns;
+	sim->opAddr = addr;
+	sim->opLen = len;
+	sim->wel = 0;
+}
+
+/**
+ * @brief Array address
+ * Decode address by opcode and address mode
+ *
+ * @param[in] sim Model
+ * @param[in] com Command
+ * @param[out] addr Cell address
+ * @return 1-decoded/0-address size doesn't match chip's mode
+ */
+static bool sim_addr(W25Q_SIM *sim, const QSPI_CommandTypeDef *com, u32_t *addr) {
+	u8_t op = com->Instruction;
+	bool op4 = op == W25Q_READ_DATA_4B || op == W25Q_FAST_READ_4B
+			|| op == W25Q_FAST_READ_DUAL_OUT_4B || op == W25Q_FAST_READ_QUAD_OUT_4B
+			|| op == W25Q_FAST_READ_DUAL_IO_4B || op == W25Q_FAST_READ_QUAD_IO_4B
+			|| op == W25Q_PAGE_PROGRAM_4B || op == W25Q_PAGE_PROGRAM_QUAD_INP_4B
+			|| op == W25Q_SECTOR_ERASE_4B || op == W25Q_64KB_BLOCK_ERASE_4B;
+	bool four = op4 || (sim->sr[2] & 0x01U);
+	if (com->AddressMode == QSPI_ADDRESS_NONE
+			|| (com->AddressSize == QSPI_ADDRESS_32_BITS) != four)
+		return 0;
+	if (four)
+		*addr = com->Address;
+	else
+		*addr = (u32_t) sim->ear * SIM_BANK + com->Address % SIM_BANK;
+	*addr &= sim->size - 1U;
+	return 1;
+}
+
+/**
+ * @brief Array read
+ * Continuous read, cells of suspended command are undefined
+ *
+ * @param[in] sim Model
+ * @param[out] buf Data
+ * @param[in] len Length
+ */
+static void sim_read(W25Q_SIM *sim, u8_t *buf, u32_t len) {
+	u32_t addr;
+	if (!sim_addr(sim, &sim->com, &addr)) {
+		sim->violations++;
+		memset(buf, 0xA5, len);
+		return;
+	}
+	bool four = sim->com.AddressSize == QSPI_ADDRESS_32_BITS;
+	// 3-byte address counter wraps in its bank
+	if (!four && addr % SIM_BANK + len > SIM_BANK)
+		sim->violations++;
+	if (sim->opLen && addr < sim->opAddr + sim->opLen && sim->opAddr < addr + len)
+		sim->violations++;
+	sim->reads++;
+	sim->readBytes += len;
+	for (u32_t i = 0; i < len; i++) {
+		u32_t a = four ? (addr + i) & (sim->size - 1U)
+				: addr - addr % SIM_BANK + (addr + i) % SIM_BANK;
+		bool undef = sim->opLen && a >= sim->opAddr && a - sim->opAddr < sim->opLen;
+		buf[i] = undef ? 0xA5 : sim->mem[a & (sim->size - 1U)];
+	}
+}
+
+/**
+ * @brief Page program
+ * Clear bits in page (address wraps in page)
+ *
+ * @param[in] sim Model
+ * @param[in] buf Data
+ * @param[in] len Length
+ */
+static void sim_program(W25Q_SIM *sim, const u8_t *buf, u32_t len) {
+	u32_t addr;
+	if (!sim->wel || sim->suspended || len > MEM_PAGE_SIZE
+			|| !sim_addr(sim, &sim->com, &addr)) {
+		sim->violations++;
+		return;
+	}
+	bool run = sim_power(sim);
+	u32_t page = addr - addr % MEM_PAGE_SIZE;
+	for (u32_t i = 0; i < len; i++) {
+		u8_t data = buf[i];
+		if (!run)
+			data |= (u8_t) sim_rand(sim); // torn: part of bits is cleared
+		sim->mem[page + (addr + i) % MEM_PAGE_SIZE] &= data;
+	}
+	sim->programs++;
+	u32_t ns = SIM_TBP1_NS + (len ? len - 1U : 0U) * SIM_TBP2_NS;
+	sim_busy(sim, ns < SIM_TPP_NS ? ns : SIM_TPP_NS, page, MEM_PAGE_SIZE);
+}
+
+/**
+ * @brief Erase
+ * Set cells of aligned unit to 0xFF
+ *
+ * @param[in] sim Model
+ * @param[in] unit Unit size (0 - chip)
+ * @param[in] ns Typical time
+ */
+static void sim_erase(W25Q_SIM *sim, u32_t unit, uint64_t ns) {
+	u32_t addr = 0;
+	if (!sim->wel || sim->suspended || (unit && !sim_addr(sim, &sim->com, &addr))) {
+		sim->violations++;
+		return;
+	}
+	if (!unit)
+		unit = sim->size;
+	addr -= addr % unit;
+	if (sim_power(sim))
+		memset(&sim->mem[addr], 0xFF, unit);
+	else
+		for (u32_t i = 0; i < unit; i++)
+			sim->mem[addr + i] |= (u8_t) sim_rand(sim); // torn: part of bits is set
+	sim->erases++;
+	sim_busy(sim, ns, addr, unit);
+}
+
+/**
+ * @brief Status register write
+ * Volatile after 0x50, else needs WEL and takes tW
+ *
+ * @param[in] sim Model
+ * @param[in] reg Register 0..2
+ * @param[in] val New value
+ */
+static void sim_write_sr(W25Q_SIM *sim, u8_t reg, u8_t val) {
+	static const u8_t mask[3] = { 0xFCU, 0x7FU, 0x66U }; // writable bits
+	sim->sr[reg] = (sim->sr[reg] & ~mask[reg]) | (val & mask[reg]);
+	if (!sim->volatileSR)
+		sim->nv[reg] = sim->sr[reg];
+}
+
+/**
+ * @brief Execute command
+ * Command without data or its data phase
+ *
+ * @param[in] sim Model
+ * @param[in,out] buf Data (NULL - no data phase)
+ * @param[in] len Length of data
+ */
+static void sim_execute(W25Q_SIM *sim, u8_t *buf, u32_t len) {
+	const QSPI_CommandTypeDef *com = &sim->com;
+	u8_t op = com->Instruction;
+	bool busy = W25Q_SimBusy(sim);
+	u8_t cap = 0, none;
+	while ((1UL << cap) < sim->size)
+		cap++;
+	// finished command's cells are defined again
+	if (!busy && !sim->suspended)
+		sim->opLen = 0;
+	// command without data phase reads nothing
+	if (!buf) {
+		buf = &none;
+		len = 0;
+	}
+
+	// release from power-down is ignored while busy (datasheet), it's no error
+	if (busy && op == W25Q_POWERUP) {
+		memset(buf, 0xFF, len);
+		return;
+	}
+	// chip only answers status and suspend while busy, release while powered down
+	if ((busy && op != W25Q_READ_SR1 && op != W25Q_READ_SR2 && op != W25Q_READ_SR3
+			&& op != W25Q_ERASEPROG_SUSPEND && op != W25Q_ENABLE_RST && op != W25Q_RESET)
+			|| (sim->sleep && op != W25Q_POWERUP)) {
+		sim->violations++;
+		memset(buf, 0xFF, len);
+		return;
+	}
+	if (op != W25Q_RESET)
+		sim->resetEn = 0;
+
+	switch (op) {
+	case W25Q_WRITE_ENABLE:
+		sim->wel = 1;
+		break;
+	case W25Q_WRITE_DISABLE:
+		sim->wel = 0;
+		break;
+	case W25Q_ENABLE_VOLATILE_SR:
+		sim->volatileSR = 1;
+		break;
+	case W25Q_READ_SR1:
+		memset(buf, (sim->sr[0] & 0xFCU) | (sim->wel << 1) | busy, len);
+		break;
+	case W25Q_READ_SR2:
+		memset(buf, (sim->sr[1] & 0x7FU) | ((sim->suspended && !busy) << 7), len);
+		break;
+	case W25Q_READ_SR3:
+		memset(buf, sim->sr[2], len);
+		break;
+	case W25Q_WRITE_SR1:
+	case W25Q_WRITE_SR2:
+	case W25Q_WRITE_SR3:
+		if (!len || (!sim->wel && !sim->volatileSR)) {
+			sim->violations++;
+			break;
+		}
+		if (op == W25Q_WRITE_SR1) {
+			sim_write_sr(sim, 0, buf[0]);
+			if (len > 1)
+				sim_write_sr(sim, 1, buf[1]);
+		} else
+			sim_write_sr(sim, op == W25Q_WRITE_SR2 ? 1 : 2, buf[0]);
+		if (sim->volatileSR)
+			sim->volatileSR = 0;
+		else if (sim_power(sim))
+			sim_busy(sim, SIM_TW_NS, 0, 0);
+		sim->wel = 0;
+		break;
+	case W25Q_ENABLE_4B_MODE:
+		sim->sr[2] |= 0x01U;
+		break;
+	case W25Q_DISABLE_4B_MODE:
+		sim->sr[2] &= ~0x01U;
+		break;
+	case W25Q_READ_EXT_ADDR_REG:
+		memset(buf, sim->ear, len);
+		break;
+	case W25Q_WRITE_EXT_ADDR_REG:
+		if (!len || !sim->wel || (sim->sr[2] & 0x01U)) {
+			sim->violations++;
+			break;
+		}
+		sim->ear = buf[0];
+		sim->wel = 0;
+		sim->earWrites++;
+		break;
+	case W25Q_READ_DATA:
+	case W25Q_READ_DATA_4B:
+	case W25Q_FAST_READ:
+	case W25Q_FAST_READ_4B:
+	case W25Q_FAST_READ_DUAL_OUT:
+	case W25Q_FAST_READ_DUAL_OUT_4B:
+	case W25Q_FAST_READ_QUAD_OUT:
+	case W25Q_FAST_READ_QUAD_OUT_4B:
+	case W25Q_FAST_READ_DUAL_IO:
+	case W25Q_FAST_READ_DUAL_IO_4B:
+	case W25Q_FAST_READ_QUAD_IO:
+	case W25Q_FAST_READ_QUAD_IO_4B:
+		sim_read(sim, buf, len);
+		break;
+	case W25Q_PAGE_PROGRAM:
+	case W25Q_PAGE_PROGRAM_4B:
+	case W25Q_PAGE_PROGRAM_QUAD_INP:
+	case W25Q_PAGE_PROGRAM_QUAD_INP_4B:
+		sim_program(sim, buf, len);
+		break;
+	case W25Q_SECTOR_ERASE:
+	case W25Q_SECTOR_ERASE_4B:
+		sim_erase(sim, 4096U, SIM_TSE_NS);
+		break;
+	case W25Q_32KB_BLOCK_ERASE:
+		sim_erase(sim, 32768U, SIM_TBE32_NS);
+		break;
+	case W25Q_64KB_BLOCK_ERASE:
+	case W25Q_64KB_BLOCK_ERASE_4B:
+		sim_erase(sim, 65536U, SIM_TBE64_NS);
+		break;
+	case W25Q_CHIP_ERASE:
+		sim_erase(sim, 0, (uint64_t) (sim->size >> 16) * SIM_TCE_US_64K * 1000U);
+		break;
+	case W25Q_ERASEPROG_SUSPEND:
+		// ignored if nothing runs or status write runs
+		if (busy && sim->opLen && !sim->suspended) {
+			sim->left = sim->busyEnd - sim_ns;
+			sim->busyEnd = sim_ns + SIM_TSUS_NS;
+			sim->suspended = 1;
+			sim->suspends++;
+		}
+		break;
+	case W25Q_ERASEPROG_RESUME:
+		if (sim->suspended) {
+			sim->busyEnd = sim_ns + sim->left;
+			sim->suspended = 0;
+		}
+		break;
+	case W25Q_POWERDOWN:
+		sim->sleep = 1;
+		break;
+	case W25Q_POWERUP:
+		sim->sleep = 0;
+		memset(buf, cap - 1U, len);
+		break;
+	case W25Q_FULLID:
+		for (u32_t i = 0; i < len; i++)
+			buf[i] = i % 2 ? cap - 1U : 0xEFU;
+		break;
+	case W25Q_READ_JEDEC_ID:
+		for (u32_t i = 0; i < len; i++)
+			buf[i] = i % 3 == 0 ? 0xEFU : i % 3 == 1 ? 0x40U : cap;
+		break;
+	case W25Q_READ_UID:
+		for (u32_t i = 0; i < len; i++)
+			buf[i] = (u8_t) (0x5A + i * 0x11U);
+		break;
+	case W25Q_READ_SFDP:
+	case W25Q_READ_SECURITY_REG:
+		memset(buf, 0xFF, len);
+		break;
+	case W25Q_READ_BLOCK_LOCK:
+		memset(buf, 0, len);
+		break;
+	case W25Q_SET_BURST_WRAP:
+	case W25Q_IND_BLOCK_LOCK:
+	case W25Q_IND_BLOCK_UNLOCK:
+	case W25Q_GLOBAL_LOCK:
+	case W25Q_GLOBAL_UNLOCK:
+		break;
+	case W25Q_ENABLE_RST:
+		sim->resetEn = 1;
+		break;
+	case W25Q_RESET:
+		if (!sim->resetEn) {
+			sim->violations++;
+			break;
+		}
+		// running command is aborted, volatile state is lost
+		memcpy(sim->sr, sim->nv, sizeof(sim->sr));
+		sim->sr[2] = (sim->sr[2] & ~0x01U) | ((sim->nv[2] >> 1) & 0x01U);
+		sim->ear = 0;
+		sim->wel = sim->volatileSR = sim->resetEn = sim->suspended = 0;
+		sim_busy(sim, SIM_TRST_NS, 0, 0);
+		break;
+	default:
+		sim->violations++;
+		memset(buf, 0xFF, len);
+		break;
+	}
+}
+
+/**
+ * @brief Model Command
+ * Instruction, address and dummy phases
+ *
+ * @param[in] dev Device
+ * @param[in] com Command
+ * @return HAL_StatusTypeDef enum (HAL_ERROR - power is lost)
+ */
+static HAL_StatusTypeDef sim_command(W25Q_Device *dev, QSPI_CommandTypeDef *com) {
+	W25Q_SIM *sim = dev->handle;
+	if (sim->dead)
+		return HAL_ERROR;
+	sim->commands++;
+	sim->com = *com;
+	sim_transfer(sim, com, 0);
+	if (com->DataMode == QSPI_DATA_NONE)
+		sim_execute(sim, NULL, 0);
+	return sim->dead ? HAL_ERROR : HAL_OK;
+}
+
+/**
+ * @brief Model Receive
+ *
+ * @param[in] dev Device
+ * @param[out] buf Data
+ * @param[in] dma Ignored (model is blocking)
+ * @return HAL_StatusTypeDef enum
+ */
+static HAL_StatusTypeDef sim_receive(W25Q_Device *dev, u8_t *buf, bool dma) {
+	W25Q_SIM *sim = dev->handle;
+	if (sim->dead)
+		return HAL_ERROR;
+	sim_transfer(sim, &sim->com, 1);
+	sim_execute(sim, buf, sim->com.NbData);
+	return HAL_OK;
+}
+
+/**
+ * @brief Model Transmit
+ *
+ * @param[in] dev Device
+ * @param[in] buf Data
+ * @param[in] dma Ignored (model is blocking)
+ * @return HAL_StatusTypeDef enum
+ */
+static HAL_StatusTypeDef sim_transmit(W25Q_Device *dev, u8_t *buf, bool dma) {
+	W25Q_SIM *sim = dev->handle;
+	if (sim->dead)
+		return HAL_ERROR;
+	sim_transfer(sim, &sim->com, 1);
+	sim_execute(sim, buf, sim->com.NbData);
+	return sim->dead ? HAL_ERROR : HAL_OK;
+}
+
+/**
+ * @brief Model Status
+ * Transfers are blocking
+ *
+ * @param[in] dev Device
+ * @return HAL_StatusTypeDef enum
+ */
+static HAL_StatusTypeDef sim_status(W25Q_Device *dev) {
+	return ((W25Q_SIM*) dev->handle)->dead ? HAL_ERROR : HAL_OK;
+}
+
+/**
+ * @brief Model Abort
+ *
+ * @param[in] dev Device
+ * @return HAL_StatusTypeDef enum
+ */
+static HAL_StatusTypeDef sim_abort(W25Q_Device *dev) {
+	return HAL_OK;
+}
+
+/// Transport of RAM model
+const W25Q_BUS w25q_sim_bus = {
+	.command = sim_command,
+	.receive = sim_receive,
+	.transmit = sim_transmit,
+	.autopoll = NULL,	// driver polls SR1
+	.status = sim_status,
+	.abort = sim_abort,
+	.dma = 0,
+	.clock = NULL,	// fixed busHz
+};
+
+/**
+ * @brief W25Q Model init
+ * Blank chip: cells erased, QE and 4-byte mode are off
+ *
+ * @param[out] sim Model
+ * @param[in] mem Cells (size bytes)
+ * @param[in] size Chip size in bytes (power of 2)
+ */
+void W25Q_SimInit(W25Q_SIM *sim, u8_t *mem, u32_t size) {
+	memset(sim, 0, sizeof(W25Q_SIM));
+	sim->mem = mem;
+	sim->size = size;
+	sim->busHz = W25Q_SIM_BUS_HZ;
+	sim->failAfter = -1;
+	sim->seed = 1;
+	memset(mem, 0xFF, size);
+}
+
+/**
+ * @brief W25Q Model power cycle
+ * Power off and on: running command ends, volatile bits are lost,
+ * ADS is set from ADP
+ *
+ * @param[in] sim Model
+ */
+void W25Q_SimPowerCycle(W25Q_SIM *sim) {
+	memcpy(sim->sr, sim->nv, sizeof(sim->sr));
+	sim->sr[2] = (sim->sr[2] & ~0x01U) | ((sim->nv[2] >> 1) & 0x01U);
+	sim->ear = 0;
+	sim->wel = sim->volatileSR = sim->resetEn = 0;
+	sim->sleep = sim->suspended = sim->dead = 0;
+	sim->busyEnd = 0;
+	sim->opLen = 0;
+	sim->failAfter = -1;
+}
+
+/**
+ * @brief W25Q Model busy
+ *
+ * @param[in] sim Model
+ * @return 1-program/erase/status write runs (BUSY)
+ */
+bool W25Q_SimBusy(const W25Q_SIM *sim) {
+	return !sim->dead && sim_ns < sim->busyEnd;
+}
+
+/**
+ * @brief W25Q Model time
+ *
+ * @return Virtual clock, ns
+ */
+uint64_t W25Q_SimTime(void) {
+	return sim_ns;
+}
+
+/**
+ * @brief W25Q Model advance
+ * Move virtual clock (OS layer's sleep and cycle counter on host)
+ *
+ * @param[in] ns Time in ns
+ */
+void W25Q_SimAdvance(u32_t ns) {
+	sim_ns += ns;
+}
+
+/// @}
+
+/// @}
@@ -0,0 +1,109 @@
+/**
+ *******************************************
+ * @file    w25q_sim.h
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   RAM model of W25Q chip for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note NOR chip in RAM behind W25Q_BUS: erase sets 0xFF, program only
+ * clears bits (AND), BUSY lasts datasheet's typical time of virtual
+ * clock, commands sent while chip is busy are counted as violations.
+ * Power loss tears the chosen program/erase. Host tests and benchmarks
+ * run driver and modules over it (see Tests):
+ * @code
+ * static u8_t cells[16 << 20];
+ * static W25Q_SIM sim;
+ * W25Q_Device flash = W25Q_DEVICE_SIM(&sim, 128);
+ * W25Q_SimInit(&sim, cells, sizeof(cells));
+ * W25Q_Init(&flash);
+ * @endcode
+ * @note Single chip (no dual-flash), no auto-polling and DMA: driver
+ * polls SR1, time goes by bus transfers and W25Q_SimAdvance (OS layer's
+ * sleep, tick and cycle counter must run on W25Q_SimTime, CPU time isn't
+ * counted)
+ */
+
+#ifndef W25Q_QSPI_W25Q_SIM_H_
+#define W25Q_QSPI_W25Q_SIM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "w25q_mem.h"
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @defgroup W25Q_Sim W25Q RAM model
+ * @brief Simulated chip and transport
+ * @{
+ */
+
+#ifndef W25Q_SIM_BUS_HZ
+/// Default bus clock of model, Hz
+#define W25Q_SIM_BUS_HZ 100000000U
+#endif
+
+/**
+ * @struct W25Q_SIM
+ * @brief  W25Q Simulated chip
+ * @{
+ */
+typedef struct{
+	u8_t *mem;			///< Cells
+	u32_t size;			///< Chip size in bytes (power of 2)
+	u32_t busHz;		///< Bus clock, Hz (transfer time)
+	u8_t sr[3];			///< Status registers (BUSY, WEL, SUS are kept apart)
+	u8_t nv[3];			///< Non-volatile status registers (power-up state)
+	u8_t ear;			///< Extended address register
+	bool wel;			///< Write enable latch
+	bool volatileSR;	///< Next status register write is volatile
+	bool resetEn;		///< Reset is enabled
+	bool sleep;			///< Powered down
+	bool suspended;		///< Program/erase is suspended (SUS)
+	bool dead;			///< Power is lost: bus fails till W25Q_SimPowerCycle
+	uint64_t busyEnd;	///< End of running command, virtual ns
+	uint64_t left;		///< Time left of suspended command, ns
+	u32_t opAddr;		///< First cell of running/suspended command
+	u32_t opLen;		///< Cells of that command (0 - not program/erase)
+	QSPI_CommandTypeDef com; ///< Command whose data phase follows
+	i32_t failAfter;	///< Program/erase commands before power loss (-1 - never)
+	u32_t seed;			///< Torn cells generator
+	u32_t commands;		///< Commands
+	u32_t reads;		///< Array read commands
+	u32_t readBytes;	///< Bytes read from array
+	u32_t programs;		///< Page programs
+	u32_t erases;		///< Sector/block/chip erases
+	u32_t suspends;		///< Suspends of program/erase
+	u32_t earWrites;	///< Extended address register writes
+	u32_t violations;	///< Commands chip ignores or can't do (busy, no WEL, undefined read)
+}W25Q_SIM;
+/** @} */
+
+extern const W25Q_BUS w25q_sim_bus;	///< Transport of RAM model
+
+/// Model device initializer: W25Q_Device flash = W25Q_DEVICE_SIM(&sim, 128);
+#define W25Q_DEVICE_SIM(sim, mbit) { .bus = &w25q_sim_bus, .handle = (sim), \
+	.size = (mbit) * 1024UL * 1024UL / 8U, .pageSize = MEM_PAGE_SIZE, \
+	.sectorSize = MEM_SECTOR_SIZE * 1024U, .blockSize = MEM_BLOCK_SIZE * 1024U, \
+	.quad = 1, .power = { .idleMs = W25Q_POWER_IDLE_MS } }
+
+void W25Q_SimInit(W25Q_SIM *sim, u8_t *mem, u32_t size);	///< Blank chip (cells are erased)
+void W25Q_SimPowerCycle(W25Q_SIM *sim);	///< Power off and on: volatile state is lost
+bool W25Q_SimBusy(const W25Q_SIM *sim);	///< Program/erase/status write runs
+uint64_t W25Q_SimTime(void);			///< Virtual clock, ns
+void W25Q_SimAdvance(u32_t ns);			///< Advance virtual clock
+/// @}
+
+/// @}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* W25Q_QSPI_W25Q_SIM_H_ */
@@ -0,0 +1,171 @@
+/**
+ *******************************************
+ * @file    w25q_spi.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   SPI transport for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Chip on plain SPI with GPIO chip select. Single line, blocking,
+ * status is polled by driver. Device: W25Q_DEVICE_SPI(&port, mbit)
+ */
+
+#include "w25q_mem.h"
+
+#ifdef HAL_SPI_MODULE_ENABLED
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @addtogroup W25Q_SPI SPI transport
+ * @brief STM32 SPI HAL transport
+ * @{
+ */
+
+#define W25Q_SPI_TIMEOUT 1000U	///< SPI HAL timeout, ms
+#define W25Q_SPI_CHUNK 0xFFFFU	///< Max length of one HAL transfer
+
+/**
+ * @brief Chip select
+ *
+ * @param[in] port SPI connection
+ * @param[in] sel 1-select (CS low)/0-release
+ */
+static void spi_cs(W25Q_SPI_PORT *port, bool sel) {
+	HAL_GPIO_WritePin(port->csPort, port->csPin,
+			sel ? GPIO_PIN_RESET : GPIO_PIN_SET);
+}
+
+/**
+ * @brief SPI Command
+ * Select chip and send instruction, address and dummy bytes.
+ * Chip stays selected if data phase follows
+ *
+ * @param[in] dev Device
+ * @param[in] com Command (single line only)
+ * @return HAL_StatusTypeDef enum
+ */
+static HAL_StatusTypeDef spi_command(W25Q_Device *dev, QSPI_CommandTypeDef *com) {
+	W25Q_SPI_PORT *port = dev->handle;
+	u8_t buf[1 + 4 + 4];
+	u8_t len = 0;
+
+	if (com->InstructionMode != QSPI_INSTRUCTION_1_LINE
+			|| (com->AddressMode != QSPI_ADDRESS_NONE
+					&& com->AddressMode != QSPI_ADDRESS_1_LINE)
+			|| (com->DataMode != QSPI_DATA_NONE
+					&& com->DataMode != QSPI_DATA_1_LINE)
+			|| com->AlternateByteMode != QSPI_ALTERNATE_BYTES_NONE
+			|| com->DummyCycles % 8U || com->DummyCycles > 32U)
+		return HAL_ERROR;
+
+	buf[len++] = com->Instruction;
+	if (com->AddressMode != QSPI_ADDRESS_NONE) {
+		// QSPI_ADDRESS_8_BITS..32_BITS -> 1..4 bytes
+		u8_t n = 1 + (com->AddressSize == QSPI_ADDRESS_16_BITS)
+				+ 2 * (com->AddressSize == QSPI_ADDRESS_24_BITS)
+				+ 3 * (com->AddressSize == QSPI_ADDRESS_32_BITS);
+		while (n--)
+			buf[len++] = (u8_t) (com->Address >> (n * 8U));
+	}
+	for (u8_t i = 0; i < com->DummyCycles / 8U; i++)
+		buf[len++] = 0xFF;
+
+	spi_cs(port, 1);
+	HAL_StatusTypeDef st = HAL_SPI_Transmit(port->spi, buf, len,
+			W25Q_SPI_TIMEOUT);
+	if (st != HAL_OK || com->DataMode == QSPI_DATA_NONE)
+		spi_cs(port, 0);
+	return st;
+}
+
+/**
+ * @brief SPI Receive
+ * Receive data phase and release chip
+ *
+ * @param[in] dev Device
+ * @param[out] buf Pointer to data array
+ * @param[in] dma Ignored, transfer is blocking
+ * @return HAL_StatusTypeDef enum
+ */
+static HAL_StatusTypeDef spi_receive(W25Q_Device *dev, u8_t *buf, bool dma) {
+	W25Q_SPI_PORT *port = dev->handle;
+	HAL_StatusTypeDef st = HAL_OK;
+
+	for (u32_t left = dev->nbData; left && st == HAL_OK;) {
+		u16_t part = left > W25Q_SPI_CHUNK ? W25Q_SPI_CHUNK : left;
+		st = HAL_SPI_Receive(port->spi, buf, part, W25Q_SPI_TIMEOUT);
+		buf += part;
+		left -= part;
+	}
+	spi_cs(port, 0);
+	return st;
+}
+
+/**
+ * @brief SPI Transmit
+ * Transmit data phase and release chip
+ *
+ * @param[in] dev Device
+ * @param[in] buf Pointer to data array
+ * @param[in] dma Ignored, transfer is blocking
+ * @return HAL_StatusTypeDef enum
+ */
+static HAL_StatusTypeDef spi_transmit(W25Q_Device *dev, u8_t *buf, bool dma) {
+	W25Q_SPI_PORT *port = dev->handle;
+	HAL_StatusTypeDef st = HAL_OK;
+
+	for (u32_t left = dev->nbData; left && st == HAL_OK;) {
+		u16_t part = left > W25Q_SPI_CHUNK ? W25Q_SPI_CHUNK : left;
+		st = HAL_SPI_Transmit(port->spi, buf, part, W25Q_SPI_TIMEOUT);
+		buf += part;
+		left -= part;
+	}
+	spi_cs(port, 0);
+	return st;
+}
+
+/**
+ * @brief SPI Transfer state
+ * Transfers are blocking, nothing runs
+ *
+ * @param[in] dev Device
+ * @return HAL_StatusTypeDef enum
+ */
+static HAL_StatusTypeDef spi_status(W25Q_Device *dev) {
+	return HAL_OK;
+}
+
+/**
+ * @brief SPI Abort
+ *
+ * @param[in] dev Device
+ * @return HAL_StatusTypeDef enum
+ */
+static HAL_StatusTypeDef spi_abort(W25Q_Device *dev) {
+	W25Q_SPI_PORT *port = dev->handle;
+	HAL_StatusTypeDef st = HAL_SPI_Abort(port->spi);
+	spi_cs(port, 0);
+	return st;
+}
+
+/// STM32 SPI transport
+const W25Q_BUS w25q_spi_bus = {
+	.command = spi_command,
+	.receive = spi_receive,
+	.transmit = spi_transmit,
+	.autopoll = NULL,	// driver polls SR1
+	.status = spi_status,
+	.abort = spi_abort,
+	.dma = 0,
+	.clock = NULL,	// SPI baud rate is set by CubeMX
+};
+
+/// @}
+
+/// @}
+
+#endif
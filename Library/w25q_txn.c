@@ -0,0 +1,754 @@
+/**
+ *******************************************
+ * @file    w25q_txn.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Power-fail-safe transactions for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Journal half: page 0 - header, pages 1..M - sector map,
+ * other pages - commit records, one page program each.
+ * Header is programmed after the map, so half with valid header
+ * has full map. Full half is compacted to the other one.
+ * Remapping is by pages of sector: record keeps base, overlay and
+ * page mask of every written sector (8 bytes of RAM per sector).
+ * New page goes to the same page of overlay if it's free there, so
+ * commit is one record program. Page already in overlay (or left by
+ * torn write) moves transaction's pages to new overlay, commit copies
+ * the rest of old overlay's pages. Compaction is the garbage collector:
+ * base pages are copied to free overlay pages and overlay becomes the
+ * base, old base is freed by new map. It runs when journal half is full
+ * or last spare sector is left (kept for folding of dirty overlays).
+ * Area is used by one task (no locking over driver's one)
+ */
+
+#include "w25q_txn.h"
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @addtogroup W25Q_Txn
+ * @{
+ */
+
+/// Journal half header
+typedef struct{
+	u32_t magic;		///< W25Q_TXN_MAGIC
+	u32_t seq;			///< Sequence of map
+	u16_t logical;		///< Logical sectors of area
+	u16_t spare;		///< Spare sectors of area
+	u32_t mapCrc;		///< CRC-32 of map
+	u32_t crc;			///< CRC-32 of fields above
+}txn_hdr;
+
+/// Commit record, followed by count txn_ent and CRC-32
+typedef struct{
+	u32_t magic;		///< W25Q_TXN_REC
+	u32_t seq;			///< Sequence of transaction
+	u16_t count;		///< Count of remapped sectors
+	u16_t rsv;			///< Reserved (0xFFFF)
+}txn_rec;
+
+/// Commit record entry: new pages of logical sector
+typedef struct{
+	u16_t logical;		///< Logical sector
+	u16_t rsv;			///< Reserved (0xFFFF)
+	W25Q_TXN_MAP map;	///< Base, overlay and mask
+}txn_ent;
+
+/// Max length of commit record: txn_rec, entries, CRC-32
+#define TXN_REC_LEN (12U + W25Q_TXN_MAX * 12U + 4U)
+
+#if TXN_REC_LEN > MEM_PAGE_SIZE
+#error "W25Q_TXN_MAX: commit record doesn't fit page"
+#endif
+
+/// Physical sector holds data
+#define txn_used(t, p) ((t)->used[(p) >> 3] & (1U << ((p) & 7U)))
+/// Mark physical sector
+#define txn_mark(t, p, on) do { if (on) (t)->used[(p) >> 3] |= 1U << ((p) & 7U); \
+	else (t)->used[(p) >> 3] &= ~(1U << ((p) & 7U)); } while (0)
+
+/**
+ * @addtogroup W25Q_TxnPriv Private Methods
+ * @{
+ */
+static inline u32_t sect_addr(W25Q_TXN *txn, u16_t phys);	///< Address of physical data sector
+static inline u32_t jrn_addr(W25Q_TXN *txn, u8_t half, u32_t page); ///< Address of journal page
+static inline u32_t map_pages(W25Q_TXN *txn);	///< Pages of map in journal half
+static inline u32_t jrn_pages(W25Q_TXN *txn);	///< Pages of journal half
+static W25Q_STATE load_half(W25Q_TXN *txn, u8_t half);	///< Load map and replay records
+static W25Q_STATE write_base(W25Q_TXN *txn, u8_t half);	///< Write map to journal half
+static W25Q_STATE compact(W25Q_TXN *txn);	///< Fold overlays, move map to other half
+static W25Q_STATE fold(W25Q_TXN *txn, u16_t logical, u8_t *freed); ///< Make overlay base
+static W25Q_STATE alloc_sector(W25Q_TXN *txn, u16_t *phys);	///< Get erased free sector
+static W25Q_STATE take_sector(W25Q_TXN *txn, u16_t *phys);	///< Get sector for transaction
+static W25Q_TXN_SHADOW* find_shadow(W25Q_TXN *txn, u16_t logical); ///< Shadow of logical sector
+static W25Q_STATE reshadow(W25Q_TXN *txn, W25Q_TXN_SHADOW *sh, u8_t skip); ///< Move shadow to new sector
+static W25Q_STATE copy_page(W25Q_TXN *txn, u16_t from, u16_t to, u8_t pi); ///< Copy page between sectors
+static W25Q_STATE page_blank(W25Q_TXN *txn, bool *blank, u16_t phys, u8_t pi); ///< Page is erased
+/// @}
+
+/**
+ * @brief W25Q Transaction area mount
+ * Recover mapping from journal: newest valid half, then its records.
+ * Torn (unfinished) commits are ignored
+ *
+ * @param[out] txn Area state
+ * @param[in] dev Device (initialized)
+ * @param[in] cfg Area
+ * @param[in] format 1-make new area if there is no journal/0-fail
+ * @return W25Q_STATE enum (W25Q_CHIP_ERR - no valid journal)
+ */
+W25Q_STATE W25Q_TxnMount(W25Q_TXN *txn, W25Q_Device *dev, const W25Q_TXN_CFG *cfg, bool format) {
+	memset(txn, 0, sizeof(W25Q_TXN));
+	txn->dev = dev;
+	txn->cfg = *cfg;
+
+	u32_t total = cfg->base + 2U * cfg->jrnSectors + cfg->logical + cfg->spare;
+	if (!cfg->logical || cfg->spare < 2U || !cfg->jrnSectors
+			|| cfg->logical + cfg->spare > W25Q_TXN_SECTORS
+			|| total > dev->size / dev->sectorSize
+			|| dev->pageSize > W25Q_TXN_PAGE
+			|| dev->sectorSize / dev->pageSize > 32U
+			|| map_pages(txn) + 2U > jrn_pages(txn))
+		return W25Q_PARAM_ERR;
+
+	// newer half first
+	txn_hdr hdr[2];
+	for (u8_t h = 0; h < 2; h++) {
+		W25Q_STATE state = W25Q_ReadRaw(dev, (u8_t*) &hdr[h], sizeof(txn_hdr), jrn_addr(txn, h, 0));
+		if (state != W25Q_OK)
+			return state;
+	}
+	u8_t first = hdr[1].seq > hdr[0].seq && hdr[1].magic == W25Q_TXN_MAGIC;
+	W25Q_STATE state = load_half(txn, first);
+	if (state == W25Q_CHIP_ERR)
+		state = load_half(txn, first ^ 1);
+	if (state != W25Q_CHIP_ERR || !format)
+		return state;
+
+	// new area: data stays where it is
+	memset(txn->used, 0, sizeof(txn->used));
+	for (u16_t i = 0; i < cfg->logical; i++) {
+		txn->map[i].base = i;
+		txn->map[i].ovl = W25Q_TXN_NONE;
+		txn->map[i].mask = 0;
+		txn_mark(txn, i, 1);
+	}
+	txn->seq = 0;
+	txn->half = 0;
+	txn->jrnPage = 1 + map_pages(txn);
+	return write_base(txn, 0);
+}
+
+/**
+ * @brief W25Q Transaction begin
+ *
+ * @param[in] txn Area state
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_TxnBegin(W25Q_TXN *txn) {
+	if (txn->open || !txn->dev)
+		return W25Q_PARAM_ERR;
+	txn->open = 1;
+	txn->count = 0;
+	return W25Q_OK;
+}
+
+/**
+ * @brief W25Q Transaction write
+ * Write extent to overlay pages, area isn't changed till commit
+ *
+ * @note Page goes to overlay of its sector if it's free there,
+ * else transaction's pages of the sector move to new overlay
+ * (NOR can't reprogram). Last spare sector runs compaction
+ * @param[in] txn Area state
+ * @param[in] addr Address in area
+ * @param[in] buf Data
+ * @param[in] len Length of data
+ * @return W25Q_STATE enum (W25Q_PARAM_ERR - out of area or spare sectors)
+ */
+W25Q_STATE W25Q_TxnWrite(W25Q_TXN *txn, u32_t addr, const u8_t *buf, u32_t len) {
+	W25Q_Device *dev = txn->dev;
+	if (!dev || !txn->open)
+		return W25Q_PARAM_ERR;
+	u32_t size = txn->cfg.logical * dev->sectorSize;
+	if (len == 0 || addr >= size || len > size - addr)
+		return W25Q_PARAM_ERR;
+
+	W25Q_STATE state = W25Q_OK;
+	u8_t *page = txn->buf[0];
+	while (len && state == W25Q_OK) {
+		u16_t ls = addr / dev->sectorSize;
+		u8_t pi = addr % dev->sectorSize / dev->pageSize;
+		u32_t po = addr % dev->pageSize;
+		u32_t n = dev->pageSize - po;
+		if (n > len)
+			n = len;
+
+		W25Q_TXN_MAP *m = &txn->map[ls];
+		W25Q_TXN_SHADOW *sh = find_shadow(txn, ls);
+		if (!sh) {
+			if (txn->count == W25Q_TXN_MAX)
+				return W25Q_PARAM_ERR;
+			sh = &txn->shadow[txn->count];
+			sh->phys = m->ovl;
+			if (sh->phys == W25Q_TXN_NONE) {
+				state = take_sector(txn, &sh->phys);
+				if (state != W25Q_OK)
+					return state;
+			}
+			sh->logical = ls;
+			sh->written = 0;
+			txn->count++;
+		}
+
+		// page = old content + new data
+		u32_t bit = 1UL << pi;
+		bool again = sh->written & bit;
+		u16_t src = again ? sh->phys : m->mask & bit ? m->ovl : m->base;
+		if (n < dev->pageSize)
+			state = W25Q_ReadBulk(dev, page, dev->pageSize,
+					sect_addr(txn, src) + pi * dev->pageSize);
+		memcpy(page + po, buf, n);
+
+		// overlay's page is taken by committed data or torn write
+		bool move = again;
+		if (state == W25Q_OK && !move && sh->phys == m->ovl) {
+			bool blank = 0;
+			if (!(m->mask & bit))
+				state = page_blank(txn, &blank, sh->phys, pi);
+			move = !blank;
+		}
+		if (state == W25Q_OK && move)
+			state = reshadow(txn, sh, pi);
+		if (state == W25Q_OK && !W25Q_IsErased(page, dev->pageSize))
+			state = W25Q_ProgramRaw(dev, page, dev->pageSize,
+					sect_addr(txn, sh->phys) + pi * dev->pageSize);
+		sh->written |= bit;
+
+		buf += n;
+		addr += n;
+		len -= n;
+	}
+	return state;
+}
+
+/**
+ * @brief W25Q Transaction read
+ * Read area, open transaction's writes are seen
+ *
+ * @param[in] txn Area state
+ * @param[in] addr Address in area
+ * @param[out] buf Data
+ * @param[in] len Length of data
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_TxnRead(W25Q_TXN *txn, u32_t addr, u8_t *buf, u32_t len) {
+	W25Q_Device *dev = txn->dev;
+	if (!dev)
+		return W25Q_PARAM_ERR;
+	u32_t size = txn->cfg.logical * dev->sectorSize;
+	if (len == 0 || addr >= size || len > size - addr)
+		return W25Q_PARAM_ERR;
+
+	W25Q_STATE state = W25Q_OK;
+	while (len && state == W25Q_OK) {
+		u16_t ls = addr / dev->sectorSize;
+		u32_t n = dev->sectorSize - addr % dev->sectorSize;
+		W25Q_TXN_MAP *m = &txn->map[ls];
+		W25Q_TXN_SHADOW *sh = txn->open ? find_shadow(txn, ls) : NULL;
+		u16_t phys = m->base;
+		// overlaid sector - page by page
+		if (sh || m->ovl != W25Q_TXN_NONE) {
+			u32_t bit = 1UL << (addr % dev->sectorSize / dev->pageSize);
+			n = dev->pageSize - addr % dev->pageSize;
+			if (sh && (sh->written & bit))
+				phys = sh->phys;
+			else if (m->mask & bit)
+				phys = m->ovl;
+		}
+		if (n > len)
+			n = len;
+		state = W25Q_ReadBulk(dev, buf, n, sect_addr(txn, phys) + addr % dev->sectorSize);
+		buf += n;
+		addr += n;
+		len -= n;
+	}
+	return state;
+}
+
+/**
+ * @brief W25Q Transaction commit
+ * Program one commit record with new pages of written sectors.
+ * Power loss before record is done leaves old data
+ *
+ * @note Costs one page program of record. Sector moved to new overlay
+ * also costs read + program of its old overlay's pages not written
+ * by transaction, full journal half - compaction
+ *
+ * @param[in] txn Area state
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_TxnCommit(W25Q_TXN *txn) {
+	W25Q_Device *dev = txn->dev;
+	if (!txn->open)
+		return W25Q_PARAM_ERR;
+
+	W25Q_STATE state = W25Q_OK;
+	u8_t *page = txn->buf[0];
+	u8_t pages = dev->sectorSize / dev->pageSize;
+	u32_t full = pages == 32U ? 0xFFFFFFFFUL : (1UL << pages) - 1U;
+
+	// new overlay takes pages of old one not written by transaction
+	for (u8_t i = 0; i < txn->count && state == W25Q_OK; i++) {
+		W25Q_TXN_SHADOW *sh = &txn->shadow[i];
+		W25Q_TXN_MAP *m = &txn->map[sh->logical];
+		if (sh->phys == m->ovl || m->ovl == W25Q_TXN_NONE)
+			continue;
+		for (u8_t pi = 0; pi < pages && state == W25Q_OK; pi++)
+			if ((m->mask & ~sh->written) & (1UL << pi))
+				state = copy_page(txn, m->ovl, sh->phys, pi);
+	}
+	if (state != W25Q_OK)
+		return state;
+	if (!txn->count) {
+		txn->open = 0;
+		return W25Q_OK;
+	}
+
+	// journal half is full - move map to the other one
+	if (txn->jrnPage >= jrn_pages(txn)) {
+		state = compact(txn);
+		if (state != W25Q_OK)
+			return state;
+	}
+
+	txn_rec *rec = (txn_rec*) page;
+	rec->magic = W25Q_TXN_REC;
+	rec->seq = txn->seq + 1;
+	rec->count = txn->count;
+	rec->rsv = 0xFFFF;
+	txn_ent *ent = (txn_ent*) (rec + 1);
+	for (u8_t i = 0; i < txn->count; i++, ent++) {
+		W25Q_TXN_SHADOW *sh = &txn->shadow[i];
+		ent->logical = sh->logical;
+		ent->rsv = 0xFFFF;
+		ent->map.base = txn->map[sh->logical].base;
+		ent->map.ovl = sh->phys;
+		ent->map.mask = txn->map[sh->logical].mask | sh->written;
+		// overlay with all pages is the sector now
+		if (ent->map.mask == full) {
+			ent->map.base = sh->phys;
+			ent->map.ovl = W25Q_TXN_NONE;
+			ent->map.mask = 0;
+		}
+	}
+	u32_t len = (u8_t*) ent - page;
+	u32_t crc = W25Q_CalcCRC(0, page, len);
+	memcpy(page + len, &crc, 4);
+
+	// the only write that makes transaction visible
+	state = W25Q_ProgramRaw(dev, page, len + 4, jrn_addr(txn, txn->half, txn->jrnPage));
+	txn->jrnPage++;
+	if (state != W25Q_OK)
+		return state;
+
+	txn->seq++;
+	ent = (txn_ent*) (rec + 1);
+	for (u8_t i = 0; i < txn->count; i++, ent++) {
+		W25Q_TXN_MAP *m = &txn->map[ent->logical];
+		if (m->base != ent->map.base)
+			txn_mark(txn, m->base, 0);
+		if (m->ovl != W25Q_TXN_NONE && m->ovl != ent->map.ovl && m->ovl != ent->map.base)
+			txn_mark(txn, m->ovl, 0);
+		*m = ent->map;
+	}
+	txn->count = 0;
+	txn->open = 0;
+	return W25Q_OK;
+}
+
+/**
+ * @brief W25Q Transaction abort
+ * Own new sectors are freed (erased on next use), pages programmed
+ * to overlays stay out of their masks
+ *
+ * @param[in] txn Area state
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE W25Q_TxnAbort(W25Q_TXN *txn) {
+	if (!txn->open)
+		return W25Q_PARAM_ERR;
+	for (u8_t i = 0; i < txn->count; i++)
+		if (txn->shadow[i].phys != txn->map[txn->shadow[i].logical].ovl)
+			txn_mark(txn, txn->shadow[i].phys, 0);
+	txn->count = 0;
+	txn->open = 0;
+	return W25Q_OK;
+}
+
+/**
+ * @addtogroup W25Q_TxnPriv
+ * @{
+ */
+
+/**
+ * @brief Physical data sector address
+ *
+ * @param[in] txn Area state
+ * @param[in] phys Physical sector of area
+ * @return Byte address in chip
+ */
+u32_t sect_addr(W25Q_TXN *txn, u16_t phys) {
+	return (txn->cfg.base + 2U * txn->cfg.jrnSectors + phys) * txn->dev->sectorSize;
+}
+
+/**
+ * @brief Journal page address
+ *
+ * @param[in] txn Area state
+ * @param[in] half Journal half
+ * @param[in] page Page of half
+ * @return Byte address in chip
+ */
+u32_t jrn_addr(W25Q_TXN *txn, u8_t half, u32_t page) {
+	return (txn->cfg.base + half * txn->cfg.jrnSectors) * txn->dev->sectorSize
+			+ page * txn->dev->pageSize;
+}
+
+/**
+ * @brief Pages of map
+ *
+ * @param[in] txn Area state
+ * @return Pages taken by map in journal half
+ */
+u32_t map_pages(W25Q_TXN *txn) {
+	return (txn->cfg.logical * sizeof(W25Q_TXN_MAP) + txn->dev->pageSize - 1) / txn->dev->pageSize;
+}
+
+/**
+ * @brief Pages of journal half
+ *
+ * @param[in] txn Area state
+ * @return Pages count
+ */
+u32_t jrn_pages(W25Q_TXN *txn) {
+	return txn->cfg.jrnSectors * txn->dev->sectorSize / txn->dev->pageSize;
+}
+
+/**
+ * @brief Load journal half
+ * Check header, read map, apply records after it
+ *
+ * @param[in,out] txn Area state
+ * @param[in] half Journal half
+ * @return W25Q_STATE enum (W25Q_CHIP_ERR - half isn't valid)
+ */
+W25Q_STATE load_half(W25Q_TXN *txn, u8_t half) {
+	W25Q_Device *dev = txn->dev;
+	txn_hdr hdr;
+	W25Q_STATE state = W25Q_ReadRaw(dev, (u8_t*) &hdr, sizeof(hdr), jrn_addr(txn, half, 0));
+	if (state != W25Q_OK)
+		return state;
+	if (hdr.magic != W25Q_TXN_MAGIC || hdr.crc != W25Q_CalcCRC(0, &hdr, sizeof(hdr) - 4)
+			|| hdr.logical != txn->cfg.logical || hdr.spare != txn->cfg.spare)
+		return W25Q_CHIP_ERR;
+
+	u32_t mapLen = txn->cfg.logical * sizeof(W25Q_TXN_MAP);
+	state = W25Q_ReadBulk(dev, (u8_t*) txn->map, mapLen, jrn_addr(txn, half, 1));
+	if (state != W25Q_OK)
+		return state;
+	if (W25Q_CalcCRC(0, txn->map, mapLen) != hdr.mapCrc)
+		return W25Q_CHIP_ERR;
+	txn->seq = hdr.seq;
+	txn->half = half;
+
+	// records up to first erased page, torn ones fail CRC
+	u16_t total = txn->cfg.logical + txn->cfg.spare;
+	u8_t *page = txn->buf[0];
+	u32_t p = 1 + map_pages(txn);
+	for (; p < jrn_pages(txn); p++) {
+		state = W25Q_ReadRaw(dev, page, TXN_REC_LEN, jrn_addr(txn, half, p));
+		if (state != W25Q_OK)
+			return state;
+		txn_rec *rec = (txn_rec*) page;
+		if (rec->magic == 0xFFFFFFFFU)
+			break;
+		u32_t len = sizeof(txn_rec) + rec->count * sizeof(txn_ent);
+		u32_t crc;
+		if (rec->magic != W25Q_TXN_REC || rec->count > W25Q_TXN_MAX || rec->seq <= txn->seq)
+			continue;
+		memcpy(&crc, page + len, 4);
+		if (crc != W25Q_CalcCRC(0, page, len))
+			continue;
+		txn_ent *ent = (txn_ent*) (rec + 1);
+		for (u16_t i = 0; i < rec->count; i++, ent++)
+			if (ent->logical < txn->cfg.logical)
+				txn->map[ent->logical] = ent->map;
+		txn->seq = rec->seq;
+	}
+	txn->jrnPage = p;
+
+	memset(txn->used, 0, sizeof(txn->used));
+	for (u16_t i = 0; i < txn->cfg.logical; i++) {
+		W25Q_TXN_MAP *m = &txn->map[i];
+		if (m->base >= total || txn_used(txn, m->base))
+			return W25Q_CHIP_ERR;
+		txn_mark(txn, m->base, 1);
+		if (m->ovl == W25Q_TXN_NONE)
+			continue;
+		if (m->ovl >= total || txn_used(txn, m->ovl))
+			return W25Q_CHIP_ERR;
+		txn_mark(txn, m->ovl, 1);
+	}
+	return W25Q_OK;
+}
+
+/**
+ * @brief Write journal base
+ * Erase half, program map, then header
+ *
+ * @param[in] txn Area state
+ * @param[in] half Journal half
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE write_base(W25Q_TXN *txn, u8_t half) {
+	W25Q_Device *dev = txn->dev;
+	W25Q_STATE state = W25Q_OK;
+	u32_t first = txn->cfg.base + half * txn->cfg.jrnSectors;
+	for (u16_t i = 0; i < txn->cfg.jrnSectors && state == W25Q_OK; i++)
+		state = W25Q_EraseSector(dev, first + i);
+
+	u32_t mapLen = txn->cfg.logical * sizeof(W25Q_TXN_MAP);
+	if (state == W25Q_OK)
+		state = W25Q_ProgramBulk(dev, (u8_t*) txn->map, mapLen, jrn_addr(txn, half, 1), 0);
+	if (state != W25Q_OK)
+		return state;
+
+	txn_hdr hdr = { W25Q_TXN_MAGIC, txn->seq, txn->cfg.logical, txn->cfg.spare,
+			W25Q_CalcCRC(0, txn->map, mapLen), 0 };
+	hdr.crc = W25Q_CalcCRC(0, &hdr, sizeof(hdr) - 4);
+	return W25Q_ProgramRaw(dev, (u8_t*) &hdr, sizeof(hdr), jrn_addr(txn, half, 0));
+}
+
+/**
+ * @brief Compaction
+ * Fold overlays of sectors not written by open transaction,
+ * then write map to other journal half with next sequence
+ *
+ * @note Folded sectors' old bases are freed only after new header:
+ * old half points to them till then
+ * @param[in,out] txn Area state
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE compact(W25Q_TXN *txn) {
+	u8_t freed[sizeof(txn->used)] = { 0 };
+	W25Q_STATE state = W25Q_OK;
+	for (u16_t i = 0; i < txn->cfg.logical && state == W25Q_OK; i++)
+		if (txn->map[i].ovl != W25Q_TXN_NONE && !find_shadow(txn, i))
+			state = fold(txn, i, freed);
+	if (state != W25Q_OK)
+		return state;
+
+	// newer header wins at mount even without records after it
+	txn->seq++;
+	state = write_base(txn, txn->half ^ 1);
+	if (state != W25Q_OK)
+		return state;
+	txn->half ^= 1;
+	txn->jrnPage = 1 + map_pages(txn);
+	for (u16_t i = 0; i < sizeof(freed); i++)
+		txn->used[i] &= ~freed[i];
+	return W25Q_OK;
+}
+
+/**
+ * @brief Fold overlay
+ * Copy base pages to free pages of overlay, it becomes the base.
+ * Overlay with torn pages is folded to new sector with all pages
+ *
+ * @param[in,out] txn Area state
+ * @param[in] logical Logical sector
+ * @param[in,out] freed Sectors to free after compaction (bit mask)
+ * @return W25Q_STATE enum (W25Q_OK - also when there's no sector to fold to)
+ */
+W25Q_STATE fold(W25Q_TXN *txn, u16_t logical, u8_t *freed) {
+	W25Q_TXN_MAP *m = &txn->map[logical];
+	u8_t pages = txn->dev->sectorSize / txn->dev->pageSize;
+	W25Q_STATE state = W25Q_OK;
+	bool blank = 1;
+	for (u8_t pi = 0; pi < pages && blank && state == W25Q_OK; pi++)
+		if (!(m->mask & (1UL << pi)))
+			state = page_blank(txn, &blank, m->ovl, pi);
+	if (state != W25Q_OK)
+		return state;
+
+	u16_t to = m->ovl;
+	if (!blank && alloc_sector(txn, &to) != W25Q_OK)
+		return W25Q_OK; // stays overlaid
+	for (u8_t pi = 0; pi < pages && state == W25Q_OK; pi++) {
+		bool in = m->mask & (1UL << pi);
+		if (!in || to != m->ovl)
+			state = copy_page(txn, in ? m->ovl : m->base, to, pi);
+	}
+	if (state != W25Q_OK) {
+		if (to != m->ovl)
+			txn_mark(txn, to, 0);
+		return state;
+	}
+
+	freed[m->base >> 3] |= 1U << (m->base & 7U);
+	if (to != m->ovl)
+		freed[m->ovl >> 3] |= 1U << (m->ovl & 7U);
+	m->base = to;
+	m->ovl = W25Q_TXN_NONE;
+	m->mask = 0;
+	return W25Q_OK;
+}
+
+/**
+ * @brief Allocate sector
+ * Take next free physical sector and erase it if needed
+ *
+ * @param[in,out] txn Area state
+ * @param[out] phys Physical sector
+ * @return W25Q_STATE enum (W25Q_PARAM_ERR - no free sectors)
+ */
+W25Q_STATE alloc_sector(W25Q_TXN *txn, u16_t *phys) {
+	u16_t total = txn->cfg.logical + txn->cfg.spare;
+	for (u16_t i = 0; i < total; i++) {
+		u16_t p = (txn->next + i) % total;
+		if (txn_used(txn, p))
+			continue;
+
+		u32_t sect = txn->cfg.base + 2U * txn->cfg.jrnSectors + p;
+		bool blank = 0;
+		W25Q_STATE state = W25Q_SectorBlankCheck(txn->dev, &blank, sect);
+		if (state == W25Q_OK && !blank)
+			state = W25Q_EraseSector(txn->dev, sect);
+		if (state != W25Q_OK)
+			return state;
+		txn_mark(txn, p, 1);
+		txn->next = (p + 1) % total;
+		*phys = p;
+		return W25Q_OK;
+	}
+	return W25Q_PARAM_ERR;
+}
+
+/**
+ * @brief Take sector
+ * Allocate sector for transaction, last free one is left for
+ * compaction (folding of torn overlay needs it): compact first
+ *
+ * @param[in,out] txn Area state
+ * @param[out] phys Physical sector
+ * @return W25Q_STATE enum (W25Q_PARAM_ERR - no free sectors)
+ */
+W25Q_STATE take_sector(W25Q_TXN *txn, u16_t *phys) {
+	u16_t total = txn->cfg.logical + txn->cfg.spare;
+	for (u8_t pass = 0; pass < 2; pass++) {
+		u16_t free = 0;
+		for (u16_t p = 0; p < total; p++)
+			free += !txn_used(txn, p);
+		if (free > 1U)
+			return alloc_sector(txn, phys);
+		if (pass == 0) {
+			W25Q_STATE state = compact(txn);
+			if (state != W25Q_OK)
+				return state;
+		}
+	}
+	return W25Q_PARAM_ERR;
+}
+
+/**
+ * @brief Find shadow
+ *
+ * @param[in] txn Area state
+ * @param[in] logical Logical sector
+ * @return Shadow or NULL
+ */
+W25Q_TXN_SHADOW* find_shadow(W25Q_TXN *txn, u16_t logical) {
+	for (u8_t i = 0; i < txn->count; i++)
+		if (txn->shadow[i].logical == logical)
+			return &txn->shadow[i];
+	return NULL;
+}
+
+/**
+ * @brief Move shadow
+ * Copy transaction's pages except one to new sector, free the old
+ * one if it's transaction's own (overlay stays)
+ *
+ * @param[in,out] txn Area state
+ * @param[in,out] sh Shadow
+ * @param[in] skip Page to be rewritten by caller
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE reshadow(W25Q_TXN *txn, W25Q_TXN_SHADOW *sh, u8_t skip) {
+	W25Q_Device *dev = txn->dev;
+	u16_t phys;
+	W25Q_STATE state = take_sector(txn, &phys);
+	if (state != W25Q_OK)
+		return state;
+	u8_t pages = dev->sectorSize / dev->pageSize;
+	for (u8_t pi = 0; pi < pages && state == W25Q_OK; pi++)
+		if (pi != skip && (sh->written & (1UL << pi)))
+			state = copy_page(txn, sh->phys, phys, pi);
+	if (state != W25Q_OK) {
+		txn_mark(txn, phys, 0);
+		return state;
+	}
+	if (sh->phys != txn->map[sh->logical].ovl)
+		txn_mark(txn, sh->phys, 0);
+	sh->phys = phys;
+	return W25Q_OK;
+}
+
+/**
+ * @brief Copy page
+ * Erased page isn't programmed
+ *
+ * @param[in] txn Area state
+ * @param[in] from Source physical sector
+ * @param[in] to Destination physical sector (page is erased)
+ * @param[in] pi Page of sector
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE copy_page(W25Q_TXN *txn, u16_t from, u16_t to, u8_t pi) {
+	W25Q_Device *dev = txn->dev;
+	u32_t off = pi * dev->pageSize;
+	W25Q_STATE state = W25Q_ReadBulk(dev, txn->buf[1], dev->pageSize, sect_addr(txn, from) + off);
+	if (state == W25Q_OK && !W25Q_IsErased(txn->buf[1], dev->pageSize))
+		state = W25Q_ProgramRaw(dev, txn->buf[1], dev->pageSize, sect_addr(txn, to) + off);
+	return state;
+}
+
+/**
+ * @brief Page blank check
+ *
+ * @param[in] txn Area state
+ * @param[out] blank 1-page is erased
+ * @param[in] phys Physical sector
+ * @param[in] pi Page of sector
+ * @return W25Q_STATE enum
+ */
+W25Q_STATE page_blank(W25Q_TXN *txn, bool *blank, u16_t phys, u8_t pi) {
+	W25Q_Device *dev = txn->dev;
+	W25Q_STATE state = W25Q_ReadBulk(dev, txn->buf[1], dev->pageSize,
+			sect_addr(txn, phys) + pi * dev->pageSize);
+	*blank = state == W25Q_OK && W25Q_IsErased(txn->buf[1], dev->pageSize);
+	return state;
+}
+
+/// @}
+
+/// @}
+
+/// @}
@@ -0,0 +1,125 @@
+/**
+ *******************************************
+ * @file    w25q_txn.h
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Power-fail-safe transactions for W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Area of chip is split to journal (2 halves) and data sectors.
+ * Logical sector is base physical sector plus overlay sector holding
+ * its pages of a mask. Transaction programs new pages to free pages of
+ * the overlay (or to a new one), then one page program of journal
+ * record with new mask makes them visible. Torn record fails CRC,
+ * so mount sees old data. Journal compaction folds overlays to bases
+ */
+
+#ifndef W25Q_QSPI_W25Q_TXN_H_
+#define W25Q_QSPI_W25Q_TXN_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "w25q_mem.h"
+
+/**
+ * @addtogroup W25Q_Driver
+ * @{
+ */
+
+/**
+ * @defgroup W25Q_Txn W25Q Transactions
+ * @brief Atomic multi-page writes with journal and shadow sectors
+ * @{
+ */
+
+#ifndef W25Q_TXN_SECTORS
+/// Max physical data sectors of area (logical + spare), 8 bytes of RAM each
+#define W25Q_TXN_SECTORS 64U
+#endif
+#ifndef W25Q_TXN_MAX
+/// Max sectors written by one transaction (8 bytes of RAM each)
+#define W25Q_TXN_MAX 8U
+#endif
+
+#define W25Q_TXN_MAGIC 0x4E585457U	///< Journal header magic ("WTXN")
+#define W25Q_TXN_REC 0x43525457U	///< Commit record magic ("WTRC")
+#define W25Q_TXN_PAGE (MEM_PAGE_SIZE * 2U) ///< Page buffer size (dual-flash page)
+#define W25Q_TXN_NONE 0xFFFFU		///< No overlay sector
+
+/**
+ * @struct W25Q_TXN_CFG
+ * @brief  W25Q Transaction area
+ * Sectors from base: journal (2 * jrnSectors), then logical + spare
+ * @{
+ */
+typedef struct{
+	u32_t base;			///< First sector of area
+	u16_t logical;		///< Logical sectors (seen by user)
+	u16_t spare;		///< Spare sectors for overlays (>= 2, more - less folding)
+	u16_t jrnSectors;	///< Sectors of one journal half
+}W25Q_TXN_CFG;
+/** @} */
+
+/**
+ * @struct W25Q_TXN_MAP
+ * @brief  W25Q Physical pages of logical sector
+ * @{
+ */
+typedef struct{
+	u16_t base;			///< Physical sector of pages out of mask
+	u16_t ovl;			///< Overlay physical sector (W25Q_TXN_NONE - none)
+	u32_t mask;			///< Pages in overlay (bit mask)
+}W25Q_TXN_MAP;
+/** @} */
+
+/**
+ * @struct W25Q_TXN_SHADOW
+ * @brief  W25Q Sector written by transaction
+ * @{
+ */
+typedef struct{
+	u16_t logical;		///< Logical sector
+	u16_t phys;			///< Sector of new pages: overlay or own new one
+	u32_t written;		///< Pages written by transaction (bit mask)
+}W25Q_TXN_SHADOW;
+/** @} */
+
+/**
+ * @struct W25Q_TXN
+ * @brief  W25Q Transaction area state
+ * @{
+ */
+typedef struct{
+	W25Q_Device *dev;			///< Device
+	W25Q_TXN_CFG cfg;			///< Area
+	W25Q_TXN_MAP map[W25Q_TXN_SECTORS];	///< Logical to physical sectors
+	u8_t used[(W25Q_TXN_SECTORS + 7U) / 8U]; ///< Physical sector holds data (bit mask)
+	u32_t seq;					///< Last committed sequence
+	u8_t half;					///< Active journal half
+	u32_t jrnPage;				///< Next record page in active half
+	u16_t next;					///< Next physical sector to allocate (wear spreading)
+	bool open;					///< Transaction in progress
+	u8_t count;					///< Shadows of transaction
+	W25Q_TXN_SHADOW shadow[W25Q_TXN_MAX]; ///< Sectors written by transaction
+	u8_t buf[2][W25Q_TXN_PAGE] __ALIGNED(32); ///< Page buffers
+}W25Q_TXN;
+/** @} */
+
+W25Q_STATE W25Q_TxnMount(W25Q_TXN *txn, W25Q_Device *dev, const W25Q_TXN_CFG *cfg, bool format); ///< Recover area state from journal
+W25Q_STATE W25Q_TxnBegin(W25Q_TXN *txn);	///< Start transaction
+W25Q_STATE W25Q_TxnWrite(W25Q_TXN *txn, u32_t addr, const u8_t *buf, u32_t len); ///< Write extent to transaction
+W25Q_STATE W25Q_TxnRead(W25Q_TXN *txn, u32_t addr, u8_t *buf, u32_t len);	///< Read area (sees own transaction)
+W25Q_STATE W25Q_TxnCommit(W25Q_TXN *txn);	///< Make transaction's writes durable at once
+W25Q_STATE W25Q_TxnAbort(W25Q_TXN *txn);	///< Drop transaction's writes
+
+/// @}
+
+/// @}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* W25Q_QSPI_W25Q_TXN_H_ */
@@ -0,0 +1,151 @@
+/**
+ *******************************************
+ * @file    bench_lfs.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Host benchmark of littlefs on W25Qxxx lib (w25q_lfs.c)
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note littlefs with sector blocks on the RAM chip model: virtual time,
+ * erase commands and skipped erases of file create, append, read and
+ * dir scan. Appends run twice more after half of files are removed:
+ * as is and after W25Q_LfsPreErase (free areas by block commands).
+ * Needs littlefs sources: make bench_lfs LFS=path/to/littlefs
+ */
+
+#include <string.h>
+#include "test.h"
+#include "w25q_lfs.h"
+
+#define BENCH_BLOCKS 256U	///< littlefs blocks (1 MB of sectors)
+#define BENCH_FILES 16U		///< Files in dir
+#define BENCH_APPENDS 32U	///< Appends per file
+#define BENCH_CHUNK 200U	///< Append size, bytes
+
+static W25Q_LFS wl;
+static struct lfs_config cfg;
+static lfs_t lfs;
+static u8_t map[(BENCH_BLOCKS + 7U) / 8U];
+static u8_t chunk[BENCH_CHUNK];
+static uint64_t phaseStart;
+static u32_t phaseErases, phaseSkipped, phaseCommands;
+
+/**
+ * @brief Phase start
+ */
+static void phase_start(void) {
+	phaseStart = W25Q_SimTime();
+	phaseErases = wl.erases;
+	phaseSkipped = wl.erasesSkipped;
+	phaseCommands = sim.commands;
+}
+
+/**
+ * @brief Phase end
+ * Print virtual time and erases of the phase
+ *
+ * @param[in] name Phase name
+ */
+static void phase_end(const char *name) {
+	printf("%-16s %10.1f ms %6u erases %6u skipped %8u commands\n", name,
+			(W25Q_SimTime() - phaseStart) / 1e6, wl.erases - phaseErases,
+			wl.erasesSkipped - phaseSkipped, sim.commands - phaseCommands);
+}
+
+/**
+ * @brief File name
+ *
+ * @param[out] path Name buffer
+ * @param[in] i File number
+ */
+static void file_name(char *path, u32_t i) {
+	sprintf(path, "/log/f%02u", i);
+}
+
+/**
+ * @brief Append to files
+ * Every file gets BENCH_APPENDS chunks, synced after every chunk
+ *
+ * @param[in] step File number step (1 - all, 2 - even ones)
+ */
+static void append(u32_t step) {
+	char path[16];
+	lfs_file_t file;
+	for (u32_t n = 0; n < BENCH_APPENDS; n++)
+		for (u32_t i = 0; i < BENCH_FILES; i += step) {
+			file_name(path, i);
+			memset(chunk, (int) (i + n), sizeof(chunk));
+			CHECK(lfs_file_open(&lfs, &file, path, LFS_O_WRONLY | LFS_O_APPEND) == 0);
+			CHECK(lfs_file_write(&lfs, &file, chunk, sizeof(chunk)) == (lfs_ssize_t) sizeof(chunk));
+			CHECK(lfs_file_close(&lfs, &file) == 0);
+		}
+}
+
+int main(void) {
+	char path[16];
+	lfs_file_t file;
+	lfs_dir_t dir;
+	struct lfs_info info;
+	test_start();
+	CHECK(W25Q_LfsConfig(&wl, &cfg, &flash, 0, BENCH_BLOCKS, 0) == W25Q_OK);
+
+	phase_start();
+	CHECK(W25Q_LfsWipe(&wl, BENCH_BLOCKS) == W25Q_OK);
+	CHECK(lfs_format(&lfs, &cfg) == 0 && lfs_mount(&lfs, &cfg) == 0);
+	phase_end("wipe + format");
+
+	phase_start();
+	CHECK(lfs_mkdir(&lfs, "/log") == 0);
+	for (u32_t i = 0; i < BENCH_FILES; i++) {
+		file_name(path, i);
+		CHECK(lfs_file_open(&lfs, &file, path, LFS_O_WRONLY | LFS_O_CREAT) == 0);
+		CHECK(lfs_file_close(&lfs, &file) == 0);
+	}
+	phase_end("create");
+
+	phase_start();
+	append(1);
+	phase_end("append");
+
+	phase_start();
+	for (u32_t i = 0; i < BENCH_FILES; i++) {
+		file_name(path, i);
+		CHECK(lfs_file_open(&lfs, &file, path, LFS_O_RDONLY) == 0);
+		for (u32_t n = 0; n < BENCH_APPENDS; n++) {
+			CHECK(lfs_file_read(&lfs, &file, chunk, sizeof(chunk)) == (lfs_ssize_t) sizeof(chunk));
+			CHECK(chunk[0] == (u8_t) (i + n) && chunk[BENCH_CHUNK - 1] == (u8_t) (i + n));
+		}
+		CHECK(lfs_file_close(&lfs, &file) == 0);
+	}
+	phase_end("read");
+
+	phase_start();
+	u32_t entries = 0;
+	CHECK(lfs_dir_open(&lfs, &dir, "/log") == 0);
+	while (lfs_dir_read(&lfs, &dir, &info) > 0)
+		entries++;
+	CHECK(lfs_dir_close(&lfs, &dir) == 0);
+	CHECK(entries == BENCH_FILES + 2U); // with . and ..
+	phase_end("dir scan");
+
+	// free half of the area, then append to the rest twice
+	for (u32_t i = 1; i < BENCH_FILES; i += 2) {
+		file_name(path, i);
+		CHECK(lfs_remove(&lfs, path) == 0);
+	}
+	phase_start();
+	append(2);
+	phase_end("append again");
+
+	phase_start();
+	CHECK(W25Q_LfsPreErase(&wl, &lfs, map) == W25Q_OK);
+	phase_end("pre-erase");
+	printf("pre-erase: %u blocks by block commands\n", wl.erasesBatched);
+	phase_start();
+	append(2);
+	phase_end("append erased");
+
+	CHECK(lfs_unmount(&lfs) == 0);
+	test_end();
+	return 0;
+}
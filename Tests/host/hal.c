@@ -0,0 +1,107 @@
+/**
+ *******************************************
+ * @file    hal.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Host build's HAL for W25Qxxx lib tests
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note HAL_Delay, HAL_GetTick and DWT run on virtual clock of
+ * w25q_sim.c, so bare-metal OS port sleeps and waits with it.
+ * QUADSPI functions fail: devices are W25Q_DEVICE_SIM
+ */
+
+#include "w25q_sim.h"
+
+/**
+ * @addtogroup W25Q_Host
+ * @{
+ */
+
+#define HOST_CORE_HZ 1000000000U	///< Core clock of host: cycle is 1 ns
+#define HOST_CYCLE_READ_NS 10U		///< Virtual time of one cycle counter read
+
+uint32_t SystemCoreClock = HOST_CORE_HZ;	///< Core clock
+CoreDebug_Type host_core_debug;			///< CoreDebug registers
+static DWT_Type host_dwt_regs;			///< DWT registers
+
+/**
+ * @brief DWT registers
+ * Cycle counter of virtual clock. Every read takes a little time,
+ * so busy-waits by cycle counter end
+ *
+ * @return DWT registers
+ */
+DWT_Type *host_dwt(void) {
+	W25Q_SimAdvance(HOST_CYCLE_READ_NS);
+	host_dwt_regs.CYCCNT = (uint32_t) W25Q_SimTime();
+	return &host_dwt_regs;
+}
+
+/**
+ * @brief Delay
+ *
+ * @param[in] Delay Time in ms
+ */
+void HAL_Delay(uint32_t Delay) {
+	while (Delay--)
+		W25Q_SimAdvance(1000000U);
+}
+
+/**
+ * @brief Tick
+ *
+ * @return Milliseconds of virtual clock
+ */
+uint32_t HAL_GetTick(void) {
+	W25Q_SimAdvance(HOST_CYCLE_READ_NS);
+	return (uint32_t) (W25Q_SimTime() / 1000000U);
+}
+
+/// No QUADSPI on host
+HAL_StatusTypeDef HAL_QSPI_Init(QSPI_HandleTypeDef *hqspi) {
+	return HAL_ERROR;
+}
+
+/// No QUADSPI on host
+HAL_StatusTypeDef HAL_QSPI_Command(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, uint32_t Timeout) {
+	return HAL_ERROR;
+}
+
+/// No QUADSPI on host
+HAL_StatusTypeDef HAL_QSPI_Transmit(QSPI_HandleTypeDef *hqspi, uint8_t *pData, uint32_t Timeout) {
+	return HAL_ERROR;
+}
+
+/// No QUADSPI on host
+HAL_StatusTypeDef HAL_QSPI_Receive(QSPI_HandleTypeDef *hqspi, uint8_t *pData, uint32_t Timeout) {
+	return HAL_ERROR;
+}
+
+/// No QUADSPI on host
+HAL_StatusTypeDef HAL_QSPI_Transmit_DMA(QSPI_HandleTypeDef *hqspi, uint8_t *pData) {
+	return HAL_ERROR;
+}
+
+/// No QUADSPI on host
+HAL_StatusTypeDef HAL_QSPI_Receive_DMA(QSPI_HandleTypeDef *hqspi, uint8_t *pData) {
+	return HAL_ERROR;
+}
+
+/// No QUADSPI on host
+HAL_StatusTypeDef HAL_QSPI_AutoPolling_IT(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd,
+		QSPI_AutoPollingTypeDef *cfg) {
+	return HAL_ERROR;
+}
+
+/// No QUADSPI on host
+HAL_StatusTypeDef HAL_QSPI_Abort(QSPI_HandleTypeDef *hqspi) {
+	return HAL_ERROR;
+}
+
+/// No QUADSPI on host
+HAL_QSPI_StateTypeDef HAL_QSPI_GetState(QSPI_HandleTypeDef *hqspi) {
+	return HAL_QSPI_STATE_ERROR;
+}
+
+/// @}
@@ -0,0 +1,165 @@
+/**
+ *******************************************
+ * @file    main.h
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Host build's part of STM32 HAL and CMSIS used by W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Types and constants of QUADSPI HAL for command descriptors,
+ * CMSIS intrinsics and DWT cycle counter running on virtual clock of
+ * w25q_sim.c (hal.c). QUADSPI transport is linked, but chip is
+ * the model: W25Q_DEVICE_SIM
+ */
+
+#ifndef W25Q_HOST_MAIN_H_
+#define W25Q_HOST_MAIN_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+/**
+ * @defgroup W25Q_Host Host HAL
+ * @brief HAL subset for host tests
+ * @{
+ */
+
+typedef enum {
+	HAL_OK = 0x00U,
+	HAL_ERROR = 0x01U,
+	HAL_BUSY = 0x02U,
+	HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+typedef enum {
+	HAL_QSPI_STATE_RESET = 0x00U,
+	HAL_QSPI_STATE_READY = 0x01U,
+	HAL_QSPI_STATE_BUSY = 0x02U,
+	HAL_QSPI_STATE_ERROR = 0x08U
+} HAL_QSPI_StateTypeDef;
+
+typedef struct {
+	uint32_t ClockPrescaler;
+	uint32_t FifoThreshold;
+	uint32_t SampleShifting;
+	uint32_t FlashSize;
+	uint32_t ChipSelectHighTime;
+	uint32_t ClockMode;
+	uint32_t FlashID;
+	uint32_t DualFlash;
+} QSPI_InitTypeDef;
+
+typedef struct {
+	void *Instance;
+	QSPI_InitTypeDef Init;
+	volatile HAL_QSPI_StateTypeDef State;
+	volatile uint32_t ErrorCode;
+} QSPI_HandleTypeDef;
+
+typedef struct {
+	uint32_t Instruction;
+	uint32_t Address;
+	uint32_t AlternateBytes;
+	uint32_t AddressSize;
+	uint32_t AlternateBytesSize;
+	uint32_t DummyCycles;
+	uint32_t InstructionMode;
+	uint32_t AddressMode;
+	uint32_t AlternateByteMode;
+	uint32_t DataMode;
+	uint32_t NbData;
+	uint32_t DdrMode;
+	uint32_t DdrHoldHalfCycle;
+	uint32_t SIOOMode;
+} QSPI_CommandTypeDef;
+
+typedef struct {
+	uint32_t Match;
+	uint32_t Mask;
+	uint32_t Interval;
+	uint32_t StatusBytesSize;
+	uint32_t MatchMode;
+	uint32_t AutomaticStop;
+} QSPI_AutoPollingTypeDef;
+
+#define HAL_QSPI_MODULE_ENABLED
+#define HAL_QSPI_TIMEOUT_DEFAULT_VALUE 5000U
+#define HAL_QSPI_ERROR_NONE 0x00U
+
+#define QSPI_INSTRUCTION_NONE 0x00U
+#define QSPI_INSTRUCTION_1_LINE 0x01U
+#define QSPI_INSTRUCTION_2_LINES 0x02U
+#define QSPI_INSTRUCTION_4_LINES 0x03U
+#define QSPI_ADDRESS_NONE 0x00U
+#define QSPI_ADDRESS_1_LINE 0x01U
+#define QSPI_ADDRESS_2_LINES 0x02U
+#define QSPI_ADDRESS_4_LINES 0x03U
+#define QSPI_ADDRESS_8_BITS 0x00U
+#define QSPI_ADDRESS_16_BITS 0x01U
+#define QSPI_ADDRESS_24_BITS 0x02U
+#define QSPI_ADDRESS_32_BITS 0x03U
+#define QSPI_ALTERNATE_BYTES_NONE 0x00U
+#define QSPI_ALTERNATE_BYTES_1_LINE 0x01U
+#define QSPI_ALTERNATE_BYTES_2_LINES 0x02U
+#define QSPI_ALTERNATE_BYTES_4_LINES 0x03U
+#define QSPI_ALTERNATE_BYTES_8_BITS 0x00U
+#define QSPI_DATA_NONE 0x00U
+#define QSPI_DATA_1_LINE 0x01U
+#define QSPI_DATA_2_LINES 0x02U
+#define QSPI_DATA_4_LINES 0x03U
+#define QSPI_DDR_MODE_DISABLE 0x00U
+#define QSPI_DDR_HHC_ANALOG_DELAY 0x00U
+#define QSPI_SIOO_INST_EVERY_CMD 0x00U
+#define QSPI_MATCH_MODE_AND 0x00U
+#define QSPI_AUTOMATIC_STOP_ENABLE 0x01U
+#define QSPI_SAMPLE_SHIFTING_NONE 0x00U
+#define QSPI_SAMPLE_SHIFTING_HALFCYCLE 0x01U
+
+HAL_StatusTypeDef HAL_QSPI_Init(QSPI_HandleTypeDef *hqspi);
+HAL_StatusTypeDef HAL_QSPI_Command(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_Transmit(QSPI_HandleTypeDef *hqspi, uint8_t *pData, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_Receive(QSPI_HandleTypeDef *hqspi, uint8_t *pData, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_Transmit_DMA(QSPI_HandleTypeDef *hqspi, uint8_t *pData);
+HAL_StatusTypeDef HAL_QSPI_Receive_DMA(QSPI_HandleTypeDef *hqspi, uint8_t *pData);
+HAL_StatusTypeDef HAL_QSPI_AutoPolling_IT(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd,
+		QSPI_AutoPollingTypeDef *cfg);
+HAL_StatusTypeDef HAL_QSPI_Abort(QSPI_HandleTypeDef *hqspi);
+HAL_QSPI_StateTypeDef HAL_QSPI_GetState(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_StatusMatchCallback(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_RxCpltCallback(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_TxCpltCallback(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_ErrorCallback(QSPI_HandleTypeDef *hqspi);
+
+void HAL_Delay(uint32_t Delay);	///< Advances virtual clock
+uint32_t HAL_GetTick(void);		///< Virtual clock, ms
+
+/// DWT registers used by cycle counter
+typedef struct {
+	volatile uint32_t CTRL;
+	volatile uint32_t CYCCNT;
+} DWT_Type;
+
+/// CoreDebug registers used by cycle counter
+typedef struct {
+	volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+DWT_Type *host_dwt(void);	///< DWT with CYCCNT of virtual clock
+extern CoreDebug_Type host_core_debug;
+extern uint32_t SystemCoreClock;
+
+#define DWT (host_dwt())
+#define CoreDebug (&host_core_debug)
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+
+#define __ALIGNED(x) __attribute__((aligned(x)))
+#define __NOP() do {} while (0)
+static inline uint32_t __REV(uint32_t x) { return __builtin_bswap32(x); }
+static inline uint32_t __REV16(uint32_t x) { return ((x & 0x00FF00FFU) << 8) | ((x >> 8) & 0x00FF00FFU); }
+static inline uint32_t __CLZ(uint32_t x) { return x ? (uint32_t) __builtin_clz(x) : 32U; }
+
+/// @}
+
+#endif /* W25Q_HOST_MAIN_H_ */
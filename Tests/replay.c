@@ -0,0 +1,139 @@
+/**
+ *******************************************
+ * @file    replay.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Host replay of recorded W25Qxxx API calls
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Runs calls of `w25q_trace.py calls` (field trace) through the
+ * driver on the RAM chip model and prints virtual time of every call
+ * kind, so driver changes are compared on the same workload.
+ * Idle gaps between recorded calls are kept. Optional second argument
+ * is the trace of the replay for `w25q_trace.py summary`:
+ *
+ *     ./replay calls.txt [trace.bin]
+ */
+
+#include <string.h>
+#include "test.h"
+
+#define REPLAY_KINDS 4U		///< read, urgent, program, erase
+
+static const char *const kinds[REPLAY_KINDS] = { "read", "urgent", "program", "erase" };
+static u8_t buf[0x8000];
+static W25Q_TRACE_REC recs[64];
+
+/**
+ * @brief Run call
+ *
+ * @param[in] kind Index in kinds
+ * @param[in] addr Start address
+ * @param[in] len Length (erase: 4096/32768/65536, 0 - chip)
+ * @return W25Q_STATE enum
+ */
+static W25Q_STATE run(u32_t kind, u32_t addr, u32_t len) {
+	W25Q_STATE state = W25Q_OK;
+	switch (kind) {
+	case 0:
+	case 1:
+		for (u32_t done = 0; state == W25Q_OK && done < len; ) {
+			u32_t part = len - done < sizeof(buf) ? len - done : sizeof(buf);
+			state = kind ? W25Q_ReadUrgent(&flash, buf, part, addr + done, 0)
+					: W25Q_ReadBulk(&flash, buf, part, addr + done);
+			done += part;
+		}
+		break;
+	case 2:
+		memset(buf, 0, len);
+		state = W25Q_ProgramRaw(&flash, buf, len, addr);
+		break;
+	default:
+		if (len == 0)
+			state = W25Q_EraseChip(&flash);
+		else if (len == 4096U)
+			state = W25Q_EraseSector(&flash, addr / len);
+		else
+			state = W25Q_EraseBlock(&flash, addr / len, len == 32768U ? 32 : 64);
+	}
+	return state;
+}
+
+/**
+ * @brief Save trace
+ * Move trace ring to the file
+ *
+ * @param[in] out Trace file (NULL - drop)
+ */
+static void save(FILE *out) {
+	u32_t count;
+	do {
+		CHECK(W25Q_TraceRead(&flash, recs, 64, &count) == W25Q_OK);
+		if (out)
+			fwrite(recs, sizeof(recs[0]), count, out);
+	} while (count);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		printf("usage: %s calls.txt [trace.bin]\n", argv[0]);
+		return 1;
+	}
+	FILE *in = fopen(argv[1], "r");
+	CHECK(in);
+	FILE *out = NULL;
+	W25Q_TRACE_HDR hdr;
+	if (argc > 2) {
+		out = fopen(argv[2], "wb");
+		CHECK(out);
+		fwrite(&hdr, sizeof(hdr), 1, out); // written again at the end
+	}
+
+	test_start();
+	save(NULL);
+	u32_t count[REPLAY_KINDS] = { 0 }, errors = 0, commands = sim.commands;
+	uint64_t ns[REPLAY_KINDS] = { 0 }, max[REPLAY_KINDS] = { 0 };
+	uint64_t start = W25Q_SimTime();
+	char line[128], name[16];
+	u32_t addr, len;
+	double at;
+	while (fgets(line, sizeof(line), in)) {
+		if (sscanf(line, "%15s %x %u %lf", name, &addr, &len, &at) != 4)
+			continue;
+		u32_t k = 0;
+		while (k < REPLAY_KINDS && strcmp(name, kinds[k]))
+			k++;
+		if (k == REPLAY_KINDS || addr >= sim.size)
+			continue;
+		// keep field's idle gaps: background end of erase, power-down
+		uint64_t due = start + (uint64_t) (at * 1000.0);
+		if (W25Q_SimTime() < due)
+			W25Q_SimAdvance(due - W25Q_SimTime());
+
+		uint64_t t = W25Q_SimTime();
+		errors += run(k, addr, len) != W25Q_OK;
+		t = W25Q_SimTime() - t;
+		count[k]++;
+		ns[k] += t;
+		if (t > max[k])
+			max[k] = t;
+		save(out);
+	}
+	fclose(in);
+
+	printf("%-8s %8s %12s %10s %10s\n", "call", "count", "total us", "avg us", "max us");
+	for (u32_t k = 0; k < REPLAY_KINDS; k++)
+		if (count[k])
+			printf("%-8s %8u %12.1f %10.1f %10.1f\n", kinds[k], count[k], ns[k] / 1000.0,
+					ns[k] / 1000.0 / count[k], max[k] / 1000.0);
+	printf("span %.1f us, %u commands, %u errors\n",
+			(W25Q_SimTime() - start) / 1000.0, sim.commands - commands, errors);
+	if (out) {
+		CHECK(W25Q_TraceHeader(&flash, &hdr) == W25Q_OK);
+		fseek(out, 0, SEEK_SET);
+		fwrite(&hdr, sizeof(hdr), 1, out);
+		fclose(out);
+	}
+	test_end();
+	return 0;
+}
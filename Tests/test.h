@@ -0,0 +1,76 @@
+/**
+ *******************************************
+ * @file    test.h
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Host tests fixture of W25Qxxx lib
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Every test is one program: chip is RAM model (flash, sim, cells),
+ * CHECK prints failed condition and exits with error
+ */
+
+#ifndef W25Q_TEST_H_
+#define W25Q_TEST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "w25q_sim.h"
+
+#ifndef TEST_MBIT
+#define TEST_MBIT 128U	///< Chip size of tests, Mbit
+#endif
+
+/// Check condition, fail test
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+		exit(1); \
+	} \
+} while (0)
+
+static u8_t cells[TEST_MBIT * 1024U * 1024U / 8U];	///< Chip cells
+static W25Q_SIM sim;	///< Chip model
+static W25Q_Device flash = W25Q_DEVICE_SIM(&sim, TEST_MBIT);	///< Device
+
+/**
+ * @brief Test start
+ * Blank chip, driver init
+ */
+static inline void test_start(void) {
+	W25Q_SimInit(&sim, cells, sizeof(cells));
+	CHECK(W25Q_Init(&flash) == W25Q_OK);
+}
+
+/**
+ * @brief Power loss
+ * Power off after given program/erase commands (-1 - never)
+ *
+ * @param[in] after Program/erase commands before loss
+ */
+static inline void test_fail_after(i32_t after) {
+	sim.failAfter = after;
+}
+
+/**
+ * @brief Reboot
+ * Power cycle and driver init
+ *
+ * @return 1-power was lost before reboot
+ */
+static inline bool test_reboot(void) {
+	bool lost = sim.dead;
+	W25Q_SimPowerCycle(&sim);
+	CHECK(W25Q_Init(&flash) == W25Q_OK);
+	return lost;
+}
+
+/**
+ * @brief Test end
+ * Driver never broke chip's protocol
+ */
+static inline void test_end(void) {
+	CHECK(sim.violations == 0);
+}
+
+#endif /* W25Q_TEST_H_ */
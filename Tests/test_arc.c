@@ -0,0 +1,86 @@
+/**
+ *******************************************
+ * @file    test_arc.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Host test of asset archive (w25q_arc, Tools/w25q_arc.py)
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Random files are packed by the tool, image is programmed
+ * to chip: every entry is found by one read, payload and CRC match
+ */
+
+#include "test.h"
+#include "w25q_arc.h"
+
+#define ARC_BASE 0x100000U	///< Archive address
+#define ARC_FILES 300		///< Images in archive
+
+static W25Q_ARC arc;
+static u8_t image[4 << 20];
+
+/// Write file of resource dir
+static void put_file(const char *name, const u8_t *data, u32_t len) {
+	char path[128];
+	snprintf(path, sizeof(path), "arc_res/%s", name);
+	FILE *f = fopen(path, "wb");
+	CHECK(f && fwrite(data, 1, len, f) == len);
+	fclose(f);
+}
+
+int main(void) {
+	static u8_t buf[6000], ref[ARC_FILES + 1][6000];
+	u32_t refLen[ARC_FILES + 1];
+	char name[64];
+	W25Q_ARC_ENTRY e;
+	srand(4);
+
+	// resources and archive
+	CHECK(system("rm -rf arc_res && mkdir -p arc_res/img arc_res/fonts") == 0);
+	for (int i = 1; i <= ARC_FILES; i++) {
+		refLen[i] = rand() % sizeof(buf);
+		for (u32_t j = 0; j < refLen[i]; j++)
+			ref[i][j] = rand();
+		snprintf(name, sizeof(name), "img/i%d.bin", i);
+		put_file(name, ref[i], refLen[i]);
+	}
+	memset(buf, 0x55, 5000);
+	put_file("fonts/mono16.bin", buf, 5000);
+	put_file("empty.bin", buf, 0);
+	CHECK(system("python3 " W25Q_ARC_TOOL " build arc.bin arc_res --strip arc_res/ --crc") == 0);
+	FILE *f = fopen("arc.bin", "rb");
+	CHECK(f);
+	u32_t size = fread(image, 1, sizeof(image), f);
+	fclose(f);
+
+	test_start();
+	CHECK(W25Q_ProgramBulk(&flash, image, size, ARC_BASE, 1) == W25Q_OK);
+	CHECK(W25Q_ArcMount(&arc, &flash, ARC_BASE, cells) == W25Q_OK);
+	printf("archive %u bytes, %u entries\n", size, arc.count);
+
+	for (int i = 1; i <= ARC_FILES; i++) {
+		snprintf(name, sizeof(name), "img/i%d.bin", i);
+		u32_t reads = sim.reads;
+		CHECK(W25Q_ArcFind(&arc, name, &e) == W25Q_OK);
+		CHECK(sim.reads - reads == 1);
+		CHECK(e.size == refLen[i] && e.offset % 32 == 0);
+		if (!e.size)
+			continue;
+		CHECK(W25Q_ArcRead(&arc, &e, buf, 0, e.size) == W25Q_OK);
+		CHECK(memcmp(buf, ref[i], e.size) == 0);
+		CHECK(memcmp(W25Q_ArcPtr(&arc, &e), ref[i], e.size) == 0);
+		CHECK(W25Q_ArcVerify(&arc, &e) == W25Q_OK);
+	}
+	CHECK(W25Q_ArcFind(&arc, "fonts/mono16.bin", &e) == W25Q_OK && e.size == 5000);
+	CHECK(W25Q_ArcFind(&arc, "empty.bin", &e) == W25Q_OK && e.size == 0);
+	CHECK(W25Q_ArcFind(&arc, "nope.bin", &e) == W25Q_PARAM_ERR);
+	test_end();
+
+	// damaged payload and header
+	CHECK(W25Q_ArcFind(&arc, "fonts/mono16.bin", &e) == W25Q_OK);
+	cells[ARC_BASE + e.offset] ^= 1;
+	CHECK(W25Q_ArcVerify(&arc, &e) == W25Q_VERIFY_ERR);
+	cells[ARC_BASE + 20] ^= 1;	// header CRC
+	CHECK(W25Q_ArcMount(&arc, &flash, ARC_BASE, NULL) == W25Q_CHIP_ERR);
+	return 0;
+}
@@ -0,0 +1,83 @@
+/**
+ *******************************************
+ * @file    test_blk.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Host test of block device (w25q_blk)
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Sequential writes to blank area, random writes/reads/syncs:
+ * reads see cache, flush writes exactly the area
+ */
+
+#include "test.h"
+#include "w25q_blk.h"
+
+#define AREA_SECT 10U	///< First sector of block device
+#define AREA 64U		///< Sectors of block device
+#define LBAS (AREA * 8U)
+
+static W25Q_BLK blk;
+static u8_t ref[AREA * 4096U];
+
+/// Chip's area matches reference
+static bool area_synced(void) {
+	return memcmp(cells + AREA_SECT * 4096U, ref, sizeof(ref)) == 0;
+}
+
+int main(void) {
+	static u8_t buf[16 * 512];
+	test_start();
+	srand(1);
+	CHECK(W25Q_BlkInit(&blk, &flash, AREA_SECT, AREA) == W25Q_OK);
+	CHECK(blk.count == LBAS);
+	memset(ref, 0xFF, sizeof(ref));
+
+	// sequential 512 B writes to blank sectors: no erase
+	u32_t erases = sim.erases;
+	for (u32_t lba = 0; lba < 64; lba++) {
+		for (int i = 0; i < 512; i++)
+			buf[i] = rand();
+		memcpy(ref + lba * 512U, buf, 512);
+		CHECK(W25Q_BlkWrite(&blk, buf, lba, 1) == W25Q_OK);
+	}
+	CHECK(W25Q_BlkSync(&blk) == W25Q_OK);
+	CHECK(sim.erases == erases);
+	CHECK(area_synced());
+	printf("sequential: flushes %u, erases skipped %u\n", blk.flushes, blk.erasesSkipped);
+
+	for (int it = 0; it < 20000; it++) {
+		u32_t lba = rand() % LBAS, n = 1 + rand() % 16;
+		if (lba + n > LBAS)
+			n = LBAS - lba;
+		int op = rand() % 10;
+		if (op < 5) {
+			for (u32_t i = 0; i < n * 512U; i++)
+				buf[i] = rand() % 3 ? rand() : 0xFF;
+			memcpy(ref + lba * 512U, buf, n * 512U);
+			CHECK(W25Q_BlkWrite(&blk, buf, lba, n) == W25Q_OK);
+		} else if (op < 9) {
+			CHECK(W25Q_BlkRead(&blk, buf, lba, n) == W25Q_OK);
+			CHECK(memcmp(buf, ref + lba * 512U, n * 512U) == 0);
+		} else if (rand() % 50 == 0) {
+			CHECK(W25Q_BlkSync(&blk) == W25Q_OK);
+			CHECK(area_synced());
+		} else	// same data: nothing to write
+			CHECK(W25Q_BlkWrite(&blk, ref + lba * 512U, lba, n) == W25Q_OK);
+	}
+	CHECK(W25Q_BlkSync(&blk) == W25Q_OK);
+	CHECK(area_synced());
+	CHECK(cells[AREA_SECT * 4096U - 1U] == 0xFF && cells[(AREA_SECT + AREA) * 4096U] == 0xFF);
+	printf("random: hits %u, flushes %u, erases %u, skipped %u\n",
+			blk.hits, blk.flushes, blk.erases, blk.erasesSkipped);
+
+	// idle flush
+	blk.flushMs = 0;
+	buf[0] ^= 1;
+	CHECK(W25Q_BlkWrite(&blk, buf, 3, 1) == W25Q_OK);
+	CHECK(W25Q_BlkTask(&blk) == W25Q_OK);
+	CHECK(!blk.line[0].dirty && !blk.line[1].dirty);
+	CHECK(W25Q_BlkRead(&blk, buf, LBAS - 1U, 2) == W25Q_PARAM_ERR);
+	test_end();
+	return 0;
+}
@@ -0,0 +1,62 @@
+/**
+ *******************************************
+ * @file    test_ckpt.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Host test of checkpoints (w25q_ckpt)
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Random states saved, every other save with power loss:
+ * mount returns last saved state or the torn one if it completed
+ */
+
+#include "test.h"
+#include "w25q_ckpt.h"
+
+static W25Q_CKPT ck;
+static W25Q_CKPT_CFG cfg = { .base = 100, .slotSectors = 2, .interval = 1000 };
+static u8_t state[8192], good[8192], rd[8192];
+
+int main(void) {
+	u32_t len = sizeof(rd), pos, goodLen = 0, goodPos = 0;
+	bool have = 0;
+	int losses = 0;
+	test_start();
+	srand(2);
+	CHECK(W25Q_CkptMount(&ck, &flash, &cfg, rd, &len, &pos) == W25Q_CHIP_ERR);	// blank
+	CHECK(W25Q_CkptDue(&ck, 0));
+
+	for (int it = 0; it < 3000; it++) {
+		u32_t l = rand() % (W25Q_CkptCapacity(&ck) + 1), p = rand();
+		for (u32_t i = 0; i < l; i++)
+			state[i] = rand();
+		if (it % 2)
+			test_fail_after(rand() % 6);
+		W25Q_STATE st = W25Q_CkptSave(&ck, state, l, p);
+		bool lost = test_reboot();
+		CHECK(lost || st == W25Q_OK);
+		losses += lost;
+		if (!lost) {
+			memcpy(good, state, l);
+			goodLen = l;
+			goodPos = p;
+			have = 1;
+		}
+		len = sizeof(rd);
+		st = W25Q_CkptMount(&ck, &flash, &cfg, rd, &len, &pos);
+		if (!have && st == W25Q_CHIP_ERR)
+			continue;
+		CHECK(st == W25Q_OK);
+		if (have && len == goodLen && pos == goodPos && !memcmp(rd, good, len))
+			continue;
+		// torn save completed before loss
+		CHECK(lost && len == l && pos == p && !memcmp(rd, state, l));
+		memcpy(good, state, l);
+		goodLen = l;
+		goodPos = p;
+		have = 1;
+	}
+	test_end();
+	printf("saves 3000, losses %d, seq %u\n", losses, ck.seq);
+	return 0;
+}
@@ -0,0 +1,57 @@
+/**
+ *******************************************
+ * @file    test_cnt.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Host test of counter (w25q_cnt)
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Counting with remounts, then power loss in add:
+ * value is never lost and never more than bits ever added
+ */
+
+#include "test.h"
+#include "w25q_cnt.h"
+
+static W25Q_CNT cnt;
+
+int main(void) {
+	u32_t ref = 0, hi = 0;	// value and bits ever tried
+	test_start();
+	srand(5);
+	CHECK(W25Q_CntMount(&cnt, &flash, 10) == W25Q_OK);
+	CHECK(W25Q_CntGet(&cnt) == 0);
+
+	for (int i = 0; i < 100000; i++) {
+		u32_t n = rand() % 50 ? 1 : rand() % 3000;
+		CHECK(W25Q_CntAdd(&cnt, n) == W25Q_OK);
+		ref += n;
+		CHECK(W25Q_CntGet(&cnt) == ref);
+		if (i % 997 == 0) {
+			CHECK(W25Q_CntMount(&cnt, &flash, 10) == W25Q_OK);
+			CHECK(W25Q_CntGet(&cnt) == ref);
+		}
+	}
+	printf("value %u, erases %u, seq %u\n", ref, cnt.erases, cnt.seq);
+	CHECK(W25Q_CntSetFlag(&cnt, !W25Q_CntFlag(&cnt)) == W25Q_OK);
+	CHECK(W25Q_CntSetFlag(&cnt, W25Q_CntFlag(&cnt)) == W25Q_OK);
+	ref = W25Q_CntGet(&cnt);
+	test_end();
+
+	// torn add clears part of its bits: next mounts may count them
+	for (int it = 0; it < 3000; it++) {
+		u32_t n = rand() % 4 ? 1 : rand() % 40000;
+		if (ref + n > hi)
+			hi = ref + n;
+		test_fail_after(rand() % 4);
+		W25Q_STATE st = W25Q_CntAdd(&cnt, n);
+		bool lost = test_reboot();
+		CHECK(lost || st == W25Q_OK);
+		CHECK(W25Q_CntMount(&cnt, &flash, 10) == W25Q_OK);
+		u32_t v = W25Q_CntGet(&cnt);
+		CHECK(v >= (lost ? ref : ref + n) && v <= hi);
+		ref = v;
+	}
+	printf("power loss OK, value %u\n", ref);
+	return 0;
+}
@@ -0,0 +1,57 @@
+/**
+ *******************************************
+ * @file    test_init.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Host benchmark of boot-to-first-read time (W25Q_Init)
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Virtual time of Init and first 256-byte read at model's bus
+ * clock: first boot of blank chip, next boot, MCU reset during page
+ * program and during sector erase (Init gives up after W25Q_TIMEOUT_INIT)
+ */
+
+#include "test.h"
+
+#define INIT_MAX_US 100U	///< Bound of boot without running write, us
+
+static u8_t buf[256];
+
+/**
+ * @brief Boot
+ * Init and first read
+ *
+ * @param[in] name Case name
+ * @param[out] us Boot-to-first-read time, us
+ * @return W25Q_STATE enum of Init
+ */
+static W25Q_STATE boot(const char *name, u32_t *us) {
+	uint64_t start = W25Q_SimTime();
+	u32_t commands = sim.commands;
+	W25Q_STATE state = W25Q_Init(&flash);
+	if (state == W25Q_OK)
+		state = W25Q_ReadRaw(&flash, buf, sizeof(buf), 0);
+	*us = (u32_t) ((W25Q_SimTime() - start) / 1000U);
+	printf("%-22s %6u us, %u commands, state %d\n", name, *us, sim.commands - commands, state);
+	return state;
+}
+
+int main(void) {
+	u32_t us;
+	W25Q_OP op;
+	W25Q_SimInit(&sim, cells, sizeof(cells));
+	printf("bus %u MHz\n", sim.busHz / 1000000U);
+
+	CHECK(boot("first boot", &us) == W25Q_OK && us < INIT_MAX_US);
+	W25Q_SimPowerCycle(&sim);
+	CHECK(boot("next boot", &us) == W25Q_OK && us < INIT_MAX_US);
+
+	// MCU reset, chip keeps running the write
+	memset(buf, 0, sizeof(buf));
+	CHECK(W25Q_ProgramStart(&flash, &op, buf, sizeof(buf), 0x1000) == W25Q_OK);
+	CHECK(boot("reset during program", &us) == W25Q_OK && us < INIT_MAX_US + 1000U);
+	CHECK(W25Q_EraseStart(&flash, &op, 0x1000, 4096) == W25Q_OK);
+	CHECK(boot("reset during erase", &us) == W25Q_BUSY && us < 20000U);
+	test_end();
+	return 0;
+}
@@ -0,0 +1,106 @@
+/**
+ *******************************************
+ * @file    test_lz.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Host test of compressed log (w25q_lz)
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Append text/random/repeated data, read back at random offsets,
+ * remount, then power loss in append/sync: log keeps whole prefix
+ */
+
+#include "test.h"
+#include "w25q_lz.h"
+
+static W25Q_LZ lz;
+static W25Q_LZ_CFG cfg = { .base = 100, .indexSectors = 4, .dataSectors = 512 };
+static u8_t ref[8 << 20];	///< Logical content
+static u32_t refLen;
+
+/// Log-like text
+static void gen_text(u8_t *p, u32_t n) {
+	static const char *words[] = { "temp=", "volt=", "ERR ", "ok ", "sensor ", "\n", "id:", "value " };
+	char num[16];
+	while (n) {
+		const char *w = words[rand() % 8];
+		u32_t l = strlen(w);
+		if (l > n)
+			l = n;
+		memcpy(p, w, l);
+		p += l;
+		n -= l;
+		l = sprintf(num, "%d", rand() % 1000);
+		if (l > n)
+			l = n;
+		memcpy(p, num, l);
+		p += l;
+		n -= l;
+	}
+}
+
+/// Random reads match logical content
+static void check_reads(int count) {
+	static u8_t buf[20000];
+	CHECK(lz.size == refLen);
+	for (int i = 0; i < count && refLen; i++) {
+		u32_t off = rand() % refLen, n = 1 + rand() % sizeof(buf);
+		if (n > refLen - off)
+			n = refLen - off;
+		CHECK(W25Q_LzRead(&lz, buf, off, n) == W25Q_OK);
+		CHECK(memcmp(buf, ref + off, n) == 0);
+	}
+}
+
+int main(void) {
+	static u8_t tmp[10000];
+	test_start();
+	srand(3);
+	CHECK(W25Q_LzMount(&lz, &flash, &cfg, 1) == W25Q_OK);
+
+	// round trip: text, random (incompressible) and repeated bytes
+	for (int i = 0; i < 300; i++) {
+		u32_t n = 1 + rand() % 3000;
+		int kind = rand() % 6;
+		if (kind < 4)
+			gen_text(tmp, n);
+		else if (kind == 4)
+			for (u32_t j = 0; j < n; j++)
+				tmp[j] = rand();
+		else
+			memset(tmp, rand(), n);
+		CHECK(W25Q_LzAppend(&lz, tmp, n) == W25Q_OK);
+		memcpy(ref + refLen, tmp, n);
+		refLen += n;
+		if (rand() % 40 == 0)
+			CHECK(W25Q_LzSync(&lz) == W25Q_OK);
+		check_reads(30);
+	}
+	CHECK(W25Q_LzSync(&lz) == W25Q_OK);
+	printf("logical %u stored %u (%.2fx)\n", refLen, lz.dataEnd, (double) refLen / lz.dataEnd);
+	check_reads(300);
+	CHECK(W25Q_LzMount(&lz, &flash, &cfg, 0) == W25Q_OK);
+	check_reads(300);
+	test_end();
+
+	// power loss: synced appends stay, torn one leaves a prefix
+	for (int it = 0; it < 400 && lz.dataEnd < cfg.dataSectors * 4096U - 20000U; it++) {
+		u32_t n = 1 + rand() % 9000;
+		gen_text(tmp, n);
+		test_fail_after(rand() % 8);
+		W25Q_STATE st = W25Q_LzAppend(&lz, tmp, n);
+		if (st == W25Q_OK)
+			st = W25Q_LzSync(&lz);
+		bool lost = test_reboot();
+		CHECK(lost || st == W25Q_OK);
+		CHECK(W25Q_LzMount(&lz, &flash, &cfg, 0) == W25Q_OK);
+		if (st == W25Q_OK)
+			CHECK(lz.size == refLen + n);
+		CHECK(lz.size >= refLen && lz.size <= refLen + n);
+		memcpy(ref + refLen, tmp, lz.size - refLen);
+		refLen = lz.size;
+		check_reads(30);
+	}
+	printf("power loss OK, logical %u stored %u\n", refLen, lz.dataEnd);
+	return 0;
+}
@@ -0,0 +1,115 @@
+/**
+ *******************************************
+ * @file    test_txn.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Host test of transactions (w25q_txn)
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Random transactions, every other one with power loss:
+ * after remount area is all old or all new. Then cost of one-page
+ * commits (page + record programs, compactions)
+ */
+
+#include "test.h"
+#include "w25q_txn.h"
+
+#define LOGICAL 8U	///< Logical sectors
+
+static W25Q_TXN txn;
+static W25Q_TXN_CFG cfg = { .base = 16, .logical = LOGICAL, .spare = 4, .jrnSectors = 1 };
+static u8_t model[LOGICAL * 4096U];	///< Committed content
+static u8_t pend[LOGICAL * 4096U];	///< Content of open transaction
+static u8_t rd[LOGICAL * 4096U];
+
+/// Area reads as expected
+static bool area_is(const u8_t *exp) {
+	CHECK(W25Q_TxnRead(&txn, 0, rd, sizeof(rd)) == W25Q_OK);
+	return memcmp(rd, exp, sizeof(rd)) == 0;
+}
+
+/// Random transaction: some writes and commit
+static W25Q_STATE run_txn(void) {
+	static u8_t buf[700];
+	W25Q_STATE st = W25Q_TxnBegin(&txn);
+	if (st != W25Q_OK)
+		return st;
+	memcpy(pend, model, sizeof(model));
+	for (int i = 1 + rand() % 5; i > 0; i--) {
+		u32_t addr = rand() % sizeof(model), len = 1 + rand() % sizeof(buf);
+		if (rand() % 3 == 0) {	// whole page
+			addr = (rand() % LOGICAL) * 4096U + (rand() % 16) * 256U;
+			len = 256;
+		}
+		if (addr + len > sizeof(model))
+			len = sizeof(model) - addr;
+		for (u32_t j = 0; j < len; j++)
+			buf[j] = rand();
+		st = W25Q_TxnWrite(&txn, addr, buf, len);
+		if (st == W25Q_PARAM_ERR) {	// more sectors than spares
+			CHECK(W25Q_TxnAbort(&txn) == W25Q_OK);
+			memcpy(pend, model, sizeof(model));
+			CHECK(area_is(model));
+			return W25Q_OK;
+		}
+		if (st != W25Q_OK)
+			return st;
+		memcpy(pend + addr, buf, len);
+		CHECK(area_is(pend));
+	}
+	return W25Q_TxnCommit(&txn);
+}
+
+int main(void) {
+	int commits = 0, losses = 0, lostOld = 0, lostNew = 0;
+	test_start();
+	srand(1);
+	CHECK(W25Q_TxnMount(&txn, &flash, &cfg, 0) == W25Q_CHIP_ERR);	// blank
+	CHECK(W25Q_TxnMount(&txn, &flash, &cfg, 1) == W25Q_OK);
+	memset(model, 0xFF, sizeof(model));
+
+	for (int it = 0; it < 4000; it++) {
+		if (it % 2)
+			test_fail_after(rand() % 40);
+		W25Q_STATE st = run_txn();
+		bool lost = test_reboot();
+		if (!lost) {
+			CHECK(st == W25Q_OK);
+			memcpy(model, pend, sizeof(model));
+			commits++;
+			if (it % 50 == 0)
+				CHECK(W25Q_TxnMount(&txn, &flash, &cfg, 0) == W25Q_OK);
+			CHECK(area_is(model));
+			continue;
+		}
+		losses++;
+		CHECK(W25Q_TxnMount(&txn, &flash, &cfg, 0) == W25Q_OK);
+		if (area_is(model))
+			lostOld++;
+		else {
+			CHECK(area_is(pend));
+			memcpy(model, pend, sizeof(model));
+			lostNew++;
+		}
+	}
+	printf("commits %d, losses %d (old %d, new %d), erases %u, programs %u\n",
+			commits, losses, lostOld, lostNew, sim.erases, sim.programs);
+
+	// one page per commit: page to overlay + record, compaction folds
+	static u8_t buf[256];
+	u32_t min = ~0U, programs = sim.programs;
+	for (u32_t i = 0; i < 64; i++) {
+		u32_t before = sim.programs;
+		memset(buf, i, sizeof(buf));
+		CHECK(W25Q_TxnBegin(&txn) == W25Q_OK);
+		CHECK(W25Q_TxnWrite(&txn, 3U * 4096U + (i % 16U) * 256U, buf, sizeof(buf)) == W25Q_OK);
+		CHECK(W25Q_TxnCommit(&txn) == W25Q_OK);
+		memcpy(model + 3U * 4096U + (i % 16U) * 256U, buf, sizeof(buf));
+		if (sim.programs - before < min)
+			min = sim.programs - before;
+	}
+	CHECK(area_is(model) && min == 2);
+	printf("page commits: %.1f programs avg, %u min\n", (sim.programs - programs) / 64.0, min);
+	test_end();
+	return 0;
+}
@@ -0,0 +1,85 @@
+/**
+ *******************************************
+ * @file    test_urgent.c
+ * @author  Dmitriy Semenov / Crazy_Geeks
+ * @brief   Host test of W25Q_ReadUrgent deadlines
+ * @note    https://github.com/Crazy-Geeks/STM32-W25Q-QSPI
+ *******************************************
+ *
+ * @note Read during sector erase: suspended for short deadline, waited
+ * for if erase ends in time, always waited for over erase's own cells
+ */
+
+#include "test.h"
+
+static u8_t buf[256];
+
+/**
+ * @brief Urgent read
+ * Read and measure it
+ *
+ * @param[in] addr Start address
+ * @param[in] deadlineUs Read's deadline, us
+ * @param[out] us Read time, us
+ * @return W25Q_STATE enum
+ */
+static W25Q_STATE urgent(u32_t addr, u32_t deadlineUs, u32_t *us) {
+	uint64_t start = W25Q_SimTime();
+	W25Q_STATE state = W25Q_ReadUrgent(&flash, buf, sizeof(buf), addr, deadlineUs);
+	*us = (u32_t) ((W25Q_SimTime() - start) / 1000U);
+	return state;
+}
+
+/**
+ * @brief Finish operation
+ *
+ * @param[in] op Started operation
+ */
+static void finish(W25Q_OP *op) {
+	W25Q_STATE state;
+	while ((state = W25Q_OpPoll(&flash, op)) == W25Q_BUSY)
+		;
+	CHECK(state == W25Q_OK);
+}
+
+int main(void) {
+	W25Q_OP op;
+	W25Q_STATS stats;
+	u32_t us;
+	test_start();
+	memset(buf, 0x5A, sizeof(buf));
+	CHECK(W25Q_ProgramRaw(&flash, buf, sizeof(buf), 0x10000) == W25Q_OK);
+
+	// default deadline: erase is suspended for the read
+	CHECK(W25Q_EraseStart(&flash, &op, 0x1000, 4096) == W25Q_OK);
+	u32_t suspends = sim.suspends;
+	CHECK(urgent(0x10000, 0, &us) == W25Q_OK);
+	printf("suspended read %u us\n", us);
+	CHECK(sim.suspends == suspends + 1 && W25Q_SimBusy(&sim));
+	CHECK(us <= W25Q_DEADLINE_HIGH_US && buf[0] == 0x5A && buf[255] == 0x5A);
+	finish(&op);
+
+	// erase ends before the deadline: waited for
+	CHECK(W25Q_EraseStart(&flash, &op, 0x1000, 4096) == W25Q_OK);
+	W25Q_SimAdvance(44000000U);
+	CHECK(urgent(0x10000, 5000U, &us) == W25Q_OK);
+	printf("waited read %u us\n", us);
+	CHECK(sim.suspends == suspends + 1 && !W25Q_SimBusy(&sim));
+	CHECK(us < 5000U && buf[0] == 0x5A);
+	finish(&op);
+
+	// read of erased cells waits even over the deadline
+	CHECK(W25Q_ProgramRaw(&flash, buf, sizeof(buf), 0x1000) == W25Q_OK);
+	CHECK(W25Q_StatsReset(&flash) == W25Q_OK);
+	CHECK(W25Q_EraseStart(&flash, &op, 0x1000, 4096) == W25Q_OK);
+	CHECK(urgent(0x1000, 0, &us) == W25Q_OK);
+	printf("overlapping read %u us\n", us);
+	CHECK(sim.suspends == suspends + 1 && !W25Q_SimBusy(&sim));
+	CHECK(buf[0] == 0xFF && buf[255] == 0xFF);
+	CHECK(W25Q_StatsGet(&flash, &stats) == W25Q_OK);
+	CHECK(stats.deadlineMissed[W25Q_PRIO_HIGH] == 1);
+	finish(&op);
+
+	test_end();
+	return 0;
+}
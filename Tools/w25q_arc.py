@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""
+W25Q asset archive tool
+
+Packs files into the read-only archive read by w25q_arc.c (W25Q_ArcMount,
+W25Q_ArcFind, W25Q_ArcRead, W25Q_ArcPtr) and lists existing archives.
+
+    w25q_arc.py build assets.bin fonts/ images/logo.bin  # directories recursively
+    w25q_arc.py build assets.bin res/ --strip res/ --align 32 --crc
+    w25q_arc.py list  assets.bin
+
+Entry names are paths relative to --strip with '/' separators, exactly
+what the device passes to W25Q_ArcFind. Archive is little-endian:
+32-byte header, directory of (slots + probe - 1) 24-byte entries,
+payloads aligned to --align (cache line or more for memory-mapped
+access). Seed and slot count are chosen so that every entry is within
+the probe window of its slot: lookup on device is one directory read.
+Empty slots are 0xFF, like erased flash.
+"""
+
+import argparse
+import os
+import struct
+import sys
+import zlib
+
+HDR = struct.Struct("<IBBBBIIIIII")
+ENTRY = struct.Struct("<IIIIII")
+MAGIC = 0x43524157
+VERSION = 1
+HDR_SIZE = 32
+FLAG_CRC = 0x01
+EMPTY = 0xFFFFFFFF
+MASK = 0xFFFFFFFF
+
+
+def arc_hash(name, seed):
+    """Slot hash and check hash, same as W25Q_ArcHash"""
+    h = 2166136261 ^ seed
+    c = 5381 ^ seed
+    for b in name.encode("utf-8"):
+        h = ((h ^ b) * 16777619) & MASK
+        c = (c * 33 + b) & MASK
+    return h, c
+
+
+def collect(paths, strip):
+    files = []
+    for p in paths:
+        if os.path.isdir(p):
+            for root, dirs, names in os.walk(p):
+                dirs.sort()
+                for n in sorted(names):
+                    files.append(os.path.join(root, n))
+        else:
+            files.append(p)
+    out = {}
+    for f in files:
+        name = os.path.relpath(f, strip) if strip else os.path.normpath(f)
+        name = name.replace(os.sep, "/")
+        if name in out:
+            sys.exit("%s: duplicate entry name" % name)
+        out[name] = f
+    return out
+
+
+def place(names, probe, max_seeds=4096):
+    """Find slots and seed with every entry within probe window"""
+    slots = 1
+    while slots * 4 < len(names) * 5:    # load <= 80 %
+        slots *= 2
+    while True:
+        for seed in range(max_seeds):
+            hashes = [arc_hash(n, seed) for n in names]
+            if any(h == EMPTY for h, _ in hashes) or len(set(hashes)) != len(hashes):
+                continue
+            table = [None] * (slots + probe - 1)
+            ok = True
+            for i, (h, _) in enumerate(hashes):
+                s = h & (slots - 1)
+                for k in range(probe):
+                    if table[s + k] is None:
+                        table[s + k] = i
+                        break
+                else:
+                    ok = False
+                    break
+            if ok:
+                return slots, seed, hashes, table
+        slots *= 2
+
+
+def cmd_build(args):
+    if not 1 <= args.probe <= 255:
+        sys.exit("--probe: 1..255 (device W25Q_ARC_PROBE_MAX must be >= it)")
+    if args.align < 4 or args.align & (args.align - 1):
+        sys.exit("--align: power of 2, 4 or more")
+    files = collect(args.inputs, args.strip)
+    if not files:
+        sys.exit("no input files")
+    names = sorted(files)
+    slots, seed, hashes, table = place(names, args.probe)
+
+    align_shift = args.align.bit_length() - 1
+    dir_size = (slots + args.probe - 1) * ENTRY.size
+    pos = HDR_SIZE + dir_size
+    payload = bytearray()
+    entries = {}
+    for i, n in enumerate(names):
+        with open(files[n], "rb") as f:
+            data = f.read()
+        pad = -(pos + len(payload)) % args.align
+        payload += b"\xff" * pad
+        offset = pos + len(payload)
+        payload += data
+        crc = zlib.crc32(data) & MASK if args.crc else EMPTY
+        flags = FLAG_CRC if args.crc else 0
+        entries[i] = ENTRY.pack(hashes[i][0], hashes[i][1], offset, len(data), crc, flags)
+
+    directory = b"".join(entries[i] if i is not None else b"\xff" * ENTRY.size
+                         for i in table)
+    size = pos + len(payload)
+    hdr = HDR.pack(MAGIC, VERSION, align_shift, args.probe, 0xFF, len(names),
+                   slots, seed, size, zlib.crc32(directory) & MASK, 0)
+    hdr = hdr[:-4] + struct.pack("<I", zlib.crc32(hdr[:-4]) & MASK)
+    with open(args.archive, "wb") as f:
+        f.write(hdr + directory + payload)
+    print("%s: %d entries, %d slots (probe %d, seed %d), %d bytes"
+          % (args.archive, len(names), slots, args.probe, seed, size))
+    if args.verbose:
+        for n in names:
+            print("  %s" % n)
+
+
+def cmd_list(args):
+    with open(args.archive, "rb") as f:
+        data = f.read()
+    if len(data) < HDR_SIZE:
+        sys.exit("%s: too short" % args.archive)
+    (magic, version, align_shift, probe, _, count, slots, seed, size,
+     dir_crc, crc) = HDR.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        sys.exit("%s: not a W25Q archive (bad magic/version)" % args.archive)
+    if crc != zlib.crc32(data[:HDR_SIZE - 4]) & MASK:
+        sys.exit("%s: header CRC error" % args.archive)
+    dir_end = HDR_SIZE + (slots + probe - 1) * ENTRY.size
+    if dir_crc != zlib.crc32(data[HDR_SIZE:dir_end]) & MASK:
+        sys.exit("%s: directory CRC error" % args.archive)
+    print("%d entries, %d slots, probe %d, seed %d, align %d, %d bytes"
+          % (count, slots, probe, seed, 1 << align_shift, size))
+    for i in range(slots + probe - 1):
+        h, c, offset, length, ecrc, flags = ENTRY.unpack_from(data, HDR_SIZE + i * ENTRY.size)
+        if h == EMPTY:
+            continue
+        state = ""
+        if flags & FLAG_CRC:
+            ok = zlib.crc32(data[offset:offset + length]) & MASK == ecrc
+            state = " crc ok" if ok else " CRC ERROR"
+        print("  slot %5d (+%d)  hash %08x  offset 0x%08x  size %8d%s"
+              % (i, i - (h & (slots - 1)), h, offset, length, state))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("cmd", choices=("build", "list"))
+    ap.add_argument("archive")
+    ap.add_argument("inputs", nargs="*", help="files and directories (build)")
+    ap.add_argument("--strip", default="", help="path prefix removed from names")
+    ap.add_argument("--align", type=int, default=32,
+                    help="payload alignment, bytes (power of 2)")
+    ap.add_argument("--probe", type=int, default=8,
+                    help="probe window, entries read per lookup")
+    ap.add_argument("--crc", action="store_true", help="store CRC-32 of payloads")
+    ap.add_argument("-v", "--verbose", action="store_true")
+    args = ap.parse_args()
+    {"build": cmd_build, "list": cmd_list}[args.cmd](args)
+
+
+if __name__ == "__main__":
+    main()
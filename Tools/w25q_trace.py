@@ -0,0 +1,253 @@
+#!/usr/bin/env python3
+"""
+W25Q trace tool
+
+Decodes a trace dump made with W25Q_TraceHeader + W25Q_TraceRead
+(W25Q_TRACE_ENABLE = 1) and replays it against a simulated W25Q chip.
+
+Dump = W25Q_TRACE_HDR + W25Q_TRACE_REC records, little-endian.
+
+    w25q_trace.py dump    trace.bin             # print every command
+    w25q_trace.py summary trace.bin             # per-opcode counts and times
+    w25q_trace.py replay  trace.bin --clock 80  # model the pattern on the chip
+    w25q_trace.py calls   trace.bin > calls.txt # API calls of the pattern
+
+Replay puts the recorded command stream on a model of the bus (line
+widths, address size and dummy cycles per opcode) and of the chip
+(typical program/erase times from the W25Q256JV datasheet). It reports
+bus time, time spent waiting for the chip and status polls, so driver
+changes can be compared on a real field workload without hardware.
+
+Calls turns the commands back into driver API calls (read, urgent read
+between suspend and resume, program, erase), one per line. Tests/replay
+runs them through the current driver on the RAM chip model, so the
+driver itself is benchmarked on the recorded workload:
+
+    cd Tests && make replay && ./replay calls.txt new.bin
+    w25q_trace.py summary new.bin
+"""
+
+import argparse
+import struct
+import sys
+from collections import defaultdict
+
+HDR = struct.Struct("<IHHII")
+REC = struct.Struct("<IIIIBBH")
+MAGIC = 0x54353257
+FLAG_WRITE, FLAG_DMA, FLAG_ERR = 0x01, 0x02, 0x04
+
+# opcode: (name, instruction lines, address lines, address bytes,
+#          dummy cycles, data lines, chip busy time after command in us)
+OPS = {
+    0x06: ("WREN", 1, 0, 0, 0, 0, 0),
+    0x04: ("WRDI", 1, 0, 0, 0, 0, 0),
+    0x50: ("VOL_SR_WREN", 1, 0, 0, 0, 0, 0),
+    0x05: ("RDSR1", 1, 0, 0, 0, 1, 0),
+    0x35: ("RDSR2", 1, 0, 0, 0, 1, 0),
+    0x15: ("RDSR3", 1, 0, 0, 0, 1, 0),
+    0x01: ("WRSR1", 1, 0, 0, 0, 1, 10000),
+    0x31: ("WRSR2", 1, 0, 0, 0, 1, 10000),
+    0x11: ("WRSR3", 1, 0, 0, 0, 1, 10000),
+    0xC5: ("WREAR", 1, 0, 0, 0, 1, 0),
+    0xC8: ("RDEAR", 1, 0, 0, 0, 1, 0),
+    0xB7: ("EN4B", 1, 0, 0, 0, 0, 0),
+    0xE9: ("EX4B", 1, 0, 0, 0, 0, 0),
+    0x03: ("READ", 1, 1, 3, 0, 1, 0),
+    0x13: ("READ4B", 1, 1, 4, 0, 1, 0),
+    0x0B: ("FREAD", 1, 1, 3, 8, 1, 0),
+    0x0C: ("FREAD4B", 1, 1, 4, 8, 1, 0),
+    0x3B: ("DREAD", 1, 1, 3, 8, 2, 0),
+    0x3C: ("DREAD4B", 1, 1, 4, 8, 2, 0),
+    0x6B: ("QREAD", 1, 1, 3, 8, 4, 0),
+    0x6C: ("QREAD4B", 1, 1, 4, 8, 4, 0),
+    0xBB: ("DIOREAD", 1, 2, 3, 4, 2, 0),
+    0xBC: ("DIOREAD4B", 1, 2, 4, 4, 2, 0),
+    0xEB: ("QIOREAD", 1, 4, 3, 6, 4, 0),
+    0xEC: ("QIOREAD4B", 1, 4, 4, 6, 4, 0),
+    0x02: ("PP", 1, 1, 3, 0, 1, 400),
+    0x12: ("PP4B", 1, 1, 4, 0, 1, 400),
+    0x32: ("QPP", 1, 1, 3, 0, 4, 400),
+    0x34: ("QPP4B", 1, 1, 4, 0, 4, 400),
+    0x20: ("SE", 1, 1, 3, 0, 0, 45000),
+    0x21: ("SE4B", 1, 1, 4, 0, 0, 45000),
+    0x52: ("BE32", 1, 1, 3, 0, 0, 120000),
+    0xD8: ("BE64", 1, 1, 3, 0, 0, 150000),
+    0xDC: ("BE64_4B", 1, 1, 4, 0, 0, 150000),
+    0xC7: ("CE", 1, 0, 0, 0, 0, 80000000),
+    0x60: ("CE", 1, 0, 0, 0, 0, 80000000),
+    0x75: ("SUSPEND", 1, 0, 0, 0, 0, 20),
+    0x7A: ("RESUME", 1, 0, 0, 0, 0, 0),
+    0xB9: ("PD", 1, 0, 0, 0, 0, 3),
+    0xAB: ("RES", 1, 1, 3, 0, 1, 3),
+    0x90: ("MFID", 1, 1, 3, 0, 1, 0),
+    0x9F: ("JEDEC", 1, 0, 0, 0, 1, 0),
+    0x4B: ("UID", 1, 1, 4, 0, 1, 0),
+    0x5A: ("SFDP", 1, 1, 3, 8, 1, 0),
+    0x44: ("ERSCUR", 1, 1, 3, 0, 0, 45000),
+    0x42: ("PRSCUR", 1, 1, 3, 0, 1, 400),
+    0x48: ("RDSCUR", 1, 1, 3, 8, 1, 0),
+    0x66: ("RSTEN", 1, 0, 0, 0, 0, 0),
+    0x99: ("RST", 1, 0, 0, 0, 0, 30),
+}
+STATUS_READS = (0x05, 0x35, 0x15)
+SUSPEND, RESUME = 0x75, 0x7A
+
+
+def load(path):
+    with open(path, "rb") as f:
+        raw = f.read()
+    if len(raw) < HDR.size:
+        sys.exit("%s: too short" % path)
+    magic, version, rec_size, timer_hz, dropped = HDR.unpack_from(raw)
+    if magic != MAGIC:
+        sys.exit("%s: not a W25Q trace (bad magic)" % path)
+    if rec_size != REC.size:
+        sys.exit("%s: record size %d, expected %d" % (path, rec_size, REC.size))
+    recs = []
+    for off in range(HDR.size, len(raw) - rec_size + 1, rec_size):
+        t, dur, addr, length, op, flags, seq = REC.unpack_from(raw, off)
+        recs.append(dict(time=t, dur=dur, addr=addr, len=length, op=op,
+                         flags=flags, seq=seq))
+    return dict(version=version, timer_hz=timer_hz or 1, dropped=dropped), recs
+
+
+def op_name(op):
+    return OPS[op][0] if op in OPS else "0x%02X" % op
+
+
+def cmd_dump(hdr, recs, args):
+    us = 1e6 / hdr["timer_hz"]
+    t0 = recs[0]["time"] if recs else 0
+    for r in recs:
+        flags = "".join(c for c, m in (("W", FLAG_WRITE), ("D", FLAG_DMA),
+                                       ("E", FLAG_ERR)) if r["flags"] & m)
+        print("%5d %12.2f us %-10s addr=0x%08X len=%-6d %9.2f us %s" % (
+            r["seq"], ((r["time"] - t0) & 0xFFFFFFFF) * us, op_name(r["op"]),
+            r["addr"], r["len"], r["dur"] * us, flags))
+    if hdr["dropped"]:
+        print("(%d records dropped before dump)" % hdr["dropped"])
+
+
+def cmd_summary(hdr, recs, args):
+    us = 1e6 / hdr["timer_hz"]
+    cnt, data, busy = defaultdict(int), defaultdict(int), defaultdict(int)
+    for r in recs:
+        cnt[r["op"]] += 1
+        data[r["op"]] += r["len"]
+        busy[r["op"]] += r["dur"]
+    total = sum(busy.values()) or 1
+    print("%-10s %8s %12s %12s %6s" % ("opcode", "count", "bytes", "time us", "%"))
+    for op in sorted(cnt, key=lambda o: -busy[o]):
+        print("%-10s %8d %12d %12.1f %5.1f%%" % (
+            op_name(op), cnt[op], data[op], busy[op] * us, 100.0 * busy[op] / total))
+    if recs:
+        span = ((recs[-1]["time"] + recs[-1]["dur"] - recs[0]["time"])
+                & 0xFFFFFFFF) * us
+        print("recorded span: %.1f us, in commands: %.1f us" % (span, total * us))
+
+
+def cmd_replay(hdr, recs, args):
+    """Replay on the bus/chip model, optionally without status polls."""
+    clk_us = 1.0 / args.clock
+    now = bus = wait = 0.0
+    busy_until = 0.0
+    left = None     # remaining time of suspended program/erase
+    polls = skipped = 0
+    for r in recs:
+        op = r["op"]
+        if op not in OPS:
+            skipped += 1
+            continue
+        _, il, al, ab, dummy, dl, busy_us = OPS[op]
+        if op in STATUS_READS:
+            if args.no_polls:
+                # ideal driver: woken exactly when the chip is ready
+                if now < busy_until:
+                    wait += busy_until - now
+                    now = busy_until
+                continue
+            polls += now < busy_until
+        elif now < busy_until and op != SUSPEND:
+            # recorded driver already polled; a real chip would ignore this
+            wait += busy_until - now
+            now = busy_until
+        if args.addr4 and ab:
+            ab = 4
+        clocks = 8 // il
+        clocks += (ab * 8) // al if al else 0
+        clocks += dummy
+        clocks += (r["len"] * 8) // dl if dl else 0
+        t = clocks * clk_us
+        now += t
+        bus += t
+        if op == SUSPEND:
+            # ignored when nothing runs, else the rest waits for resume
+            if now < busy_until and left is None:
+                left = busy_until - now
+                busy_until = now + busy_us
+        elif op == RESUME:
+            if left is not None:
+                busy_until = now + left
+                left = None
+        elif busy_us:
+            busy_until = now + busy_us
+    print("commands: %d (%d unknown skipped), status polls while busy: %d"
+          % (len(recs), skipped, polls))
+    print("modeled: bus %.1f us + chip wait %.1f us = %.1f us at %.1f MHz"
+          % (bus, wait, now, args.clock))
+    if recs:
+        us = 1e6 / hdr["timer_hz"]
+        span = ((recs[-1]["time"] + recs[-1]["dur"] - recs[0]["time"])
+                & 0xFFFFFFFF) * us
+        print("recorded: %.1f us" % span)
+
+
+ERASES = {0x20: 4096, 0x21: 4096, 0x52: 32768, 0xD8: 65536, 0xDC: 65536,
+          0xC7: 0, 0x60: 0}
+READS = (0x03, 0x13, 0x0B, 0x0C, 0x3B, 0x3C, 0x6B, 0x6C, 0xBB, 0xBC,
+         0xEB, 0xEC)
+PROGRAMS = (0x02, 0x12, 0x32, 0x34)
+
+
+def cmd_calls(hdr, recs, args):
+    """Print API calls of the commands: read/urgent/program/erase addr len."""
+    us = 1e6 / hdr["timer_hz"]
+    t0 = recs[0]["time"] if recs else 0
+    suspended = False
+    print("# calls of %d commands: op addr len time_us" % len(recs))
+    for r in recs:
+        op, t = r["op"], ((r["time"] - t0) & 0xFFFFFFFF) * us
+        if op == SUSPEND:
+            suspended = True
+            continue
+        if op == RESUME:
+            suspended = False
+            continue
+        if op in READS:
+            call = "urgent" if suspended else "read"
+            print("%s 0x%08X %d %.1f" % (call, r["addr"], r["len"], t))
+        elif op in PROGRAMS:
+            print("program 0x%08X %d %.1f" % (r["addr"], r["len"], t))
+        elif op in ERASES:
+            print("erase 0x%08X %d %.1f" % (r["addr"], ERASES[op], t))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("cmd", choices=("dump", "summary", "replay", "calls"))
+    ap.add_argument("file")
+    ap.add_argument("--clock", type=float, default=50.0, help="QSPI clock, MHz")
+    ap.add_argument("--addr4", action="store_true",
+                    help="all addressed commands use 4-byte addresses")
+    ap.add_argument("--no-polls", action="store_true",
+                    help="drop status polls, wait for the chip ideally")
+    args = ap.parse_args()
+    hdr, recs = load(args.file)
+    {"dump": cmd_dump, "summary": cmd_summary, "replay": cmd_replay,
+     "calls": cmd_calls}[args.cmd](hdr, recs, args)
+
+
+if __name__ == "__main__":
+    main()